@@ -0,0 +1,1085 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "controllerState.h"
+#include "inactivityStages.h"
+#include "occupancy.h"
+#include "outputShadow.h"
+#include "powerBudget.h"
+#include "runtimeConfig.h"
+#include "settings.h"
+#include "supplyMonitor.h"
+#include "thermalPolicy.h"
+#include "valveArbiter.h"
+#include "vpd.h"
+
+// The mist and fan control logic: what the buttons, the remote interfaces,
+// the sensors and the inactivity timeout do to the valve and the fan. It
+// owns no hardware and no clock, Hal provides both, so the firmware and the
+// host tools run the same code. Everything it does later is a deadline in
+// one of its task slots, run by tick() once per loop() pass.
+//
+// Hal must provide:
+//   uint32_t now()                            ms, millis() on the unit
+//   void writeMist(bool)                      the outputs, only from tick()
+//   void writeFanPercent(int)
+//   void trace(uint16_t code, int16_t value)  see traceCode
+//   void confirm(uint8_t blinks)              a gesture was recognized
+//   void modeChanged()                        a pattern or VPD control started or stopped
+//   void mistSessionStarted()                 first opening since the nozzles were dried
+//   void mistSessionEnded()                   stop-all after misting
+//   void acknowledgeFaults()
+//   void buttonEvent(int button, int clicks)  for the automation rules
+//   void sleep()                              returns once woken
+//   void log(const char *format, ...)         debug output
+
+// What the controller did recently, see TraceLog.
+namespace traceCode
+{
+  enum : uint16_t
+  {
+    boot,          // value: reset reason
+    mist,          // value: valve state
+    fan,           // value: applied percent
+    pattern,       // value: pattern started, 0 stopped
+    stopAll,
+    supply,        // value: SupplyMonitor::State
+    fault,         // value: 1 nozzle clog, 2 leak
+    remoteWrite,   // value: register
+    rule,          // value: rules fired
+    config,
+    state          // value: 1 restored
+  };
+}
+
+// Everything that can ask for mist, each owns one interval in the arbiter.
+namespace mistSource
+{
+  enum : size_t
+  {
+    burst,   // single click
+    pattern, // repeating on/off patterns
+    manual,  // button held down
+    remote,  // mist register, held until written back to 0
+    vpd,     // VPD controller duty
+    flush,   // nozzle flush pulses
+    count
+  };
+}
+
+namespace powerLoad
+{
+  enum : size_t
+  {
+    fan,
+    valve,
+    count
+  };
+}
+
+namespace inactivityStage
+{
+  enum : size_t
+  {
+    fanMinimum,
+    mistOff,
+    sleep,
+    count
+  };
+}
+const uint32_t inactivityDeadlines[inactivityStage::count] = {settings::delays::fanMinimum, settings::delays::timeout,
+                                                              settings::delays::sleep};
+
+struct CurrentValue
+{
+  bool mistState = 0; // Current relay state
+  int fanPercent = 0;  // Fan speed as last requested, before thermal derating
+  int32_t vpdPa = -1;  // Latest vapor pressure deficit, negative until measured
+  int32_t humidityPermille = -1; // Latest relative humidity in 0.1 %, negative until measured
+  unsigned long vpdMeasuredAt = 0;
+  int mistFractionPercent = 0; // Share of the mist period set with the encoder
+  size_t patternOnDuration = 0;  // Last pattern started by mistForDurationRepeating()
+  size_t patternOffDuration = 0;
+  unsigned long patternStartedAt = 0;
+  bool suspendedPattern = false; // Pattern stopped because the space is vacant, resumes on presence
+  bool vacant = false;
+  int inactiveFanPercent = -1;  // Fan speed before inactivity lowered it, negative if it was not lowered
+  int suspendedFanPercent = -1; // Fan speed before vacancy lowered it, negative if it was not lowered
+  bool mistUsedSinceDrying = false; // a stop-all only needs to dry the nozzles if they were used
+};
+
+// Settings that can be changed at runtime through a configuration document.
+inline RuntimeConfig defaultRuntimeConfig()
+{
+  VpdControllerConfig vpd;
+  RuntimeConfig config = {{{1000, 30000}, {1000, 15000}, {3000, 30000}, {3000, 15000}},
+                          (int32_t)settings::delays::fanMinimum, (int32_t)settings::delays::timeout,
+                          (int32_t)settings::delays::sleep, settings::delays::fanMinimumPercent,
+                          vpd.targetPa, vpd.kpPermillePerKpa, vpd.kiPermillePerKpa, vpd.maxDutyPermille,
+                          vpd.humidBandPa, vpd.fanMinPercent};
+  return config;
+}
+
+struct PulseSequence
+{
+  size_t onDuration;
+  size_t offDuration;
+  uint8_t pulses;
+};
+
+const PulseSequence flushSequence = {settings::purge::flushPulseOn, settings::purge::flushPulseOff,
+                                     settings::purge::flushPulses};
+
+template <typename Hal>
+class Controller
+{
+public:
+  typedef ControllerState<mistSource::count> State;
+
+  explicit Controller(Hal &hal)
+      : hal(hal),
+        thermalPolicy({settings::thermal::freezeBelow, settings::thermal::freezeRelease,
+                       settings::thermal::derateHysteresis, settings::thermal::fanCurve,
+                       sizeof(settings::thermal::fanCurve) / sizeof(settings::thermal::fanCurve[0])}),
+        runtimeConfig(defaultRuntimeConfig()),
+        inactivityStages(inactivityDeadlines),
+        powerBudget({settings::power::steadyBudgetMa, settings::power::peakBudgetMa},
+                    {settings::power::fan, settings::power::valve}),
+        driver(*this),
+        outputs(driver)
+  {
+  }
+
+  // Starts the inactivity stages and the nozzle flushes, first thing in setup().
+  void begin()
+  {
+    createTimeoutTimer();
+    if (settings::purge::flushInterval > 0) schedule(flushTask, settings::purge::flushInterval);
+  }
+
+  // Runs every task that is due, then writes the outputs the tasks and the
+  // callbacks of this pass settled on. Call once at the end of every loop().
+  void tick()
+  {
+    size_t task;
+    while (nextDue(hal.now(), task))
+    {
+      run(task);
+    }
+    commitOutputs();
+  }
+
+  // When tick() next has something to do, for hosts that skip ahead instead
+  // of calling it all the time. False if only an outside event can change
+  // anything.
+  bool nextDeadline(uint32_t &at) const
+  {
+    uint32_t now = hal.now();
+    // an output held back for another load's inrush goes out within a few ms
+    if (outputs.fanPending() || (outputs.mistPending() && supplyState == SupplyMonitor::normal))
+    {
+      at = now + 1;
+      return true;
+    }
+    bool found = false;
+    int32_t soonest = 0;
+    for (size_t i = 0; i < taskCount; i++)
+    {
+      if (!armed[i]) continue;
+      int32_t left = (int32_t)(dueAt[i] - now);
+      if (!found || left < soonest) soonest = left;
+      found = true;
+    }
+    at = now + (soonest > 0 ? soonest : 0);
+    return found;
+  }
+
+  // Button gestures, from OneButton or the touch pads; IR keys and remote
+  // writes map onto them too.
+  void clicked(int button, int clicks)
+  {
+    resetTimeoutTimer();
+    hal.buttonEvent(button, clicks);
+    if (settings::debug) hal.log("Button %d, %d clicks\n", button, clicks);
+    if (button == 1)
+    {
+      if (clicks == 1)
+      {
+        hal.confirm(1);
+        mistForDuration(1000);
+      }
+      else
+      {
+        startMistPattern(clicks);
+      }
+    }
+    else if (button == 2)
+    {
+      if (clicks == 1)
+      {
+        hal.confirm(1);
+        fanOn();
+      }
+      else if (clicks == 2)
+      {
+        hal.confirm(2);
+        fanOff();
+      }
+      else if (clicks == 3)
+      {
+        hal.confirm(3);
+        startVpdControl();
+      }
+    }
+    else if (button == 3)
+    {
+      if (clicks == 1)
+      {
+        hal.confirm(1);
+        cancelMistForDurationRepeatingTask();
+        stopVpdControl();
+      }
+      else if (clicks == 2)
+      {
+        hal.confirm(2);
+        cancelAllTimerTasksAndTurnOffMistAndFan();
+      }
+      else if (clicks == 3)
+      {
+        // acknowledge faults, e.g. after fixing a leak or cleaning the nozzles
+        hal.confirm(3);
+        hal.acknowledgeFaults();
+      }
+    }
+  }
+
+  void longPressStarted(int button)
+  {
+    resetTimeoutTimer();
+    held[button - 1] = true;
+  }
+
+  // Called over and over while the button stays down.
+  void longPressed(int button)
+  {
+    resetTimeoutTimer();
+    if (button == 1 && !valveArbiter.isActive(mistSource::manual)) mistHold(mistSource::manual);
+  }
+
+  void longPressStopped(int button)
+  {
+    resetTimeoutTimer();
+    held[button - 1] = false;
+    if (button == 1) mistRelease(mistSource::manual);
+  }
+
+  // Button three held switches the knob from fan speed to mist fraction.
+  void encoderTurned(int32_t steps)
+  {
+    resetTimeoutTimer();
+    if (held[2]) adjustMistFraction(steps);
+    else adjustFanSpeed(steps);
+  }
+
+  // Patterns selected by clicking button one n times, timings from the
+  // runtime configuration.
+  void startMistPattern(int n)
+  {
+    if (n < 2 || n >= 2 + (int)configPatternCount) return;
+    hal.trace(traceCode::pattern, n);
+    hal.confirm(n);
+    const PatternTiming &pattern = runtimeConfig.patterns[n - 2];
+    mistForDurationRepeating(pattern.on, pattern.off);
+  }
+
+  // The patternSelect register: 0 stops, 2-5 start a pattern, 6 VPD control.
+  bool selectPattern(uint16_t value)
+  {
+    if (value == 0)
+    {
+      cancelMistForDurationRepeatingTask();
+      stopVpdControl();
+    }
+    else if (value >= 2 && value <= 5) startMistPattern(value);
+    else if (value == 6) startVpdControl();
+    else return false;
+    return true;
+  }
+
+  void requestFanPercent(int percent)
+  {
+    cancel(dryingTask);
+    setFanSpeedPercent(percent);
+  }
+
+  void fanOn()
+  {
+    if (settings::debug) hal.log("Turning fan ON\n");
+    cancel(dryingTask);
+    setFanSpeedPercent(100);
+  }
+
+  void fanOff()
+  {
+    if (settings::debug) hal.log("Turning fan OFF\n");
+    cancel(dryingTask);
+    setFanSpeedPercent(0);
+  }
+
+  void mistHold(size_t source)
+  {
+    valveArbiter.hold(source, hal.now());
+    applyValveArbiter();
+  }
+
+  void mistRelease(size_t source)
+  {
+    valveArbiter.release(source);
+    applyValveArbiter();
+  }
+
+  void cancelAllTimerTasksAndTurnOffMistAndFan()
+  {
+    hal.trace(traceCode::stopAll, 0);
+    cancelAllTimerTasks();
+    mistOff();
+    if (currentValue.mistUsedSinceDrying)
+    {
+      hal.mistSessionEnded();
+      startDrying();
+    }
+    else
+    {
+      fanOff();
+    }
+  }
+
+  void resetTimeoutTimer()
+  {
+    if (currentValue.inactiveFanPercent >= 0)
+    {
+      setFanSpeedPercent(currentValue.inactiveFanPercent);
+      currentValue.inactiveFanPercent = -1;
+    }
+    createTimeoutTimer();
+  }
+
+  void climateMeasured(int32_t vpdPa, int32_t humidityPermille)
+  {
+    currentValue.vpdPa = vpdPa;
+    currentValue.humidityPermille = humidityPermille;
+    currentValue.vpdMeasuredAt = hal.now();
+  }
+
+  void temperatureMeasured(float temperature)
+  {
+    if (thermalPolicy.update(temperature, hal.now())) thermalPolicyChanged();
+  }
+
+  // Drops a reading older than maxAge, the sensor is gone.
+  void temperatureExpired(uint32_t maxAge)
+  {
+    if (thermalPolicy.expire(hal.now(), maxAge))
+    {
+      if (settings::debug) hal.log("No recent temperature reading, thermal limits lifted\n");
+      thermalPolicyChanged();
+    }
+  }
+
+  void supplyChanged(SupplyMonitor::State state)
+  {
+    hal.trace(traceCode::supply, state);
+    // the fan only gets its shed load back once the rail has stayed up for a
+    // while, so its own spin-up cannot pull the rail straight down again
+    if (state != SupplyMonitor::normal) cancel(supplyRecoveryTask);
+    else if (supplyState != SupplyMonitor::normal) schedule(supplyRecoveryTask, settings::supply::recoveryHold);
+    supplyState = state;
+    // shed or restore fan load; valve openings are held back in commitOutputs()
+    setFanSpeedPercent(currentValue.fanPercent);
+  }
+
+  void suspendForVacancy()
+  {
+    if (settings::debug) hal.log("Space vacant, suspending mist pattern and lowering fan\n");
+    currentValue.vacant = true;
+    currentValue.suspendedPattern = armed[patternTask];
+    if (currentValue.suspendedPattern)
+    {
+      cancel(patternTask);
+      mistRelease(mistSource::pattern);
+      hal.modeChanged();
+    }
+    if (currentValue.fanPercent > settings::occupancy::vacantFanPercent)
+    {
+      currentValue.suspendedFanPercent = currentValue.fanPercent;
+      setFanSpeedPercent(settings::occupancy::vacantFanPercent);
+    }
+  }
+
+  // Pick the pattern up where it would be had it kept running, so the
+  // misting rhythm does not drift with every visit.
+  void resumeForOccupancy()
+  {
+    if (settings::debug) hal.log("Presence detected, resuming\n");
+    currentValue.vacant = false;
+    if (currentValue.suspendedFanPercent >= 0)
+    {
+      setFanSpeedPercent(currentValue.suspendedFanPercent);
+      currentValue.suspendedFanPercent = -1;
+    }
+    if (!currentValue.suspendedPattern) return;
+    currentValue.suspendedPattern = false;
+
+    size_t onDuration = currentValue.patternOnDuration;
+    size_t period = onDuration + currentValue.patternOffDuration;
+    uint32_t phase = patternPhase(currentValue.patternStartedAt, hal.now(), period);
+    if (phase < onDuration)
+    {
+      mistForDuration(onDuration - phase, mistSource::pattern);
+    }
+    schedule(patternTask, period - phase);
+    hal.modeChanged();
+  }
+
+  void applyRuntimeConfig(const RuntimeConfig &config)
+  {
+    runtimeConfig = config;
+    inactivityStages.setDeadline(inactivityStage::fanMinimum, config.fanMinimumDelay);
+    inactivityStages.setDeadline(inactivityStage::mistOff, config.timeoutDelay);
+    inactivityStages.setDeadline(inactivityStage::sleep, config.sleepDelay);
+    scheduleTimeoutTimer();
+
+    VpdControllerConfig vpd;
+    vpd.targetPa = config.vpdTargetPa;
+    vpd.kpPermillePerKpa = config.vpdKp;
+    vpd.kiPermillePerKpa = config.vpdKi;
+    vpd.maxDutyPermille = config.vpdMaxDutyPermille;
+    vpd.humidBandPa = config.vpdHumidBandPa;
+    vpd.fanMinPercent = config.vpdFanMinPercent;
+    vpdController = VpdController(vpd);
+    hal.trace(traceCode::config, 0);
+    // a running pattern keeps its timing until it is started again
+    if (settings::debug) hal.log("Configuration applied\n");
+  }
+
+  State capture() const
+  {
+    State state;
+    memset(&state, 0, sizeof(state)); // equal states must compare equal, byte for byte
+    uint32_t now = hal.now();
+    state.magic = controllerState::magic;
+    state.version = controllerState::version;
+    state.size = sizeof(state);
+
+    state.fanPercent = currentValue.fanPercent;
+    state.inactiveFanPercent = currentValue.inactiveFanPercent;
+    state.suspendedFanPercent = currentValue.suspendedFanPercent;
+    state.mistFractionPercent = currentValue.mistFractionPercent;
+    state.vacant = currentValue.vacant;
+    state.suspendedPattern = currentValue.suspendedPattern;
+    state.mistUsedSinceDrying = currentValue.mistUsedSinceDrying;
+    state.inactivityStage = inactivityStages.stage();
+
+    state.patternRunning = armed[patternTask];
+    state.patternOnDuration = currentValue.patternOnDuration;
+    state.patternOffDuration = currentValue.patternOffDuration;
+    state.patternElapsed = now - currentValue.patternStartedAt;
+    state.vpdControl = armed[vpdControlTask];
+    if (state.vpdControl) state.vpdControlLeft = timeLeft(vpdControlTask, now);
+    state.vpdIntegralPermille = vpdController.integralPermille();
+    state.drying = armed[dryingTask];
+    if (state.drying) state.dryingLeft = timeLeft(dryingTask, now);
+    state.mistFractionPending = armed[mistFractionTask];
+    if (state.mistFractionPending) state.mistFractionLeft = timeLeft(mistFractionTask, now);
+    if (armed[pulseSequenceTask]) // only the nozzle flush runs pulse sequences
+    {
+      state.flushPulsesLeft = pulseSequenceRemaining;
+      state.flushPulseLeft = timeLeft(pulseSequenceTask, now);
+    }
+    state.sinceActivity = now - inactivityStages.lastActivityAt();
+
+    for (size_t i = 0; i < mistSource::count; i++)
+    {
+      if (!valveArbiter.isActive(i)) continue;
+      int32_t start, end;
+      bool open;
+      valveArbiter.relativeRequest(i, now, start, end, open);
+      // an expired request lingers until the next valve edge, e.g. under a hold
+      if (!open && end <= 0) continue;
+      MistRequestState &request = state.mist[i];
+      request.active = true;
+      request.open = open;
+      request.start = start;
+      request.end = open ? 0 : end;
+    }
+    state.config = runtimeConfig;
+    state.seal();
+    return state;
+  }
+
+  // Put the controller back into a captured state, with every deadline the
+  // same distance away as it was at capture. Presence is measured, not
+  // restored; the caller resumes if the space is no longer vacant.
+  void restore(const State &state)
+  {
+    if (settings::debug) hal.log("Restoring controller state\n");
+    cancelAllTimerTasks();
+    applyRuntimeConfig(state.config);
+    uint32_t now = hal.now();
+
+    currentValue.inactiveFanPercent = state.inactiveFanPercent;
+    currentValue.suspendedFanPercent = state.suspendedFanPercent;
+    currentValue.mistFractionPercent = state.mistFractionPercent;
+    currentValue.vacant = state.vacant;
+    currentValue.suspendedPattern = state.suspendedPattern;
+    currentValue.mistUsedSinceDrying = state.mistUsedSinceDrying;
+    currentValue.patternOnDuration = state.patternOnDuration;
+    currentValue.patternOffDuration = state.patternOffDuration;
+    currentValue.patternStartedAt = now - state.patternElapsed;
+
+    for (size_t i = 0; i < mistSource::count; i++)
+    {
+      const MistRequestState &request = state.mist[i];
+      if (!request.active) continue;
+      // a button hold ends with the release, which the button state after the
+      // reset knows nothing of; only a remote hold has someone to end it
+      if (request.open && i != mistSource::remote) continue;
+      if (request.open) valveArbiter.hold(i, now + request.start);
+      else valveArbiter.request(i, now + request.start, now + request.end);
+    }
+    size_t period = state.patternOnDuration + state.patternOffDuration;
+    if (state.patternRunning && period > 0)
+    {
+      // the on phase is in the restored mist requests, only the next cycle is left
+      uint32_t phase = patternPhase(currentValue.patternStartedAt, now, period);
+      schedule(patternTask, period - phase);
+    }
+    if (state.vpdControl)
+    {
+      vpdController.restoreIntegral(state.vpdIntegralPermille);
+      schedule(vpdControlTask, state.vpdControlLeft);
+    }
+    if (state.drying) schedule(dryingTask, state.dryingLeft);
+    if (state.mistFractionPending) schedule(mistFractionTask, state.mistFractionLeft);
+    if (state.flushPulsesLeft > 0)
+    {
+      pulseSequence = &flushSequence;
+      pulseSequenceRemaining = state.flushPulsesLeft;
+      schedule(pulseSequenceTask, state.flushPulseLeft);
+    }
+    inactivityStages.restore(now - state.sinceActivity, state.inactivityStage);
+    scheduleTimeoutTimer();
+
+    setFanSpeedPercent(state.fanPercent);
+    applyValveArbiter();
+    hal.modeChanged();
+    hal.trace(traceCode::state, 1);
+  }
+
+  // 0 idle, 1 repeating pattern, 2 VPD control, 3 nozzle flush
+  uint16_t patternMode() const
+  {
+    return armed[patternTask] ? 1 : armed[vpdControlTask] ? 2 : armed[pulseSequenceTask] ? 3 : 0;
+  }
+
+  bool patternRunning() const { return armed[patternTask]; }
+  bool vpdControlRunning() const { return armed[vpdControlTask]; }
+  bool mistState() const { return currentValue.mistState; }
+  int fanAppliedPercent() const { return outputs.fanPercent(); }
+  const CurrentValue &current() const { return currentValue; }
+  const ThermalPolicy &thermal() const { return thermalPolicy; }
+  const RuntimeConfig &config() const { return runtimeConfig; }
+
+private:
+  // Peripheral writes, only ever called from commitOutputs().
+  struct Driver
+  {
+    explicit Driver(Controller &controller) : controller(controller) {}
+
+    void writeMist(bool state)
+    {
+      controller.hal.writeMist(state);
+      controller.hal.trace(traceCode::mist, state);
+      controller.powerBudget.set(powerLoad::valve, state ? 100 : 0, controller.hal.now());
+    }
+
+    void writeFanPercent(int percent)
+    {
+      controller.hal.writeFanPercent(percent);
+      controller.hal.trace(traceCode::fan, percent);
+      controller.powerBudget.set(powerLoad::fan, percent, controller.hal.now());
+    }
+
+    Controller &controller;
+  };
+
+  enum : size_t
+  {
+    patternTask,        // next on phase of the repeating pattern
+    vpdControlTask,     // next VPD control cycle
+    pulseSequenceTask,  // next pulse of a nozzle flush
+    dryingTask,         // fan off after drying
+    valveEdgeTask,      // next change of the arbitrated valve state
+    mistFractionTask,   // the knob came to rest
+    flushTask,          // periodic nozzle flush
+    flushRetryTask,     // a flush deferred while misting
+    timeoutTask,        // next inactivity stage
+    supplyRecoveryTask, // the rail has been back long enough
+    taskCount
+  };
+
+  void schedule(size_t task, uint32_t delay)
+  {
+    armed[task] = true;
+    dueAt[task] = hal.now() + delay;
+  }
+
+  void cancel(size_t task) { armed[task] = false; }
+
+  uint32_t timeLeft(size_t task, uint32_t now) const
+  {
+    int32_t left = (int32_t)(dueAt[task] - now);
+    return left > 0 ? left : 0;
+  }
+
+  // The most overdue task, if any is due.
+  bool nextDue(uint32_t now, size_t &due) const
+  {
+    bool found = false;
+    int32_t latest = 0;
+    for (size_t i = 0; i < taskCount; i++)
+    {
+      if (!armed[i]) continue;
+      int32_t late = (int32_t)(now - dueAt[i]);
+      if (late < 0 || (found && late <= latest)) continue;
+      due = i;
+      latest = late;
+      found = true;
+    }
+    return found;
+  }
+
+  // Repeating tasks schedule themselves again before doing their work, from
+  // the time they actually ran.
+  void run(size_t task)
+  {
+    cancel(task);
+    switch (task)
+    {
+    case patternTask:
+      schedule(patternTask, currentValue.patternOnDuration + currentValue.patternOffDuration);
+      mistForDuration(currentValue.patternOnDuration, mistSource::pattern);
+      break;
+    case vpdControlTask:
+      schedule(vpdControlTask, settings::climate::vpdCycle);
+      vpdControlCycle();
+      break;
+    case pulseSequenceTask:
+      pulse();
+      break;
+    case dryingTask:
+      if (settings::debug) hal.log("Drying finished, fan OFF\n");
+      setFanSpeedPercent(0);
+      break;
+    case valveEdgeTask:
+      applyValveArbiter();
+      break;
+    case mistFractionTask:
+      applyMistFraction();
+      break;
+    case flushTask:
+      schedule(flushTask, settings::purge::flushInterval);
+      flushNozzles();
+      break;
+    case flushRetryTask:
+      flushNozzles();
+      break;
+    case timeoutTask:
+      implementTimeouts();
+      break;
+    case supplyRecoveryTask:
+      setFanSpeedPercent(currentValue.fanPercent);
+      break;
+    }
+  }
+
+  void commitOutputs()
+  {
+    reserveValveCurrent();
+    // opening the valve on a sagging rail risks a brown-out, it waits for recovery;
+    // a start during another load's inrush waits for the next pass, and a fan
+    // speed-up waits for a valve opening in the same pass so their inrushes
+    // do not stack
+    uint32_t now = hal.now();
+    bool mistMayOpen = supplyState == SupplyMonitor::normal && powerBudget.canStart(powerLoad::valve, 100, now);
+    bool valveOpening = mistMayOpen && outputs.mistPending() && outputs.mist();
+    outputs.commit(mistMayOpen, !valveOpening && powerBudget.canStart(powerLoad::fan, outputs.fanPercent(), now));
+  }
+
+  // The valve's hold current is only reserved while it is open or a pattern,
+  // VPD control, flush or hold is about to open it; the rest of the time the
+  // fan may use it. A change re-applies the fan speed, and the shadow lowers
+  // the fan before the valve opens and raises it after the valve closes.
+  void reserveValveCurrent()
+  {
+    bool reserve = mistPatternActive();
+    if (reserve == valveReserved) return;
+    valveReserved = reserve;
+    powerBudget.reserve(powerLoad::valve, reserve);
+    setFanSpeedPercent(currentValue.fanPercent);
+  }
+
+  int supplyFanLimitPercent() const
+  {
+    switch (supplyState)
+    {
+    case SupplyMonitor::critical:
+      return settings::supply::criticalFanPercent;
+    case SupplyMonitor::sagging:
+      return settings::supply::saggingFanPercent;
+    default:
+      return armed[supplyRecoveryTask] ? settings::supply::saggingFanPercent : 100;
+    }
+  }
+
+  static int constrained(int value, int low, int high) { return value < low ? low : value > high ? high : value; }
+
+  void writeMistState(bool state)
+  {
+    if (state == currentValue.mistState) return;
+    if (state)
+    {
+      // misting again ends any drying, the fan keeps its current speed
+      cancel(dryingTask);
+      if (!currentValue.mistUsedSinceDrying) hal.mistSessionStarted();
+      currentValue.mistUsedSinceDrying = true;
+    }
+    outputs.setMist(state);
+    currentValue.mistState = state;
+  }
+
+  void setFanSpeedPercent(int percent)
+  {
+    currentValue.fanPercent = percent;
+    int limited = thermalPolicy.filterFanPercent(percent);
+    if (limited != percent)
+    {
+      if (settings::debug) hal.log("Fan derated from %d%% to %d%% at %dC\n", percent, limited, (int)thermalPolicy.temperature());
+    }
+    if (limited > supplyFanLimitPercent())
+    {
+      limited = supplyFanLimitPercent();
+      if (settings::debug) hal.log("Fan limited to %d%% by the supply\n", limited);
+    }
+    // see reserveValveCurrent()
+    if (limited > powerBudget.maxPercent(powerLoad::fan))
+    {
+      limited = powerBudget.maxPercent(powerLoad::fan);
+      if (settings::debug) hal.log("Fan limited to %d%% by the power budget\n", limited);
+    }
+    outputs.setFanPercent(limited);
+  }
+
+  void mistOn()
+  {
+    if (!thermalPolicy.mistAllowed())
+    {
+      if (settings::debug) hal.log("Mist ON blocked, too cold\n");
+      return;
+    }
+    if (settings::debug) hal.log("Turning mist ON\n");
+    writeMistState(true);
+  }
+
+  void mistOff()
+  {
+    if (settings::debug) hal.log("Turning mist OFF\n");
+    writeMistState(false);
+  }
+
+  // Drive the valve from the union of all mist requests and schedule the next
+  // time that union changes, instead of one off-task per request.
+  void applyValveArbiter()
+  {
+    uint32_t now = hal.now();
+    if (valveArbiter.valveOn(now) && thermalPolicy.mistAllowed()) mistOn();
+    else mistOff();
+
+    cancel(valveEdgeTask);
+    uint32_t edge = 0;
+    if (valveArbiter.nextEdge(now, edge))
+    {
+      schedule(valveEdgeTask, edge - now);
+    }
+  }
+
+  void mistForDuration(size_t duration, size_t source = mistSource::burst)
+  {
+    if (settings::debug) hal.log("Turning mist ON for %d seconds\n", (int)(duration / 1000));
+    uint32_t now = hal.now();
+    valveArbiter.request(source, now, now + duration);
+    applyValveArbiter();
+  }
+
+  void cancelMistForDurationRepeatingTask()
+  {
+    if (settings::debug) hal.log("Repeating mist task CANCELLED\n");
+    hal.trace(traceCode::pattern, 0);
+    cancel(patternTask);
+    currentValue.suspendedPattern = false; // stopped, presence must not bring it back
+    mistRelease(mistSource::pattern);
+    hal.modeChanged();
+  }
+
+  // Patterns and VPD control both decide when to mist, so only one of them
+  // runs at a time; starting either stops the other.
+  void mistForDurationRepeating(size_t onDuration, size_t offDuration)
+  {
+    if (settings::debug) hal.log("Starting mist pattern, on for %d seconds, off for %d seconds\n",
+                                 (int)(onDuration / 1000), (int)(offDuration / 1000));
+    currentValue.suspendedPattern = false; // a new pattern replaces the running one, and one suspended for vacancy
+    stopVpdControl();
+    currentValue.patternOnDuration = onDuration;
+    currentValue.patternOffDuration = offDuration;
+    currentValue.patternStartedAt = hal.now();
+    mistForDuration(onDuration, mistSource::pattern); // the first on phase starts right away
+    schedule(patternTask, onDuration + offDuration);
+    hal.modeChanged();
+  }
+
+  // Like mistForDurationRepeating(), but for a fixed number of pulses.
+  void mistPulseSequence(const PulseSequence &sequence)
+  {
+    if (settings::debug) hal.log("Starting %d mist pulses of %d ms\n", sequence.pulses, (int)sequence.onDuration);
+    pulseSequence = &sequence;
+    pulseSequenceRemaining = sequence.pulses;
+    pulse();
+  }
+
+  void pulse()
+  {
+    mistForDuration(pulseSequence->onDuration, mistSource::flush);
+    if (--pulseSequenceRemaining > 0) schedule(pulseSequenceTask, pulseSequence->onDuration + pulseSequence->offDuration);
+    else cancel(pulseSequenceTask);
+  }
+
+  bool mistPatternActive() const
+  {
+    return armed[patternTask] || armed[vpdControlTask] || armed[pulseSequenceTask] || currentValue.mistState || held[0];
+  }
+
+  void flushNozzles()
+  {
+    // a flush already waiting for a gap covers this one too
+    if (armed[flushRetryTask]) return;
+    if (mistPatternActive())
+    {
+      // never cut into a running pattern, try again shortly
+      if (settings::debug) hal.log("Nozzle flush due but mist is active, deferring\n");
+      schedule(flushRetryTask, settings::purge::flushRetry);
+      return;
+    }
+    if (settings::debug) hal.log("Flushing nozzles\n");
+    mistPulseSequence(flushSequence);
+  }
+
+  // Run the fan for a while after a session so the nozzles and the area around
+  // them dry instead of dripping.
+  void startDrying()
+  {
+    currentValue.mistUsedSinceDrying = false;
+    if (settings::purge::dryingDuration == 0)
+    {
+      fanOff();
+      return;
+    }
+    if (settings::debug) hal.log("Drying after mist session\n");
+    setFanSpeedPercent(settings::purge::dryingFanPercent);
+    schedule(dryingTask, settings::purge::dryingDuration);
+  }
+
+  void thermalPolicyChanged()
+  {
+    if (settings::debug) hal.log("Thermal policy changed: mist %s, fan limit %d%%\n",
+                                 thermalPolicy.mistAllowed() ? "allowed" : "blocked", thermalPolicy.fanLimitPercent());
+    applyValveArbiter();
+    setFanSpeedPercent(currentValue.fanPercent);
+  }
+
+  void vpdControlCycle()
+  {
+    if (currentValue.vpdPa < 0 || hal.now() - currentValue.vpdMeasuredAt > settings::climate::staleAfter)
+    {
+      if (settings::debug) hal.log("VPD control: no recent climate reading, cycle skipped\n");
+      return;
+    }
+    VpdOutput output = vpdController.update(currentValue.vpdPa);
+    if (settings::debug) hal.log("VPD control: %d Pa, mist duty %d/1000, fan %d%%\n", (int)currentValue.vpdPa,
+                                 (int)output.mistDutyPermille, output.fanPercent);
+    setFanSpeedPercent(output.fanPercent);
+    size_t onDuration = settings::climate::vpdCycle * output.mistDutyPermille / 1000;
+    if (onDuration > 0)
+    {
+      mistForDuration(onDuration, mistSource::vpd);
+    }
+  }
+
+  void stopVpdControl()
+  {
+    if (settings::debug) hal.log("VPD control STOPPED\n");
+    cancel(vpdControlTask);
+    mistRelease(mistSource::vpd); // the duty of the current cycle ends with it
+    hal.modeChanged();
+  }
+
+  void startVpdControl()
+  {
+    if (settings::debug) hal.log("VPD control STARTED\n");
+    cancelMistForDurationRepeatingTask();
+    stopVpdControl();
+    vpdController.reset();
+    schedule(vpdControlTask, settings::climate::vpdCycle);
+    vpdControlCycle();
+    hal.modeChanged();
+  }
+
+  void applyMistFraction()
+  {
+    int percent = currentValue.mistFractionPercent;
+    if (percent == 0)
+    {
+      cancelMistForDurationRepeatingTask();
+      return;
+    }
+    size_t onDuration = settings::encoder::mistPeriod * percent / 100;
+    mistForDurationRepeating(onDuration, settings::encoder::mistPeriod - onDuration);
+  }
+
+  void adjustMistFraction(int32_t steps)
+  {
+    int percent = constrained(currentValue.mistFractionPercent + (int)steps, 0, settings::encoder::maxMistPercent);
+    if (settings::debug) hal.log("Encoder: mist fraction %d%%\n", percent);
+    currentValue.mistFractionPercent = percent;
+    // restarting the pattern on every detent would mist each time, wait for the knob to rest
+    schedule(mistFractionTask, settings::encoder::mistSettle);
+  }
+
+  void adjustFanSpeed(int32_t steps)
+  {
+    int percent = currentValue.fanPercent + steps;
+    if (steps < 0 && percent < settings::encoder::fanMinRunning) percent = 0;
+    if (steps > 0 && percent < settings::encoder::fanMinRunning) percent = settings::encoder::fanMinRunning;
+    percent = constrained(percent, 0, 100);
+    if (settings::debug) hal.log("Encoder: fan %d%%\n", percent);
+    cancel(dryingTask);
+    setFanSpeedPercent(percent);
+  }
+
+  // Only the tasks driving the outputs; the nozzle flushes and the inactivity
+  // timeout, which is what eventually puts a stopped unit to sleep, keep
+  // running.
+  void cancelAllTimerTasks()
+  {
+    if (settings::debug) hal.log("Cancelling ALL running timer tasks!\n");
+    cancel(patternTask);
+    cancel(mistFractionTask);
+    cancel(vpdControlTask);
+    cancel(pulseSequenceTask);
+    cancel(dryingTask);
+    cancel(valveEdgeTask);
+    valveArbiter.clear();
+    // a stop-all also ends whatever was waiting for presence to return
+    currentValue.suspendedPattern = false;
+    currentValue.suspendedFanPercent = -1;
+    currentValue.inactiveFanPercent = -1;
+    hal.modeChanged();
+  }
+
+  // Light sleep keeps all state; any button (or the PIR) wakes the unit and
+  // counts as activity.
+  void sleepUntilWoken()
+  {
+    if (settings::debug) hal.log("Inactive, going to sleep\n");
+    cancelAllTimerTasks();
+    mistOff();
+    fanOff();
+    commitOutputs();
+    hal.sleep();
+    if (settings::debug) hal.log("Woken up\n");
+    createTimeoutTimer();
+  }
+
+  void implementTimeout(size_t stage)
+  {
+    if (settings::debug) hal.log("Inactivity stage %d reached\n", (int)stage);
+    if (stage == inactivityStage::fanMinimum)
+    {
+      if (currentValue.fanPercent > runtimeConfig.fanMinimumPercent)
+      {
+        currentValue.inactiveFanPercent = currentValue.fanPercent;
+        setFanSpeedPercent(runtimeConfig.fanMinimumPercent);
+      }
+    }
+    else if (stage == inactivityStage::mistOff)
+    {
+      cancelMistForDurationRepeatingTask();
+      stopVpdControl();
+      cancel(pulseSequenceTask);
+      currentValue.suspendedPattern = false;
+      valveArbiter.clear();
+      applyValveArbiter();
+    }
+    else if (stage == inactivityStage::sleep)
+    {
+      sleepUntilWoken();
+    }
+  }
+
+  void implementTimeouts()
+  {
+    size_t stage;
+    while (inactivityStages.update(hal.now(), stage))
+    {
+      implementTimeout(stage);
+    }
+    scheduleTimeoutTimer();
+  }
+
+  void scheduleTimeoutTimer()
+  {
+    cancel(timeoutTask);
+    uint32_t remaining;
+    if (inactivityStages.untilNext(hal.now(), remaining))
+    {
+      schedule(timeoutTask, remaining);
+    }
+  }
+
+  void createTimeoutTimer()
+  {
+    if (settings::debug) hal.log("Timeout timer (re)set, first stage in %d ms\n", (int)runtimeConfig.fanMinimumDelay);
+    inactivityStages.activity(hal.now());
+    scheduleTimeoutTimer();
+  }
+
+  Hal &hal;
+  CurrentValue currentValue;
+  ValveArbiter<mistSource::count> valveArbiter;
+  ThermalPolicy thermalPolicy;
+  VpdController vpdController;
+  RuntimeConfig runtimeConfig;
+  InactivityStages<inactivityStage::count> inactivityStages;
+  PowerBudget<powerLoad::count> powerBudget;
+  bool valveReserved = true; // see reserveValveCurrent()
+  Driver driver;
+  OutputShadow<Driver> outputs;
+  SupplyMonitor::State supplyState = SupplyMonitor::normal;
+  bool held[3] = {false, false, false}; // long presses in progress, per button
+  const PulseSequence *pulseSequence = &flushSequence;
+  uint8_t pulseSequenceRemaining = 0;
+  bool armed[taskCount] = {};
+  uint32_t dueAt[taskCount] = {};
+};
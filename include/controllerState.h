@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crashRecord.h"
+#include "runtimeConfig.h"
+
+// Everything needed to put the controller back where it was: the requested
+// outputs, what is running and when it is next due. Deadlines are kept as
+// milliseconds relative to the moment of capture, so a checkpoint does not
+// depend on the clock it was taken with and two captures of the same state
+// compare equal byte for byte. Sensor readings, button state and the
+// applied outputs are not part of it; they are measured or derived again.
+
+namespace controllerState
+{
+  constexpr uint32_t magic = 0x54535443; // "CTST"
+  constexpr uint16_t version = 1;
+}
+
+struct MistRequestState
+{
+  uint8_t active;
+  uint8_t open; // held, end is meaningless
+  uint16_t reserved;
+  int32_t start; // ms from capture, negative if already started
+  int32_t end;
+};
+
+template <size_t mistSources>
+struct ControllerState
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size; // sizeof, the source count changes it
+
+  int16_t fanPercent; // as requested, before derating
+  int16_t inactiveFanPercent;
+  int16_t suspendedFanPercent;
+  int16_t mistFractionPercent;
+  uint8_t vacant;
+  uint8_t suspendedPattern;
+  uint8_t mistUsedSinceDrying;
+  uint8_t inactivityStage;
+
+  // Running activities; each Left is the time until it is next due.
+  uint8_t patternRunning;
+  uint8_t vpdControl;
+  uint8_t drying;
+  uint8_t mistFractionPending;
+  uint8_t flushPulsesLeft;
+  uint8_t reserved[3];
+  uint32_t patternOnDuration;
+  uint32_t patternOffDuration;
+  uint32_t patternElapsed; // since the pattern started, also while suspended
+  uint32_t vpdControlLeft;
+  uint32_t dryingLeft;
+  uint32_t mistFractionLeft;
+  uint32_t flushPulseLeft;
+  uint32_t sinceActivity;
+  int32_t vpdIntegralPermille;
+
+  MistRequestState mist[mistSources];
+  RuntimeConfig config;
+  uint32_t crc; // crc32 of everything before it
+
+  void seal() { crc = crash::crc32((const uint8_t *)this, offsetof(ControllerState, crc)); }
+  bool valid() const
+  {
+    return magic == controllerState::magic && version == controllerState::version && size == sizeof(*this) &&
+           crc == crash::crc32((const uint8_t *)this, offsetof(ControllerState, crc));
+  }
+};
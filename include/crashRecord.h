@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What is kept about the last crash. The layout is fixed (all fields
+// naturally aligned, little endian) because tools/decodeCrash.py reads it
+// byte for byte; bump crash::version when it changes.
+
+namespace crash
+{
+  constexpr uint32_t magic = 0x48535243; // "CRSH"
+  constexpr uint16_t version = 2;
+  constexpr size_t traceLength = 32;
+  constexpr size_t backtraceLength = 16;
+
+  inline uint32_t crc32(const uint8_t *data, size_t length)
+  {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+      crc ^= data[i];
+      for (int bit = 0; bit < 8; bit++)
+      {
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      }
+    }
+    return ~crc;
+  }
+}
+
+struct TraceEvent
+{
+  uint32_t at; // ms since boot
+  uint16_t code;
+  int16_t value;
+};
+
+struct ControllerSnapshot
+{
+  uint32_t uptime; // ms
+  int16_t fanPercent;
+  int16_t fanAppliedPercent;
+  uint8_t mist;
+  uint8_t patternMode;
+  uint8_t faults;
+  uint8_t supplyState;
+  int32_t vpdPa;
+  uint16_t supplyMillivolts;
+  uint16_t reserved;
+};
+
+// Ring of the most recent trace events, oldest first.
+template <size_t length>
+struct TraceLog
+{
+  uint32_t head;
+  uint32_t count;
+  TraceEvent events[length];
+
+  void clear()
+  {
+    head = 0;
+    count = 0;
+  }
+
+  void add(uint32_t at, uint16_t code, int16_t value)
+  {
+    events[head] = {at, code, value};
+    head = (head + 1) % length;
+    if (count < length) count++;
+  }
+
+  // A log in memory that survived a reset may be garbage.
+  bool plausible() const { return head < length && count <= length; }
+
+  const TraceEvent &event(size_t index) const { return events[(head + length - count + index) % length]; }
+};
+
+struct CrashRecord
+{
+  uint32_t magic;
+  uint16_t version;
+  uint8_t resetReason;    // esp_reset_reason_t
+  uint8_t backtraceDepth; // 0 without a core dump summary
+  uint32_t pc;
+  uint32_t exceptionCause;
+  uint32_t exceptionAddress;
+  uint32_t backtrace[crash::backtraceLength];
+  char task[16];
+  char elfSha256[16]; // first hex digits, to match the dump with its ELF
+  uint32_t registers[16]; // A0-A15 of the crashing task, zero without a summary
+  ControllerSnapshot state;
+  uint32_t eventCount;
+  TraceEvent events[crash::traceLength];
+  uint32_t crc; // crc32 of everything before it
+
+  void seal() { crc = crash::crc32((const uint8_t *)this, offsetof(CrashRecord, crc)); }
+  bool valid() const
+  {
+    return magic == crash::magic && version == crash::version &&
+           crc == crash::crc32((const uint8_t *)this, offsetof(CrashRecord, crc));
+  }
+};
+
+static_assert(sizeof(CrashRecord) == 464, "tools/decodeCrash.py expects this layout");
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+// Turns raw quadrature counts into adjustment steps. Counts are collected
+// into whole detents; detents that follow each other quickly are multiplied
+// so a fast spin sweeps the whole range while a slow turn still moves by one.
+
+struct EncoderAcceleratorConfig
+{
+  int8_t countsPerDetent = 4;     // x4 decoding of a typical 20 detent encoder
+  uint16_t fastDetentMs = 40;     // detents closer than this get the full multiplier
+  uint16_t slowDetentMs = 200;    // detents further apart than this are single steps
+  uint8_t maxMultiplier = 5;
+};
+
+class EncoderAccelerator
+{
+public:
+  explicit EncoderAccelerator(const EncoderAcceleratorConfig &config = EncoderAcceleratorConfig()) : config(config) {}
+
+  // Feed the counts seen since the last call; returns the signed number of
+  // steps to apply.
+  int32_t update(int32_t counts, uint32_t now)
+  {
+    pending += counts;
+    int32_t detents = pending / config.countsPerDetent;
+    if (detents == 0) return 0;
+    pending -= detents * config.countsPerDetent;
+
+    uint32_t interval = now - lastDetentAt;
+    lastDetentAt = now;
+    // a reversal always starts slow
+    bool reversed = (detents > 0) != (lastDirection > 0);
+    lastDirection = detents > 0 ? 1 : -1;
+    if (reversed) return detents;
+
+    return detents * multiplier(interval / (detents > 0 ? detents : -detents));
+  }
+
+  // Feed a reading of a pulse counter that resets to 0 at +-limit; returns
+  // the steps turned since the last reading.
+  int32_t counterRead(int16_t count, int16_t limit, uint32_t now)
+  {
+    int32_t delta = count - lastCount;
+    lastCount = count;
+    // a jump of more than half the range means the counter wrapped
+    if (delta > limit / 2) delta -= limit;
+    if (delta < -limit / 2) delta += limit;
+    if (delta == 0) return 0;
+    return update(delta, now);
+  }
+
+private:
+  int32_t multiplier(uint32_t detentInterval) const
+  {
+    if (detentInterval >= config.slowDetentMs) return 1;
+    if (detentInterval <= config.fastDetentMs) return config.maxMultiplier;
+    uint32_t span = config.slowDetentMs - config.fastDetentMs;
+    return 1 + (config.maxMultiplier - 1) * (config.slowDetentMs - detentInterval) / span;
+  }
+
+  EncoderAcceleratorConfig config;
+  int32_t pending = 0;
+  int16_t lastCount = 0;
+  uint32_t lastDetentAt = 0;
+  int8_t lastDirection = 0;
+};
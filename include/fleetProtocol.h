@@ -0,0 +1,160 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "modbusRtu.h"
+#include "remoteRegisters.h"
+
+// Fleet protocol on CAN (TWAI). Standard 11 bit identifiers:
+//
+//   bit 10     direction, 0 command to a unit, 1 report from a unit
+//   bits 9..7  message type
+//   bits 6..0  node, the addressed unit for commands (0 broadcasts to all),
+//              the sending unit for reports
+//
+// Every frame carries 8 data bytes, multi-byte values little endian.
+
+namespace fleet
+{
+  constexpr uint8_t broadcast = 0;
+  constexpr uint8_t frameBytes = 8;
+
+  enum Command : uint8_t
+  {
+    stopAll,       // no payload
+    writeRegister, // register u16, value u16
+    readRegisters, // start u16, count u8 (1-2)
+    requestStatus  // no payload
+  };
+
+  enum Report : uint8_t
+  {
+    status,         // see StatusReport
+    writeResult,    // register u16, exception u8
+    registerValues  // start u16, count u8, exception u8, values u16 x count (count <= 2)
+  };
+
+  struct Frame
+  {
+    uint16_t id;
+    uint8_t data[frameBytes];
+  };
+
+  struct StatusReport
+  {
+    uint8_t fanPercent;        // requested
+    uint8_t fanAppliedPercent; // after derating
+    uint8_t flags;             // bit 0 mist on, 1 vacant
+    uint8_t patternMode;       // as the remote register
+    uint8_t faults;            // as the remote register
+    uint8_t supplyDecivolts;
+    uint16_t vpdPa;            // 0xFFFF until measured
+  };
+
+  inline uint16_t identifier(bool report, uint8_t type, uint8_t node)
+  {
+    return (report ? 0x400 : 0) | (type & 0x7) << 7 | (node & 0x7F);
+  }
+
+  inline bool isReport(uint16_t id) { return id & 0x400; }
+  inline uint8_t type(uint16_t id) { return id >> 7 & 0x7; }
+  inline uint8_t node(uint16_t id) { return id & 0x7F; }
+
+  inline uint16_t get16(const uint8_t *data) { return data[0] | (uint16_t)data[1] << 8; }
+  inline void put16(uint8_t *data, uint16_t value)
+  {
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+  }
+
+  // Dual acceptance filter of the TWAI controller for standard frames:
+  // filter 1 passes commands to this node, filter 2 broadcast commands.
+  // Mask bits set to 1 are don't care; the data byte bits of filter 1
+  // (19..16, 3..0) are ignored and the RTR bit must be 0.
+  inline void acceptanceFilter(uint8_t node, uint32_t &code, uint32_t &mask)
+  {
+    uint32_t typeBits = identifier(false, 0x7, 0);
+    code = (uint32_t)identifier(false, 0, node) << 21 | (uint32_t)identifier(false, 0, broadcast) << 5;
+    mask = typeBits << 21 | 0xFu << 16 | 0xFu | typeBits << 5;
+  }
+
+  // Software equivalent of acceptanceFilter(), for drivers without one.
+  inline bool accepts(uint8_t node, uint16_t id)
+  {
+    return !isReport(id) && (fleet::node(id) == node || fleet::node(id) == broadcast);
+  }
+
+  inline Frame statusFrame(uint8_t node, const StatusReport &report)
+  {
+    Frame frame = {identifier(true, status, node), {report.fanPercent, report.fanAppliedPercent, report.flags,
+                                                    report.patternMode, report.faults, report.supplyDecivolts}};
+    put16(frame.data + 6, report.vpdPa);
+    return frame;
+  }
+}
+
+// A unit's side of the protocol: commands act on the remote registers, the
+// Registers of modbusRtu.h, the same as Modbus and web writes do. Broadcast
+// commands are carried out without an answer, as dozens of units must not
+// all answer at once.
+template <typename Registers>
+class FleetNode
+{
+public:
+  enum Answer : uint8_t
+  {
+    none,
+    reply,       // send the answer frame
+    statusReport // send a status report
+  };
+
+  FleetNode(uint8_t node, Registers &registers) : node(node), registers(registers) {}
+
+  // Handle one received frame. Returns what to send back; for reply the
+  // frame is in answer.
+  Answer handle(const fleet::Frame &command, fleet::Frame &answer)
+  {
+    if (!fleet::accepts(node, command.id)) return none;
+    bool broadcast = fleet::node(command.id) == fleet::broadcast;
+    const uint8_t *data = command.data;
+    answer = fleet::Frame();
+
+    switch (fleet::type(command.id))
+    {
+    case fleet::stopAll:
+      // the same path as a Modbus or web stop-all: traced, and it restarts
+      // the inactivity stages so the unit still goes to sleep afterwards
+      registers.write(remoteRegister::stopAll, 1);
+      return none;
+    case fleet::writeRegister:
+      answer.id = fleet::identifier(true, fleet::writeResult, node);
+      fleet::put16(answer.data, fleet::get16(data));
+      answer.data[2] = registers.write(fleet::get16(data), fleet::get16(data + 2));
+      break;
+    case fleet::readRegisters:
+    {
+      uint16_t start = fleet::get16(data);
+      uint8_t count = data[2] > 2 ? 2 : data[2];
+      answer.id = fleet::identifier(true, fleet::registerValues, node);
+      fleet::put16(answer.data, start);
+      answer.data[2] = count;
+      for (uint8_t i = 0; i < count && answer.data[3] == modbus::none; i++)
+      {
+        uint16_t value = 0;
+        answer.data[3] = registers.read(start + i, value);
+        fleet::put16(answer.data + 4 + 2 * i, value);
+      }
+      break;
+    }
+    case fleet::requestStatus:
+      return broadcast ? none : statusReport;
+    default:
+      return none;
+    }
+    return broadcast ? none : reply;
+  }
+
+private:
+  uint8_t node;
+  Registers &registers;
+};
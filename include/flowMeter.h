@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+// Water metering from a hall-effect flow sensor, plus leak detection: any
+// real flow while the valve is commanded closed means the valve or the
+// plumbing is leaking. A short settle time after closing lets the line
+// drain before pulses count as a leak.
+
+struct FlowMeterConfig
+{
+  uint16_t pulsesPerLiter = 450;   // YF-S201 style sensors
+  uint16_t closeSettleMs = 2000;   // flow right after closing is the line draining
+  uint16_t leakPulses = 20;        // pulses within one window while closed...
+  uint32_t leakWindowMs = 60000;   // ...to raise a leak fault
+};
+
+class FlowMeter
+{
+public:
+  explicit FlowMeter(const FlowMeterConfig &config = FlowMeterConfig()) : config(config) {}
+
+  void valveChanged(bool open, uint32_t now)
+  {
+    valveOpen = open;
+    valveChangedAt = now;
+    closedPulses = 0;
+    windowStartedAt = now;
+  }
+
+  // Feed the pulses counted since the last call.
+  void addPulses(uint32_t pulses, uint32_t now)
+  {
+    sessionPulses += pulses;
+    dayPulses += pulses;
+    totalPulses += pulses;
+
+    if (valveOpen || now - valveChangedAt < config.closeSettleMs) return;
+    if (now - windowStartedAt >= config.leakWindowMs)
+    {
+      windowStartedAt = now;
+      closedPulses = 0;
+    }
+    closedPulses += pulses;
+    if (closedPulses >= config.leakPulses) leak = true;
+  }
+
+  void startSession() { sessionPulses = 0; }
+  void startDay() { dayPulses = 0; }
+  void clearLeak() { leak = false; }
+
+  float sessionLiters() const { return (float)sessionPulses / config.pulsesPerLiter; }
+  float dayLiters() const { return (float)dayPulses / config.pulsesPerLiter; }
+  float totalLiters() const { return (float)totalPulses / config.pulsesPerLiter; }
+  uint32_t totalPulseCount() const { return totalPulses; }
+  bool leaking() const { return leak; }
+
+private:
+  FlowMeterConfig config;
+  bool valveOpen = false;
+  uint32_t valveChangedAt = 0;
+  uint32_t windowStartedAt = 0;
+  uint32_t closedPulses = 0;
+  uint32_t sessionPulses = 0;
+  uint32_t dayPulses = 0;
+  uint32_t totalPulses = 0;
+  bool leak = false;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+// Collects digital output changes into per-bank set/clear masks and applies
+// them with one write-1-to-set and one write-1-to-clear register access per
+// bank, so outputs switch together instead of one digitalWrite() at a time.
+//
+// Registers must provide set(bank, mask) and clear(bank, mask); on the chip
+// these are GPIO.out_w1ts/out_w1tc (pins 0-31) and out1_w1ts/out1_w1tc
+// (pins 32 and up).
+
+template <typename Registers>
+class GpioBatch
+{
+public:
+  static constexpr uint8_t banks = 2;
+
+  explicit GpioBatch(Registers &registers) : registers(registers) {}
+
+  void write(uint8_t pin, bool level)
+  {
+    uint8_t bank = pin / 32;
+    uint32_t mask = 1UL << (pin % 32);
+    if (level)
+    {
+      setMask[bank] |= mask;
+      clearMask[bank] &= ~mask;
+    }
+    else
+    {
+      clearMask[bank] |= mask;
+      setMask[bank] &= ~mask;
+    }
+  }
+
+  bool pending() const
+  {
+    for (uint8_t bank = 0; bank < banks; bank++)
+    {
+      if (setMask[bank] || clearMask[bank]) return true;
+    }
+    return false;
+  }
+
+  void apply()
+  {
+    for (uint8_t bank = 0; bank < banks; bank++)
+    {
+      if (clearMask[bank]) registers.clear(bank, clearMask[bank]);
+      if (setMask[bank]) registers.set(bank, setMask[bank]);
+      setMask[bank] = 0;
+      clearMask[bank] = 0;
+    }
+  }
+
+private:
+  Registers &registers;
+  uint32_t setMask[banks] = {};
+  uint32_t clearMask[banks] = {};
+};
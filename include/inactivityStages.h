@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Staged inactivity timeout. Each stage has its own deadline measured from
+// one activity timestamp; stages are entered in order, and any activity
+// starts over from the first one.
+
+template <size_t stageCount>
+class InactivityStages
+{
+public:
+  // deadlines in ms after the last activity, ascending
+  explicit InactivityStages(const uint32_t (&deadlines)[stageCount])
+  {
+    for (size_t i = 0; i < stageCount; i++)
+    {
+      this->deadlines[i] = deadlines[i];
+    }
+  }
+
+  // Takes effect from the next update(), measured from the same activity.
+  void setDeadline(size_t stage, uint32_t deadline) { deadlines[stage] = deadline; }
+
+  void activity(uint32_t now)
+  {
+    lastActivity = now;
+    reached = 0;
+  }
+
+  // Back to a checkpointed position: last activity and stages reached.
+  void restore(uint32_t lastActivity, size_t reached)
+  {
+    this->lastActivity = lastActivity;
+    this->reached = reached < stageCount ? reached : stageCount;
+  }
+
+  // Number of stages reached so far.
+  size_t stage() const { return reached; }
+
+  // Advance by at most one stage. Returns true and the stage index (0 based)
+  // if a deadline has passed; call again until it returns false to catch up
+  // after a late wakeup.
+  bool update(uint32_t now, size_t &entered)
+  {
+    if (reached == stageCount || now - lastActivity < deadlines[reached]) return false;
+    entered = reached++;
+    return true;
+  }
+
+  // Time left until the next stage, false once all stages are reached.
+  bool untilNext(uint32_t now, uint32_t &remaining) const
+  {
+    if (reached == stageCount) return false;
+    uint32_t elapsed = now - lastActivity;
+    remaining = elapsed >= deadlines[reached] ? 0 : deadlines[reached] - elapsed;
+    return true;
+  }
+
+  uint32_t lastActivityAt() const { return lastActivity; }
+
+private:
+  uint32_t deadlines[stageCount];
+  uint32_t lastActivity = 0;
+  size_t reached = 0;
+};
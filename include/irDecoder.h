@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decoders for NEC and RC5 infrared frames captured by the RMT peripheral.
+//
+// Input is the RMT symbol stream: each symbol holds two (level, duration)
+// halves, durations in microseconds (1 MHz RMT tick). IR receiver modules
+// pull their output low while they see the carrier, so level 0 is a mark.
+
+struct IrSymbol
+{
+  uint16_t duration0;
+  uint8_t level0;
+  uint16_t duration1;
+  uint8_t level1;
+};
+
+struct IrCode
+{
+  enum Protocol : uint8_t
+  {
+    nec,
+    rc5
+  };
+
+  Protocol protocol;
+  uint16_t address;
+  uint8_t command;
+  bool repeat; // NEC repeat frame, or RC5 frame with an unchanged toggle bit
+};
+
+namespace ir
+{
+  // Flattened view of a symbol stream as alternating marks and spaces.
+  class PulseReader
+  {
+  public:
+    PulseReader(const IrSymbol *symbols, size_t count) : symbols(symbols), count(count) {}
+
+    bool next(bool &mark, uint32_t &duration)
+    {
+      if (index >= count * 2) return false;
+      const IrSymbol &symbol = symbols[index / 2];
+      bool first = index % 2 == 0;
+      index++;
+      duration = first ? symbol.duration0 : symbol.duration1;
+      mark = (first ? symbol.level0 : symbol.level1) == 0;
+      if (duration == 0) index = count * 2; // a zero duration ends the frame
+      return duration > 0;
+    }
+
+  private:
+    const IrSymbol *symbols;
+    size_t count;
+    size_t index = 0;
+  };
+
+  inline bool near(uint32_t duration, uint32_t expected)
+  {
+    // receiver modules stretch marks and shrink spaces by up to ~100 us
+    uint32_t tolerance = expected / 4 + 100;
+    return duration + tolerance >= expected && duration <= expected + tolerance;
+  }
+
+  inline bool decodeNec(const IrSymbol *symbols, size_t count, IrCode &code)
+  {
+    PulseReader reader(symbols, count);
+    bool mark;
+    uint32_t duration;
+    if (!reader.next(mark, duration) || !mark || !near(duration, 9000)) return false;
+    if (!reader.next(mark, duration) || mark) return false;
+    if (near(duration, 2250))
+    {
+      code.protocol = IrCode::nec;
+      code.repeat = true;
+      return true;
+    }
+    if (!near(duration, 4500)) return false;
+
+    uint32_t bits = 0;
+    for (int bit = 0; bit < 32; bit++)
+    {
+      if (!reader.next(mark, duration) || !mark || !near(duration, 560)) return false;
+      if (!reader.next(mark, duration) || mark) return false;
+      if (near(duration, 1690)) bits |= 1UL << bit; // LSB first
+      else if (!near(duration, 560)) return false;
+    }
+
+    uint8_t address = bits;
+    uint8_t addressInverse = bits >> 8;
+    uint8_t command = bits >> 16;
+    uint8_t commandInverse = bits >> 24;
+    if ((uint8_t)~command != commandInverse) return false;
+    code.protocol = IrCode::nec;
+    // extended NEC drops the address inverse for a 16 bit address
+    code.address = (uint8_t)~address == addressInverse ? address : (bits & 0xFFFF);
+    code.command = command;
+    code.repeat = false;
+    return true;
+  }
+
+  // RC5 is Manchester coded with 889 us half bits; a 1 is a space followed
+  // by a mark. The capture starts at the first mark, which is the second
+  // half of the always-set start bit. lastToggle carries the toggle bit
+  // between frames, -1 before the first one.
+  inline bool decodeRc5(const IrSymbol *symbols, size_t count, IrCode &code, int8_t &lastToggle)
+  {
+    constexpr uint32_t halfBit = 889;
+    constexpr int frameHalves = 28;
+    bool halves[frameHalves];
+    int filled = 0;
+    halves[filled++] = false;
+
+    PulseReader reader(symbols, count);
+    bool mark;
+    uint32_t duration;
+    while (reader.next(mark, duration))
+    {
+      int length = near(duration, halfBit) ? 1 : near(duration, 2 * halfBit) ? 2 : 0;
+      if (length == 0 || filled + length > frameHalves) return false;
+      for (int i = 0; i < length; i++)
+      {
+        halves[filled++] = mark;
+      }
+    }
+    // a trailing space half is lost in the idle line
+    if (filled == frameHalves - 1) halves[filled++] = false;
+    if (filled != frameHalves) return false;
+
+    uint16_t bits = 0;
+    for (int i = 0; i < frameHalves; i += 2)
+    {
+      if (halves[i] == halves[i + 1]) return false;
+      bits = (bits << 1) | (halves[i + 1] ? 1 : 0);
+    }
+
+    // S1, S2 (inverted 7th command bit), toggle, 5 address bits, 6 command bits
+    int8_t toggle = (bits & 0x800) ? 1 : 0;
+    code.protocol = IrCode::rc5;
+    code.address = (bits >> 6) & 0x1F;
+    code.command = (bits & 0x3F) | ((bits & 0x1000) ? 0 : 0x40);
+    code.repeat = toggle == lastToggle;
+    lastToggle = toggle;
+    return true;
+  }
+}
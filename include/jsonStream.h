@@ -0,0 +1,397 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming JSON without a document tree. JsonReader is a push parser: feed
+// it the text in chunks of any size and it calls the handler for every
+// token as soon as it is complete, keeping only a fixed-size token buffer
+// and a container stack. JsonWriter emits the same events as text.
+//
+// Numbers are limited to integers that fit int32_t, strings to plain ASCII
+// escapes (no \u); both are all a configuration needs.
+//
+// Handler must provide, each returning false to reject the document:
+//   bool beginObject(), endObject(), beginArray(), endArray()
+//   bool key(const char *), string(const char *), number(int32_t),
+//        boolean(bool), null()
+
+namespace json
+{
+  enum Error : uint8_t
+  {
+    ok,
+    syntax,
+    tooDeep,
+    tooLong,   // a string or number longer than the token buffer
+    rejected,  // by the handler, or a number out of range
+    incomplete
+  };
+}
+
+template <typename Handler, size_t maxDepth = 8, size_t maxToken = 32>
+class JsonReader
+{
+public:
+  explicit JsonReader(Handler &handler) : handler(handler) {}
+
+  void reset()
+  {
+    state = expectValue;
+    depth = 0;
+    tokenLength = 0;
+    failure = json::ok;
+    offset = 0;
+  }
+
+  // Returns false from the first error on; later calls are ignored.
+  bool feed(const char *data, size_t length)
+  {
+    for (size_t i = 0; i < length && failure == json::ok; i++, offset++)
+    {
+      process(data[i]);
+    }
+    return failure == json::ok;
+  }
+
+  // Call after the last chunk; true only for one complete, accepted value.
+  bool finish()
+  {
+    if (failure == json::ok && (state == inNumber || state == inLiteral)) endToken();
+    if (failure == json::ok && state != done) failure = json::incomplete;
+    return failure == json::ok;
+  }
+
+  json::Error error() const { return failure; }
+  size_t position() const { return offset; } // of the error, or characters consumed
+
+private:
+  enum State : uint8_t
+  {
+    expectValue,
+    expectValueOrEnd, // right after '['
+    expectKey,
+    expectKeyOrEnd,   // right after '{'
+    expectColon,
+    expectCommaOrEnd,
+    inString,
+    inEscape,
+    inNumber,
+    inLiteral,
+    done
+  };
+
+  static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+  static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+  static bool isLetter(char c) { return c >= 'a' && c <= 'z'; }
+
+  void fail(json::Error error) { failure = error; }
+  void check(bool accepted)
+  {
+    if (!accepted) fail(json::rejected);
+  }
+
+  bool append(char c)
+  {
+    if (tokenLength + 1 >= maxToken)
+    {
+      fail(json::tooLong);
+      return false;
+    }
+    token[tokenLength++] = c;
+    return true;
+  }
+
+  void afterValue() { state = depth == 0 ? done : expectCommaOrEnd; }
+
+  void push(bool object)
+  {
+    if (depth == maxDepth)
+    {
+      fail(json::tooDeep);
+      return;
+    }
+    isObject[depth++] = object;
+    check(object ? handler.beginObject() : handler.beginArray());
+    state = object ? expectKeyOrEnd : expectValueOrEnd;
+  }
+
+  void pop(bool object)
+  {
+    if (depth == 0 || isObject[depth - 1] != object)
+    {
+      fail(json::syntax);
+      return;
+    }
+    depth--;
+    check(object ? handler.endObject() : handler.endArray());
+    afterValue();
+  }
+
+  // Ends a number or literal, which have no closing character of their own.
+  void endToken()
+  {
+    token[tokenLength] = '\0';
+    if (state == inNumber)
+    {
+      bool negative = token[0] == '-';
+      size_t first = negative ? 1 : 0;
+      if (tokenLength == first) return fail(json::syntax);
+      int64_t value = 0;
+      for (size_t i = first; i < tokenLength; i++)
+      {
+        if (!isDigit(token[i])) return fail(json::syntax);
+        value = value * 10 + (token[i] - '0');
+        if (value > (int64_t)INT32_MAX + 1) return fail(json::rejected);
+      }
+      if (negative) value = -value;
+      if (value > INT32_MAX) return fail(json::rejected);
+      check(handler.number((int32_t)value));
+    }
+    else if (tokenLength == 4 && token[0] == 't' && token[1] == 'r' && token[2] == 'u' && token[3] == 'e')
+    {
+      check(handler.boolean(true));
+    }
+    else if (tokenLength == 5 && token[0] == 'f' && token[1] == 'a' && token[2] == 'l' && token[3] == 's' && token[4] == 'e')
+    {
+      check(handler.boolean(false));
+    }
+    else if (tokenLength == 4 && token[0] == 'n' && token[1] == 'u' && token[2] == 'l' && token[3] == 'l')
+    {
+      check(handler.null());
+    }
+    else
+    {
+      return fail(json::syntax);
+    }
+    afterValue();
+  }
+
+  void process(char c)
+  {
+    switch (state)
+    {
+    case inString:
+      if (c == '\\')
+      {
+        state = inEscape;
+      }
+      else if (c == '"')
+      {
+        token[tokenLength] = '\0';
+        if (stringIsKey)
+        {
+          check(handler.key(token));
+          state = expectColon;
+        }
+        else
+        {
+          check(handler.string(token));
+          afterValue();
+        }
+      }
+      else if ((uint8_t)c < 0x20)
+      {
+        fail(json::syntax);
+      }
+      else
+      {
+        append(c);
+      }
+      return;
+
+    case inEscape:
+    {
+      const char *from = "\"\\/bfnrt";
+      const char *to = "\"\\/\b\f\n\r\t";
+      for (size_t i = 0; from[i]; i++)
+      {
+        if (c == from[i])
+        {
+          state = inString;
+          append(to[i]);
+          return;
+        }
+      }
+      fail(json::syntax);
+      return;
+    }
+
+    case inNumber:
+      if (isDigit(c))
+      {
+        append(c);
+        return;
+      }
+      if (c == '.' || c == 'e' || c == 'E') return fail(json::rejected); // not an integer
+      endToken();
+      break; // c still needs handling
+
+    case inLiteral:
+      if (isLetter(c))
+      {
+        append(c);
+        return;
+      }
+      endToken();
+      break;
+
+    default:
+      break;
+    }
+
+    if (failure != json::ok || isSpace(c)) return;
+    switch (state)
+    {
+    case expectValue:
+    case expectValueOrEnd:
+      if (c == '{') push(true);
+      else if (c == '[') push(false);
+      else if (c == ']' && state == expectValueOrEnd) pop(false);
+      else if (c == '"') startString(false);
+      else if (c == '-' || isDigit(c)) startToken(inNumber, c);
+      else if (isLetter(c)) startToken(inLiteral, c);
+      else fail(json::syntax);
+      break;
+    case expectKey:
+    case expectKeyOrEnd:
+      if (c == '"') startString(true);
+      else if (c == '}' && state == expectKeyOrEnd) pop(true);
+      else fail(json::syntax);
+      break;
+    case expectColon:
+      if (c == ':') state = expectValue;
+      else fail(json::syntax);
+      break;
+    case expectCommaOrEnd:
+      if (c == ',') state = isObject[depth - 1] ? expectKey : expectValue;
+      else if (c == '}') pop(true);
+      else if (c == ']') pop(false);
+      else fail(json::syntax);
+      break;
+    default: // trailing garbage after the value
+      fail(json::syntax);
+      break;
+    }
+  }
+
+  void startString(bool key)
+  {
+    stringIsKey = key;
+    tokenLength = 0;
+    state = inString;
+  }
+
+  void startToken(State tokenState, char c)
+  {
+    tokenLength = 0;
+    state = tokenState;
+    append(c);
+  }
+
+  Handler &handler;
+  State state = expectValue;
+  bool isObject[maxDepth];
+  size_t depth = 0;
+  char token[maxToken];
+  size_t tokenLength = 0;
+  bool stringIsKey = false;
+  json::Error failure = json::ok;
+  size_t offset = 0;
+};
+
+// Sink must provide write(const uint8_t *, size_t), like Arduino's Print.
+template <typename Sink, size_t maxDepth = 8>
+class JsonWriter
+{
+public:
+  explicit JsonWriter(Sink &sink) : sink(sink) {}
+
+  void beginObject() { open('{'); }
+  void endObject() { close('}'); }
+  void beginArray() { open('['); }
+  void endArray() { close(']'); }
+
+  void key(const char *name)
+  {
+    separate();
+    quoted(name);
+    put(":", 1);
+    afterKey = true;
+  }
+
+  void string(const char *text)
+  {
+    separate();
+    quoted(text);
+  }
+
+  void number(int32_t value)
+  {
+    separate();
+    char digits[12];
+    size_t length = 0;
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    do
+    {
+      digits[sizeof(digits) - 1 - length++] = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) digits[sizeof(digits) - 1 - length++] = '-';
+    put(digits + sizeof(digits) - length, length);
+  }
+
+  void boolean(bool value)
+  {
+    separate();
+    put(value ? "true" : "false", value ? 4 : 5);
+  }
+
+private:
+  void put(const char *text, size_t length) { sink.write((const uint8_t *)text, length); }
+
+  // A comma before every element but the first of its container.
+  void separate()
+  {
+    if (afterKey)
+    {
+      afterKey = false;
+      return;
+    }
+    if (depth > 0 && depth <= maxDepth && count[depth - 1]++ > 0) put(",", 1);
+  }
+
+  void open(char c)
+  {
+    separate();
+    put(&c, 1);
+    if (depth < maxDepth) count[depth] = 0;
+    depth++;
+  }
+
+  void close(char c)
+  {
+    depth--;
+    put(&c, 1);
+  }
+
+  void quoted(const char *text)
+  {
+    put("\"", 1);
+    for (; *text; text++)
+    {
+      const char *escaped = nullptr;
+      if (*text == '"') escaped = "\\\"";
+      else if (*text == '\\') escaped = "\\\\";
+      else if (*text == '\n') escaped = "\\n";
+      if (escaped) put(escaped, 2);
+      else put(text, 1);
+    }
+    put("\"", 1);
+  }
+
+  Sink &sink;
+  size_t count[maxDepth];
+  size_t depth = 0;
+  bool afterKey = false;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Status LED sequencing. A pattern is a list of steps, each fading to a level
+// and holding it. Confirmation codes are queued and played once (or a few
+// times) in order; when the queue is empty the idle pattern, which shows the
+// controller state, loops. The hardware side only has to fade to each step's
+// level and ask for the next step after rampMs + holdMs.
+
+struct LedStep
+{
+  uint8_t level;   // 0 = off, 255 = full brightness
+  uint16_t rampMs; // fade time to reach level
+  uint16_t holdMs; // time to stay at level afterwards
+};
+
+struct LedPattern
+{
+  const LedStep *steps;
+  uint8_t stepCount;
+  uint8_t repeats; // plays of a queued pattern, ignored for the idle pattern
+};
+
+class LedSequencer
+{
+public:
+  static constexpr size_t queueSize = 4;
+
+  // Returns false if the queue is full and the pattern was dropped.
+  bool enqueue(const LedPattern &pattern)
+  {
+    if (queued == queueSize || pattern.stepCount == 0 || pattern.repeats == 0) return false;
+    queue[(head + queued) % queueSize] = pattern;
+    queued++;
+    return true;
+  }
+
+  // An empty pattern leaves the LED dark when nothing is queued.
+  void setIdle(const LedPattern &pattern)
+  {
+    idle = pattern;
+    idleStep = 0;
+  }
+
+  bool playingIdle() const { return queued == 0 || !started; }
+
+  // Next step to play. Returns false when there is nothing left to show, in
+  // which case the LED should be turned off and no further step requested.
+  bool next(LedStep &step)
+  {
+    if (queued > 0)
+    {
+      const LedPattern &pattern = queue[head];
+      started = true;
+      step = pattern.steps[stepIndex];
+      if (++stepIndex == pattern.stepCount)
+      {
+        stepIndex = 0;
+        if (++repeatIndex == pattern.repeats)
+        {
+          repeatIndex = 0;
+          head = (head + 1) % queueSize;
+          queued--;
+          started = false;
+          idleStep = 0;
+        }
+      }
+      return true;
+    }
+    if (idle.stepCount == 0) return false;
+    step = idle.steps[idleStep];
+    idleStep = (idleStep + 1) % idle.stepCount;
+    return true;
+  }
+
+private:
+  LedPattern queue[queueSize] = {};
+  size_t head = 0;
+  size_t queued = 0;
+  uint8_t stepIndex = 0;
+  uint8_t repeatIndex = 0;
+  bool started = false;
+  LedPattern idle = {nullptr, 0, 0};
+  uint8_t idleStep = 0;
+};
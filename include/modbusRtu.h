@@ -0,0 +1,223 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Modbus RTU slave side: CRC, request parsing and response building for
+// read holding/input registers (3, 4), write single register (6) and write
+// multiple registers (16). Framing (the 3.5 character gap) is left to the
+// UART, whose receive events ModbusFramer turns into frames; handle() gets
+// one complete frame.
+//
+// Registers must provide
+//   modbus::Exception read(uint16_t address, uint16_t &value)
+//   modbus::Exception write(uint16_t address, uint16_t value)
+// returning modbus::none on success.
+
+namespace modbus
+{
+  constexpr size_t maxFrame = 256;
+  constexpr uint8_t broadcast = 0;
+
+  enum Exception : uint8_t
+  {
+    none = 0,
+    illegalFunction = 1,
+    illegalAddress = 2,
+    illegalValue = 3
+  };
+
+  enum Function : uint8_t
+  {
+    readHolding = 3,
+    readInput = 4,
+    writeSingle = 6,
+    writeMultiple = 16
+  };
+
+  inline uint16_t crc16(const uint8_t *data, size_t length)
+  {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+      crc ^= data[i];
+      for (int bit = 0; bit < 8; bit++)
+      {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+      }
+    }
+    return crc;
+  }
+
+  inline uint16_t word(const uint8_t *data) { return (uint16_t)data[0] << 8 | data[1]; }
+}
+
+template <typename Registers>
+class ModbusSlave
+{
+public:
+  ModbusSlave(uint8_t address, Registers &registers) : address(address), registers(registers) {}
+
+  // Handle one request frame. Returns the length of the response written to
+  // response (at most modbus::maxFrame bytes), 0 if nothing is to be sent:
+  // frames for other units, bad CRCs and broadcasts.
+  size_t handle(const uint8_t *request, size_t length, uint8_t *response)
+  {
+    if (length < 4) return 0;
+    if (request[0] != address && request[0] != modbus::broadcast) return 0;
+    uint16_t crc = request[length - 2] | (uint16_t)request[length - 1] << 8;
+    if (modbus::crc16(request, length - 2) != crc)
+    {
+      crcErrors++;
+      return 0;
+    }
+    requests++;
+
+    bool broadcast = request[0] == modbus::broadcast;
+    uint8_t function = request[1];
+    const uint8_t *data = request + 2;
+    size_t dataLength = length - 4;
+    size_t responseLength = 0;
+    modbus::Exception exception = modbus::none;
+
+    if ((function == modbus::readHolding || function == modbus::readInput) && !broadcast)
+    {
+      exception = read(data, dataLength, response, responseLength);
+    }
+    else if (function == modbus::writeSingle)
+    {
+      exception = writeSingle(data, dataLength);
+      if (exception == modbus::none)
+      {
+        for (size_t i = 0; i < 4; i++) response[2 + i] = data[i]; // echo
+        responseLength = 6;
+      }
+    }
+    else if (function == modbus::writeMultiple)
+    {
+      exception = writeMultiple(data, dataLength);
+      if (exception == modbus::none)
+      {
+        for (size_t i = 0; i < 4; i++) response[2 + i] = data[i]; // start and count
+        responseLength = 6;
+      }
+    }
+    else if (!broadcast)
+    {
+      exception = modbus::illegalFunction;
+    }
+
+    if (broadcast) return 0;
+    response[0] = address;
+    response[1] = function;
+    if (exception != modbus::none)
+    {
+      exceptions++;
+      response[1] |= 0x80;
+      response[2] = exception;
+      responseLength = 3;
+    }
+    crc = modbus::crc16(response, responseLength);
+    response[responseLength++] = crc & 0xFF;
+    response[responseLength++] = crc >> 8;
+    return responseLength;
+  }
+
+  uint32_t requestCount() const { return requests; }
+  uint32_t crcErrorCount() const { return crcErrors; }
+  uint32_t exceptionCount() const { return exceptions; }
+
+private:
+  modbus::Exception read(const uint8_t *data, size_t length, uint8_t *response, size_t &responseLength)
+  {
+    if (length != 4) return modbus::illegalValue;
+    uint16_t start = modbus::word(data);
+    uint16_t count = modbus::word(data + 2);
+    if (count == 0 || count > 125) return modbus::illegalValue;
+    for (uint16_t i = 0; i < count; i++)
+    {
+      uint16_t value;
+      modbus::Exception exception = registers.read(start + i, value);
+      if (exception != modbus::none) return exception;
+      response[3 + 2 * i] = value >> 8;
+      response[4 + 2 * i] = value & 0xFF;
+    }
+    response[2] = count * 2;
+    responseLength = 3 + count * 2;
+    return modbus::none;
+  }
+
+  modbus::Exception writeSingle(const uint8_t *data, size_t length)
+  {
+    if (length != 4) return modbus::illegalValue;
+    return registers.write(modbus::word(data), modbus::word(data + 2));
+  }
+
+  // Registers are written in order; an exception stops at the failing one.
+  modbus::Exception writeMultiple(const uint8_t *data, size_t length)
+  {
+    if (length < 5) return modbus::illegalValue;
+    uint16_t start = modbus::word(data);
+    uint16_t count = modbus::word(data + 2);
+    if (count == 0 || count > 123 || data[4] != count * 2 || length != 5 + count * 2u) return modbus::illegalValue;
+    for (uint16_t i = 0; i < count; i++)
+    {
+      modbus::Exception exception = registers.write(start + i, modbus::word(data + 5 + 2 * i));
+      if (exception != modbus::none) return exception;
+    }
+    return modbus::none;
+  }
+
+  uint8_t address;
+  Registers &registers;
+  uint32_t requests = 0;
+  uint32_t crcErrors = 0;
+  uint32_t exceptions = 0;
+};
+
+// Assembles request frames from the UART driver's receive events: data
+// adds bytes, and the receive timeout, set to the 3.5 character gap that
+// ends an RTU frame, ends the frame. Longer frames than modbus::maxFrame are
+// dropped whole, so are frames cut short by a line error.
+class ModbusFramer
+{
+public:
+  void received(const uint8_t *data, size_t length)
+  {
+    for (size_t i = 0; i < length; i++)
+    {
+      if (frameLength == modbus::maxFrame)
+      {
+        overflow = true;
+        return;
+      }
+      buffer[frameLength++] = data[i];
+    }
+  }
+
+  // The receive timeout. Returns the length of the frame to handle, 0 when
+  // there is none; the frame stays in frame() until the next byte.
+  size_t ended()
+  {
+    size_t length = overflow ? 0 : frameLength;
+    if (overflow) overflows++;
+    discard();
+    return length;
+  }
+
+  // A line error: overflow, parity or framing.
+  void discard()
+  {
+    frameLength = 0;
+    overflow = false;
+  }
+
+  const uint8_t *frame() const { return buffer; }
+  uint32_t overflowCount() const { return overflows; }
+
+private:
+  uint8_t buffer[modbus::maxFrame];
+  size_t frameLength = 0;
+  bool overflow = false;
+  uint32_t overflows = 0;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+// Vacancy detection from a PIR sensor. The sensor output stays high while it
+// sees motion; the space counts as vacant once the output has been low for
+// the whole vacancy delay, and occupied again on the next motion.
+
+class OccupancyTracker
+{
+public:
+  enum Event : uint8_t
+  {
+    none,
+    vacated,
+    occupied
+  };
+
+  explicit OccupancyTracker(uint32_t vacancyDelay) : vacancyDelay(vacancyDelay) {}
+
+  // motionAt is the time of the last rising edge (or any time the output was
+  // seen high), motionActive the current output level.
+  Event update(uint32_t now, uint32_t motionAt, bool motionActive)
+  {
+    bool recentMotion = motionActive || now - motionAt < vacancyDelay;
+    if (vacant && (motionActive || motionAt != vacatedAfter))
+    {
+      vacant = false;
+      return occupied;
+    }
+    if (!vacant && !recentMotion)
+    {
+      vacant = true;
+      vacatedAfter = motionAt;
+      return vacated;
+    }
+    return none;
+  }
+
+  bool isVacant() const { return vacant; }
+
+private:
+  uint32_t vacancyDelay;
+  bool vacant = false;
+  uint32_t vacatedAfter = 0; // last motion seen before going vacant
+};
+
+// Where a repeating on/off pattern started at start is at time now, so a
+// suspended pattern can pick up in step as if it had kept running.
+inline uint32_t patternPhase(uint32_t start, uint32_t now, uint32_t period)
+{
+  return period == 0 ? 0 : (now - start) % period;
+}
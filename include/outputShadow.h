@@ -0,0 +1,59 @@
+#pragma once
+
+// Shadow copy of the controller outputs. Callbacks only change the desired
+// state; commit() runs once at the end of each loop() pass and touches the
+// peripherals only for outputs that actually changed, in a fixed order that
+// closes the valve before the fan changes and opens it after.
+//
+// Driver must provide writeMist(bool) and writeFanPercent(int).
+
+template <typename Driver>
+class OutputShadow
+{
+public:
+  explicit OutputShadow(Driver &driver) : driver(driver) {}
+
+  void setMist(bool state) { desiredMist = state; }
+  void setFanPercent(int percent) { desiredFanPercent = percent; }
+
+  bool mist() const { return desiredMist; }
+  int fanPercent() const { return desiredFanPercent; }
+  bool mistPending() const { return !written || desiredMist != writtenMist; }
+  bool fanPending() const { return !written || desiredFanPercent != writtenFanPercent; }
+  bool pending() const { return mistPending() || fanPending(); }
+
+  // With allowMistOn false a pending valve opening is held back (and stays
+  // pending) while everything else is written as usual; allowFanIncrease
+  // does the same for a fan speed-up.
+  void commit(bool allowMistOn = true, bool allowFanIncrease = true)
+  {
+    bool mistChanged = (!written || desiredMist != writtenMist) && (allowMistOn || !desiredMist);
+    bool fanChanged = (!written || desiredFanPercent != writtenFanPercent) &&
+                      (allowFanIncrease || (written && desiredFanPercent < writtenFanPercent));
+
+    if (mistChanged && !desiredMist)
+    {
+      driver.writeMist(false);
+    }
+    if (fanChanged)
+    {
+      driver.writeFanPercent(desiredFanPercent);
+    }
+    if (mistChanged && desiredMist)
+    {
+      driver.writeMist(true);
+    }
+
+    if (mistChanged) writtenMist = desiredMist;
+    if (fanChanged) writtenFanPercent = desiredFanPercent;
+    written = true;
+  }
+
+private:
+  Driver &driver;
+  bool desiredMist = false;
+  int desiredFanPercent = 0;
+  bool writtenMist = false;
+  int writtenFanPercent = 0;
+  bool written = false; // the first commit writes everything
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Electrical budget for the switched loads. Each load has a steady current
+// at full level and an inrush current that flows for a short window after
+// it is switched on or stepped up. Starts are only allowed while the peak
+// (steady plus open inrush windows) stays within the peak budget, so two
+// inrushes end up a few ms apart instead of stacked, and a load's level is
+// capped so the steady draw fits with every other reserved load at full. All
+// loads start out reserved; an owner that knows a load is off and stays off
+// for now may release it.
+
+struct PowerLoad
+{
+  uint16_t steadyMa; // at 100%
+  uint16_t inrushMa; // extra on top of steady while starting
+  uint16_t inrushMs;
+};
+
+struct PowerBudgetConfig
+{
+  uint16_t steadyBudgetMa;
+  uint16_t peakBudgetMa;
+};
+
+template <size_t loadCount>
+class PowerBudget
+{
+public:
+  PowerBudget(const PowerBudgetConfig &config, const PowerLoad (&loads)[loadCount]) : config(config)
+  {
+    for (size_t i = 0; i < loadCount; i++)
+    {
+      this->loads[i] = loads[i];
+      reserved[i] = true;
+    }
+  }
+
+  // Record a load being switched to percent of its full draw. An increase
+  // opens its inrush window.
+  void set(size_t load, uint8_t percent, uint32_t now)
+  {
+    if (percent > levels[load])
+    {
+      inrushAt[load] = now;
+      inrushing[load] = true;
+    }
+    levels[load] = percent;
+  }
+
+  // Whether maxPercent() of the others counts load at full.
+  void reserve(size_t load, bool reserved) { this->reserved[load] = reserved; }
+
+  uint32_t steadyMa() const
+  {
+    uint32_t total = 0;
+    for (size_t i = 0; i < loadCount; i++)
+    {
+      total += (uint32_t)loads[i].steadyMa * levels[i] / 100;
+    }
+    return total;
+  }
+
+  uint32_t peakMa(uint32_t now)
+  {
+    uint32_t total = steadyMa();
+    for (size_t i = 0; i < loadCount; i++)
+    {
+      if (inrushActive(i, now)) total += loads[i].inrushMa;
+    }
+    return total;
+  }
+
+  // Whether load may be switched on or stepped up to percent now. With no
+  // other inrush in progress a start is always allowed, so an oversized load
+  // still runs.
+  bool canStart(size_t load, uint8_t percent, uint32_t now)
+  {
+    bool othersStarting = false;
+    for (size_t i = 0; i < loadCount; i++)
+    {
+      if (i != load && inrushActive(i, now)) othersStarting = true;
+    }
+    uint32_t increase = percent > levels[load] ? (uint32_t)loads[load].steadyMa * (percent - levels[load]) / 100 : 0;
+    return !othersStarting || peakMa(now) + increase + loads[load].inrushMa <= config.peakBudgetMa;
+  }
+
+  // Highest level of load that keeps the steady draw within budget with the
+  // other reserved loads at full.
+  uint8_t maxPercent(size_t load) const
+  {
+    uint32_t others = 0;
+    for (size_t i = 0; i < loadCount; i++)
+    {
+      if (i != load && reserved[i]) others += loads[i].steadyMa;
+    }
+    if (loads[load].steadyMa == 0) return 100;
+    if (others >= config.steadyBudgetMa) return 0;
+    uint32_t percent = (uint32_t)(config.steadyBudgetMa - others) * 100 / loads[load].steadyMa;
+    return percent > 100 ? 100 : percent;
+  }
+
+private:
+  bool inrushActive(size_t load, uint32_t now)
+  {
+    if (inrushing[load] && now - inrushAt[load] >= loads[load].inrushMs) inrushing[load] = false;
+    return inrushing[load];
+  }
+
+  PowerBudgetConfig config;
+  PowerLoad loads[loadCount];
+  uint8_t levels[loadCount] = {};
+  uint32_t inrushAt[loadCount] = {};
+  bool inrushing[loadCount] = {};
+  bool reserved[loadCount];
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Line pressure transient analysis for nozzle clog detection.
+//
+// Raw ADC samples are averaged into fixed-size bins. While the valve is closed
+// the bins track the resting line pressure; when the valve opens a capture
+// window of bins is recorded and reduced to a few features once it is full.
+// The first few captures teach the baseline, later captures are compared
+// against it. Nothing in here touches the hardware so it builds on the host.
+
+struct PressureFeatures
+{
+  float restPressure = 0;  // average reading before the valve opened
+  float dropMagnitude = 0; // rest pressure minus the lowest reading after opening
+  float settleTime = 0;    // us from opening until readings stay inside the settle band
+};
+
+struct PressureMonitorConfig
+{
+  uint32_t samplePeriodUs = 200;   // time between raw ADC samples
+  uint16_t samplesPerBin = 25;     // raw samples averaged into one bin
+  float restSmoothing = 0.05;      // EWMA weight of a new bin in the resting pressure
+  float settleBandFraction = 0.1;  // settle band as a fraction of the drop...
+  float minSettleBand = 8;         // ...but never narrower than this (ADC counts)
+  float minDrop = 16;              // smaller drops mean no flow was seen at all
+  uint8_t learnCaptures = 8;       // captures averaged into the baseline
+  float baselineSmoothing = 0.05;  // EWMA weight of a healthy capture after learning
+  float dropTolerance = 0.4;       // allowed fractional shortfall of the drop
+  float settleTolerance = 2.0;     // allowed settle time as a multiple of the baseline
+  uint8_t faultAfter = 3;          // consecutive deviating captures before flagging
+};
+
+class PressureMonitor
+{
+public:
+  static constexpr size_t captureBins = 128;
+
+  explicit PressureMonitor(const PressureMonitorConfig &config = PressureMonitorConfig()) : config(config) {}
+
+  // Call right before the valve is energized, after all samples taken while it
+  // was still closed have been fed in.
+  void valveOpened()
+  {
+    valveOpen = true;
+    capturing = true;
+    binCount = 0;
+    resetBin();
+  }
+
+  // A capture cut short by the valve closing says nothing about the nozzle.
+  void valveClosed()
+  {
+    valveOpen = false;
+    capturing = false;
+  }
+
+  // Feed one raw sample. Returns true when it completed a capture, after
+  // which lastFeatures() and clogged() reflect the new data.
+  bool addSample(uint16_t sample)
+  {
+    binSum += sample;
+    if (++binSamples < config.samplesPerBin)
+    {
+      return false;
+    }
+    float bin = (float)binSum / binSamples;
+    resetBin();
+
+    if (!capturing)
+    {
+      // after a full capture the valve may still be open, and the flowing
+      // pressure must not pull the resting pressure down
+      if (!valveOpen)
+      {
+        restPressure = restKnown ? restPressure + config.restSmoothing * (bin - restPressure) : bin;
+        restKnown = true;
+      }
+      return false;
+    }
+
+    bins[binCount++] = bin;
+    if (binCount < captureBins)
+    {
+      return false;
+    }
+    capturing = false;
+    return restKnown && evaluateCapture();
+  }
+
+  const PressureFeatures &lastFeatures() const { return features; }
+  const PressureFeatures &baseline() const { return baselineFeatures; }
+  bool isLearning() const { return learned < config.learnCaptures; }
+  bool isCapturing() const { return capturing; }
+  bool clogged() const { return fault; }
+  uint32_t capturePeriodUs() const { return binPeriodUs() * captureBins; }
+
+  // Forget the learned baseline, e.g. after the nozzles have been cleaned.
+  void relearn()
+  {
+    learned = 0;
+    deviations = 0;
+    fault = false;
+    baselineFeatures = PressureFeatures();
+  }
+
+private:
+  uint32_t binPeriodUs() const { return config.samplePeriodUs * config.samplesPerBin; }
+
+  void resetBin()
+  {
+    binSum = 0;
+    binSamples = 0;
+  }
+
+  bool evaluateCapture()
+  {
+    float lowest = bins[0];
+    for (size_t i = 1; i < captureBins; i++)
+    {
+      if (bins[i] < lowest) lowest = bins[i];
+    }
+
+    // the tail of the window is taken as the settled flowing pressure
+    constexpr size_t tailBins = 8;
+    float settled = 0;
+    for (size_t i = captureBins - tailBins; i < captureBins; i++)
+    {
+      settled += bins[i];
+    }
+    settled /= tailBins;
+
+    features.restPressure = restPressure;
+    features.dropMagnitude = restPressure - lowest;
+    float band = features.dropMagnitude * config.settleBandFraction;
+    if (band < config.minSettleBand) band = config.minSettleBand;
+
+    size_t lastOutside = 0;
+    for (size_t i = 0; i < captureBins; i++)
+    {
+      float error = bins[i] - settled;
+      if (error > band || error < -band) lastOutside = i + 1;
+    }
+    features.settleTime = lastOutside * binPeriodUs();
+
+    if (isLearning())
+    {
+      learned++;
+      baselineFeatures.restPressure += (features.restPressure - baselineFeatures.restPressure) / learned;
+      baselineFeatures.dropMagnitude += (features.dropMagnitude - baselineFeatures.dropMagnitude) / learned;
+      baselineFeatures.settleTime += (features.settleTime - baselineFeatures.settleTime) / learned;
+      return true;
+    }
+
+    bool deviates =
+        features.dropMagnitude < config.minDrop ||
+        features.dropMagnitude < baselineFeatures.dropMagnitude * (1 - config.dropTolerance) ||
+        features.settleTime > baselineFeatures.settleTime * config.settleTolerance + binPeriodUs();
+    if (deviates)
+    {
+      if (deviations < config.faultAfter) deviations++;
+    }
+    else
+    {
+      deviations = 0;
+      // follow slow drift such as seasonal supply pressure changes
+      baselineFeatures.dropMagnitude += config.baselineSmoothing * (features.dropMagnitude - baselineFeatures.dropMagnitude);
+      baselineFeatures.settleTime += config.baselineSmoothing * (features.settleTime - baselineFeatures.settleTime);
+    }
+    fault = deviations >= config.faultAfter;
+    return true;
+  }
+
+  PressureMonitorConfig config;
+  float bins[captureBins];
+  size_t binCount = 0;
+  uint32_t binSum = 0;
+  uint16_t binSamples = 0;
+  bool valveOpen = false;
+  bool capturing = false;
+  float restPressure = 0;
+  bool restKnown = false;
+  PressureFeatures features;
+  PressureFeatures baselineFeatures;
+  uint8_t learned = 0;
+  uint8_t deviations = 0;
+  bool fault = false;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// Register map for remote control, served as Modbus holding registers (input
+// registers read the same values) and over the CAN fleet interface. The
+// registers themselves are RemoteRegisters in src/main.cpp.
+namespace remoteRegister
+{
+  enum : uint16_t
+  {
+    fanPercent,        // rw, requested fan speed
+    fanAppliedPercent, // r, after thermal, supply and power derating
+    mist,              // rw, 1 holds the valve open like a long press, 0 releases it
+    patternMode,       // r, 0 idle, 1 repeating pattern, 2 VPD control, 3 nozzle flush
+    patternOnSeconds,  // r, of the running repeating pattern
+    patternOffSeconds, // r
+    patternSelect,     // w, 0 stops, 2-5 start the button one click patterns, 6 VPD control
+    mistFraction,      // r, percent set with the encoder
+    vpd,               // r, Pa, 0xFFFF until measured
+    temperature,       // r, 0.1 C signed, 0xFFFF without a valid reading
+    supplyMillivolts,  // r
+    faults,            // r, bit 0 nozzle clog, 1 leak, 2 supply sagging, 3 supply critical; any write acknowledges
+    waterTotalHigh,    // r, ml since boot, high word first
+    waterTotalLow,
+    waterDayHigh,      // r, ml in the current day
+    waterDayLow,
+    stopAll,           // w, 1 cancels everything and turns mist and fan off
+    humidity,          // r, 0.1 %RH, 0xFFFF until measured
+    count
+  };
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytecode for user automations, compiled on the host by
+// tools/compileRules.py. A program is
+//
+//   magic, rule count, then per rule: length, code
+//
+// and each rule's code is a condition in postfix, `then`, actions, `end`.
+// The actions run once each time the condition turns true. There are no
+// jumps, so one evaluation of every rule runs each instruction at most
+// once, and load() proves the stack stays within bounds.
+//
+// Machine must provide int32_t read(uint8_t input) and
+// void write(uint8_t output, int32_t value).
+
+namespace rules
+{
+  constexpr uint8_t magic = 0xA7; // also the format version
+  constexpr size_t maxProgram = 256;
+  constexpr size_t maxRules = 16;
+  constexpr size_t maxStack = 8;
+
+  enum Op : uint8_t
+  {
+    push8 = 1, // int8 follows
+    push16,    // int16 follows, little endian
+    load,      // input id follows
+    add,
+    sub,
+    lt,
+    le,
+    gt,
+    ge,
+    eq,
+    ne,
+    both,      // logical and
+    either,    // logical or
+    negate,    // logical not
+    then,      // pops the condition
+    write,     // output id follows, pops the value
+    end
+  };
+
+  // Operand bytes following op, or -1 for an unknown op.
+  inline int operandBytes(uint8_t op)
+  {
+    if (op == push8 || op == load || op == write) return 1;
+    if (op == push16) return 2;
+    return op >= add && op <= end ? 0 : -1;
+  }
+}
+
+template <typename Machine>
+class RuleEngine
+{
+public:
+  // Checks the whole program first; an invalid one leaves the loaded
+  // program untouched.
+  bool load(const uint8_t *program, size_t length)
+  {
+    if (length < 2 || length > rules::maxProgram || program[0] != rules::magic) return false;
+    size_t count = program[1];
+    if (count > rules::maxRules) return false;
+    size_t offset = 2;
+    for (size_t rule = 0; rule < count; rule++)
+    {
+      if (offset >= length) return false;
+      size_t ruleLength = program[offset++];
+      if (offset + ruleLength > length || !validRule(program + offset, ruleLength)) return false;
+      offset += ruleLength;
+    }
+    if (offset != length) return false;
+
+    for (size_t i = 0; i < length; i++) code[i] = program[i];
+    codeLength = length;
+    ruleTotal = count;
+    for (size_t i = 0; i < rules::maxRules; i++) wasTrue[i] = false;
+    return true;
+  }
+
+  void clear()
+  {
+    codeLength = 0;
+    ruleTotal = 0;
+  }
+
+  size_t ruleCount() const { return ruleTotal; }
+  size_t programLength() const { return codeLength; }
+  const uint8_t *program() const { return code; }
+
+  // Evaluate every rule once. Returns the number of rules that fired.
+  size_t evaluate(Machine &machine)
+  {
+    size_t fired = 0;
+    size_t offset = 2;
+    for (size_t rule = 0; rule < ruleTotal; rule++)
+    {
+      size_t ruleLength = code[offset++];
+      if (run(machine, code + offset, rule)) fired++;
+      offset += ruleLength;
+    }
+    return fired;
+  }
+
+private:
+  // Simulates the stack depth; a valid rule never under- or overflows.
+  static bool validRule(const uint8_t *rule, size_t length)
+  {
+    size_t depth = 0;
+    bool condition = true;
+    for (size_t pc = 0; pc < length;)
+    {
+      uint8_t op = rule[pc];
+      int operands = rules::operandBytes(op);
+      if (operands < 0 || pc + 1 + operands > length) return false;
+      pc += 1 + operands;
+
+      if (op == rules::push8 || op == rules::push16 || op == rules::load)
+      {
+        if (++depth > rules::maxStack) return false;
+      }
+      else if (op == rules::negate)
+      {
+        if (depth < 1) return false;
+      }
+      else if (op == rules::then)
+      {
+        if (!condition || depth != 1) return false;
+        condition = false;
+        depth = 0;
+      }
+      else if (op == rules::write)
+      {
+        if (condition || depth < 1) return false;
+        depth--;
+      }
+      else if (op == rules::end)
+      {
+        return !condition && depth == 0 && pc == length;
+      }
+      else // binary
+      {
+        if (depth < 2) return false;
+        depth--;
+      }
+    }
+    return false; // no end
+  }
+
+  bool run(Machine &machine, const uint8_t *rule, size_t index)
+  {
+    int32_t stack[rules::maxStack];
+    size_t depth = 0;
+    for (size_t pc = 0;;)
+    {
+      uint8_t op = rule[pc++];
+      switch (op)
+      {
+      case rules::push8: stack[depth++] = (int8_t)rule[pc++]; break;
+      case rules::push16:
+        stack[depth++] = (int16_t)(rule[pc] | rule[pc + 1] << 8);
+        pc += 2;
+        break;
+      case rules::load: stack[depth++] = machine.read(rule[pc++]); break;
+      case rules::negate: stack[depth - 1] = !stack[depth - 1]; break;
+      case rules::then:
+      {
+        bool now = stack[--depth] != 0;
+        bool rising = now && !wasTrue[index];
+        wasTrue[index] = now;
+        if (!rising) return false;
+        break;
+      }
+      case rules::write:
+        machine.write(rule[pc++], stack[--depth]);
+        break;
+      case rules::end: return true;
+      default:
+      {
+        int32_t b = stack[--depth];
+        int32_t &a = stack[depth - 1];
+        switch (op)
+        {
+        case rules::add: a = (int32_t)((uint32_t)a + (uint32_t)b); break; // wraps instead of overflowing
+        case rules::sub: a = (int32_t)((uint32_t)a - (uint32_t)b); break;
+        case rules::lt: a = a < b; break;
+        case rules::le: a = a <= b; break;
+        case rules::gt: a = a > b; break;
+        case rules::ge: a = a >= b; break;
+        case rules::eq: a = a == b; break;
+        case rules::ne: a = a != b; break;
+        case rules::both: a = a && b; break;
+        case rules::either: a = a || b; break;
+        }
+        break;
+      }
+      }
+    }
+  }
+
+  uint8_t code[rules::maxProgram];
+  size_t codeLength = 0;
+  size_t ruleTotal = 0;
+  bool wasTrue[rules::maxRules] = {};
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "jsonStream.h"
+
+// The settings that can be changed at runtime, and their JSON form:
+//
+//   {
+//     "patterns": [{"on": 1000, "off": 30000}, ...],   button one, 2 to 5 clicks
+//     "delays": {"fanMinimum": ms, "timeout": ms, "sleep": ms, "fanMinimumPercent": %},
+//     "vpd": {"target": Pa, "kp": .., "ki": .., "maxDuty": permille, "humidBand": Pa, "fanMin": %}
+//   }
+//
+// Documents may leave out anything that should stay as it is. ConfigReader
+// checks every value against its range while parsing into a staged copy;
+// the caller applies that copy only if the whole document was accepted.
+
+constexpr size_t configPatternCount = 4;
+
+struct PatternTiming
+{
+  int32_t on;  // ms
+  int32_t off; // ms
+};
+
+struct RuntimeConfig
+{
+  PatternTiming patterns[configPatternCount];
+  int32_t fanMinimumDelay;
+  int32_t timeoutDelay;
+  int32_t sleepDelay;
+  int32_t fanMinimumPercent;
+  int32_t vpdTargetPa;
+  int32_t vpdKp;
+  int32_t vpdKi;
+  int32_t vpdMaxDutyPermille;
+  int32_t vpdHumidBandPa;
+  int32_t vpdFanMinPercent;
+};
+
+namespace config
+{
+  struct Field
+  {
+    const char *section;
+    const char *name;
+    int32_t RuntimeConfig::*member;
+    int32_t min;
+    int32_t max;
+  };
+
+  constexpr int32_t day = 24L * 60 * 60 * 1000;
+
+  const Field fields[] = {
+      {"delays", "fanMinimum", &RuntimeConfig::fanMinimumDelay, 60000, day},
+      {"delays", "timeout", &RuntimeConfig::timeoutDelay, 60000, day},
+      {"delays", "sleep", &RuntimeConfig::sleepDelay, 60000, day},
+      {"delays", "fanMinimumPercent", &RuntimeConfig::fanMinimumPercent, 0, 100},
+      {"vpd", "target", &RuntimeConfig::vpdTargetPa, 200, 3000},
+      {"vpd", "kp", &RuntimeConfig::vpdKp, 0, 5000},
+      {"vpd", "ki", &RuntimeConfig::vpdKi, 0, 1000},
+      {"vpd", "maxDuty", &RuntimeConfig::vpdMaxDutyPermille, 1, 1000},
+      {"vpd", "humidBand", &RuntimeConfig::vpdHumidBandPa, 0, 2000},
+      {"vpd", "fanMin", &RuntimeConfig::vpdFanMinPercent, 0, 100},
+  };
+  constexpr size_t fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+  struct PatternField
+  {
+    const char *name;
+    int32_t PatternTiming::*member;
+    int32_t min;
+    int32_t max;
+  };
+
+  const PatternField patternFields[] = {
+      {"on", &PatternTiming::on, 100, 60000},
+      {"off", &PatternTiming::off, 1000, 60L * 60 * 1000},
+  };
+
+  constexpr const char *patternsSection = "patterns";
+
+  // Checks across fields, once the whole document is in.
+  inline bool consistent(const RuntimeConfig &config)
+  {
+    return config.fanMinimumDelay < config.timeoutDelay && config.timeoutDelay < config.sleepDelay;
+  }
+}
+
+// JsonReader handler that parses a document into a staged configuration.
+class ConfigReader
+{
+public:
+  explicit ConfigReader(RuntimeConfig &staged) : staged(staged) {}
+
+  // Start over from base; anything the document leaves out keeps its value.
+  void reset(const RuntimeConfig &base)
+  {
+    staged = base;
+    depth = 0;
+    section = nullptr;
+    inPatterns = false;
+    patternIndex = -1;
+    target = nullptr;
+  }
+
+  bool beginObject()
+  {
+    bool allowed = depth == 0 || (depth == 1 && section != nullptr && section != config::patternsSection) ||
+                   (depth == 2 && inPatterns && ++patternIndex < (int)configPatternCount);
+    depth++;
+    return allowed && target == nullptr;
+  }
+
+  bool endObject()
+  {
+    depth--;
+    if (depth == 1 && !inPatterns) section = nullptr;
+    return true;
+  }
+
+  bool beginArray()
+  {
+    if (depth != 1 || section != config::patternsSection) return false;
+    inPatterns = true;
+    depth++;
+    return true;
+  }
+
+  bool endArray()
+  {
+    depth--;
+    inPatterns = false;
+    section = nullptr;
+    return true;
+  }
+
+  bool key(const char *name)
+  {
+    if (depth == 1)
+    {
+      if (strcmp(name, config::patternsSection) == 0)
+      {
+        section = config::patternsSection;
+        patternIndex = -1;
+        return true;
+      }
+      for (size_t i = 0; i < config::fieldCount; i++)
+      {
+        if (strcmp(name, config::fields[i].section) == 0)
+        {
+          section = config::fields[i].section;
+          return true;
+        }
+      }
+      return false;
+    }
+    if (depth == 2 && !inPatterns)
+    {
+      for (size_t i = 0; i < config::fieldCount; i++)
+      {
+        const config::Field &field = config::fields[i];
+        if (strcmp(field.section, section) == 0 && strcmp(name, field.name) == 0)
+        {
+          target = &(staged.*field.member);
+          min = field.min;
+          max = field.max;
+          return true;
+        }
+      }
+      return false;
+    }
+    if (depth == 3 && inPatterns)
+    {
+      for (const config::PatternField &field : config::patternFields)
+      {
+        if (strcmp(name, field.name) == 0)
+        {
+          target = &(staged.patterns[patternIndex].*field.member);
+          min = field.min;
+          max = field.max;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  bool number(int32_t value)
+  {
+    if (target == nullptr || value < min || value > max) return false;
+    *target = value;
+    target = nullptr;
+    return true;
+  }
+
+  bool string(const char *) { return false; }
+  bool boolean(bool) { return false; }
+  bool null() { return false; }
+
+  bool consistent() const { return config::consistent(staged); }
+
+private:
+  RuntimeConfig &staged;
+  int depth = 0;
+  const char *section = nullptr;
+  bool inPatterns = false;
+  int patternIndex = -1;
+  int32_t *target = nullptr; // field named by the last key, waiting for its value
+  int32_t min = 0;
+  int32_t max = 0;
+};
+
+// One document upload: parsed into a copy of base as the chunks arrive and
+// handed out only once it is complete and valid, so a rejected or abandoned
+// upload changes nothing.
+class ConfigUpload
+{
+public:
+  ConfigUpload() : staged(), reader(staged), json(reader) {}
+
+  void begin(const RuntimeConfig &base)
+  {
+    reader.reset(base);
+    json.reset();
+    accepted = false;
+  }
+
+  bool feed(const char *data, size_t length) { return json.feed(data, length); }
+
+  // After the last chunk; true if result() may be applied.
+  bool finish()
+  {
+    accepted = json.finish() && reader.consistent();
+    return accepted;
+  }
+
+  bool valid() const { return accepted; }
+  const RuntimeConfig &result() const { return staged; }
+  json::Error error() const { return json.error(); }
+  size_t position() const { return json.position(); }
+
+private:
+  RuntimeConfig staged;
+  ConfigReader reader;
+  JsonReader<ConfigReader> json;
+  bool accepted = false;
+};
+
+template <typename Sink>
+void writeConfig(JsonWriter<Sink> &writer, const RuntimeConfig &config)
+{
+  writer.beginObject();
+  writer.key(config::patternsSection);
+  writer.beginArray();
+  for (const PatternTiming &pattern : config.patterns)
+  {
+    writer.beginObject();
+    for (const config::PatternField &field : config::patternFields)
+    {
+      writer.key(field.name);
+      writer.number(pattern.*field.member);
+    }
+    writer.endObject();
+  }
+  writer.endArray();
+
+  const char *section = nullptr;
+  for (size_t i = 0; i < config::fieldCount; i++)
+  {
+    const config::Field &field = config::fields[i];
+    if (section == nullptr || strcmp(field.section, section) != 0)
+    {
+      if (section != nullptr) writer.endObject();
+      section = field.section;
+      writer.key(section);
+      writer.beginObject();
+    }
+    writer.key(field.name);
+    writer.number(config.*field.member);
+  }
+  if (section != nullptr) writer.endObject();
+  writer.endObject();
+}
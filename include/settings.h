@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "powerBudget.h"
+#include "thermalPolicy.h"
+
+// Settings of the control logic in include/controller.h, shared by the
+// firmware and the host tools that simulate it. The hardware settings (pins,
+// peripherals, polling intervals) are in src/main.cpp, in the same
+// namespaces.
+
+namespace settings
+{
+  constexpr bool debug = false;
+
+  namespace encoder
+  {
+    constexpr int fanMinRunning = 70;               // % the fan needs to spin, stepping below turns it off
+    constexpr int maxMistPercent = 50;              // % of the mist period
+    constexpr size_t mistPeriod = 30000;            // ms, mist fraction is applied as on/off within this
+    constexpr unsigned long mistSettle = 750;       // ms without turning before a new mist fraction is applied
+  }
+
+  namespace occupancy
+  {
+    constexpr int vacantFanPercent = 70;            // fan is lowered to this while vacant
+  }
+
+  namespace delays
+  {
+    // if no buttons are pressed for this long...
+    constexpr unsigned long fanMinimum = 1 * 60 * 60 * 1000; // ...the fan is turned down to its minimum
+    constexpr unsigned long timeout = 2 * 60 * 60 * 1000;    // ...mist patterns are stopped
+    constexpr unsigned long sleep = 3 * 60 * 60 * 1000;      // ...the fan is turned off and the unit sleeps
+                                                             // until a button or the PIR wakes it
+    constexpr int fanMinimumPercent = 70;
+  }
+
+  namespace power
+  {
+    constexpr uint16_t steadyBudgetMa = 1500;         // what the adapter delivers continuously
+    constexpr uint16_t peakBudgetMa = 3000;           // short peaks before the rail droops
+    constexpr PowerLoad fan = {1200, 1800, 40};       // spin-up surge on a speed increase
+    constexpr PowerLoad valve = {400, 600, 15};       // coil pull-in
+  }
+
+  namespace supply
+  {
+    constexpr uint32_t sagBelowMv = 11000;             // 12 V rail
+    constexpr uint32_t sagReleaseMv = 11400;
+    constexpr uint32_t criticalBelowMv = 10200;
+    constexpr uint32_t criticalReleaseMv = 10600;
+    constexpr int saggingFanPercent = 70;              // fan cap while the rail sags...
+    constexpr int criticalFanPercent = 0;
+    constexpr unsigned long recoveryHold = 10000;      // ms, ...and this long after it is back
+  }
+
+  namespace thermal
+  {
+    constexpr float freezeBelow = 2.0;             // C, misting is blocked below this...
+    constexpr float freezeRelease = 4.0;           // C, ...until it warms up past this
+    constexpr float derateHysteresis = 2.0;        // C of cooling before fan derating is relaxed
+    constexpr ThermalCurvePoint fanCurve[] = {
+        {40.0, 100}, // full speed up to 40C
+        {50.0, 85},
+        {60.0, 70}, // fans stall below ~70% duty, so never derate further
+    };
+  }
+
+  namespace climate
+  {
+    constexpr unsigned long staleAfter = 30000;     // ms, VPD control pauses on older readings
+    constexpr unsigned long vpdCycle = 30000;       // ms, mist duty is applied once per cycle
+  }
+
+  namespace purge
+  {
+    constexpr unsigned long flushInterval = 6 * 60 * 60 * 1000; // ms between nozzle flushes, 0 disables them
+    constexpr unsigned long flushRetry = 60 * 1000;             // ms, a flush that is due while misting waits this long
+    constexpr size_t flushPulseOn = 200;                        // ms, short pulses at full line pressure
+    constexpr size_t flushPulseOff = 300;
+    constexpr uint8_t flushPulses = 5;
+    constexpr int dryingFanPercent = 80;                        // fan speed while drying after a session
+    constexpr unsigned long dryingDuration = 5 * 60 * 1000;     // ms, 0 turns the fan off immediately
+  }
+}
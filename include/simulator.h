@@ -0,0 +1,539 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "controller.h"
+#include "crashRecord.h"
+
+// Host only: runs the Controller against a simulated clock, for the scenario
+// tests in test/test_scenarios, tools/simulate.cpp and tools/sweep.cpp. Time
+// skips from one deadline to the next instead of passing, so days of use
+// take milliseconds. Each Simulation owns everything it touches; any number
+// of them can run side by side, one per thread.
+
+struct SimMetrics
+{
+  uint64_t mistMs = 0;
+  uint32_t valveCycles = 0;  // openings
+  uint64_t fanPercentMs = 0; // fan percent integrated over time
+  uint64_t awakeMs = 0;
+  uint64_t asleepMs = 0;
+  uint32_t peakMa = 0;       // highest supply current, inrush included
+  uint32_t peakSteadyMa = 0; // highest supply current without inrush
+
+  void add(const SimMetrics &other)
+  {
+    mistMs += other.mistMs;
+    valveCycles += other.valveCycles;
+    fanPercentMs += other.fanPercentMs;
+    awakeMs += other.awakeMs;
+    asleepMs += other.asleepMs;
+    if (other.peakMa > peakMa) peakMa = other.peakMa;
+    if (other.peakSteadyMa > peakSteadyMa) peakSteadyMa = other.peakSteadyMa;
+  }
+};
+
+// The Hal of a simulated unit: outputs go into the metrics, the trace
+// events into a list, and sleep() lasts until wakeAt. The supply current is
+// modelled from settings::power on its own, not from the controller's
+// PowerBudget, so the metrics show what the budget actually achieves.
+struct SimHal
+{
+  explicit SimHal(uint32_t start = 0) : clock(start), wakeAt(start), accountedAt(start) {}
+
+  uint32_t clock;
+  uint32_t wakeAt; // the next outside event, a button or the PIR
+  bool recording = true;
+  std::vector<TraceEvent> events;
+  SimMetrics metrics;
+
+  uint32_t now() { return clock; }
+
+  void writeMist(bool state)
+  {
+    account();
+    if (state && !mist)
+    {
+      metrics.valveCycles++;
+      valveStartedAt = clock;
+      valveStarted = true;
+    }
+    mist = state;
+    measureCurrent();
+  }
+
+  void writeFanPercent(int percent)
+  {
+    account();
+    if (percent > fanPercent)
+    {
+      fanStartedAt = clock;
+      fanStarted = true;
+      fanStep = percent - fanPercent;
+    }
+    fanPercent = percent;
+    measureCurrent();
+  }
+
+  // Supply current now: each load's steady draw at its level, plus its
+  // inrush for the window after it was switched on or stepped up. The fan's
+  // surge grows with the speed step; PowerBudget assumes the full surge for
+  // any step.
+  uint32_t currentMa(bool withInrush = true) const
+  {
+    const PowerLoad &fan = settings::power::fan;
+    const PowerLoad &valve = settings::power::valve;
+    uint32_t total = (uint32_t)fan.steadyMa * fanPercent / 100 + (mist ? valve.steadyMa : 0);
+    if (!withInrush) return total;
+    if (fanStarted && clock - fanStartedAt < fan.inrushMs) total += (uint32_t)fan.inrushMa * fanStep / 100;
+    if (valveStarted && mist && clock - valveStartedAt < valve.inrushMs) total += valve.inrushMa;
+    return total;
+  }
+
+  void trace(uint16_t code, int16_t value)
+  {
+    if (recording) events.push_back({clock, code, value});
+  }
+
+  void confirm(uint8_t) {}
+  void modeChanged() {}
+  void mistSessionStarted() {}
+  void mistSessionEnded() {}
+  void acknowledgeFaults() {}
+  void buttonEvent(int, int) {}
+  void log(const char *, ...) {}
+
+  // The outputs are off by now, see Controller::sleepUntilWoken().
+  void sleep()
+  {
+    account();
+    int32_t asleep = (int32_t)(wakeAt - clock);
+    if (asleep <= 0) return;
+    metrics.asleepMs += asleep;
+    clock = wakeAt;
+    accountedAt = clock;
+  }
+
+  // Adds the time since the last output change to the metrics.
+  void account()
+  {
+    uint32_t elapsed = clock - accountedAt;
+    if (mist) metrics.mistMs += elapsed;
+    metrics.fanPercentMs += (uint64_t)fanPercent * elapsed;
+    metrics.awakeMs += elapsed;
+    accountedAt = clock;
+  }
+
+private:
+  // The draw only rises at an output change, so checking right after each
+  // one finds every peak.
+  void measureCurrent()
+  {
+    if (currentMa() > metrics.peakMa) metrics.peakMa = currentMa();
+    if (currentMa(false) > metrics.peakSteadyMa) metrics.peakSteadyMa = currentMa(false);
+  }
+
+  bool mist = false;
+  int fanPercent = 0;
+  uint32_t accountedAt;
+  uint32_t fanStartedAt = 0;
+  uint32_t valveStartedAt = 0;
+  int fanStep = 0; // percent, of the last speed-up
+  bool fanStarted = false;
+  bool valveStarted = false;
+};
+
+// A supply with source resistance: the rail droops by the load current,
+// SimHal::currentMa(), times the resistance. Read every readingMs through a
+// SupplyMonitor with the firmware thresholds, one sample per reading.
+struct SimSupply
+{
+  static constexpr uint32_t readingMs = 10; // like samplesPerBlock in src/main.cpp
+
+  SimSupply(uint32_t openCircuitMv = 12000, uint32_t sourceMilliohms = 0)
+      : openCircuitMv(openCircuitMv), sourceMilliohms(sourceMilliohms),
+        monitor({1, 1000, settings::supply::sagBelowMv, settings::supply::sagReleaseMv,
+                 settings::supply::criticalBelowMv, settings::supply::criticalReleaseMv})
+  {
+  }
+
+  uint32_t railMv(const SimHal &hal) const
+  {
+    uint32_t drop = (uint64_t)hal.currentMa() * sourceMilliohms / 1000;
+    return drop < openCircuitMv ? openCircuitMv - drop : 0;
+  }
+
+  uint32_t openCircuitMv;
+  uint32_t sourceMilliohms;
+  SupplyMonitor monitor;
+  uint32_t lowestMv = UINT32_MAX;
+};
+
+// The encoder's pulse counter unit as encoderSetup() in src/main.cpp sets it
+// up: both channels count the edges of one quadrature signal, with the other
+// one as the direction, which gives 4 counts per cycle. Both inputs pass a
+// glitch filter that drops any level lasting less than filterCycles, and the
+// counter resets to 0 when it reaches +-limit. Time is in APB cycles, like
+// the filter length.
+struct SimPulseCounter
+{
+  static constexpr uint32_t cyclesPerUs = 80;
+
+  SimPulseCounter(uint16_t filterCycles, int16_t limit) : filterCycles(filterCycles), limit(limit) {}
+
+  // The encoder's outputs change to a and b at `at`.
+  void drive(bool a, bool b, uint64_t at)
+  {
+    settle(at);
+    setInput(inputs[0], a, at);
+    setInput(inputs[1], b, at);
+  }
+
+  // The counter as pcnt_get_counter_value() reads it.
+  int16_t read(uint64_t at)
+  {
+    settle(at);
+    return count;
+  }
+
+  uint32_t glitches = 0; // levels the filter dropped
+
+private:
+  struct Input
+  {
+    bool raw = false;   // at the pin
+    bool level = false; // past the filter
+    uint64_t since = 0; // raw level since
+  };
+
+  void setInput(Input &input, bool raw, uint64_t at)
+  {
+    if (raw == input.raw) return;
+    if (input.raw != input.level) glitches++; // back before the filter let it through
+    input.raw = raw;
+    input.since = at;
+  }
+
+  // Lets through every level that has lasted the filter length by `at`, in
+  // the order they did.
+  void settle(uint64_t at)
+  {
+    for (;;)
+    {
+      int next = -1;
+      for (int i = 0; i < 2; i++)
+      {
+        const Input &input = inputs[i];
+        if (input.raw == input.level || input.since + filterCycles > at) continue;
+        if (next < 0 || input.since < inputs[next].since) next = i;
+      }
+      if (next < 0) return;
+      inputs[next].level = inputs[next].raw;
+      edge(next);
+    }
+  }
+
+  // Channel 0 counts down on A's rising edges and up on its falling ones,
+  // channel 1 the other way round on B; a low control input reverses either.
+  void edge(int channel)
+  {
+    int step = inputs[channel].level ? 1 : -1;
+    if (channel == 0) step = -step;
+    if (!inputs[1 - channel].level) step = -step;
+    count += step;
+    if (count >= limit || count <= -limit) count = 0;
+  }
+
+  uint16_t filterCycles;
+  int16_t limit;
+  Input inputs[2];
+  int16_t count = 0;
+};
+
+class Simulation
+{
+public:
+  explicit Simulation(uint32_t start = 0) : hal(start), controller(hal) {}
+
+  // From now on the rail is read every SimSupply::readingMs and its state
+  // changes go to the controller, the way the firmware's ADC monitor does.
+  // Without a supply the rail is stiff and never read. Connecting again
+  // changes the supply under the same monitor.
+  void connectSupply(uint32_t openCircuitMv, uint32_t sourceMilliohms)
+  {
+    if (!supplyConnected) nextReadingAt = hal.clock;
+    supply.openCircuitMv = openCircuitMv;
+    supply.sourceMilliohms = sourceMilliohms;
+    supplyConnected = true;
+  }
+
+  // What setup() does: fan on, nothing misting.
+  void powerOn()
+  {
+    controller.begin();
+    controller.fanOn();
+    controller.tick();
+  }
+
+  // Runs every deadline up to until, then one pass at until. A unit that
+  // goes to sleep on the way wakes at until, where the next outside event is.
+  void runUntil(uint32_t until)
+  {
+    hal.wakeAt = until;
+    uint32_t at;
+    while (nextStep(at) && (int32_t)(at - until) <= 0)
+    {
+      hal.clock = at;
+      readSupply();
+      controller.tick();
+    }
+    if ((int32_t)(until - hal.clock) > 0) hal.clock = until;
+    readSupply();
+    controller.tick();
+  }
+
+  // Brings the metrics up to the current time.
+  const SimMetrics &metrics()
+  {
+    hal.account();
+    return hal.metrics;
+  }
+
+  SimHal hal;
+  Controller<SimHal> controller;
+  SimSupply supply;
+
+private:
+  // The next controller deadline or supply reading, whichever comes first.
+  bool nextStep(uint32_t &at) const
+  {
+    bool found = controller.nextDeadline(at);
+    if (!supplyConnected) return found;
+    uint32_t reading = (int32_t)(nextReadingAt - hal.clock) > 0 ? nextReadingAt : hal.clock;
+    if (!found || (int32_t)(reading - at) < 0) at = reading;
+    return true;
+  }
+
+  void readSupply()
+  {
+    if (!supplyConnected || (int32_t)(hal.clock - nextReadingAt) < 0) return;
+    nextReadingAt = hal.clock + SimSupply::readingMs;
+    uint32_t millivolts = supply.railMv(hal);
+    if (millivolts < supply.lowestMv) supply.lowestMv = millivolts;
+    if (supply.monitor.addSample(millivolts, hal.clock)) controller.supplyChanged(supply.monitor.currentState());
+  }
+
+  bool supplyConnected = false;
+  uint32_t nextReadingAt = 0;
+};
+
+// Scenario files list outside events, one per line, at ms since power on:
+//
+//   1000 click 1 3        button, clicks
+//   5000 hold 1           long press starts
+//   8000 release 1
+//   9000 turn -5          encoder steps
+//   9500 vacant           and occupied
+//   9600 temperature 1.5  C
+//   9700 climate 1800 450 VPD in Pa, humidity in 0.1 %
+//   9800 supply sagging   normal, sagging or critical
+//   9900 rail 12000 500   open circuit mV and source mOhm, see SimSupply
+//   60000 end             the simulation stops here
+//
+// Lines are in time order and may contain # comments.
+namespace scenario
+{
+  enum Action : uint8_t
+  {
+    click,
+    hold,
+    release,
+    turn,
+    vacant,
+    occupied,
+    temperature,
+    climate,
+    supply,
+    rail,
+    end
+  };
+
+  struct ActionName
+  {
+    const char *name;
+    Action action;
+    int arguments;
+  };
+
+  const ActionName actions[] = {
+      {"click", click, 2},
+      {"hold", hold, 1},
+      {"release", release, 1},
+      {"turn", turn, 1},
+      {"vacant", vacant, 0},
+      {"occupied", occupied, 0},
+      {"temperature", temperature, 1},
+      {"climate", climate, 2},
+      {"supply", supply, 1},
+      {"rail", rail, 2},
+      {"end", end, 0},
+  };
+
+  const char *const supplyStates[] = {"normal", "sagging", "critical"};
+
+  struct Step
+  {
+    uint32_t at;
+    Action action;
+    double arguments[2];
+  };
+
+  // Parses one line into step; false with a message in error if it is not
+  // a step, true with empty set for a blank or comment line.
+  inline bool parse(const char *line, Step &step, bool &empty, std::string &error)
+  {
+    char text[128];
+    size_t length = strcspn(line, "#\r\n");
+    if (length >= sizeof(text))
+    {
+      error = "line too long";
+      return false;
+    }
+    memcpy(text, line, length);
+    text[length] = '\0';
+
+    char name[16], first[16], second[16];
+    unsigned long at;
+    int fields = sscanf(text, "%lu %15s %15s %15s", &at, name, first, second);
+    empty = fields <= 0;
+    if (empty) return true;
+    for (const ActionName &action : actions)
+    {
+      if (fields < 2 || strcmp(name, action.name) != 0) continue;
+      if (fields - 2 != action.arguments)
+      {
+        error = std::string(action.name) + " takes " + std::to_string(action.arguments) + " arguments";
+        return false;
+      }
+      step.at = at;
+      step.action = action.action;
+      if (action.action == supply)
+      {
+        for (size_t i = 0; i < sizeof(supplyStates) / sizeof(supplyStates[0]); i++)
+        {
+          if (strcmp(first, supplyStates[i]) == 0)
+          {
+            step.arguments[0] = i;
+            return true;
+          }
+        }
+        error = std::string("unknown supply state ") + first;
+        return false;
+      }
+      step.arguments[0] = action.arguments > 0 ? atof(first) : 0;
+      step.arguments[1] = action.arguments > 1 ? atof(second) : 0;
+      return true;
+    }
+    error = "expected <ms> <action> [arguments]";
+    return false;
+  }
+
+  // Reads a scenario that ends with an end step.
+  inline bool read(const char *path, std::vector<Step> &steps, std::string &error)
+  {
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+    {
+      error = std::string(path) + ": cannot open";
+      return false;
+    }
+    char line[256];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file))
+    {
+      number++;
+      Step step;
+      bool empty;
+      std::string message;
+      if (!parse(line, step, empty, message))
+      {
+        error = std::string(path) + ":" + std::to_string(number) + ": " + message;
+        ok = false;
+      }
+      else if (!empty && !steps.empty() && step.at < steps.back().at)
+      {
+        error = std::string(path) + ":" + std::to_string(number) + ": steps must be in time order";
+        ok = false;
+      }
+      else if (!empty) steps.push_back(step);
+    }
+    fclose(file);
+    if (ok && (steps.empty() || steps.back().action != end))
+    {
+      error = std::string(path) + ": the last step must be end";
+      ok = false;
+    }
+    return ok;
+  }
+
+  inline void apply(Simulation &simulation, const Step &step)
+  {
+    Controller<SimHal> &controller = simulation.controller;
+    int first = (int)step.arguments[0];
+    switch (step.action)
+    {
+    case click:
+      controller.clicked(first, (int)step.arguments[1]);
+      break;
+    case hold:
+      controller.longPressStarted(first);
+      controller.longPressed(first);
+      break;
+    case release:
+      controller.longPressStopped(first);
+      break;
+    case turn:
+      controller.encoderTurned(first);
+      break;
+    case vacant:
+      controller.suspendForVacancy();
+      break;
+    case occupied:
+      controller.resumeForOccupancy();
+      break;
+    case temperature:
+      controller.temperatureMeasured((float)step.arguments[0]);
+      break;
+    case climate:
+      controller.climateMeasured(first, (int32_t)step.arguments[1]);
+      break;
+    case supply:
+      controller.supplyChanged((SupplyMonitor::State)first);
+      break;
+    case rail:
+      simulation.connectSupply(first, (uint32_t)step.arguments[1]);
+      break;
+    case end:
+      break;
+    }
+  }
+
+  // Powers the unit on at 0 and plays the steps, each followed by a loop()
+  // pass the way the firmware handles callbacks.
+  inline void play(Simulation &simulation, const std::vector<Step> &steps)
+  {
+    simulation.powerOn();
+    for (const Step &step : steps)
+    {
+      simulation.runUntil(step.at);
+      apply(simulation, step);
+      simulation.controller.tick();
+    }
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Supply rail supervision. Raw ADC samples of the divided-down rail are
+// averaged into blocks and classified as normal, sagging or critical, each
+// threshold with its own release level so a rail hovering at a limit does
+// not flap. Every state change is kept in a small event log.
+
+struct SupplyMonitorConfig
+{
+  uint16_t samplesPerBlock;   // raw samples averaged per reading
+  uint32_t microvoltsPerCount; // ADC scale including the divider
+  uint32_t sagBelowMv;        // readings below this shed load...
+  uint32_t sagReleaseMv;      // ...until they recover above this
+  uint32_t criticalBelowMv;
+  uint32_t criticalReleaseMv;
+};
+
+class SupplyMonitor
+{
+public:
+  enum State : uint8_t
+  {
+    normal,
+    sagging,
+    critical
+  };
+
+  struct Event
+  {
+    uint32_t at;        // ms
+    uint16_t millivolts;
+    State state;
+  };
+
+  static constexpr size_t logSize = 16;
+
+  explicit SupplyMonitor(const SupplyMonitorConfig &config) : config(config) {}
+
+  // Feed one raw sample. Returns true when it completed a block that changed
+  // the state; the new event is then the last one in the log.
+  bool addSample(uint16_t sample, uint32_t now)
+  {
+    blockSum += sample;
+    if (++blockSamples < config.samplesPerBlock) return false;
+    millivolts = (uint64_t)blockSum * config.microvoltsPerCount / blockSamples / 1000;
+    blockSum = 0;
+    blockSamples = 0;
+
+    State next;
+    if (millivolts < config.criticalBelowMv) next = critical;
+    else if (state == critical && millivolts < config.criticalReleaseMv) next = critical;
+    else if (millivolts < config.sagBelowMv) next = sagging;
+    else if (state != normal && millivolts < config.sagReleaseMv) next = sagging;
+    else next = normal;
+
+    if (next == state) return false;
+    state = next;
+    log[logHead] = {now, (uint16_t)millivolts, state};
+    logHead = (logHead + 1) % logSize;
+    if (logCount < logSize) logCount++;
+    return true;
+  }
+
+  State currentState() const { return state; }
+  uint32_t lastMillivolts() const { return millivolts; }
+
+  // Events oldest first, index < eventCount().
+  size_t eventCount() const { return logCount; }
+  const Event &event(size_t index) const { return log[(logHead + logSize - logCount + index) % logSize]; }
+
+private:
+  SupplyMonitorConfig config;
+  uint32_t blockSum = 0;
+  uint16_t blockSamples = 0;
+  uint32_t millivolts = 0;
+  State state = normal;
+  Event log[logSize];
+  size_t logHead = 0;
+  size_t logCount = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ambient temperature policy: blocks misting near freezing and caps fan duty
+// in a hot enclosure. Both decisions use hysteresis so a reading hovering
+// around a threshold does not make the outputs chatter.
+
+struct ThermalCurvePoint
+{
+  float temperature; // degrees C
+  int maxPercent;    // highest fan duty allowed at this temperature
+};
+
+struct ThermalPolicyConfig
+{
+  float freezeBelow;               // mist is blocked below this...
+  float freezeRelease;             // ...until the temperature rises above this
+  float derateHysteresis;          // cooling needed before a derate is relaxed
+  const ThermalCurvePoint *curve;  // ascending temperatures
+  size_t curvePoints;
+};
+
+class ThermalPolicy
+{
+public:
+  explicit ThermalPolicy(const ThermalPolicyConfig &config) : config(config) {}
+
+  // Feed a new ambient reading taken at now (ms). Returns true if either
+  // decision changed.
+  bool update(float temperature, uint32_t now)
+  {
+    bool wasAllowed = mistAllowed();
+    int previousLimit = fanLimitPercent();
+
+    if (!known)
+    {
+      frozen = temperature < config.freezeRelease;
+      derateTemperature = temperature;
+      known = true;
+    }
+    else
+    {
+      if (temperature < config.freezeBelow) frozen = true;
+      else if (temperature > config.freezeRelease) frozen = false;
+
+      if (temperature > derateTemperature) derateTemperature = temperature;
+      else if (temperature < derateTemperature - config.derateHysteresis) derateTemperature = temperature + config.derateHysteresis;
+    }
+    lastTemperature = temperature;
+    readAt = now;
+
+    return wasAllowed != mistAllowed() || previousLimit != fanLimitPercent();
+  }
+
+  // Forget a reading older than maxAge, so a sensor that dropped off does not
+  // hold its last decision (a frost lockout, say) for good; the policy then
+  // behaves as without a sensor. Returns true if either decision changed.
+  bool expire(uint32_t now, uint32_t maxAge)
+  {
+    if (!known || now - readAt <= maxAge) return false;
+    bool wasAllowed = mistAllowed();
+    int previousLimit = fanLimitPercent();
+    known = false;
+    frozen = false;
+    return wasAllowed != mistAllowed() || previousLimit != fanLimitPercent();
+  }
+
+  // Without a reading nothing is restricted, a missing sensor must not brick the unit.
+  bool mistAllowed() const { return !known || !frozen; }
+
+  int fanLimitPercent() const
+  {
+    if (!known || config.curvePoints == 0) return 100;
+    const ThermalCurvePoint *curve = config.curve;
+    if (derateTemperature <= curve[0].temperature) return curve[0].maxPercent;
+    for (size_t i = 1; i < config.curvePoints; i++)
+    {
+      if (derateTemperature <= curve[i].temperature)
+      {
+        float fraction = (derateTemperature - curve[i - 1].temperature) / (curve[i].temperature - curve[i - 1].temperature);
+        return curve[i - 1].maxPercent + (int)(fraction * (curve[i].maxPercent - curve[i - 1].maxPercent));
+      }
+    }
+    return curve[config.curvePoints - 1].maxPercent;
+  }
+
+  int filterFanPercent(int percent) const
+  {
+    int limit = fanLimitPercent();
+    return percent > limit ? limit : percent;
+  }
+
+  bool hasReading() const { return known; }
+  float temperature() const { return lastTemperature; }
+
+  // Signed tenths of a degree as the remote registers carry it, 0xFFFF
+  // without a valid reading. -0.1 C would read as no reading, so it goes
+  // out as -0.2 C.
+  uint16_t temperatureRegister() const
+  {
+    if (!known) return 0xFFFF;
+    int16_t tenths = lastTemperature * 10;
+    return tenths == -1 ? (uint16_t)-2 : (uint16_t)tenths;
+  }
+
+private:
+  ThermalPolicyConfig config;
+  bool known = false;
+  bool frozen = false;
+  float derateTemperature = 0;
+  float lastTemperature = 0;
+  uint32_t readAt = 0;
+};
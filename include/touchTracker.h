@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+// Baseline and threshold tracking for one capacitive touch channel. On the
+// S2 a touch raises the reading; the untouched level drifts slowly with
+// temperature and humidity, which matters on a misting unit. The baseline
+// follows that drift only while the pad is released, and the touch threshold
+// is kept as a fixed fraction above it.
+//
+// On the chip the hardware compares against the threshold and raises
+// interrupts, and the tracker is only fed occasional smoothed readings to
+// re-tune it. update() also does the comparison in software, with hysteresis,
+// for simulated readings.
+
+struct TouchTrackerConfig
+{
+  float thresholdRatio = 0.05;  // touch when the reading rises this far above baseline
+  float releaseFraction = 0.6;  // of the threshold, released below it
+  float baselineSmoothing = 0.02; // EWMA weight of a released reading
+};
+
+class TouchTracker
+{
+public:
+  explicit TouchTracker(const TouchTrackerConfig &config = TouchTrackerConfig()) : config(config) {}
+
+  // Feed a reading; returns the software press state.
+  bool update(uint32_t reading)
+  {
+    if (baseline == 0)
+    {
+      baseline = reading;
+      return false;
+    }
+    float delta = (float)reading - baseline;
+    if (pressed)
+    {
+      if (delta < thresholdDelta() * config.releaseFraction) pressed = false;
+    }
+    else if (delta > thresholdDelta())
+    {
+      pressed = true;
+    }
+    if (!pressed) track(reading);
+    return pressed;
+  }
+
+  // Feed a reading whose press state is already known, e.g. from the
+  // hardware interrupt, so the baseline never learns a finger.
+  void track(uint32_t reading, bool touched = false)
+  {
+    if (touched) return;
+    if (baseline == 0) baseline = reading;
+    else baseline += config.baselineSmoothing * ((float)reading - baseline);
+  }
+
+  // Rise above baseline that counts as a touch, as programmed into the hardware.
+  uint32_t thresholdDelta() const { return baseline * config.thresholdRatio; }
+  uint32_t baselineReading() const { return baseline; }
+  bool isPressed() const { return pressed; }
+
+private:
+  TouchTrackerConfig config;
+  float baseline = 0;
+  bool pressed = false;
+};
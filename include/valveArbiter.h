@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Arbitration of one valve between several requesters. Every source owns at
+// most one "on" interval; a new request from a source replaces its previous
+// one. The valve is open whenever the union of all intervals covers the
+// current time, and only the edges of that union need to be scheduled.
+//
+// Times are millis() values and are compared through signed differences so
+// the arbiter keeps working across the 49 day rollover.
+//
+// nextEdge() is O(n^2) in the number of sources: each pass over them may
+// extend the covered run by a single interval, when overlapping requests
+// are chained in reverse source order. For the handful of sources of the
+// controller that is a few dozen comparisons, cheaper than keeping the
+// intervals sorted on every request; test_valve_arbiter reports the cost
+// for larger counts.
+
+template <size_t sourceCount>
+class ValveArbiter
+{
+public:
+  // Open the valve for [start, end) on behalf of source.
+  void request(size_t source, uint32_t start, uint32_t end)
+  {
+    intervals[source] = {start, end, true, false};
+  }
+
+  // Open-ended request, e.g. while a button is held.
+  void hold(size_t source, uint32_t start)
+  {
+    intervals[source] = {start, start, true, true};
+  }
+
+  void release(size_t source)
+  {
+    intervals[source].active = false;
+  }
+
+  void clear()
+  {
+    for (size_t i = 0; i < sourceCount; i++)
+    {
+      intervals[i].active = false;
+    }
+  }
+
+  bool isActive(size_t source) const { return intervals[source].active; }
+
+  // The request of source as offsets from now, for checkpoints that must not
+  // depend on the clock they were taken with.
+  void relativeRequest(size_t source, uint32_t now, int32_t &start, int32_t &end, bool &open) const
+  {
+    start = (int32_t)(intervals[source].start - now);
+    end = (int32_t)(intervals[source].end - now);
+    open = intervals[source].open;
+  }
+
+  bool valveOn(uint32_t now) const
+  {
+    for (size_t i = 0; i < sourceCount; i++)
+    {
+      if (covers(intervals[i], now)) return true;
+    }
+    return false;
+  }
+
+  // Time of the next change of valveOn(). Returns false if the state will
+  // not change on its own (all closed, or held open indefinitely). Expired
+  // intervals are dropped along the way.
+  bool nextEdge(uint32_t now, uint32_t &edge)
+  {
+    for (size_t i = 0; i < sourceCount; i++)
+    {
+      Interval &interval = intervals[i];
+      if (interval.active && !interval.open && !before(now, interval.end)) interval.active = false;
+    }
+
+    if (!valveOn(now))
+    {
+      bool found = false;
+      for (size_t i = 0; i < sourceCount; i++)
+      {
+        const Interval &interval = intervals[i];
+        if (interval.active && before(now, interval.start) && (!found || before(interval.start, edge)))
+        {
+          edge = interval.start;
+          found = true;
+        }
+      }
+      return found;
+    }
+
+    // grow the covered run until no interval reaches past its end
+    edge = now;
+    bool extended = true;
+    while (extended)
+    {
+      extended = false;
+      for (size_t i = 0; i < sourceCount; i++)
+      {
+        const Interval &interval = intervals[i];
+        if (!interval.active || before(edge, interval.start)) continue;
+        if (interval.open) return false;
+        if (before(edge, interval.end))
+        {
+          edge = interval.end;
+          extended = true;
+        }
+      }
+    }
+    return true;
+  }
+
+private:
+  struct Interval
+  {
+    uint32_t start;
+    uint32_t end;
+    bool active;
+    bool open;
+  };
+
+  static bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+  static bool covers(const Interval &interval, uint32_t now)
+  {
+    if (!interval.active || before(now, interval.start)) return false;
+    return interval.open || before(now, interval.end);
+  }
+
+  Interval intervals[sourceCount] = {};
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+
+// Vapor pressure deficit in integer arithmetic, the S2 has no FPU.
+//
+// Saturation vapor pressure follows the Tetens/Magnus formula
+//   es(T) = 610.78 * exp(17.27 * T / (T + 237.3))  [Pa, T in C]
+// tabulated at whole degrees and linearly interpolated in between, which
+// stays within 0.3% of the formula over the table range (the whole-Pascal
+// entries below freezing account for most of that).
+
+namespace vpd
+{
+  constexpr int16_t tableMinCelsius = -10;
+  constexpr int16_t tableMaxCelsius = 50;
+
+  constexpr uint16_t saturationTablePa[] = {
+      286, 309, 334, 361, 390, 421, 454, 490, 527, 568,              // -10 .. -1
+      611, 657, 706, 758, 813, 872, 935, 1002, 1073, 1148,           //   0 ..  9
+      1228, 1313, 1403, 1498, 1599, 1705, 1818, 1938, 2064, 2197,    //  10 .. 19
+      2338, 2487, 2644, 2809, 2984, 3168, 3361, 3565, 3780, 4006,    //  20 .. 29
+      4243, 4492, 4755, 5030, 5319, 5622, 5941, 6275, 6625, 6991,    //  30 .. 39
+      7375, 7778, 8199, 8639, 9100, 9582, 10086, 10612, 11162, 11737, //  40 .. 49
+      12336,                                                         //  50
+  };
+
+  // Temperature in hundredths of a degree C, clamped to the table range.
+  inline int32_t saturationVaporPressurePa(int16_t centiCelsius)
+  {
+    if (centiCelsius <= tableMinCelsius * 100) return saturationTablePa[0];
+    if (centiCelsius >= tableMaxCelsius * 100) return saturationTablePa[tableMaxCelsius - tableMinCelsius];
+    int32_t offset = centiCelsius - tableMinCelsius * 100;
+    int32_t index = offset / 100;
+    int32_t fraction = offset % 100;
+    int32_t low = saturationTablePa[index];
+    int32_t high = saturationTablePa[index + 1];
+    return low + ((high - low) * fraction + 50) / 100;
+  }
+
+  // Relative humidity in hundredths of a percent.
+  inline int32_t vaporPressureDeficitPa(int16_t centiCelsius, uint16_t rhCentiPercent)
+  {
+    if (rhCentiPercent > 10000) rhCentiPercent = 10000;
+    return saturationVaporPressurePa(centiCelsius) * (10000 - rhCentiPercent) / 10000;
+  }
+}
+
+struct VpdControllerConfig
+{
+  int32_t targetPa = 1000;           // 1.0 kPa suits most vegetative growth
+  int32_t kpPermillePerKpa = 400;    // mist duty per kPa of deficit above target
+  int32_t kiPermillePerKpa = 50;     // integral gain, per control cycle
+  uint16_t maxDutyPermille = 300;    // never mist more than this fraction of a cycle
+  int32_t humidBandPa = 200;         // below target by this much, ventilate instead
+  uint8_t fanMinPercent = 70;        // fans stall below this
+};
+
+struct VpdOutput
+{
+  uint16_t mistDutyPermille = 0;
+  uint8_t fanPercent = 0;
+};
+
+// PI controller from measured VPD to mist duty. Too dry (VPD above target)
+// means more mist, with the fan scaled along to evaporate it; too humid
+// stops misting and runs the fan flat out to exchange air.
+class VpdController
+{
+public:
+  explicit VpdController(const VpdControllerConfig &config = VpdControllerConfig()) : config(config) {}
+
+  // Call once per control cycle.
+  VpdOutput update(int32_t vpdPa)
+  {
+    int32_t error = vpdPa - config.targetPa;
+    VpdOutput output;
+
+    if (error < -config.humidBandPa)
+    {
+      integral = 0;
+      output.fanPercent = 100;
+      return output;
+    }
+
+    integral += error * config.kiPermillePerKpa / 1000;
+    int32_t maxIntegral = config.maxDutyPermille;
+    if (integral > maxIntegral) integral = maxIntegral;
+    if (integral < 0) integral = 0;
+
+    int32_t duty = error * config.kpPermillePerKpa / 1000 + integral;
+    if (duty < 0) duty = 0;
+    if (duty > config.maxDutyPermille) duty = config.maxDutyPermille;
+    output.mistDutyPermille = duty;
+
+    output.fanPercent = duty == 0 ? 0 : config.fanMinPercent + (100 - config.fanMinPercent) * duty / config.maxDutyPermille;
+    return output;
+  }
+
+  void reset() { integral = 0; }
+
+  // The accumulated duty, so a checkpoint can carry it over.
+  int32_t integralPermille() const { return integral; }
+  void restoreIntegral(int32_t permille) { integral = permille; }
+
+private:
+  VpdControllerConfig config;
+  int32_t integral = 0;
+};
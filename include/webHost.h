@@ -0,0 +1,330 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "modbusRtu.h"
+#include "runtimeConfig.h"
+#include "webUi.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS, where SO_NOSIGPIPE would be the way
+#endif
+
+// Host only: the web UI on a local socket, for tools/webServe.cpp and
+// test/test_web_ui. Answers the routes of webUi.h the way webSetup() in
+// src/main.cpp does, with plain HTTP/1.1 and one request per connection
+// apart from the event stream. Everything runs on the thread calling
+// serve(), so Unit needs no locking; writes and configurations are applied
+// as they come instead of queued for loop().
+//
+// Unit must provide the Registers of modbusRtu.h plus
+//   RuntimeConfig config()
+//   void applyRuntimeConfig(const RuntimeConfig &config)
+
+template <typename Unit>
+class WebHost
+{
+public:
+  explicit WebHost(Unit &unit, uint32_t eventIntervalMs = 1000) : unit(unit), eventIntervalMs(eventIntervalMs) {}
+
+  ~WebHost()
+  {
+    for (Connection &connection : connections) close(connection.socket);
+    if (listener >= 0) close(listener);
+  }
+
+  // Listens on 127.0.0.1:port, any free port for 0.
+  bool begin(uint16_t port = 0)
+  {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) return false;
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    if (bind(listener, (sockaddr *)&address, length) != 0 || listen(listener, 8) != 0 ||
+        getsockname(listener, (sockaddr *)&address, &length) != 0)
+    {
+      return false;
+    }
+    boundPort = ntohs(address.sin_port);
+    nextEventAt = now() + eventIntervalMs;
+    return true;
+  }
+
+  uint16_t port() const { return boundPort; }
+
+  // Handles what arrives within ms, and sends the registers events due.
+  void serve(int ms)
+  {
+    std::vector<pollfd> sockets;
+    sockets.push_back({listener, POLLIN, 0});
+    for (const Connection &connection : connections) sockets.push_back({connection.socket, POLLIN, 0});
+    int32_t untilEvent = nextEventAt - now();
+    if (untilEvent < ms) ms = untilEvent < 0 ? 0 : untilEvent;
+    if (poll(sockets.data(), sockets.size(), ms) > 0)
+    {
+      // the same order as connections, which only grows below
+      for (size_t i = connections.size(); i-- > 0;)
+      {
+        if (sockets[i + 1].revents != 0 && !receive(connections[i])) drop(i);
+      }
+      if (sockets[0].revents & POLLIN) accepted(accept(listener, nullptr, nullptr));
+    }
+    if ((int32_t)(now() - nextEventAt) >= 0)
+    {
+      nextEventAt = now() + eventIntervalMs;
+      sendEvents();
+    }
+  }
+
+private:
+  struct Connection
+  {
+    int socket;
+    std::string head;       // until the blank line after the headers
+    bool headDone = false;
+    std::string method;
+    std::string path;
+    std::string ifNoneMatch;
+    size_t bodyLeft = 0;
+    size_t bodyReceived = 0;
+    std::string form;       // a /write body
+    bool events = false;    // an open event stream
+  };
+
+  // JsonWriter's sink.
+  struct Text
+  {
+    std::string text;
+    void write(const uint8_t *data, size_t length) { text.append((const char *)data, length); }
+  };
+
+  static uint32_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void accepted(int socket)
+  {
+    if (socket < 0) return;
+    Connection connection;
+    connection.socket = socket;
+    connections.push_back(connection);
+  }
+
+  void drop(size_t i)
+  {
+    if (configOwner == connections[i].socket) configOwner = -1; // gave up halfway
+    close(connections[i].socket);
+    connections.erase(connections.begin() + i);
+  }
+
+  // False once the connection is done with.
+  bool receive(Connection &connection)
+  {
+    char data[1024];
+    ssize_t length = recv(connection.socket, data, sizeof(data), 0);
+    if (length <= 0 || connection.events) return length > 0;
+    size_t used = 0;
+    if (!connection.headDone)
+    {
+      size_t before = connection.head.size();
+      connection.head.append(data, length);
+      size_t end = connection.head.find("\r\n\r\n");
+      if (end == std::string::npos) return connection.head.size() < 8192;
+      connection.head.resize(end + 4);
+      used = connection.head.size() - before;
+      if (!parseHead(connection)) return respond(connection, 400);
+      if (connection.method == "GET") return get(connection);
+      if (connection.method != "POST") return respond(connection, 404);
+    }
+    size_t body = (size_t)length - used < connection.bodyLeft ? length - used : connection.bodyLeft;
+    if (!post(connection, data + used, body)) return false;
+    connection.bodyLeft -= body;
+    return connection.bodyLeft > 0 || finishPost(connection);
+  }
+
+  bool parseHead(Connection &connection)
+  {
+    connection.headDone = true;
+    const std::string &head = connection.head;
+    size_t space = head.find(' ');
+    size_t secondSpace = head.find(' ', space + 1);
+    if (space == std::string::npos || secondSpace == std::string::npos) return false;
+    connection.method = head.substr(0, space);
+    connection.path = head.substr(space + 1, secondSpace - space - 1);
+    connection.path = connection.path.substr(0, connection.path.find('?'));
+    for (size_t line = head.find("\r\n") + 2; line < head.size() - 2; line = head.find("\r\n", line) + 2)
+    {
+      std::string header = head.substr(line, head.find("\r\n", line) - line);
+      size_t colon = header.find(':');
+      if (colon == std::string::npos) return false;
+      std::string value = header.substr(header.find_first_not_of(' ', colon + 1));
+      if (strncasecmp(header.c_str(), "Content-Length:", 15) == 0)
+      {
+        connection.bodyLeft = strtoul(value.c_str(), nullptr, 10);
+      }
+      if (strncasecmp(header.c_str(), "If-None-Match:", 14) == 0) connection.ifNoneMatch = value;
+    }
+    return true;
+  }
+
+  bool get(Connection &connection)
+  {
+    const WebAsset *asset = webUi::findAsset(connection.path.c_str());
+    if (asset != nullptr)
+    {
+      if (webUi::notModified(*asset, connection.ifNoneMatch.c_str())) return respond(connection, 304);
+      std::string headers = std::string("Content-Encoding: gzip\r\nCache-Control: ") + webUi::cacheControl +
+                            "\r\nETag: " + asset->etag + "\r\n";
+      std::string data((const char *)asset->data, asset->length); // as it is, the browser inflates it
+      return respond(connection, 200, asset->contentType, data, headers);
+    }
+    if (connection.path == "/config")
+    {
+      Text json;
+      JsonWriter<Text> writer(json);
+      writeConfig(writer, unit.config());
+      return respond(connection, 200, "application/json", json.text);
+    }
+    if (connection.path == webUi::eventsPath)
+    {
+      connection.events = true;
+      return send(connection,
+                  "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                  "Connection: keep-alive\r\n\r\n");
+    }
+    return respond(connection, 404);
+  }
+
+  // A chunk of the body as it arrives, so a configuration is parsed in
+  // pieces the way the firmware's body handler does.
+  bool post(Connection &connection, const char *data, size_t length)
+  {
+    if (connection.path == "/write")
+    {
+      connection.form.append(data, length);
+      return connection.form.size() < 256;
+    }
+    if (connection.path != "/config" || length == 0) return true;
+    if (connection.bodyReceived == 0 && configOwner < 0) // one upload at a time
+    {
+      configOwner = connection.socket;
+      configDocument.begin(unit.config());
+    }
+    connection.bodyReceived += length;
+    if (configOwner == connection.socket) configDocument.feed(data, length);
+    return true;
+  }
+
+  bool finishPost(Connection &connection)
+  {
+    if (connection.path == "/write")
+    {
+      uint16_t address, value;
+      if (!webUi::parseWord(field(connection.form, "register").c_str(), address) ||
+          !webUi::parseWord(field(connection.form, "value").c_str(), value))
+      {
+        return respond(connection, 400);
+      }
+      unit.write(address, value);
+      return respond(connection, 202);
+    }
+    if (connection.path != "/config") return respond(connection, 404);
+    if (configOwner != connection.socket) return respond(connection, 409); // another upload had the parser, or no body
+    configOwner = -1;
+    if (!configDocument.finish())
+    {
+      char message[48];
+      snprintf(message, sizeof(message), "Invalid configuration (error %d at %u)", configDocument.error(),
+               (unsigned)configDocument.position());
+      return respond(connection, 400, "text/plain", message);
+    }
+    unit.applyRuntimeConfig(configDocument.result());
+    return respond(connection, 202);
+  }
+
+  // A form field's value, "" if absent.
+  static std::string field(const std::string &form, const char *name)
+  {
+    std::string key = std::string(name) + "=";
+    for (size_t at = 0;;)
+    {
+      size_t end = form.find('&', at);
+      if (form.compare(at, key.size(), key) == 0) return form.substr(at + key.size(), end - at - key.size());
+      if (end == std::string::npos) return "";
+      at = end + 1;
+    }
+  }
+
+  void sendEvents()
+  {
+    char json[webUi::registersJsonSize];
+    size_t length = 0;
+    for (size_t i = connections.size(); i-- > 0;)
+    {
+      if (!connections[i].events) continue;
+      if (length == 0) length = webUi::registersJson(unit, json);
+      std::string event = std::string("event: ") + webUi::registersEvent + "\ndata: " + json + "\n\n";
+      if (!send(connections[i], event)) drop(i);
+    }
+  }
+
+  // Sends the response and ends the connection, so always false.
+  bool respond(Connection &connection, int status, const char *contentType = "text/plain", const std::string &body = "",
+               const std::string &headers = "")
+  {
+    char head[128];
+    snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n",
+             status, reason(status), contentType, (unsigned)body.size());
+    send(connection, head + headers + "\r\n" + body);
+    return false;
+  }
+
+  static const char *reason(int status)
+  {
+    switch (status)
+    {
+    case 200: return "OK";
+    case 202: return "Accepted";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 409: return "Conflict";
+    default: return "Not Found";
+    }
+  }
+
+  bool send(Connection &connection, const std::string &data)
+  {
+    for (size_t sent = 0; sent < data.size();)
+    {
+      ssize_t length = ::send(connection.socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (length <= 0) return false;
+      sent += length;
+    }
+    return true;
+  }
+
+  Unit &unit;
+  uint32_t eventIntervalMs;
+  int listener = -1;
+  uint16_t boundPort = 0;
+  uint32_t nextEventAt = 0;
+  std::vector<Connection> connections;
+  ConfigUpload configDocument;
+  int configOwner = -1; // socket of the upload owning the parser
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "remoteRegisters.h"
+#include "webAssets.h" // generated from web/ by tools/embedWebAssets.py
+
+// The web UI's request handling that does not depend on the server: the
+// AsyncWebServer routes in src/main.cpp and the host server in
+// include/webHost.h both answer through these.
+//
+//   GET  /, /index.html  the gzipped assets, cached for a day, revalidated by ETag
+//   POST /write          register=&value=, like a Modbus write of one register
+//   GET  /config         the runtime configuration as JSON, see runtimeConfig.h
+//   POST /config         a (partial) configuration document
+//   GET  /events         an event stream of "registers" events, all registers
+//                        as one JSON array indexed like the register map
+
+namespace webUi
+{
+  constexpr const char *cacheControl = "max-age=86400";
+  constexpr const char *eventsPath = "/events";
+  constexpr const char *registersEvent = "registers";
+  constexpr size_t registersJsonSize = remoteRegister::count * 6 + 3;
+
+  // The asset served at path, index.html also at "/"; nullptr if none is.
+  inline const WebAsset *findAsset(const char *path)
+  {
+    if (strcmp(path, "/") == 0) path = "/index.html";
+    for (size_t i = 0; i < webAssetCount; i++)
+    {
+      if (strcmp(webAssets[i].path, path) == 0) return &webAssets[i];
+    }
+    return nullptr;
+  }
+
+  // True if the client's copy, by its If-None-Match header, is current.
+  inline bool notModified(const WebAsset &asset, const char *ifNoneMatch)
+  {
+    return ifNoneMatch != nullptr && strcmp(ifNoneMatch, asset.etag) == 0;
+  }
+
+  // A register address or value of a /write form field. Parsed wide so an
+  // out of range number is refused instead of wrapping onto another
+  // register or value.
+  inline bool parseWord(const char *text, uint16_t &word)
+  {
+    if (text == nullptr || *text < '0' || *text > '9') return false;
+    char *end;
+    unsigned long value = strtoul(text, &end, 10);
+    if (*end != '\0' || value > 0xFFFF) return false;
+    word = value;
+    return true;
+  }
+
+  // The payload of a registers event, written to json (registersJsonSize
+  // bytes); returns its length.
+  template <typename Registers>
+  size_t registersJson(Registers &registers, char *json)
+  {
+    size_t length = 0;
+    json[length++] = '[';
+    for (uint16_t address = 0; address < remoteRegister::count; address++)
+    {
+      uint16_t value = 0;
+      registers.read(address, value);
+      length += snprintf(json + length, registersJsonSize - length, address ? ",%u" : "%u", value);
+    }
+    json[length++] = ']';
+    json[length] = '\0';
+    return length;
+  }
+}
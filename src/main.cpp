@@ -1,12 +1,55 @@
 #include "Arduino.h"
 #include <arduino-timer.h>
+#include <stdarg.h>
 
 #include "OneButton.h"
-
+#include "driver/adc.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "driver/pcnt.h"
+#include "driver/rmt.h"
+#include "driver/touch_sensor.h"
+#include "driver/twai.h"
+#include "driver/uart.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "soc/gpio_struct.h"
+#if CONFIG_ESP_COREDUMP_ENABLE_TO_FLASH && CONFIG_ESP_COREDUMP_DATA_FORMAT_ELF
+#include "esp_core_dump.h"
+#define HAVE_CORE_DUMP_SUMMARY 1
+#endif
+#include <DallasTemperature.h>
+#include <ESPAsyncWebServer.h>
+#include <OneWire.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <Wire.h>
+
+#include "controller.h"
+#include "controllerState.h"
+#include "crashRecord.h"
+#include "encoderAccelerator.h"
+#include "fleetProtocol.h"
+#include "flowMeter.h"
+#include "gpioBatch.h"
+#include "irDecoder.h"
+#include "ledPattern.h"
+#include "modbusRtu.h"
+#include "occupancy.h"
+#include "pressureMonitor.h"
+#include "remoteRegisters.h"
+#include "ruleEngine.h"
+#include "runtimeConfig.h"
+#include "supplyMonitor.h"
+#include "touchTracker.h"
+#include "webUi.h"
+#include "vpd.h"
+
+// The settings of the control logic are in include/settings.h.
 namespace settings
 {
-  constexpr bool debug = false;
-
   namespace serial
   {
     constexpr unsigned long baud = 115200;
@@ -20,12 +63,113 @@ namespace settings
     constexpr int buttonOne = 9;    // pushbutton closest to the connector
     constexpr int buttonTwo = 11;   // pushbutton in middle
     constexpr int buttonThree = 12; // pushbutton farthest from the connector
+    constexpr int pressure = 3;     // line pressure sensor analog output (ADC1 channel 2)
+    constexpr int supply = 4;       // supply rail through a 100k/10k divider (ADC1 channel 3)
+    constexpr int temperature = 16; // DS18B20 ambient temperature sensor data line
+    constexpr int sda = 33;         // SHT31 temperature/humidity sensor
+    constexpr int scl = 35;
+    constexpr int statusLed = 15;   // onboard LED of the S2 Mini
+    constexpr int encoderA = 17;    // rotary encoder quadrature outputs
+    constexpr int encoderB = 18;
+    constexpr int irReceiver = 21;  // 38 kHz IR receiver module output
+    constexpr int occupancy = 37;   // PIR sensor output, high while it sees motion
+    constexpr int flowMeter = 38;   // hall-effect flow sensor pulse output
+    constexpr int modbusTx = 39;    // RS-485 transceiver DI
+    constexpr int modbusRx = 40;    // RS-485 transceiver RO
+    constexpr int modbusEnable = 41; // RS-485 transceiver DE/RE, driven by the UART while sending
+    constexpr int canTx = 1;        // CAN transceiver TXD
+    constexpr int canRx = 2;        // CAN transceiver RXD
+  }
+
+  namespace input
+  {
+    constexpr bool touch = false;                // read the three buttons as capacitive touch pads instead
+    constexpr unsigned long touchRetune = 1000;  // ms between touch baseline/threshold updates
+  }
+
+  namespace encoder
+  {
+    constexpr pcnt_unit_t unit = PCNT_UNIT_0;
+    constexpr int16_t countLimit = 10000;           // the counter wraps to 0 at +-limit
+    constexpr uint16_t glitchFilter = 1023;         // APB cycles (~12.8 us), shorter pulses are ignored
+    constexpr unsigned long pollInterval = 20;      // ms between counter reads
+  }
+
+  namespace ir
+  {
+    constexpr rmt_channel_t channel = RMT_CHANNEL_0;
+    constexpr uint8_t clockDivider = 80;            // 1 us RMT ticks
+    constexpr uint8_t glitchFilter = 200;           // APB ticks (2.5 us), shorter pulses are dropped
+    constexpr uint16_t frameGap = 12000;            // us of silence that ends a frame
+    constexpr unsigned long pollInterval = 20;      // ms between ring buffer checks
+    constexpr uint16_t address = 0x00;              // remote to listen to, NEC address or RC5 system
+
+    // Keys of the common 21 key NEC remote; RC5 remotes send the digits as 0-9.
+    namespace key
+    {
+      constexpr uint8_t necOne = 0x0C, necTwo = 0x18, necThree = 0x5E, necFour = 0x08, necFive = 0x1C;
+      constexpr uint8_t necFanOn = 0x47, necFanOff = 0x45, necStopPattern = 0x43, necStopAll = 0x46;
+      constexpr uint8_t rc5FanOn = 0x20, rc5FanOff = 0x21, rc5StopPattern = 0x35, rc5StopAll = 0x0C;
+    }
+  }
+
+  namespace modbus
+  {
+    constexpr uart_port_t port = UART_NUM_1;        // UART0 is the debug console
+    constexpr int baudRate = 19200;
+    constexpr uint8_t address = 1;                  // unit address on the bus
+    constexpr uint8_t frameGap = 4;                 // character times of silence that end a frame (3.5 rounded up)
+    constexpr int rxBufferBytes = 512;
+    constexpr int txBufferBytes = 512;
+    constexpr unsigned long pollInterval = 5;       // ms between checks for a finished frame
+  }
+
+  namespace fleet
+  {
+    constexpr uint8_t node = 1;                      // unit number on the CAN bus, 1-127, unique per unit
+    constexpr unsigned long pollInterval = 10;       // ms between receive queue checks
+    constexpr unsigned long statusInterval = 10000;  // ms between unsolicited status reports
+  }
+
+  namespace web
+  {
+    constexpr const char *ssid = "";                 // empty disables Wi-Fi and the web UI
+    constexpr const char *password = "";
+    constexpr const char *hostname = "mistfan";
+    constexpr uint16_t port = 80;
+    constexpr unsigned long eventInterval = 1000;    // ms between state updates on the event stream
+    constexpr unsigned long applyInterval = 20;      // ms between applying queued writes
+    constexpr size_t pendingWrites = 8;
+  }
+
+  namespace crash
+  {
+    constexpr unsigned long snapshotInterval = 1000; // ms between controller state snapshots
+    constexpr const char *key = "crash";             // NVS key, in the rules namespace
+    constexpr bool resumeAfterBrownout = true;       // restore the controller state retained across the reset
+  }
+
+  namespace rules
+  {
+    constexpr unsigned long evaluateInterval = 100; // ms between rule evaluations
+    constexpr unsigned long consoleInterval = 50;   // ms between serial console reads
+    constexpr const char *storage = "mistfan";      // NVS namespace
+    constexpr const char *key = "rules";
+  }
+
+  namespace occupancy
+  {
+    constexpr unsigned long vacancyDelay = 15 * 60 * 1000; // ms without motion before patterns are suspended
+    constexpr unsigned long checkInterval = 250;           // ms between vacancy checks
   }
 
-  namespace delays
+  namespace flow
   {
-    constexpr unsigned long timeout = 2 * 60 * 60 * 1000; // if no buttons are pressed for this long, then fan and
-                                                          // mist will be turned off //(and sleep not implemented)
+    constexpr pcnt_unit_t unit = PCNT_UNIT_1;        // unit 0 decodes the encoder
+    constexpr int16_t countLimit = 30000;            // the counter wraps to 0 at this
+    constexpr uint16_t glitchFilter = 1023;          // APB cycles (~12.8 us)
+    constexpr unsigned long readInterval = 1000;     // ms between counter reads
+    constexpr unsigned long day = 24UL * 60 * 60 * 1000; // ms, daily totals restart after this
   }
 
   namespace pwm
@@ -37,36 +181,138 @@ namespace settings
     {
       constexpr int fan = 1;
       constexpr int mist = 2;
+      constexpr int statusLed = 3;
     }
+
+    constexpr uint32_t statusLedFrequency = 5000;
+  }
+
+  namespace analog
+  {
+    constexpr uint32_t sampleFrequency = 10000;        // Hz, ADC continuous mode, shared by the channels below
+    constexpr uint32_t frameBytes = 128;               // DMA frame size, bounds how late an opening is seen
+    constexpr uint32_t bufferBytes = 4096;             // driver ring buffer, must outlast drainInterval
+    constexpr unsigned long drainInterval = 20;        // ms between draining the DMA buffer
+  }
+
+  namespace pressure
+  {
+    constexpr adc_channel_t channel = ADC_CHANNEL_2;  // must match pins::pressure
+    constexpr uint32_t sampleFrequency = analog::sampleFrequency / 2;
+    constexpr uint16_t samplesPerBin = 25;             // 5 ms bins, 640 ms capture window
+  }
+
+  namespace supply
+  {
+    constexpr adc_channel_t channel = ADC_CHANNEL_3;  // must match pins::supply
+    constexpr uint16_t samplesPerBlock = 50;           // 10 ms per reading
+    constexpr uint32_t dividerRatio = 11;
+    constexpr uint32_t microvoltsPerCount = 2500000UL * dividerRatio / 2047; // 11 bit results, ~2.5 V at 11 dB
+  }
+
+  namespace thermal
+  {
+    constexpr unsigned long readInterval = 10000;  // ms between temperature conversions
+    constexpr unsigned long conversionTime = 750;  // ms, DS18B20 at 12 bit resolution
+    constexpr unsigned long staleAfter = 3 * readInterval; // ms, older readings count as none
+  }
+
+  namespace climate
+  {
+    constexpr uint8_t address = 0x44;               // SHT31 with ADDR pulled low
+    constexpr unsigned long readInterval = 5000;    // ms between humidity measurements
+    constexpr unsigned long conversionTime = 20;    // ms, high repeatability single shot
   }
 }
 
-struct CurrentValue
+Timer<32> timer; // the background tasks, 16 by default is too few
+
+// What the controller did recently, kept in RTC memory that survives a
+// panic or watchdog reset so it can go into the crash record on the next
+// boot.
+RTC_NOINIT_ATTR uint32_t traceMagic;
+RTC_NOINIT_ATTR TraceLog<crash::traceLength> traceLog;
+RTC_NOINIT_ATTR ControllerSnapshot lastSnapshot;
+
+bool traceStreaming = false; // also print each event, see traceCommand()
+
+void trace(uint16_t code, int16_t value = 0)
+{
+  uint32_t now = millis();
+  traceLog.add(now, code, value);
+  if (traceStreaming) Serial.printf("trace %lu %u %d\n", (unsigned long)now, code, value);
+}
+
+// The peripherals and the status LED as the controller sees them, defined
+// further down next to what they drive.
+struct FirmwareHal
 {
-  bool mistState = 0; // Current relay state
+  uint32_t now() { return millis(); }
+  void writeMist(bool state);
+  void writeFanPercent(int percent);
+  void trace(uint16_t code, int16_t value) { ::trace(code, value); }
+  void confirm(uint8_t blinks);
+  void modeChanged();
+  void mistSessionStarted();
+  void mistSessionEnded();
+  void acknowledgeFaults();
+  void buttonEvent(int button, int clicks);
+  void sleep();
+  void log(const char *format, ...);
 };
-CurrentValue currentValue;
+FirmwareHal firmware;
+Controller<FirmwareHal> controller(firmware);
+
+OneWire oneWire(settings::pins::temperature);
+DallasTemperature temperatureSensor(&oneWire);
+
+LedSequencer ledSequencer;
+portMUX_TYPE ledMux = portMUX_INITIALIZER_UNLOCKED;
+esp_timer_handle_t ledTimer;
+bool ledRunning = false;
+
+const LedStep blinkSteps[] = {{255, 0, 150}, {0, 0, 250}};
+const LedStep codeGapSteps[] = {{0, 0, 600}};
+const LedStep patternSteps[] = {{255, 1500, 0}, {0, 1500, 500}}; // slow breathing
+const LedStep vpdSteps[] = {{96, 500, 0}, {0, 500, 2000}};       // dim heartbeat
+const LedStep faultSteps[] = {{255, 0, 100}, {0, 0, 100}};      // fast flashing
+
+void updateStatusLed();
+
+FlowMeter flowMeter;
+int16_t flowLastCount = 0;
+unsigned long flowDayStartedAt = 0;
+
+PressureMonitorConfig pressureMonitorConfig()
+{
+  PressureMonitorConfig config;
+  config.samplePeriodUs = 1000000 / settings::pressure::sampleFrequency;
+  config.samplesPerBin = settings::pressure::samplesPerBin;
+  return config;
+}
+PressureMonitor pressureMonitor(pressureMonitorConfig());
 
-void setMistState(bool state) { currentValue.mistState = state; }
-bool getMistState() { return currentValue.mistState; }
+SupplyMonitor supplyMonitor({settings::supply::samplesPerBlock, settings::supply::microvoltsPerCount,
+                             settings::supply::sagBelowMv, settings::supply::sagReleaseMv,
+                             settings::supply::criticalBelowMv, settings::supply::criticalReleaseMv});
 
-auto timer = timer_create_default(); // create a timer with default settings
-Timer<>::Task mistForDurationRepeatingTask;
-Timer<>::Task timeoutTimerTask;
+// With touch input the pads are read by the touch peripheral and OneButton is
+// only fed the resulting state.
+constexpr int buttonPin(int pin) { return settings::input::touch ? -1 : pin; }
 
-OneButton buttonOne = OneButton(settings::pins::buttonOne, // Input pin for the button
-                                true,                      // Button is active LOW
-                                true                       // Enable internal pull-up resistor
+OneButton buttonOne = OneButton(buttonPin(settings::pins::buttonOne), // Input pin for the button
+                                true,                                 // Button is active LOW
+                                !settings::input::touch               // Enable internal pull-up resistor
 );
 
-OneButton buttonTwo = OneButton(settings::pins::buttonTwo, // Input pin for the button
-                                true,                      // Button is active LOW
-                                true                       // Enable internal pull-up resistor
+OneButton buttonTwo = OneButton(buttonPin(settings::pins::buttonTwo), // Input pin for the button
+                                true,                                 // Button is active LOW
+                                !settings::input::touch               // Enable internal pull-up resistor
 );
 
-OneButton buttonThree = OneButton(settings::pins::buttonThree, // Input pin for the button
-                                  true,                        // Button is active LOW
-                                  true                         // Enable internal pull-up resistor
+OneButton buttonThree = OneButton(buttonPin(settings::pins::buttonThree), // Input pin for the button
+                                  true,                                   // Button is active LOW
+                                  !settings::input::touch                 // Enable internal pull-up resistor
 );
 
 uint32_t calculateMaxDutyFromPrecision(int precision)
@@ -88,331 +334,1468 @@ void setPwmPercent(uint32_t pwmChannel, int percent)
   ledcWrite(pwmChannel, calculateDutyFromPercent(percent));
 }
 
-void setFanSpeedPercent(int percent)
+constexpr ledc_mode_t statusLedMode = LEDC_LOW_SPEED_MODE;
+constexpr ledc_channel_t statusLedChannel = (ledc_channel_t)settings::pwm::channel::statusLed;
+
+// Runs in the esp_timer task: the LEDC fades in hardware and the timer wakes
+// up once per step, so loop() never has to service the LED.
+void ledStepFromTimer(void *)
 {
-  setPwmPercent(settings::pwm::channel::fan, percent);
+  LedStep step;
+  portENTER_CRITICAL(&ledMux);
+  ledRunning = ledSequencer.next(step);
+  portEXIT_CRITICAL(&ledMux);
+  if (!ledRunning)
+  {
+    ledc_set_duty(statusLedMode, statusLedChannel, 0);
+    ledc_update_duty(statusLedMode, statusLedChannel);
+    return;
+  }
+  if (step.rampMs > 0)
+  {
+    ledc_set_fade_with_time(statusLedMode, statusLedChannel, step.level, step.rampMs);
+    ledc_fade_start(statusLedMode, statusLedChannel, LEDC_FADE_NO_WAIT);
+  }
+  else
+  {
+    ledc_set_duty(statusLedMode, statusLedChannel, step.level);
+    ledc_update_duty(statusLedMode, statusLedChannel);
+  }
+  esp_timer_start_once(ledTimer, (uint64_t)(step.rampMs + step.holdMs) * 1000);
+}
+
+// Restart the sequence right away unless a queued pattern is mid-play.
+void kickStatusLed()
+{
+  portENTER_CRITICAL(&ledMux);
+  bool restart = !ledRunning || ledSequencer.playingIdle();
+  portEXIT_CRITICAL(&ledMux);
+  if (restart)
+  {
+    esp_timer_stop(ledTimer);
+    esp_timer_start_once(ledTimer, 0);
+  }
+}
+
+void playStatusLed(const LedPattern &pattern)
+{
+  portENTER_CRITICAL(&ledMux);
+  bool queued = ledSequencer.enqueue(pattern);
+  portEXIT_CRITICAL(&ledMux);
+  if (!queued)
+  {
+    if (settings::debug) Serial.println("Status LED queue full, pattern dropped");
+    return;
+  }
+  kickStatusLed();
+}
+
+void setStatusLedIdle(const LedPattern &pattern)
+{
+  portENTER_CRITICAL(&ledMux);
+  ledSequencer.setIdle(pattern);
+  portEXIT_CRITICAL(&ledMux);
+  kickStatusLed();
+}
+
+// Blink once per click of the recognized gesture.
+void confirmWithStatusLed(uint8_t blinks)
+{
+  playStatusLed({blinkSteps, 2, blinks});
+  playStatusLed({codeGapSteps, 1, 1});
+}
+
+void statusLedSetup()
+{
+  ledcSetup(settings::pwm::channel::statusLed, settings::pwm::statusLedFrequency, settings::pwm::precision);
+  ledcAttachPin(settings::pins::statusLed, settings::pwm::channel::statusLed);
+  ledc_fade_func_install(0);
+
+  esp_timer_create_args_t args = {};
+  args.callback = ledStepFromTimer;
+  args.name = "statusLed";
+  esp_timer_create(&args, &ledTimer);
+}
+
+void supplyStateChanged()
+{
+  const SupplyMonitor::Event &event = supplyMonitor.event(supplyMonitor.eventCount() - 1);
+  const char *names[] = {"normal", "sagging", "critical"};
+  if (settings::debug) Serial.printf("Supply %s at %d mV\n", names[event.state], event.millivolts);
+  controller.supplyChanged(event.state);
 }
 
-void writeMistState(bool state = currentValue.mistState)
+void drainAnalogSamples()
 {
-  if ((state && !getMistState()) || (!state && getMistState()))
+  uint8_t buffer[settings::analog::frameBytes];
+  uint32_t length = 0;
+  while (adc_digi_read_bytes(buffer, sizeof(buffer), &length, 0) == ESP_OK && length > 0)
   {
-    digitalWrite(settings::pins::mistSwitch, state);
-    setMistState(state);
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+      adc_digi_output_data_t *result = (adc_digi_output_data_t *)&buffer[i];
+      if (result->type2.channel == settings::supply::channel)
+      {
+        if (supplyMonitor.addSample(result->type2.data, millis())) supplyStateChanged();
+        continue;
+      }
+      if (result->type2.channel != settings::pressure::channel) continue;
+      if (pressureMonitor.addSample(result->type2.data))
+      {
+        const PressureFeatures &features = pressureMonitor.lastFeatures();
+        if (settings::debug) Serial.printf("Pressure capture: rest %d, drop %d, settle %d ms%s\n",
+                                           (int)features.restPressure, (int)features.dropMagnitude,
+                                           (int)(features.settleTime / 1000),
+                                           pressureMonitor.isLearning() ? " (learning)" : "");
+        if (pressureMonitor.clogged())
+        {
+          if (settings::debug) Serial.println("Pressure transient deviates from baseline, nozzle clog suspected!");
+          trace(traceCode::fault, 1);
+          updateStatusLed();
+        }
+      }
+    }
   }
 }
 
-void mistOn()
+bool drainAnalogSamplesFromTimer(void *)
+{
+  drainAnalogSamples();
+  return true;
+}
+
+// Line pressure and supply rail are converted alternately by the ADC1
+// digital controller and collected by DMA.
+void analogSetup()
 {
-  if (settings::debug) Serial.println("Turning mist ON");
-  writeMistState(1);
+  adc_digi_init_config_t init = {};
+  init.max_store_buf_size = settings::analog::bufferBytes;
+  init.conv_num_each_intr = settings::analog::frameBytes;
+  init.adc1_chan_mask = BIT(settings::pressure::channel) | BIT(settings::supply::channel);
+  init.adc2_chan_mask = 0;
+  adc_digi_initialize(&init);
+
+  adc_digi_pattern_config_t patterns[2] = {};
+  const adc_channel_t channels[2] = {settings::pressure::channel, settings::supply::channel};
+  for (int i = 0; i < 2; i++)
+  {
+    patterns[i].atten = ADC_ATTEN_DB_11;
+    patterns[i].channel = channels[i];
+    patterns[i].unit = 0; // ADC1
+    patterns[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+  }
+
+  adc_digi_configuration_t config = {};
+  config.conv_limit_en = false;
+  config.pattern_num = 2;
+  config.adc_pattern = patterns;
+  config.sample_freq_hz = settings::analog::sampleFrequency;
+  config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+  adc_digi_controller_configure(&config);
+  adc_digi_start();
 }
 
-void cancelMistForDurationRepeatingTask()
+struct GpioRegisters
+{
+  void set(uint8_t bank, uint32_t mask)
+  {
+    if (bank == 0) GPIO.out_w1ts = mask;
+    else GPIO.out1_w1ts.val = mask;
+  }
+
+  void clear(uint8_t bank, uint32_t mask)
+  {
+    if (bank == 0) GPIO.out_w1tc = mask;
+    else GPIO.out1_w1tc.val = mask;
+  }
+};
+GpioRegisters gpioRegisters;
+GpioBatch<GpioRegisters> gpioBatch(gpioRegisters);
+
+void FirmwareHal::writeMist(bool state)
 {
-  if (settings::debug) Serial.println("Repeating mist task CANCELLED");
-  timer.cancel(mistForDurationRepeatingTask);
+  if (state)
+  {
+    // everything still buffered was sampled with the valve closed
+    drainAnalogSamples();
+    pressureMonitor.valveOpened();
+  }
+  else
+  {
+    pressureMonitor.valveClosed();
+  }
+  gpioBatch.write(settings::pins::mistSwitch, state);
+  gpioBatch.apply();
+  flowMeter.valveChanged(state, millis());
 }
 
-bool mistOnFromTimer(void *)
+void FirmwareHal::writeFanPercent(int percent)
 {
-  mistOn();
-  return true; 
+  setPwmPercent(settings::pwm::channel::fan, percent);
 }
 
-void mistOff()
+void FirmwareHal::confirm(uint8_t blinks)
 {
-  if (settings::debug) Serial.println("Turning mist OFF");
-  writeMistState(0);
+  confirmWithStatusLed(blinks);
 }
-bool mistOffFromTimer(void *)
+
+void FirmwareHal::mistSessionStarted()
 {
-  mistOff();
-  return true; 
+  flowMeter.startSession();
 }
 
-void toggleMistState()
+void FirmwareHal::mistSessionEnded()
 {
-  if (settings::debug) Serial.println("Toggling mist pin state");
-  writeMistState(!currentValue.mistState);
+  if (settings::debug) Serial.printf("Mist session ended, %d ml used\n", (int)(flowMeter.sessionLiters() * 1000));
 }
 
-void mistForDuration(size_t duration)
+void FirmwareHal::log(const char *format, ...)
 {
-  if (settings::debug) Serial.printf("Turning mist ON for %d seconds\n", (duration / 1000));
-  mistOn();
-  timer.in(duration, mistOffFromTimer); //(delay, function_to_call)
+  char line[128];
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+  Serial.print(line);
 }
 
-bool mistForDurationFromTimer(void *opaque)
+void updateStatusLed()
 {
-  if (buttonOne.isLongPressed())
+  if (pressureMonitor.clogged() || flowMeter.leaking())
+  {
+    setStatusLedIdle({faultSteps, 2});
+  }
+  else if (controller.vpdControlRunning())
+  {
+    setStatusLedIdle({vpdSteps, 2});
+  }
+  else if (controller.patternRunning())
   {
-    if (settings::debug) Serial.println("mistForDurationFromTimer:  ");
-    if (settings::debug) Serial.println("  Task triggered, but currently misting while button is held,");
-    if (settings::debug) Serial.println("  so this task will be skipped");
+    setStatusLedIdle({patternSteps, 2});
   }
   else
   {
-    size_t duration = (size_t)opaque;
-    mistForDuration(duration);
+    setStatusLedIdle({});
   }
-  return true; 
 }
 
-void mistForDurationRepeating(size_t onDuration, size_t offDuration)
+void FirmwareHal::modeChanged()
 {
-  if (settings::debug) Serial.printf(
-      "Starting mist on/off repeating timer; on for %d seconds, off for %d "
-      "seconds.",
-      (onDuration / 1000), (offDuration / 1000));
-  mistForDuration(
-      onDuration); // timer.every waits for the off duration before first call,
-                   // so we call the function once initially.
-  mistForDurationRepeatingTask = timer.every((offDuration + onDuration), mistForDurationFromTimer,
-                                             (void *)onDuration); // (interval, function_to_call, argument)
+  updateStatusLed();
 }
 
-void fanOn()
+bool readTemperatureFromTimer(void *)
 {
-  if (settings::debug) Serial.println("Turning fan ON");
-  setPwmPercent(settings::pwm::channel::fan, 100);
+  float temperature = temperatureSensor.getTempCByIndex(0);
+  if (temperature == DEVICE_DISCONNECTED_C)
+  {
+    if (settings::debug) Serial.println("Temperature sensor not responding");
+    return false; // the last reading ages until requestTemperatureFromTimer drops it
+  }
+  controller.temperatureMeasured(temperature);
+  return false;
+}
+
+bool requestTemperatureFromTimer(void *)
+{
+  controller.temperatureExpired(settings::thermal::staleAfter);
+  temperatureSensor.requestTemperatures();
+  timer.in(settings::thermal::conversionTime, readTemperatureFromTimer);
+  return true;
+}
+
+void temperatureSetup()
+{
+  temperatureSensor.begin();
+  temperatureSensor.setWaitForConversion(false);
+  requestTemperatureFromTimer(nullptr);
+}
+
+uint8_t sht31Crc(const uint8_t *data)
+{
+  uint8_t crc = 0xFF;
+  for (int i = 0; i < 2; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+bool readClimateFromTimer(void *)
+{
+  uint8_t data[6];
+  if (Wire.requestFrom(settings::climate::address, (uint8_t)sizeof(data)) != sizeof(data))
+  {
+    if (settings::debug) Serial.println("Humidity sensor not responding");
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = Wire.read();
+  }
+  if (sht31Crc(&data[0]) != data[2] || sht31Crc(&data[3]) != data[5])
+  {
+    if (settings::debug) Serial.println("Humidity sensor CRC mismatch");
+    return false;
+  }
+  uint32_t rawTemperature = (data[0] << 8) | data[1];
+  uint32_t rawHumidity = (data[3] << 8) | data[4];
+  int16_t centiCelsius = -4500 + (int32_t)(17500 * rawTemperature / 65535);
+  uint16_t rhCentiPercent = 10000 * rawHumidity / 65535;
+  int32_t vpdPa = vpd::vaporPressureDeficitPa(centiCelsius, rhCentiPercent);
+  controller.climateMeasured(vpdPa, rhCentiPercent / 10);
+  if (settings::debug) Serial.printf("Climate %d.%02dC %d.%02d%%RH, VPD %d Pa\n", centiCelsius / 100, abs(centiCelsius % 100),
+                                     rhCentiPercent / 100, rhCentiPercent % 100, vpdPa);
+  return false;
 }
 
-void fanOff()
+bool requestClimateFromTimer(void *)
 {
-  if (settings::debug) Serial.println("Turning fan OFF");
-  setPwmPercent(settings::pwm::channel::fan, 0);
+  Wire.beginTransmission(settings::climate::address);
+  Wire.write(0x24); // single shot, high repeatability, no clock stretching
+  Wire.write(0x00);
+  if (Wire.endTransmission() == 0)
+  {
+    timer.in(settings::climate::conversionTime, readClimateFromTimer);
+  }
+  return true;
 }
 
-void cancelAllTimerTasks()
+void climateSetup()
 {
-  if (settings::debug) Serial.printf("Cancelling ALL running timer tasks!\n");
-  timer.cancel();
+  Wire.begin(settings::pins::sda, settings::pins::scl);
 }
 
-void cancelAllTimerTasksAndTurnOffMistAndFan()
+// GPIO1-14 double as touch channels 1-14, so the button pins work as pads.
+const touch_pad_t touchPads[] = {(touch_pad_t)settings::pins::buttonOne, (touch_pad_t)settings::pins::buttonTwo,
+                                 (touch_pad_t)settings::pins::buttonThree};
+constexpr size_t touchPadCount = sizeof(touchPads) / sizeof(touchPads[0]);
+TouchTracker touchTrackers[touchPadCount];
+volatile uint32_t touchActiveMask = 0;
+
+// The hardware compares each pad against its threshold and interrupts on
+// touch and release, so nothing polls the pads.
+void IRAM_ATTR touchIsr(void *)
 {
-  cancelAllTimerTasks();
-  mistOff();
-  fanOff();
+  touch_pad_read_intr_status_mask();
+  touchActiveMask = touch_pad_get_status();
 }
 
-void implementTimeout()
+bool touchPressed(size_t index)
 {
-  if (settings::debug) Serial.println("Timeout timer task has executed, doing timeout task now...");
-  cancelAllTimerTasksAndTurnOffMistAndFan();
-  // go to sleep? need to add (deep)sleep mode.
+  return touchActiveMask & BIT(touchPads[index]);
 }
 
-bool implementTimeoutFromTimer(void *)
+// Follow the slow drift of the untouched readings and move the hardware
+// thresholds along with it.
+bool retuneTouchFromTimer(void *)
 {
-  implementTimeout();
+  for (size_t i = 0; i < touchPadCount; i++)
+  {
+    uint32_t smooth = 0;
+    touch_pad_filter_read_smooth(touchPads[i], &smooth);
+    touchTrackers[i].track(smooth, touchPressed(i));
+    touch_pad_set_thresh(touchPads[i], touchTrackers[i].thresholdDelta());
+  }
+  touch_pad_sleep_set_threshold(touchPads[0], touchTrackers[0].thresholdDelta());
   return true;
 }
 
-void createTimeoutTimer()
+void touchSetup()
 {
-  if (settings::debug) Serial.print("Timeout timer (re)set, timeout in (ms): ");
-  if (settings::debug) Serial.println(settings::delays::timeout);
-  timeoutTimerTask = timer.in(settings::delays::timeout, implementTimeoutFromTimer);
+  if (settings::debug) Serial.println("Setting up touch pads...");
+  touch_pad_init();
+  for (size_t i = 0; i < touchPadCount; i++)
+  {
+    touch_pad_config(touchPads[i]);
+  }
+
+  touch_filter_config_t filter = {};
+  filter.mode = TOUCH_PAD_FILTER_IIR_16;
+  filter.debounce_cnt = 1;
+  filter.noise_thr = 0;
+  filter.jitter_step = 4;
+  filter.smh_lvl = TOUCH_PAD_SMOOTH_IIR_2;
+  touch_pad_filter_set_config(&filter);
+  touch_pad_filter_enable();
+
+  touch_pad_isr_register(touchIsr, nullptr, (touch_pad_intr_mask_t)(TOUCH_PAD_INTR_MASK_ACTIVE | TOUCH_PAD_INTR_MASK_INACTIVE));
+  touch_pad_intr_enable((touch_pad_intr_mask_t)(TOUCH_PAD_INTR_MASK_ACTIVE | TOUCH_PAD_INTR_MASK_INACTIVE));
+  touch_pad_set_fsm_mode(TOUCH_FSM_MODE_TIMER);
+  touch_pad_fsm_start();
+
+  // the S2 keeps a single pad scanning in sleep, button one wakes the unit
+  touch_pad_sleep_channel_enable(touchPads[0], true);
+
+  // let the filter settle before taking the first baselines
+  delay(100);
+  retuneTouchFromTimer(nullptr);
 }
 
-void resetTimeoutTimer()
+void enableTouchWakeup()
 {
-  timer.cancel(timeoutTimerTask);
-  createTimeoutTimer();
+  if (settings::input::touch) esp_sleep_enable_touchpad_wakeup();
 }
 
-// This function will be called when the button1 was pressed 1 time (and no 2.
-// button press followed).
-void clickOne()
+EncoderAccelerator encoderAccelerator;
+
+bool readEncoderFromTimer(void *)
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 1 click.");
-  mistForDuration(1000);
+  int16_t count = 0;
+  pcnt_get_counter_value(settings::encoder::unit, &count);
+  int32_t steps = encoderAccelerator.counterRead(count, settings::encoder::countLimit, millis());
+  if (steps == 0) return true;
+  controller.encoderTurned(steps);
+  return true;
 }
 
-// This function will be called when the button1 was pressed 2 times in a short
-// timeframe.
-void doubleclickOne()
+// Full quadrature decoding in the pulse counter: each channel counts the
+// edges of one signal, with the other one deciding the direction.
+void encoderSetup()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 1 doubleclick.");
-  // mist for 1 second every 30 seconds
-  mistForDurationRepeating(1000, 30000);
+  pcnt_config_t config = {};
+  config.unit = settings::encoder::unit;
+  config.counter_h_lim = settings::encoder::countLimit;
+  config.counter_l_lim = -settings::encoder::countLimit;
+
+  config.channel = PCNT_CHANNEL_0;
+  config.pulse_gpio_num = settings::pins::encoderA;
+  config.ctrl_gpio_num = settings::pins::encoderB;
+  config.pos_mode = PCNT_COUNT_DEC;
+  config.neg_mode = PCNT_COUNT_INC;
+  config.lctrl_mode = PCNT_MODE_REVERSE;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  pcnt_unit_config(&config);
+
+  config.channel = PCNT_CHANNEL_1;
+  config.pulse_gpio_num = settings::pins::encoderB;
+  config.ctrl_gpio_num = settings::pins::encoderA;
+  config.pos_mode = PCNT_COUNT_INC;
+  config.neg_mode = PCNT_COUNT_DEC;
+  pcnt_unit_config(&config);
+
+  pcnt_set_filter_value(settings::encoder::unit, settings::encoder::glitchFilter);
+  pcnt_filter_enable(settings::encoder::unit);
+  pcnt_counter_pause(settings::encoder::unit);
+  pcnt_counter_clear(settings::encoder::unit);
+  pcnt_counter_resume(settings::encoder::unit);
 }
 
-// This function will be called once, when the button1 is pressed for a long
-// time.
-void longPressStartOne()
+OccupancyTracker occupancyTracker(settings::occupancy::vacancyDelay);
+volatile unsigned long occupancyMotionAt = 0;
+
+void IRAM_ATTR occupancyIsr()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 1 longPress start");
+  occupancyMotionAt = millis();
 }
 
-// This function will be called often, while the button1 is pressed for a long
-// time.
-void longPressOne()
+bool checkOccupancyFromTimer(void *)
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 1 longPress...");
-  mistOn();
+  bool motion = digitalRead(settings::pins::occupancy);
+  OccupancyTracker::Event event = occupancyTracker.update(millis(), occupancyMotionAt, motion);
+  if (event == OccupancyTracker::vacated) controller.suspendForVacancy();
+  else if (event == OccupancyTracker::occupied) controller.resumeForOccupancy();
+  return true;
 }
 
-// This function will be called once, when the button1 is released after beeing
-// pressed for a long time.
-void longPressStopOne()
+void occupancySetup()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 1 longPress stop");
-  mistOff();
+  pinMode(settings::pins::occupancy, INPUT);
+  attachInterrupt(digitalPinToInterrupt(settings::pins::occupancy), occupancyIsr, RISING);
+  occupancyMotionAt = millis();
 }
 
-// this function will be called when the button was pressed multiple times in a
-// short timeframe.
-void multiClickOne()
+bool readFlowFromTimer(void *)
 {
-  resetTimeoutTimer();
-  int n = buttonOne.getNumberClicks();
-  if (settings::debug) Serial.printf("multiclick detected, n=%d. \n", n);
-  if (n == 3)
+  int16_t count = 0;
+  pcnt_get_counter_value(settings::flow::unit, &count);
+  int32_t pulses = count - flowLastCount;
+  flowLastCount = count;
+  if (pulses < 0) pulses += settings::flow::countLimit; // the counter wrapped
+
+  unsigned long now = millis();
+  bool wasLeaking = flowMeter.leaking();
+  flowMeter.addPulses(pulses, now);
+  if (flowMeter.leaking() && !wasLeaking)
   {
-    mistForDurationRepeating(1000, 15000);
+    if (settings::debug) Serial.println("Flow while the valve is closed, leak suspected!");
+    trace(traceCode::fault, 2);
+    updateStatusLed();
   }
-  else if (n == 4)
+
+  if (now - flowDayStartedAt >= settings::flow::day)
   {
-    mistForDurationRepeating(3000, 30000);
+    if (settings::debug) Serial.printf("Water used in the last day: %d ml\n", (int)(flowMeter.dayLiters() * 1000));
+    flowMeter.startDay();
+    flowDayStartedAt = now;
   }
-  else if (n == 5)
+  return true;
+}
+
+void flowSetup()
+{
+  pcnt_config_t config = {};
+  config.unit = settings::flow::unit;
+  config.channel = PCNT_CHANNEL_0;
+  config.pulse_gpio_num = settings::pins::flowMeter;
+  config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+  config.pos_mode = PCNT_COUNT_INC;
+  config.neg_mode = PCNT_COUNT_DIS;
+  config.lctrl_mode = PCNT_MODE_KEEP;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.counter_h_lim = settings::flow::countLimit;
+  config.counter_l_lim = 0;
+  pcnt_unit_config(&config);
+
+  pcnt_set_filter_value(settings::flow::unit, settings::flow::glitchFilter);
+  pcnt_filter_enable(settings::flow::unit);
+  pcnt_counter_pause(settings::flow::unit);
+  pcnt_counter_clear(settings::flow::unit);
+  pcnt_counter_resume(settings::flow::unit);
+  flowDayStartedAt = millis();
+}
+
+void buttonTick();
+bool readIrFromTimer(void *);
+bool readModbusFromTimer(void *);
+bool readFleetFromTimer(void *);
+bool evaluateRulesFromTimer(void *);
+bool readConsoleFromTimer(void *);
+bool takeSnapshotFromTimer(void *);
+bool applyWebWritesFromTimer(void *);
+bool sendWebEventsFromTimer(void *);
+bool sendFleetStatusFromTimer(void *);
+
+bool buttonTickFromTimer(void *)
+{
+  buttonTick();
+  return true;
+}
+
+// Tasks that must keep running no matter which mist/fan tasks are cancelled.
+void createBackgroundTasks()
+{
+  timer.every(0, buttonTickFromTimer);
+  if (settings::input::touch)
   {
-    mistForDurationRepeating(3000, 15000);
+    timer.every(settings::input::touchRetune, retuneTouchFromTimer);
   }
-  else
+  timer.every(settings::encoder::pollInterval, readEncoderFromTimer);
+  timer.every(settings::ir::pollInterval, readIrFromTimer);
+  timer.every(settings::modbus::pollInterval, readModbusFromTimer);
+  timer.every(settings::fleet::pollInterval, readFleetFromTimer);
+  timer.every(settings::fleet::statusInterval, sendFleetStatusFromTimer);
+  timer.every(settings::rules::evaluateInterval, evaluateRulesFromTimer);
+  timer.every(settings::rules::consoleInterval, readConsoleFromTimer);
+  timer.every(settings::crash::snapshotInterval, takeSnapshotFromTimer);
+  if (settings::web::ssid[0] != '\0')
   {
+    timer.every(settings::web::applyInterval, applyWebWritesFromTimer);
+    timer.every(settings::web::eventInterval, sendWebEventsFromTimer);
   }
+  timer.every(settings::occupancy::checkInterval, checkOccupancyFromTimer);
+  timer.every(settings::flow::readInterval, readFlowFromTimer);
+  timer.every(settings::analog::drainInterval, drainAnalogSamplesFromTimer);
+  timer.every(settings::thermal::readInterval, requestTemperatureFromTimer);
+  timer.every(settings::climate::readInterval, requestClimateFromTimer);
 }
 
-void clickTwo()
+// Light sleep until a button or the PIR wakes the unit.
+void FirmwareHal::sleep()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 2 click.");
-  fanOn();
+  if (!settings::input::touch)
+  {
+    gpio_wakeup_enable((gpio_num_t)settings::pins::buttonOne, GPIO_INTR_LOW_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)settings::pins::buttonTwo, GPIO_INTR_LOW_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)settings::pins::buttonThree, GPIO_INTR_LOW_LEVEL);
+  }
+  gpio_wakeup_enable((gpio_num_t)settings::pins::occupancy, GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  enableTouchWakeup();
+  if (settings::debug) Serial.flush();
+  esp_light_sleep_start();
+
+  // The wakeup levels replace the pins' interrupt types; the buttons are
+  // polled and need none, the PIR goes back to its edge interrupt.
+  if (!settings::input::touch)
+  {
+    gpio_wakeup_disable((gpio_num_t)settings::pins::buttonOne);
+    gpio_wakeup_disable((gpio_num_t)settings::pins::buttonTwo);
+    gpio_wakeup_disable((gpio_num_t)settings::pins::buttonThree);
+  }
+  gpio_wakeup_disable((gpio_num_t)settings::pins::occupancy);
+  gpio_set_intr_type((gpio_num_t)settings::pins::occupancy, GPIO_INTR_POSEDGE);
 }
 
-void doubleclickTwo()
+// Button events for the automation rules, collected until the next
+// evaluation: bit (button - 1) * 8 + clicks.
+uint32_t ruleEvents = 0;
+
+void ruleEvent(int button, int clicks)
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 2 doubleclick.");
-  fanOff();
+  if (clicks > 7) clicks = 7;
+  ruleEvents |= 1UL << ((button - 1) * 8 + clicks);
 }
 
-void longPressStartTwo()
+void FirmwareHal::buttonEvent(int button, int clicks)
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 2 longPress start");
+  ruleEvent(button, clicks);
 }
 
-void longPressTwo()
+void acknowledgeFaults()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 2 longPress...");
+  flowMeter.clearLeak();
+  pressureMonitor.relearn();
+  updateStatusLed();
 }
 
-void longPressStopTwo()
+void FirmwareHal::acknowledgeFaults()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 2 longPress stop");
+  ::acknowledgeFaults();
 }
 
-void multiClickTwo()
+// OneButton callbacks, the gestures themselves are handled by the controller.
+void clickOne() { controller.clicked(1, 1); }
+void doubleclickOne() { controller.clicked(1, 2); }
+void multiClickOne() { controller.clicked(1, buttonOne.getNumberClicks()); }
+void longPressStartOne() { controller.longPressStarted(1); }
+void longPressOne() { controller.longPressed(1); }
+void longPressStopOne() { controller.longPressStopped(1); }
+
+void clickTwo() { controller.clicked(2, 1); }
+void doubleclickTwo() { controller.clicked(2, 2); }
+void multiClickTwo() { controller.clicked(2, buttonTwo.getNumberClicks()); }
+void longPressStartTwo() { controller.longPressStarted(2); }
+void longPressTwo() { controller.longPressed(2); }
+void longPressStopTwo() { controller.longPressStopped(2); }
+
+void clickThree() { controller.clicked(3, 1); }
+void doubleclickThree() { controller.clicked(3, 2); }
+void multiClickThree() { controller.clicked(3, buttonThree.getNumberClicks()); }
+void longPressStartThree() { controller.longPressStarted(3); }
+void longPressThree() { controller.longPressed(3); }
+void longPressStopThree() { controller.longPressStopped(3); }
+
+RingbufHandle_t irRingbuffer;
+int8_t irLastToggle = -1;
+
+// Remote keys trigger the same handlers as the buttons.
+void dispatchIrCode(const IrCode &code)
 {
-  resetTimeoutTimer();
-  int n = buttonTwo.getNumberClicks();
-  if (n == 3)
+  if (code.repeat || code.address != settings::ir::address) return;
+  namespace key = settings::ir::key;
+  bool nec = code.protocol == IrCode::nec;
+  uint8_t command = code.command;
+  int digit = -1;
+  if (nec)
   {
-    if (settings::debug) Serial.println("tripleClick detected.");
+    const uint8_t digits[] = {key::necOne, key::necTwo, key::necThree, key::necFour, key::necFive};
+    for (int i = 0; i < 5; i++)
+    {
+      if (command == digits[i]) digit = i + 1;
+    }
   }
-  else if (n == 4)
+  else if (command >= 1 && command <= 5)
   {
-    if (settings::debug) Serial.println("quadrupleClick detected.");
+    digit = command;
   }
-  else
+
+  if (digit == 1) clickOne();
+  else if (digit == 2) doubleclickOne();
+  else if (digit >= 3)
+  {
+    controller.resetTimeoutTimer();
+    controller.startMistPattern(digit);
+  }
+  else if (command == (nec ? key::necFanOn : key::rc5FanOn)) clickTwo();
+  else if (command == (nec ? key::necFanOff : key::rc5FanOff)) doubleclickTwo();
+  else if (command == (nec ? key::necStopPattern : key::rc5StopPattern)) clickThree();
+  else if (command == (nec ? key::necStopAll : key::rc5StopAll)) doubleclickThree();
+  else if (settings::debug) Serial.printf("IR command 0x%02x not mapped\n", command);
+}
+
+// The RMT captures whole frames into its ring buffer on its own, this only
+// decodes the finished ones.
+bool readIrFromTimer(void *)
+{
+  size_t length = 0;
+  rmt_item32_t *items = (rmt_item32_t *)xRingbufferReceive(irRingbuffer, &length, 0);
+  if (items == nullptr) return true;
+
+  IrSymbol symbols[72]; // NEC needs 34, RC5 at most 14
+  size_t count = length / sizeof(rmt_item32_t);
+  if (count > sizeof(symbols) / sizeof(symbols[0])) count = sizeof(symbols) / sizeof(symbols[0]);
+  for (size_t i = 0; i < count; i++)
+  {
+    symbols[i] = {(uint16_t)items[i].duration0, (uint8_t)items[i].level0, (uint16_t)items[i].duration1, (uint8_t)items[i].level1};
+  }
+  vRingbufferReturnItem(irRingbuffer, items);
+
+  IrCode code;
+  if (ir::decodeNec(symbols, count, code) || ir::decodeRc5(symbols, count, code, irLastToggle))
   {
-    if (settings::debug) Serial.print("multiClick(");
-    if (settings::debug) Serial.print(n);
-    if (settings::debug) Serial.println(") detected.");
+    if (settings::debug) Serial.printf("IR %s address 0x%02x command 0x%02x%s\n", code.protocol == IrCode::nec ? "NEC" : "RC5",
+                                       code.address, code.command, code.repeat ? " (repeat)" : "");
+    dispatchIrCode(code);
   }
+  return true;
+}
+
+void irSetup()
+{
+  rmt_config_t config = RMT_DEFAULT_CONFIG_RX((gpio_num_t)settings::pins::irReceiver, settings::ir::channel);
+  config.clk_div = settings::ir::clockDivider;
+  config.rx_config.filter_en = true;
+  config.rx_config.filter_ticks_thresh = settings::ir::glitchFilter;
+  config.rx_config.idle_threshold = settings::ir::frameGap;
+  rmt_config(&config);
+  rmt_driver_install(settings::ir::channel, 1024, 0);
+  rmt_get_ringbuf_handle(settings::ir::channel, &irRingbuffer);
+  rmt_rx_start(settings::ir::channel, true);
+}
+
+// The register map of include/remoteRegisters.h.
+struct RemoteRegisters
+{
+  modbus::Exception read(uint16_t address, uint16_t &value)
+  {
+    uint32_t waterTotal = flowMeter.totalLiters() * 1000;
+    uint32_t waterDay = flowMeter.dayLiters() * 1000;
+    const CurrentValue &current = controller.current();
+    switch (address)
+    {
+    case remoteRegister::fanPercent: value = current.fanPercent; break;
+    case remoteRegister::fanAppliedPercent: value = controller.fanAppliedPercent(); break;
+    case remoteRegister::mist: value = controller.mistState(); break;
+    case remoteRegister::patternMode: value = controller.patternMode(); break;
+    case remoteRegister::patternOnSeconds: value = controller.patternRunning() ? current.patternOnDuration / 1000 : 0; break;
+    case remoteRegister::patternOffSeconds: value = controller.patternRunning() ? current.patternOffDuration / 1000 : 0; break;
+    case remoteRegister::mistFraction: value = current.mistFractionPercent; break;
+    case remoteRegister::vpd: value = current.vpdPa < 0 ? 0xFFFF : current.vpdPa; break;
+    case remoteRegister::temperature: value = controller.thermal().temperatureRegister(); break;
+    case remoteRegister::supplyMillivolts: value = supplyMonitor.lastMillivolts(); break;
+    case remoteRegister::faults:
+      value = pressureMonitor.clogged() | flowMeter.leaking() << 1 |
+              (supplyMonitor.currentState() == SupplyMonitor::sagging) << 2 |
+              (supplyMonitor.currentState() == SupplyMonitor::critical) << 3;
+      break;
+    case remoteRegister::waterTotalHigh: value = waterTotal >> 16; break;
+    case remoteRegister::waterTotalLow: value = waterTotal & 0xFFFF; break;
+    case remoteRegister::waterDayHigh: value = waterDay >> 16; break;
+    case remoteRegister::waterDayLow: value = waterDay & 0xFFFF; break;
+    case remoteRegister::humidity: value = current.humidityPermille < 0 ? 0xFFFF : current.humidityPermille; break;
+    case remoteRegister::patternSelect:
+    case remoteRegister::stopAll: value = 0; break;
+    default: return modbus::illegalAddress;
+    }
+    return modbus::none;
+  }
+
+  // Writes from the building controller, the web page or the fleet count as
+  // activity; the automation rules pass activity = false, or a rule firing
+  // on a sensor reading would keep the unit awake for good.
+  modbus::Exception write(uint16_t address, uint16_t value, bool activity = true)
+  {
+    switch (address)
+    {
+    case remoteRegister::fanPercent:
+      if (value > 100) return modbus::illegalValue;
+      controller.requestFanPercent(value);
+      break;
+    case remoteRegister::mist:
+      if (value > 1) return modbus::illegalValue;
+      if (value) controller.mistHold(mistSource::remote);
+      else controller.mistRelease(mistSource::remote);
+      break;
+    case remoteRegister::patternSelect:
+      if (!controller.selectPattern(value)) return modbus::illegalValue;
+      break;
+    case remoteRegister::faults:
+      acknowledgeFaults();
+      break;
+    case remoteRegister::stopAll:
+      if (value != 1) return modbus::illegalValue;
+      controller.cancelAllTimerTasksAndTurnOffMistAndFan();
+      break;
+    default:
+      return modbus::illegalAddress;
+    }
+    trace(traceCode::remoteWrite, address);
+    if (activity) controller.resetTimeoutTimer();
+    return modbus::none;
+  }
+};
+RemoteRegisters remoteRegisters;
+ModbusSlave<RemoteRegisters> modbusSlave(settings::modbus::address, remoteRegisters);
+QueueHandle_t modbusQueue;
+ModbusFramer modbusFramer;
+
+// The UART driver's interrupt handler collects the bytes and reports a
+// finished frame with a receive timeout event, so nothing here ever waits
+// on the bus.
+bool readModbusFromTimer(void *)
+{
+  uart_event_t event;
+  while (xQueueReceive(modbusQueue, &event, 0))
+  {
+    if (event.type != UART_DATA)
+    {
+      // overflow, parity or framing error: the frame in progress is lost
+      uart_flush_input(settings::modbus::port);
+      xQueueReset(modbusQueue);
+      modbusFramer.discard();
+      return true;
+    }
+
+    uint8_t chunk[64];
+    for (size_t left = event.size; left > 0;)
+    {
+      size_t length = left < sizeof(chunk) ? left : sizeof(chunk);
+      uart_read_bytes(settings::modbus::port, chunk, length, 0);
+      modbusFramer.received(chunk, length);
+      left -= length;
+    }
+    if (!event.timeout_flag) continue;
+
+    size_t frameLength = modbusFramer.ended();
+    if (frameLength == 0) continue;
+    uint8_t response[modbus::maxFrame];
+    size_t responseLength = modbusSlave.handle(modbusFramer.frame(), frameLength, response);
+    if (responseLength > 0) uart_write_bytes(settings::modbus::port, response, responseLength);
+  }
+  return true;
+}
+
+void modbusSetup()
+{
+  uart_config_t config = {};
+  config.baud_rate = settings::modbus::baudRate;
+  config.data_bits = UART_DATA_8_BITS;
+  config.parity = UART_PARITY_EVEN; // Modbus RTU default 8E1
+  config.stop_bits = UART_STOP_BITS_1;
+  config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  config.source_clk = UART_SCLK_APB;
+  uart_driver_install(settings::modbus::port, settings::modbus::rxBufferBytes, settings::modbus::txBufferBytes, 8,
+                      &modbusQueue, 0);
+  uart_param_config(settings::modbus::port, &config);
+  uart_set_pin(settings::modbus::port, settings::pins::modbusTx, settings::pins::modbusRx,
+               settings::pins::modbusEnable, UART_PIN_NO_CHANGE);
+  uart_set_mode(settings::modbus::port, UART_MODE_RS485_HALF_DUPLEX); // RTS drives DE
+  uart_set_rx_timeout(settings::modbus::port, settings::modbus::frameGap);
+}
+
+void sendFleetFrame(const fleet::Frame &frame)
+{
+  twai_message_t message = {};
+  message.identifier = frame.id;
+  message.data_length_code = fleet::frameBytes;
+  for (uint8_t i = 0; i < fleet::frameBytes; i++) message.data[i] = frame.data[i];
+  if (twai_transmit(&message, 0) != ESP_OK && settings::debug) Serial.println("CAN transmit queue full, report dropped");
+}
+
+void sendFleetStatus()
+{
+  fleet::StatusReport report;
+  uint16_t value;
+  remoteRegisters.read(remoteRegister::patternMode, value);
+  report.patternMode = value;
+  remoteRegisters.read(remoteRegister::faults, value);
+  report.faults = value;
+  report.fanPercent = controller.current().fanPercent;
+  report.fanAppliedPercent = controller.fanAppliedPercent();
+  report.flags = controller.mistState() | controller.current().vacant << 1;
+  report.supplyDecivolts = supplyMonitor.lastMillivolts() / 100;
+  report.vpdPa = controller.current().vpdPa < 0 ? 0xFFFF : controller.current().vpdPa;
+  sendFleetFrame(fleet::statusFrame(settings::fleet::node, report));
+}
+
+bool sendFleetStatusFromTimer(void *)
+{
+  sendFleetStatus();
+  return true;
+}
+
+FleetNode<RemoteRegisters> fleetNode(settings::fleet::node, remoteRegisters);
+
+void dispatchFleetCommand(const twai_message_t &message)
+{
+  if (message.extd || message.rtr || message.data_length_code != fleet::frameBytes) return;
+  fleet::Frame command = {};
+  command.id = message.identifier;
+  for (uint8_t i = 0; i < fleet::frameBytes; i++) command.data[i] = message.data[i];
+  fleet::Frame answer;
+  switch (fleetNode.handle(command, answer))
+  {
+  case FleetNode<RemoteRegisters>::reply: sendFleetFrame(answer); break;
+  case FleetNode<RemoteRegisters>::statusReport: sendFleetStatus(); break;
+  case FleetNode<RemoteRegisters>::none: break;
+  }
+}
+
+// The acceptance filter drops everything not addressed to this unit in
+// hardware, so only relevant frames ever reach the receive queue.
+bool readFleetFromTimer(void *)
+{
+  twai_message_t message;
+  while (twai_receive(&message, 0) == ESP_OK)
+  {
+    dispatchFleetCommand(message);
+  }
+
+  twai_status_info_t status;
+  if (twai_get_status_info(&status) == ESP_OK)
+  {
+    if (status.state == TWAI_STATE_BUS_OFF)
+    {
+      if (settings::debug) Serial.println("CAN bus off, recovering");
+      twai_initiate_recovery();
+    }
+    else if (status.state == TWAI_STATE_STOPPED)
+    {
+      twai_start(); // recovery finished
+    }
+  }
+  return true;
+}
+
+void fleetSetup()
+{
+  twai_general_config_t general = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)settings::pins::canTx,
+                                                              (gpio_num_t)settings::pins::canRx, TWAI_MODE_NORMAL);
+  twai_timing_config_t timing = TWAI_TIMING_CONFIG_125KBITS(); // long runs between units
+  twai_filter_config_t filter = {};
+  fleet::acceptanceFilter(settings::fleet::node, filter.acceptance_code, filter.acceptance_mask);
+  filter.single_filter = false;
+  twai_driver_install(&general, &timing, &filter);
+  twai_start();
+}
+
+// User automations, see tools/compileRules.py. Rules read the remote
+// registers plus button events and act by writing remote registers.
+constexpr uint8_t ruleButtonEvents = 128; // button N clicked M times is input 128 + (N - 1) * 8 + M
+
+struct RuleMachine
+{
+  int32_t read(uint8_t input)
+  {
+    if (input >= ruleButtonEvents) return input < ruleButtonEvents + 24 && (ruleEvents >> (input - ruleButtonEvents) & 1);
+    uint16_t value = 0;
+    if (remoteRegisters.read(input, value) != modbus::none) return 0;
+    // unmeasured values (0xFFFF) read as -1, and temperature is signed
+    if (value == 0xFFFF || input == remoteRegister::temperature) return (int16_t)value;
+    return value;
+  }
+
+  void write(uint8_t output, int32_t value)
+  {
+    modbus::Exception exception = value < 0 || value > 0xFFFF ? modbus::illegalValue : remoteRegisters.write(output, value, false);
+    if (exception != modbus::none && settings::debug)
+      Serial.printf("Rule write of %d to register %d rejected (%d)\n", value, output, exception);
+  }
+};
+RuleMachine ruleMachine;
+RuleEngine<RuleMachine> ruleEngine;
+
+bool evaluateRulesFromTimer(void *)
+{
+  size_t fired = ruleEngine.evaluate(ruleMachine);
+  if (fired > 0)
+  {
+    if (settings::debug) Serial.println("Rule fired");
+    trace(traceCode::rule, fired);
+  }
+  ruleEvents = 0;
+  return true;
+}
+
+void storeRules()
+{
+  Preferences preferences;
+  preferences.begin(settings::rules::storage, false);
+  if (ruleEngine.ruleCount() == 0) preferences.remove(settings::rules::key);
+  else preferences.putBytes(settings::rules::key, ruleEngine.program(), ruleEngine.programLength());
+  preferences.end();
+}
+
+void rulesSetup()
+{
+  uint8_t program[rules::maxProgram];
+  Preferences preferences;
+  preferences.begin(settings::rules::storage, true);
+  size_t length = preferences.getBytes(settings::rules::key, program, sizeof(program));
+  preferences.end();
+  if (length > 0 && !ruleEngine.load(program, length) && settings::debug) Serial.println("Stored rules are invalid");
+}
+
+int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// "rules <hex>" loads and stores a compiled program, "rules clear" removes
+// it, "rules" shows what is loaded.
+void rulesCommand(const char *argument)
+{
+  if (*argument == '\0')
+  {
+    Serial.printf("%d rules, %d bytes\n", (int)ruleEngine.ruleCount(), (int)ruleEngine.programLength());
+    return;
+  }
+  if (strcmp(argument, "clear") == 0)
+  {
+    ruleEngine.clear();
+    storeRules();
+    Serial.println("Rules cleared");
+    return;
+  }
+
+  uint8_t program[rules::maxProgram];
+  size_t length = 0;
+  for (; argument[0] && argument[1] && length < sizeof(program); argument += 2)
+  {
+    int high = hexDigit(argument[0]), low = hexDigit(argument[1]);
+    if (high < 0 || low < 0) break;
+    program[length++] = high << 4 | low;
+  }
+  if (*argument != '\0' || !ruleEngine.load(program, length))
+  {
+    Serial.println("Invalid rules, nothing changed");
+    return;
+  }
+  storeRules();
+  Serial.printf("Loaded %d rules\n", (int)ruleEngine.ruleCount());
+}
+
+using SavedState = Controller<FirmwareHal>::State;
+
+// Kept in RTC memory by the snapshot timer, so a brown-out (the supply
+// sagging under the pump or fan) does not lose the running pattern.
+RTC_NOINIT_ATTR SavedState retainedState;
+
+void restoreState(const SavedState &state)
+{
+  controller.restore(state);
+  // presence is measured, not restored; the tracker reports vacancy again if the space is still empty
+  if (controller.current().vacant && !occupancyTracker.isVacant()) controller.resumeForOccupancy();
 }
 
-void clickThree()
+// Called at the end of setup(). Returns true if the state from before a
+// brown-out was restored.
+bool resumeAfterBrownout()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 3 click.");
-  cancelMistForDurationRepeatingTask();
+  if (!settings::crash::resumeAfterBrownout || esp_reset_reason() != ESP_RST_BROWNOUT) return false;
+  if (!retainedState.valid()) return false;
+  restoreState(retainedState);
+  return true;
 }
 
-void doubleclickThree()
+// "state" prints the controller state as hex, "state <hex>" restores one
+// printed before, on this or another unit with the same firmware.
+void stateCommand(const char *argument)
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 3 doubleclick.");
-  cancelAllTimerTasksAndTurnOffMistAndFan();
+  SavedState state;
+  if (*argument == '\0')
+  {
+    state = controller.capture();
+    Serial.print("state ");
+    const uint8_t *bytes = (const uint8_t *)&state;
+    for (size_t i = 0; i < sizeof(state); i++) Serial.printf("%02x", bytes[i]);
+    Serial.println();
+    return;
+  }
+
+  uint8_t *bytes = (uint8_t *)&state;
+  size_t length = 0;
+  for (; argument[0] && argument[1] && length < sizeof(state); argument += 2)
+  {
+    int high = hexDigit(argument[0]), low = hexDigit(argument[1]);
+    if (high < 0 || low < 0) break;
+    bytes[length++] = high << 4 | low;
+  }
+  if (*argument != '\0' || length != sizeof(state) || !state.valid() || !config::consistent(state.config))
+  {
+    Serial.println("Invalid state, nothing changed");
+    return;
+  }
+  restoreState(state);
+  Serial.println("State restored");
 }
 
-void longPressStartThree()
+ControllerSnapshot takeSnapshot()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 3 longPress start");
+  ControllerSnapshot snapshot = {};
+  uint16_t value;
+  snapshot.uptime = millis();
+  snapshot.fanPercent = controller.current().fanPercent;
+  snapshot.fanAppliedPercent = controller.fanAppliedPercent();
+  snapshot.mist = controller.mistState();
+  remoteRegisters.read(remoteRegister::patternMode, value);
+  snapshot.patternMode = value;
+  remoteRegisters.read(remoteRegister::faults, value);
+  snapshot.faults = value;
+  snapshot.supplyState = supplyMonitor.currentState();
+  snapshot.vpdPa = controller.current().vpdPa;
+  snapshot.supplyMillivolts = supplyMonitor.lastMillivolts();
+  return snapshot;
 }
 
-void longPressThree()
+bool takeSnapshotFromTimer(void *)
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 3 longPress...");
+  lastSnapshot = takeSnapshot();
+  retainedState = controller.capture();
+  return true;
 }
 
-void longPressStopThree()
+// Runs first thing in setup(). After a crash the trace and snapshot left in
+// RTC memory, plus the panic handler's core dump summary, are stored in NVS
+// for tools/decodeCrash.py; then a fresh trace starts.
+void captureCrash()
 {
-  resetTimeoutTimer();
-  if (settings::debug) Serial.println("Button 3 longPress stop");
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool crashed = reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+                 reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+  bool retained = traceMagic == crash::magic && traceLog.plausible(); // RTC memory is garbage after power-on
+
+  if (crashed)
+  {
+    CrashRecord record = {};
+    record.magic = crash::magic;
+    record.version = crash::version;
+    record.resetReason = reason;
+#ifdef HAVE_CORE_DUMP_SUMMARY
+    esp_core_dump_summary_t summary;
+    if (esp_core_dump_image_check() == ESP_OK && esp_core_dump_get_summary(&summary) == ESP_OK)
+    {
+      record.pc = summary.exc_pc;
+      record.exceptionCause = summary.ex_info.exc_cause;
+      record.exceptionAddress = summary.ex_info.exc_vaddr;
+      memcpy(record.registers, summary.ex_info.exc_a, sizeof(record.registers));
+      record.backtraceDepth = summary.exc_bt_info.depth < crash::backtraceLength ? summary.exc_bt_info.depth : crash::backtraceLength;
+      for (size_t i = 0; i < record.backtraceDepth; i++) record.backtrace[i] = summary.exc_bt_info.bt[i];
+      strncpy(record.task, summary.exc_task, sizeof(record.task));
+      memcpy(record.elfSha256, summary.app_elf_sha256, sizeof(record.elfSha256));
+      esp_core_dump_image_erase(); // a later reset without a panic must not reuse it
+    }
+#endif
+    if (retained)
+    {
+      record.state = lastSnapshot;
+      record.eventCount = traceLog.count;
+      for (size_t i = 0; i < traceLog.count; i++) record.events[i] = traceLog.event(i);
+    }
+    record.seal();
+
+    Preferences preferences;
+    preferences.begin(settings::rules::storage, false);
+    preferences.putBytes(settings::crash::key, &record, sizeof(record));
+    preferences.end();
+    if (settings::debug) Serial.printf("Crash record stored, reset reason %d, pc 0x%08x\n", reason, record.pc);
+  }
+
+  traceMagic = crash::magic;
+  traceLog.clear();
+  trace(traceCode::boot, reason);
 }
 
-void multiClickThree()
+// "crash" prints the stored crash record as hex for tools/decodeCrash.py,
+// "crash clear" removes it.
+void crashCommand(const char *argument)
 {
-  resetTimeoutTimer();
-  int n = buttonThree.getNumberClicks();
-  if (n == 3)
+  Preferences preferences;
+  preferences.begin(settings::rules::storage, false);
+  if (strcmp(argument, "clear") == 0)
   {
-    if (settings::debug) Serial.println("tripleClick detected.");
+    preferences.remove(settings::crash::key);
+    Serial.println("Crash record cleared");
   }
-  else if (n == 4)
+  else
   {
-    if (settings::debug) Serial.println("quadrupleClick detected.");
+    CrashRecord record;
+    if (preferences.getBytes(settings::crash::key, &record, sizeof(record)) != sizeof(record) || !record.valid())
+    {
+      Serial.println("No crash record");
+    }
+    else
+    {
+      Serial.print("crash ");
+      const uint8_t *bytes = (const uint8_t *)&record;
+      for (size_t i = 0; i < sizeof(record); i++) Serial.printf("%02x", bytes[i]);
+      Serial.println();
+    }
   }
+  preferences.end();
+}
+
+// "trace" prints the events still in the log, "trace on" and "trace off"
+// print every event as it happens, for tools/compareTrace.py.
+void traceCommand(const char *argument)
+{
+  if (strcmp(argument, "on") == 0) traceStreaming = true;
+  else if (strcmp(argument, "off") == 0) traceStreaming = false;
   else
   {
-    if (settings::debug) Serial.print("multiClick(");
-    if (settings::debug) Serial.print(n);
-    if (settings::debug) Serial.println(") detected.");
+    for (size_t i = 0; i < traceLog.count; i++)
+    {
+      const TraceEvent &event = traceLog.event(i);
+      Serial.printf("trace %lu %u %d\n", (unsigned long)event.at, event.code, event.value);
+    }
   }
 }
 
-void buttonTick()
+// "bench" times the valve pin going through the GPIO batch against
+// digitalWrite(), rewriting the level the pin already has so the valve does
+// not move.
+void benchCommand()
 {
-  buttonOne.tick();
-  buttonTwo.tick();
-  buttonThree.tick();
+  constexpr int rounds = 1000;
+  bool state = (GPIO.out >> settings::pins::mistSwitch) & 1; // the level latched now
+  uint32_t start = ESP.getCycleCount();
+  for (int i = 0; i < rounds; i++) digitalWrite(settings::pins::mistSwitch, state);
+  uint32_t digitalCycles = ESP.getCycleCount() - start;
+  start = ESP.getCycleCount();
+  for (int i = 0; i < rounds; i++)
+  {
+    gpioBatch.write(settings::pins::mistSwitch, state);
+    gpioBatch.apply();
+  }
+  uint32_t batchCycles = ESP.getCycleCount() - start;
+  Serial.printf("valve pin write: digitalWrite %u cycles, GPIO batch %u cycles\n", digitalCycles / rounds,
+                batchCycles / rounds);
 }
 
-bool buttonTickFromTimer(void *)
+void handleConsoleLine(const char *line)
 {
-  buttonTick();
+  const char *argument = line;
+  while (*argument && *argument != ' ') argument++;
+  size_t command = argument - line;
+  while (*argument == ' ') argument++;
+
+  if (command == 5 && strncmp(line, "rules", 5) == 0) rulesCommand(argument);
+  else if (command == 5 && strncmp(line, "crash", 5) == 0) crashCommand(argument);
+  else if (command == 5 && strncmp(line, "state", 5) == 0) stateCommand(argument);
+  else if (command == 5 && strncmp(line, "trace", 5) == 0) traceCommand(argument);
+  else if (command == 5 && strncmp(line, "bench", 5) == 0) benchCommand();
+  else Serial.println("Commands: rules [<hex>|clear], crash [clear], state [<hex>], trace [on|off], bench");
+}
+
+char consoleLine[2 * rules::maxProgram + 16];
+size_t consoleLength = 0;
+bool consoleOverflow = false;
+
+bool readConsoleFromTimer(void *)
+{
+  while (Serial.available() > 0)
+  {
+    char c = Serial.read();
+    if (c == '\r') continue;
+    if (c != '\n')
+    {
+      if (consoleLength + 1 < sizeof(consoleLine)) consoleLine[consoleLength++] = c;
+      else consoleOverflow = true;
+      continue;
+    }
+    consoleLine[consoleLength] = '\0';
+    if (consoleOverflow) Serial.println("Line too long");
+    else handleConsoleLine(consoleLine);
+    consoleLength = 0;
+    consoleOverflow = false;
+  }
+  return true;
+}
+
+// The web server runs in its own task, so request handlers never touch the
+// controller: writes are queued here and applied from the timer in loop().
+struct PendingWrite
+{
+  uint16_t address;
+  uint16_t value;
+};
+PendingWrite webWrites[settings::web::pendingWrites];
+size_t webWriteCount = 0;
+portMUX_TYPE webWritesMux = portMUX_INITIALIZER_UNLOCKED;
+
+AsyncWebServer webServer(settings::web::port);
+AsyncEventSource webEvents(webUi::eventsPath);
+
+// Configuration uploads are parsed in the web server task as they arrive,
+// into a staged copy; only a fully valid document is handed to loop().
+ConfigUpload configDocument;
+AsyncWebServerRequest *configUpload = nullptr; // request owning the parser
+RuntimeConfig pendingConfig;
+bool configPending = false;
+
+bool queueWebWrite(uint16_t address, uint16_t value)
+{
+  bool queued = false;
+  portENTER_CRITICAL(&webWritesMux);
+  if (webWriteCount < settings::web::pendingWrites)
+  {
+    webWrites[webWriteCount++] = {address, value};
+    queued = true;
+  }
+  portEXIT_CRITICAL(&webWritesMux);
+  return queued;
+}
+
+bool applyWebWritesFromTimer(void *)
+{
+  PendingWrite writes[settings::web::pendingWrites];
+  RuntimeConfig config;
+  portENTER_CRITICAL(&webWritesMux);
+  size_t count = webWriteCount;
+  for (size_t i = 0; i < count; i++) writes[i] = webWrites[i];
+  webWriteCount = 0;
+  bool configChanged = configPending;
+  if (configPending) config = pendingConfig;
+  configPending = false;
+  portEXIT_CRITICAL(&webWritesMux);
+
+  if (configChanged) controller.applyRuntimeConfig(config);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    modbus::Exception exception = remoteRegisters.write(writes[i].address, writes[i].value);
+    if (exception != modbus::none && settings::debug)
+      Serial.printf("Web write of %d to register %d rejected (%d)\n", writes[i].value, writes[i].address, exception);
+  }
+  return true;
+}
+
+// All registers as one JSON array, indexed like the register map.
+bool sendWebEventsFromTimer(void *)
+{
+  if (webEvents.count() == 0) return true;
+  char json[webUi::registersJsonSize];
+  webUi::registersJson(remoteRegisters, json);
+  webEvents.send(json, webUi::registersEvent);
   return true;
 }
 
+// Assets are gzipped at build time and sent straight from flash.
+void serveWebAsset(AsyncWebServerRequest *request, const WebAsset &asset)
+{
+  AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+  if (ifNoneMatch != nullptr && webUi::notModified(asset, ifNoneMatch->value().c_str()))
+  {
+    request->send(304);
+    return;
+  }
+  AsyncWebServerResponse *response = request->beginResponse_P(200, asset.contentType, asset.data, asset.length);
+  response->addHeader("Content-Encoding", "gzip");
+  response->addHeader("Cache-Control", webUi::cacheControl);
+  response->addHeader("ETag", asset.etag);
+  request->send(response);
+}
+
+void webSetup()
+{
+  if (settings::web::ssid[0] == '\0') return;
+  WiFi.mode(WIFI_STA);
+  WiFi.setHostname(settings::web::hostname);
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(settings::web::ssid, settings::web::password); // connects in the background
+
+  for (size_t i = 0; i < webAssetCount; i++)
+  {
+    const WebAsset &asset = webAssets[i];
+    webServer.on(asset.path, HTTP_GET, [&asset](AsyncWebServerRequest *request) { serveWebAsset(request, asset); });
+    if (webUi::findAsset("/") == &asset)
+    {
+      webServer.on("/", HTTP_GET, [&asset](AsyncWebServerRequest *request) { serveWebAsset(request, asset); });
+    }
+  }
+  webServer.on("/write", HTTP_POST, [](AsyncWebServerRequest *request) {
+    uint16_t address, value;
+    if (!request->hasParam("register", true) || !request->hasParam("value", true) ||
+        !webUi::parseWord(request->getParam("register", true)->value().c_str(), address) ||
+        !webUi::parseWord(request->getParam("value", true)->value().c_str(), value))
+    {
+      request->send(400);
+      return;
+    }
+    request->send(queueWebWrite(address, value) ? 202 : 503);
+  });
+  webServer.on("/config", HTTP_GET, [](AsyncWebServerRequest *request) {
+    portENTER_CRITICAL(&webWritesMux);
+    RuntimeConfig config = configPending ? pendingConfig : controller.config();
+    portEXIT_CRITICAL(&webWritesMux);
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    JsonWriter<AsyncResponseStream> writer(*response);
+    writeConfig(writer, config);
+    request->send(response);
+  });
+  webServer.on(
+      "/config", HTTP_POST,
+      [](AsyncWebServerRequest *request) {
+        if (request != configUpload)
+        {
+          request->send(409); // another upload had the parser, or there was no body
+          return;
+        }
+        configUpload = nullptr;
+        if (!configDocument.valid())
+        {
+          char message[48];
+          snprintf(message, sizeof(message), "Invalid configuration (error %d at %u)", configDocument.error(),
+                   (unsigned)configDocument.position());
+          request->send(400, "text/plain", message);
+          return;
+        }
+        portENTER_CRITICAL(&webWritesMux);
+        pendingConfig = configDocument.result();
+        configPending = true;
+        portEXIT_CRITICAL(&webWritesMux);
+        request->send(202);
+      },
+      nullptr,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t length, size_t index, size_t total) {
+        if (index == 0)
+        {
+          if (configUpload != nullptr) return; // one upload at a time
+          portENTER_CRITICAL(&webWritesMux);
+          RuntimeConfig base = configPending ? pendingConfig : controller.config();
+          portEXIT_CRITICAL(&webWritesMux);
+          configUpload = request;
+          request->onDisconnect([request]() {
+            if (configUpload == request) configUpload = nullptr; // gave up halfway
+          });
+          configDocument.begin(base);
+        }
+        if (request != configUpload) return;
+        configDocument.feed((const char *)data, length);
+        if (index + length == total) configDocument.finish();
+      });
+  webServer.addHandler(&webEvents);
+  webServer.onNotFound([](AsyncWebServerRequest *request) { request->send(404); });
+  webServer.begin();
+}
+
+void buttonTick()
+{
+  if (settings::input::touch)
+  {
+    buttonOne.tick(touchPressed(0));
+    buttonTwo.tick(touchPressed(1));
+    buttonThree.tick(touchPressed(2));
+    return;
+  }
+  buttonOne.tick();
+  buttonTwo.tick();
+  buttonThree.tick();
+}
+
 void buttonSetup()
 {
   if (settings::debug) Serial.println("Setting up buttons...");
+  if (settings::input::touch) touchSetup();
   buttonOne.attachClick(clickOne);
   buttonOne.attachDoubleClick(doubleclickOne);
   buttonOne.attachLongPressStart(longPressStartOne);
@@ -434,30 +1817,44 @@ void buttonSetup()
   buttonThree.attachDuringLongPress(longPressThree);
   buttonThree.attachMultiClick(multiClickThree);
 
-  timer.every(0, buttonTickFromTimer);
   if (settings::debug) Serial.println("Buttons setup successfully");
 }
 
 void setup()
 {
-  if (settings::debug) Serial.begin(115200);
+  Serial.begin(settings::serial::baud); // the console is needed even without debug output
+  captureCrash();
 
   if (settings::debug) Serial.println("Starting setup...");
-  createTimeoutTimer();
+  controller.begin();
 
   pinMode(settings::pins::mistSwitch, OUTPUT);
+  statusLedSetup();
+  analogSetup();
+  temperatureSetup();
+  climateSetup();
+  encoderSetup();
+  irSetup();
+  modbusSetup();
+  fleetSetup();
+  rulesSetup();
+  webSetup();
+  occupancySetup();
+  flowSetup();
 
   ledcSetup(settings::pwm::channel::fan, settings::pwm::frequency, settings::pwm::precision);
   ledcAttachPin(settings::pins::fan, settings::pwm::channel::fan);
 
   if (settings::debug) Serial.println("Setting up buttons...");
   buttonSetup();
+  createBackgroundTasks();
   if (settings::debug) Serial.println("Completed setup...");
 
-  fanOn();
+  if (!resumeAfterBrownout()) controller.fanOn();
 }
 
 void loop()
 {
   timer.tick();
+  controller.tick();
 }
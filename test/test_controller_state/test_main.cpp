@@ -0,0 +1,191 @@
+#include <string.h>
+#include <string>
+#include <unity.h>
+
+#include "controller.h"
+
+// Records the output writes with their time since origin, e.g.
+// "0 fan 91, 40 mist 1".
+struct TestHal
+{
+  uint32_t clock = 0;
+  uint32_t origin = 0;
+  std::string writes;
+
+  uint32_t now() { return clock; }
+  void writeMist(bool state) { record("mist", state); }
+  void writeFanPercent(int percent) { record("fan", percent); }
+  void trace(uint16_t, int16_t) {}
+  void confirm(uint8_t) {}
+  void modeChanged() {}
+  void mistSessionStarted() {}
+  void mistSessionEnded() {}
+  void acknowledgeFaults() {}
+  void buttonEvent(int, int) {}
+  void sleep() {}
+  void log(const char *, ...) {}
+
+  void record(const char *output, int value)
+  {
+    if (!writes.empty()) writes += ", ";
+    writes += std::to_string(clock - origin) + " " + output + " " + std::to_string(value);
+  }
+};
+
+typedef Controller<TestHal> TestController;
+
+// Runs everything due up to until, then leaves the clock there.
+void advance(TestController &controller, TestHal &hal, uint32_t until)
+{
+  uint32_t at;
+  while (controller.nextDeadline(at) && (int32_t)(at - until) <= 0)
+  {
+    hal.clock = at;
+    controller.tick();
+  }
+  hal.clock = until;
+  controller.tick();
+}
+
+void powerOn(TestController &controller, TestHal &hal, uint32_t at)
+{
+  hal.clock = at;
+  controller.begin();
+  controller.fanOn();
+  controller.tick();
+}
+
+// Restores state into a fresh controller whose clock is near the rollover,
+// and captures it again right away.
+TestController::State recapture(const TestController::State &state)
+{
+  TestHal hal;
+  TestController controller(hal);
+  powerOn(controller, hal, 0xFFFFF000);
+  hal.clock += 123;
+  controller.restore(state);
+  return controller.capture();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_round_trip_mid_pattern()
+{
+  TestHal hal;
+  TestController controller(hal);
+  powerOn(controller, hal, 5000);
+  controller.clicked(1, 4);
+  controller.mistHold(mistSource::remote);
+  advance(controller, hal, 5000 + 45500);
+  controller.longPressStarted(3);
+  controller.encoderTurned(10); // mist fraction, applied once the knob rests
+  controller.longPressStopped(3);
+  advance(controller, hal, 5000 + 45700);
+
+  TestController::State state = controller.capture();
+  TEST_ASSERT_TRUE(state.valid());
+  TEST_ASSERT_TRUE(state.patternRunning);
+  TEST_ASSERT_TRUE(state.mistFractionPending);
+  TEST_ASSERT_EQUAL_UINT32(550, state.mistFractionLeft);
+  TEST_ASSERT_TRUE(state.mist[mistSource::remote].active);
+  TestController::State restored = recapture(state);
+  TEST_ASSERT_EQUAL_MEMORY(&state, &restored, sizeof(state));
+}
+
+void test_round_trip_vpd_control()
+{
+  TestHal hal;
+  TestController controller(hal);
+  powerOn(controller, hal, 0);
+  controller.climateMeasured(1800, 450);
+  controller.clicked(2, 3);
+  advance(controller, hal, 40000);
+  controller.climateMeasured(1600, 500);
+  advance(controller, hal, 52000);
+
+  TestController::State state = controller.capture();
+  TEST_ASSERT_TRUE(state.vpdControl);
+  TEST_ASSERT_EQUAL_UINT32(8000, state.vpdControlLeft);
+  TEST_ASSERT_NOT_EQUAL(0, state.vpdIntegralPermille);
+  TestController::State restored = recapture(state);
+  TEST_ASSERT_EQUAL_MEMORY(&state, &restored, sizeof(state));
+}
+
+void test_round_trip_drying()
+{
+  TestHal hal;
+  TestController controller(hal);
+  powerOn(controller, hal, 0);
+  controller.clicked(1, 1);
+  advance(controller, hal, 2000);
+  controller.clicked(3, 2); // stop-all after misting dries the nozzles
+  advance(controller, hal, 62000);
+
+  TestController::State state = controller.capture();
+  TEST_ASSERT_TRUE(state.drying);
+  TEST_ASSERT_EQUAL_UINT32(settings::purge::dryingDuration - 60000, state.dryingLeft);
+  TEST_ASSERT_EQUAL_INT16(settings::purge::dryingFanPercent, state.fanPercent);
+  TestController::State restored = recapture(state);
+  TEST_ASSERT_EQUAL_MEMORY(&state, &restored, sizeof(state));
+}
+
+// Nobody is left to release a button hold after a reset.
+void test_button_hold_is_not_restored()
+{
+  TestHal hal;
+  TestController controller(hal);
+  powerOn(controller, hal, 0);
+  controller.longPressStarted(1);
+  controller.longPressed(1);
+  controller.mistHold(mistSource::remote);
+  advance(controller, hal, 3000);
+
+  TestController::State state = controller.capture();
+  TEST_ASSERT_TRUE(state.mist[mistSource::manual].active);
+  TestController::State restored = recapture(state);
+  TEST_ASSERT_FALSE(restored.mist[mistSource::manual].active);
+  TEST_ASSERT_TRUE(restored.mist[mistSource::remote].active);
+}
+
+// After the restore both controllers drive the outputs the same way, at
+// the same times relative to the checkpoint.
+void test_restored_controller_continues_identically()
+{
+  TestHal originalHal;
+  TestController original(originalHal);
+  powerOn(original, originalHal, 1000);
+  original.clicked(1, 5);
+  advance(original, originalHal, 1000 + 100000);
+  TestController::State state = original.capture();
+
+  TestHal restoredHal;
+  TestController restored(restoredHal);
+  powerOn(restored, restoredHal, 0xFFFF0000);
+  restored.restore(state);
+  restored.tick();
+
+  originalHal.origin = originalHal.clock;
+  restoredHal.origin = restoredHal.clock;
+  originalHal.writes.clear();
+  restoredHal.writes.clear();
+  advance(original, originalHal, originalHal.clock + 3 * 60 * 60 * 1000);
+  advance(restored, restoredHal, restoredHal.clock + 3 * 60 * 60 * 1000);
+  TEST_ASSERT_TRUE(originalHal.writes.size() > 0);
+  TEST_ASSERT_EQUAL_STRING(originalHal.writes.c_str(), restoredHal.writes.c_str());
+
+  TestController::State originalLater = original.capture();
+  TestController::State restoredLater = restored.capture();
+  TEST_ASSERT_EQUAL_MEMORY(&originalLater, &restoredLater, sizeof(originalLater));
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip_mid_pattern);
+  RUN_TEST(test_round_trip_vpd_control);
+  RUN_TEST(test_round_trip_drying);
+  RUN_TEST(test_button_hold_is_not_restored);
+  RUN_TEST(test_restored_controller_continues_identically);
+  return UNITY_END();
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <unity.h>
+
+#include "controller.h"
+#include "crashRecord.h"
+
+void setUp() {}
+void tearDown() {}
+
+// The offsets tools/decodeCrash.py reads the record at.
+void test_layout_matches_decoder()
+{
+  TEST_ASSERT_EQUAL(464, sizeof(CrashRecord));
+  TEST_ASSERT_EQUAL(20, offsetof(CrashRecord, backtrace));
+  TEST_ASSERT_EQUAL(84, offsetof(CrashRecord, task));
+  TEST_ASSERT_EQUAL(116, offsetof(CrashRecord, registers));
+  TEST_ASSERT_EQUAL(180, offsetof(CrashRecord, state));
+  TEST_ASSERT_EQUAL(20, sizeof(ControllerSnapshot));
+  TEST_ASSERT_EQUAL(200, offsetof(CrashRecord, eventCount));
+  TEST_ASSERT_EQUAL(204, offsetof(CrashRecord, events));
+  TEST_ASSERT_EQUAL(8, sizeof(TraceEvent));
+  TEST_ASSERT_EQUAL(460, offsetof(CrashRecord, crc));
+}
+
+// Same CRC as zlib.crc32 on the host.
+void test_crc_check_value()
+{
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crash::crc32((const uint8_t *)"123456789", 9));
+}
+
+void test_seal_and_validate()
+{
+  CrashRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = crash::magic;
+  record.version = crash::version;
+  record.pc = 0x40081234;
+  record.seal();
+  TEST_ASSERT_TRUE(record.valid());
+
+  record.events[3].value ^= 1;
+  TEST_ASSERT_FALSE(record.valid());
+  record.seal();
+  record.version = crash::version - 1;
+  TEST_ASSERT_FALSE(record.valid());
+}
+
+void test_trace_log_keeps_newest_oldest_first()
+{
+  TraceLog<4> log;
+  log.clear();
+  TEST_ASSERT_TRUE(log.plausible());
+  for (uint32_t i = 0; i < 6; i++) log.add(i * 10, i, -(int16_t)i);
+  TEST_ASSERT_EQUAL(4, log.count);
+  for (size_t i = 0; i < 4; i++)
+  {
+    TEST_ASSERT_EQUAL(i + 2, log.event(i).code);
+    TEST_ASSERT_EQUAL((i + 2) * 10, log.event(i).at);
+  }
+}
+
+void test_garbage_log_is_implausible()
+{
+  TraceLog<4> log;
+  log.head = 4;
+  log.count = 0;
+  TEST_ASSERT_FALSE(log.plausible());
+  log.head = 0;
+  log.count = 5;
+  TEST_ASSERT_FALSE(log.plausible());
+}
+
+// A record as captureCrash() would leave it after a panic.
+CrashRecord panicRecord()
+{
+  CrashRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = crash::magic;
+  record.version = crash::version;
+  record.resetReason = 4; // panic
+  record.backtraceDepth = 2;
+  record.pc = 0x40081234;
+  record.exceptionCause = 28;
+  record.exceptionAddress = 0x3FFB0010;
+  record.backtrace[0] = 0x40082000;
+  record.backtrace[1] = 0x40083000;
+  strcpy(record.task, "loopTask");
+  strcpy(record.elfSha256, "1a2b3c4d");
+  for (uint32_t i = 0; i < 16; i++) record.registers[i] = 0xA0000000 + i;
+  record.state = {12345, 80, 70, 1, 1, 0x2, 1, 1200, 11800, 0};
+  record.eventCount = 2;
+  record.events[0] = {1000, traceCode::mist, 1};
+  record.events[1] = {2500, traceCode::supply, 1};
+  record.seal();
+  return record;
+}
+
+// The tools are two directories up from this file.
+std::string toolPath(const char *name)
+{
+  std::string file = __FILE__;
+  return file.substr(0, file.find_last_of("/\\") + 1) + "../../tools/" + name;
+}
+
+// Runs tools/decodeCrash.py on the record, written raw or as the "crash"
+// console command prints it. Returns its exit status.
+int decode(const CrashRecord &record, bool consoleText, std::string &output)
+{
+  char file[] = "/tmp/crashRecordXXXXXX";
+  int descriptor = mkstemp(file);
+  TEST_ASSERT_TRUE(descriptor >= 0);
+  FILE *out = fdopen(descriptor, "wb");
+  if (consoleText)
+  {
+    fprintf(out, "crash ");
+    const uint8_t *bytes = (const uint8_t *)&record;
+    for (size_t i = 0; i < sizeof(record); i++) fprintf(out, "%02x", bytes[i]);
+    fprintf(out, "\n");
+  }
+  else
+  {
+    fwrite(&record, sizeof(record), 1, out);
+  }
+  fclose(out);
+
+  std::string command = "python3 " + toolPath("decodeCrash.py") + " " + file + " 2>&1";
+  FILE *decoder = popen(command.c_str(), "r");
+  TEST_ASSERT_NOT_NULL(decoder);
+  output.clear();
+  char buffer[256];
+  while (fgets(buffer, sizeof(buffer), decoder)) output += buffer;
+  int status = pclose(decoder);
+  unlink(file);
+  return status;
+}
+
+void assertContains(const std::string &output, const char *expected)
+{
+  TEST_ASSERT_TRUE_MESSAGE(output.find(expected) != std::string::npos, (std::string("missing \"") + expected + "\" in:\n" + output).c_str());
+}
+
+void test_decoder_reads_raw_record()
+{
+  std::string output;
+  TEST_ASSERT_EQUAL(0, decode(panicRecord(), false, output));
+  assertContains(output, "Reset reason: panic");
+  assertContains(output, "Task loopTask, exception cause 28 at 0x3ffb0010, ELF 1a2b3c4d");
+  assertContains(output, "PC 0x40081234");
+  assertContains(output, "#1  0x40083000");
+  assertContains(output, "A5  0xa0000005");
+  assertContains(output, "uptime 12.3 s");
+  assertContains(output, "fan 80% (applied 70%), mist on, repeating");
+  assertContains(output, "faults 0x2, supply sagging 11800 mV, VPD 1200 Pa");
+  assertContains(output, "Last 2 events:");
+  assertContains(output, "1.000 s  mist 1");
+  assertContains(output, "2.500 s  supply sagging");
+}
+
+void test_decoder_reads_console_text()
+{
+  std::string raw, text;
+  decode(panicRecord(), false, raw);
+  TEST_ASSERT_EQUAL(0, decode(panicRecord(), true, text));
+  TEST_ASSERT_EQUAL_STRING(raw.c_str(), text.c_str());
+}
+
+void test_decoder_rejects_damaged_record()
+{
+  CrashRecord record = panicRecord();
+  record.events[1].value = 2; // after sealing
+  std::string output;
+  TEST_ASSERT_NOT_EQUAL(0, decode(record, true, output));
+  assertContains(output, "checksum mismatch");
+
+  record.seal();
+  record.version = crash::version + 1;
+  TEST_ASSERT_NOT_EQUAL(0, decode(record, false, output));
+  assertContains(output, "not a version");
+}
+
+// The decoder names events by position, so its list must follow traceCode.
+void test_decoder_names_every_trace_code()
+{
+  CrashRecord record = panicRecord();
+  const TraceEvent events[] = {
+      {0, traceCode::boot, 9},      {1, traceCode::mist, 1},        {2, traceCode::fan, 91},
+      {3, traceCode::pattern, 2},   {4, traceCode::stopAll, 0},     {5, traceCode::supply, 2},
+      {6, traceCode::fault, 2},     {7, traceCode::remoteWrite, 16}, {8, traceCode::rule, 3},
+      {9, traceCode::config, 0},    {10, traceCode::state, 1},
+  };
+  record.eventCount = sizeof(events) / sizeof(events[0]);
+  memcpy(record.events, events, sizeof(events));
+  record.seal();
+  std::string output;
+  TEST_ASSERT_EQUAL(0, decode(record, false, output));
+  const char *expected[] = {"boot (brownout)", "mist 1",         "fan 91", "pattern 2", "stopAll 0", "supply critical",
+                            "fault 2",         "remoteWrite 16", "rule 3", "config 0",  "state 1"};
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) assertContains(output, expected[i]);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_layout_matches_decoder);
+  RUN_TEST(test_crc_check_value);
+  RUN_TEST(test_seal_and_validate);
+  RUN_TEST(test_trace_log_keeps_newest_oldest_first);
+  RUN_TEST(test_garbage_log_is_implausible);
+  RUN_TEST(test_decoder_reads_raw_record);
+  RUN_TEST(test_decoder_reads_console_text);
+  RUN_TEST(test_decoder_rejects_damaged_record);
+  RUN_TEST(test_decoder_names_every_trace_code);
+  return UNITY_END();
+}
@@ -0,0 +1,225 @@
+#include <unity.h>
+
+#include "encoderAccelerator.h"
+#include "simulator.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_counts_collect_into_detents()
+{
+  EncoderAccelerator encoder;
+  TEST_ASSERT_EQUAL_INT32(0, encoder.update(3, 1000));
+  TEST_ASSERT_EQUAL_INT32(1, encoder.update(1, 2000));
+  TEST_ASSERT_EQUAL_INT32(0, encoder.update(-2, 3000));
+  TEST_ASSERT_EQUAL_INT32(0, encoder.update(-1, 4000));
+  TEST_ASSERT_EQUAL_INT32(-1, encoder.update(-1, 5000));
+}
+
+void test_slow_turn_moves_by_one()
+{
+  EncoderAccelerator encoder;
+  uint32_t now = 1000;
+  for (int i = 0; i < 5; i++)
+  {
+    TEST_ASSERT_EQUAL_INT32(1, encoder.update(4, now));
+    now += 300;
+  }
+}
+
+void test_fast_spin_is_multiplied()
+{
+  EncoderAcceleratorConfig config;
+  EncoderAccelerator encoder(config);
+  encoder.update(4, 1000);
+  TEST_ASSERT_EQUAL_INT32(config.maxMultiplier, encoder.update(4, 1020));
+  TEST_ASSERT_EQUAL_INT32(2 * config.maxMultiplier, encoder.update(8, 1060)); // two detents, 20 ms each
+  int32_t medium = encoder.update(4, 1180);
+  TEST_ASSERT_GREATER_THAN(1, medium);
+  TEST_ASSERT_LESS_THAN(config.maxMultiplier, medium);
+}
+
+void test_reversal_starts_slow()
+{
+  EncoderAccelerator encoder;
+  encoder.update(4, 1000);
+  encoder.update(4, 1010);
+  TEST_ASSERT_EQUAL_INT32(-1, encoder.update(-4, 1020));
+}
+
+// The knob through the pulse counter model, read every 20 ms the way
+// readEncoderFromTimer() in src/main.cpp does, with the steps going to a
+// simulated controller.
+
+const uint16_t glitchFilter = 1023; // settings::encoder in src/main.cpp
+const int16_t countLimit = 10000;
+const uint64_t us = SimPulseCounter::cyclesPerUs;
+const uint64_t ms = 1000 * us;
+const uint64_t pollInterval = 20 * ms;
+
+class Rig
+{
+public:
+  explicit Rig(uint16_t filterCycles) : counter(filterCycles, countLimit) { simulation.powerOn(); }
+
+  // Turns the knob by detents, one every detentMs; each detent is a full
+  // quadrature cycle, 00 10 11 01 in AB turning up. With glitchCycles set,
+  // the line that holds spikes for that long around every edge of the other.
+  void turn(int detents, uint32_t detentMs)
+  {
+    uint64_t edgeCycles = detentMs * ms / 4;
+    int direction = detents > 0 ? 1 : -1;
+    for (int i = 0; i < 4 * abs(detents); i++)
+    {
+      at += edgeCycles;
+      edge((phase + direction + 4) % 4);
+    }
+  }
+
+  // Reads on for one more interval, with the last edges through the filter.
+  void settle()
+  {
+    at += pollInterval;
+    readUntil(at);
+  }
+
+  int16_t count() { return counter.read(at); }
+
+  SimPulseCounter counter;
+  Simulation simulation;
+  uint64_t glitchCycles = 0;
+  int32_t steps = 0;
+
+private:
+  static bool a(int phase) { return phase == 1 || phase == 2; }
+  static bool b(int phase) { return phase >= 2; }
+
+  void edge(int next)
+  {
+    bool aHolds = a(next) == a(phase);
+    if (glitchCycles > 0)
+    {
+      uint64_t from = at - glitchCycles / 2;
+      drive(aHolds ? !a(phase) : a(phase), aHolds ? b(phase) : !b(phase), from);
+      drive(aHolds ? !a(next) : a(next), aHolds ? b(next) : !b(next), at);
+      drive(a(next), b(next), from + glitchCycles);
+    }
+    else drive(a(next), b(next), at);
+    phase = next;
+  }
+
+  void drive(bool a, bool b, uint64_t when)
+  {
+    readUntil(when);
+    counter.drive(a, b, when);
+  }
+
+  // The reads due by `until`, feeding the controller at their time.
+  void readUntil(uint64_t until)
+  {
+    while (nextReadAt <= until)
+    {
+      uint32_t now = nextReadAt / ms;
+      simulation.runUntil(now);
+      int32_t read = accelerator.counterRead(counter.read(nextReadAt), countLimit, now);
+      if (read != 0)
+      {
+        steps += read;
+        simulation.controller.encoderTurned(read);
+        simulation.controller.tick();
+      }
+      nextReadAt += pollInterval;
+    }
+  }
+
+  EncoderAccelerator accelerator;
+  uint64_t at = 0;
+  uint64_t nextReadAt = pollInterval;
+  int phase = 0;
+};
+
+// Spikes on one line across the other's edges are seen as a step back and
+// two forward or the like; the filter drops them, so the count is exact.
+void test_glitches_are_filtered_out()
+{
+  Rig rig(glitchFilter);
+  rig.glitchCycles = 5 * us;
+  rig.turn(10, 300);
+  rig.turn(-3, 300);
+  rig.settle();
+  TEST_ASSERT_EQUAL_INT16(4 * 7, rig.count());
+  TEST_ASSERT_EQUAL_UINT32(4 * 13, rig.counter.glitches);
+  TEST_ASSERT_EQUAL_INT32(7, rig.steps);
+}
+
+void test_glitches_miscount_without_the_filter()
+{
+  Rig rig(0);
+  rig.glitchCycles = 5 * us;
+  rig.turn(10, 300);
+  rig.settle();
+  TEST_ASSERT_NOT_EQUAL(4 * 10, rig.count());
+  TEST_ASSERT_EQUAL_UINT32(0, rig.counter.glitches);
+}
+
+// Pulses as long as the filter pass it.
+void test_filter_length()
+{
+  Rig shorter(glitchFilter);
+  shorter.glitchCycles = glitchFilter - 1;
+  shorter.turn(10, 300);
+  shorter.settle();
+  TEST_ASSERT_EQUAL_INT16(4 * 10, shorter.count());
+
+  Rig longer(glitchFilter);
+  longer.glitchCycles = glitchFilter;
+  longer.turn(10, 300);
+  longer.settle();
+  TEST_ASSERT_NOT_EQUAL(4 * 10, longer.count());
+}
+
+// The counter resets to 0 at +-10000 counts; the steps carry on across it.
+void test_steps_carry_on_when_the_counter_wraps()
+{
+  Rig rig(glitchFilter);
+  rig.turn(3000, 250);
+  rig.settle();
+  TEST_ASSERT_EQUAL_INT16(12000 - countLimit, rig.count());
+  TEST_ASSERT_EQUAL_INT32(3000, rig.steps);
+  rig.turn(-3000, 250);
+  rig.settle();
+  TEST_ASSERT_EQUAL_INT32(0, rig.steps);
+}
+
+// A slow turn steps the fan by one percent a detent, a fast spin sweeps it
+// past the running minimum to off, and the first detent up runs it again.
+void test_turning_steps_the_fan()
+{
+  Rig rig(glitchFilter);
+  rig.glitchCycles = 5 * us;
+  TEST_ASSERT_EQUAL(100, rig.simulation.controller.fanAppliedPercent());
+  rig.turn(-5, 300);
+  rig.settle();
+  TEST_ASSERT_EQUAL(95, rig.simulation.controller.fanAppliedPercent());
+  rig.turn(-10, 20);
+  rig.settle();
+  TEST_ASSERT_EQUAL(0, rig.simulation.controller.fanAppliedPercent());
+  rig.turn(1, 300);
+  rig.settle();
+  TEST_ASSERT_EQUAL(settings::encoder::fanMinRunning, rig.simulation.controller.fanAppliedPercent());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_counts_collect_into_detents);
+  RUN_TEST(test_slow_turn_moves_by_one);
+  RUN_TEST(test_fast_spin_is_multiplied);
+  RUN_TEST(test_reversal_starts_slow);
+  RUN_TEST(test_glitches_are_filtered_out);
+  RUN_TEST(test_glitches_miscount_without_the_filter);
+  RUN_TEST(test_filter_length);
+  RUN_TEST(test_steps_carry_on_when_the_counter_wraps);
+  RUN_TEST(test_turning_steps_the_fan);
+  return UNITY_END();
+}
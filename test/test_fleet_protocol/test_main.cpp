@@ -0,0 +1,257 @@
+#include <list>
+#include <string>
+#include <vector>
+#include <unity.h>
+
+#include "fleetProtocol.h"
+
+// The TWAI dual filter on a standard data frame: filter 1 matches the
+// identifier and RTR bit against bits 31..20, filter 2 against bits 15..4.
+bool hardwareAccepts(uint32_t code, uint32_t mask, uint16_t id)
+{
+  uint32_t care = ~mask;
+  bool first = (((uint32_t)id << 21 ^ code) & care & 0xFFF00000) == 0;
+  bool second = (((uint32_t)id << 5 ^ code) & care & 0xFFF0) == 0;
+  return first || second;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_identifier_fields()
+{
+  uint16_t id = fleet::identifier(true, fleet::registerValues, 42);
+  TEST_ASSERT_EQUAL_HEX16(0x400 | 2 << 7 | 42, id);
+  TEST_ASSERT_TRUE(fleet::isReport(id));
+  TEST_ASSERT_EQUAL(fleet::registerValues, fleet::type(id));
+  TEST_ASSERT_EQUAL(42, fleet::node(id));
+
+  id = fleet::identifier(false, fleet::requestStatus, 127);
+  TEST_ASSERT_FALSE(fleet::isReport(id));
+  TEST_ASSERT_EQUAL(fleet::requestStatus, fleet::type(id));
+  TEST_ASSERT_EQUAL(127, fleet::node(id));
+  TEST_ASSERT_TRUE(id < 0x800);
+}
+
+void test_little_endian_words()
+{
+  uint8_t data[2];
+  fleet::put16(data, 0xBEEF);
+  TEST_ASSERT_EQUAL_HEX8(0xEF, data[0]);
+  TEST_ASSERT_EQUAL_HEX8(0xBE, data[1]);
+  TEST_ASSERT_EQUAL_HEX16(0xBEEF, fleet::get16(data));
+}
+
+void test_software_filter()
+{
+  TEST_ASSERT_TRUE(fleet::accepts(5, fleet::identifier(false, fleet::stopAll, 5)));
+  TEST_ASSERT_TRUE(fleet::accepts(5, fleet::identifier(false, fleet::stopAll, fleet::broadcast)));
+  TEST_ASSERT_FALSE(fleet::accepts(5, fleet::identifier(false, fleet::stopAll, 6)));
+  TEST_ASSERT_FALSE(fleet::accepts(5, fleet::identifier(true, fleet::status, 5)));
+}
+
+// The hardware filter must pass exactly the frames the software one does,
+// for every identifier.
+void test_hardware_filter_matches_software()
+{
+  const uint8_t nodes[] = {1, 5, 64, 127};
+  for (uint8_t node : nodes)
+  {
+    uint32_t code, mask;
+    fleet::acceptanceFilter(node, code, mask);
+    for (uint16_t id = 0; id < 0x800; id++)
+    {
+      TEST_ASSERT_EQUAL(fleet::accepts(node, id), hardwareAccepts(code, mask, id));
+    }
+  }
+}
+
+void test_status_frame_layout()
+{
+  fleet::StatusReport report = {80, 70, 1, 3, 4, 51, 1234};
+  fleet::Frame frame = fleet::statusFrame(9, report);
+  TEST_ASSERT_EQUAL_HEX16(fleet::identifier(true, fleet::status, 9), frame.id);
+  const uint8_t expected[fleet::frameBytes] = {80, 70, 1, 3, 4, 51, 1234 & 0xFF, 1234 >> 8};
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, frame.data, fleet::frameBytes);
+}
+
+// Registers read as ten times their address; writes are logged, e.g. "16=1".
+struct FakeRegisters
+{
+  std::string writes;
+
+  modbus::Exception read(uint16_t address, uint16_t &value)
+  {
+    if (address >= remoteRegister::count) return modbus::illegalAddress;
+    value = address * 10;
+    return modbus::none;
+  }
+
+  modbus::Exception write(uint16_t address, uint16_t value)
+  {
+    if (address >= remoteRegister::count) return modbus::illegalAddress;
+    if (!writes.empty()) writes += ", ";
+    writes += std::to_string(address) + "=" + std::to_string(value);
+    return modbus::none;
+  }
+};
+
+struct Unit
+{
+  explicit Unit(uint8_t node) : node(node), fleet(node, registers) {}
+
+  uint8_t node;
+  FakeRegisters registers;
+  FleetNode<FakeRegisters> fleet;
+};
+
+// An in-process bus: every frame sent reaches every unit, and their answers
+// go out on the bus in turn, the way they would on CAN.
+struct Bus
+{
+  std::list<Unit> units;
+  std::vector<fleet::Frame> frames; // all sent, in order
+
+  Bus(std::initializer_list<uint8_t> nodes)
+  {
+    for (uint8_t node : nodes) units.emplace_back(node);
+  }
+
+  void send(const fleet::Frame &frame)
+  {
+    size_t delivered = frames.size();
+    frames.push_back(frame);
+    for (; delivered < frames.size(); delivered++)
+    {
+      for (Unit &unit : units)
+      {
+        fleet::Frame answer;
+        switch (unit.fleet.handle(frames[delivered], answer))
+        {
+        case FleetNode<FakeRegisters>::reply: frames.push_back(answer); break;
+        case FleetNode<FakeRegisters>::statusReport:
+        {
+          fleet::StatusReport report = {};
+          report.fanPercent = unit.node;
+          frames.push_back(fleet::statusFrame(unit.node, report));
+          break;
+        }
+        case FleetNode<FakeRegisters>::none: break;
+        }
+      }
+    }
+  }
+
+  Unit &unit(uint8_t node)
+  {
+    for (Unit &unit : units)
+    {
+      if (unit.node == node) return unit;
+    }
+    return units.front();
+  }
+};
+
+fleet::Frame command(uint8_t type, uint8_t node, uint16_t first = 0, uint16_t second = 0)
+{
+  fleet::Frame frame = {};
+  frame.id = fleet::identifier(false, type, node);
+  fleet::put16(frame.data, first);
+  fleet::put16(frame.data + 2, second);
+  return frame;
+}
+
+void test_command_reaches_only_its_node()
+{
+  Bus bus({1, 5, 64});
+  bus.send(command(fleet::writeRegister, 5, remoteRegister::fanPercent, 80));
+  TEST_ASSERT_EQUAL_STRING("0=80", bus.unit(5).registers.writes.c_str());
+  TEST_ASSERT_EQUAL_STRING("", bus.unit(1).registers.writes.c_str());
+  TEST_ASSERT_EQUAL_STRING("", bus.unit(64).registers.writes.c_str());
+
+  // the answer is a report, which the other units ignore
+  TEST_ASSERT_EQUAL(2, bus.frames.size());
+  const fleet::Frame &answer = bus.frames[1];
+  TEST_ASSERT_EQUAL_HEX16(fleet::identifier(true, fleet::writeResult, 5), answer.id);
+  TEST_ASSERT_EQUAL_HEX16(remoteRegister::fanPercent, fleet::get16(answer.data));
+  TEST_ASSERT_EQUAL(modbus::none, answer.data[2]);
+}
+
+void test_write_errors_are_answered()
+{
+  Bus bus({1, 5});
+  bus.send(command(fleet::writeRegister, 1, remoteRegister::count, 1));
+  TEST_ASSERT_EQUAL(2, bus.frames.size());
+  TEST_ASSERT_EQUAL(modbus::illegalAddress, bus.frames[1].data[2]);
+}
+
+// StopAll is a write of 1 to the stopAll register on every unit, the same
+// as a Modbus or web stop-all, and nobody answers.
+void test_broadcast_stop_all()
+{
+  Bus bus({1, 5, 64});
+  bus.send(command(fleet::stopAll, fleet::broadcast));
+  for (Unit &unit : bus.units)
+  {
+    TEST_ASSERT_EQUAL_STRING("16=1", unit.registers.writes.c_str());
+  }
+  TEST_ASSERT_EQUAL(1, bus.frames.size());
+
+  bus.send(command(fleet::stopAll, 64));
+  TEST_ASSERT_EQUAL_STRING("16=1, 16=1", bus.unit(64).registers.writes.c_str());
+  TEST_ASSERT_EQUAL_STRING("16=1", bus.unit(5).registers.writes.c_str());
+}
+
+void test_broadcast_write_is_not_answered()
+{
+  Bus bus({1, 5, 64});
+  bus.send(command(fleet::writeRegister, fleet::broadcast, remoteRegister::patternSelect, 2));
+  for (Unit &unit : bus.units)
+  {
+    TEST_ASSERT_EQUAL_STRING("6=2", unit.registers.writes.c_str());
+  }
+  TEST_ASSERT_EQUAL(1, bus.frames.size());
+}
+
+// At most two registers come back; a failed read ends the answer.
+void test_read_registers()
+{
+  Bus bus({1, 64});
+  bus.send(command(fleet::readRegisters, 64, remoteRegister::vpd, 5));
+  TEST_ASSERT_EQUAL(2, bus.frames.size());
+  const uint8_t values[fleet::frameBytes] = {remoteRegister::vpd, 0, 2, modbus::none, 80, 0, 90, 0};
+  TEST_ASSERT_EQUAL_HEX16(fleet::identifier(true, fleet::registerValues, 64), bus.frames[1].id);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(values, bus.frames[1].data, fleet::frameBytes);
+
+  bus.send(command(fleet::readRegisters, 64, remoteRegister::count - 1, 2));
+  const uint8_t failed[fleet::frameBytes] = {remoteRegister::count - 1, 0, 2, modbus::illegalAddress, 170, 0, 0, 0};
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(failed, bus.frames[3].data, fleet::frameBytes);
+}
+
+void test_status_requests()
+{
+  Bus bus({1, 5, 64});
+  bus.send(command(fleet::requestStatus, 5));
+  TEST_ASSERT_EQUAL(2, bus.frames.size());
+  TEST_ASSERT_EQUAL_HEX16(fleet::identifier(true, fleet::status, 5), bus.frames[1].id);
+
+  bus.send(command(fleet::requestStatus, fleet::broadcast));
+  TEST_ASSERT_EQUAL(3, bus.frames.size());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_identifier_fields);
+  RUN_TEST(test_little_endian_words);
+  RUN_TEST(test_software_filter);
+  RUN_TEST(test_hardware_filter_matches_software);
+  RUN_TEST(test_status_frame_layout);
+  RUN_TEST(test_command_reaches_only_its_node);
+  RUN_TEST(test_write_errors_are_answered);
+  RUN_TEST(test_broadcast_stop_all);
+  RUN_TEST(test_broadcast_write_is_not_answered);
+  RUN_TEST(test_read_registers);
+  RUN_TEST(test_status_requests);
+  return UNITY_END();
+}
@@ -0,0 +1,61 @@
+#include <unity.h>
+
+#include "flowMeter.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_metering()
+{
+  FlowMeter meter;
+  meter.valveChanged(true, 0);
+  meter.addPulses(450, 1000);
+  meter.startSession();
+  meter.addPulses(225, 2000);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.5, meter.sessionLiters());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 1.5, meter.dayLiters());
+  meter.startDay();
+  meter.addPulses(45, 3000);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.1, meter.dayLiters());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 1.6, meter.totalLiters());
+  TEST_ASSERT_EQUAL_UINT32(720, meter.totalPulseCount());
+  TEST_ASSERT_FALSE(meter.leaking());
+}
+
+void test_draining_after_close_is_no_leak()
+{
+  FlowMeter meter;
+  meter.valveChanged(false, 1000);
+  meter.addPulses(100, 2999);
+  TEST_ASSERT_FALSE(meter.leaking());
+}
+
+void test_flow_while_closed_is_a_leak()
+{
+  FlowMeter meter;
+  meter.valveChanged(false, 0);
+  meter.addPulses(10, 5000);
+  TEST_ASSERT_FALSE(meter.leaking());
+  meter.addPulses(10, 6000);
+  TEST_ASSERT_TRUE(meter.leaking());
+  meter.clearLeak();
+  TEST_ASSERT_FALSE(meter.leaking());
+}
+
+void test_slow_seepage_below_window_rate()
+{
+  FlowMeter meter;
+  meter.valveChanged(false, 0);
+  for (uint32_t now = 5000; now < 600000; now += 5000) meter.addPulses(1, now);
+  TEST_ASSERT_FALSE(meter.leaking()); // 12 pulses per 60 s window
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_metering);
+  RUN_TEST(test_draining_after_close_is_no_leak);
+  RUN_TEST(test_flow_while_closed_is_a_leak);
+  RUN_TEST(test_slow_seepage_below_window_rate);
+  return UNITY_END();
+}
@@ -0,0 +1,85 @@
+#include <unity.h>
+
+#include "gpioBatch.h"
+
+// Models the output registers: write-1-to-set and write-1-to-clear act on
+// the output level of each bank, and every access is counted.
+struct MockRegisters
+{
+  uint32_t out[2] = {};
+  uint8_t accesses = 0;
+
+  void set(uint8_t bank, uint32_t mask)
+  {
+    out[bank] |= mask;
+    accesses++;
+  }
+
+  void clear(uint8_t bank, uint32_t mask)
+  {
+    out[bank] &= ~mask;
+    accesses++;
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_pins_map_to_their_bank()
+{
+  MockRegisters registers;
+  GpioBatch<MockRegisters> batch(registers);
+  batch.write(5, true);
+  batch.write(33, true);
+  batch.apply();
+  TEST_ASSERT_EQUAL_HEX32(1UL << 5, registers.out[0]);
+  TEST_ASSERT_EQUAL_HEX32(1UL << 1, registers.out[1]);
+}
+
+void test_one_set_and_one_clear_per_bank()
+{
+  MockRegisters registers;
+  registers.out[0] = 0xF0;
+  GpioBatch<MockRegisters> batch(registers);
+  batch.write(0, true);
+  batch.write(1, true);
+  batch.write(4, false);
+  batch.write(5, false);
+  batch.apply();
+  TEST_ASSERT_EQUAL_HEX32(0xC3, registers.out[0]);
+  TEST_ASSERT_EQUAL(2, registers.accesses);
+}
+
+void test_last_write_of_a_pin_wins()
+{
+  MockRegisters registers;
+  GpioBatch<MockRegisters> batch(registers);
+  batch.write(7, true);
+  batch.write(7, false);
+  batch.apply();
+  TEST_ASSERT_EQUAL_HEX32(0, registers.out[0]);
+  TEST_ASSERT_EQUAL(1, registers.accesses);
+}
+
+void test_apply_empties_the_batch()
+{
+  MockRegisters registers;
+  GpioBatch<MockRegisters> batch(registers);
+  TEST_ASSERT_FALSE(batch.pending());
+  batch.write(2, true);
+  TEST_ASSERT_TRUE(batch.pending());
+  batch.apply();
+  TEST_ASSERT_FALSE(batch.pending());
+  batch.apply();
+  TEST_ASSERT_EQUAL(1, registers.accesses);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_pins_map_to_their_bank);
+  RUN_TEST(test_one_set_and_one_clear_per_bank);
+  RUN_TEST(test_last_write_of_a_pin_wins);
+  RUN_TEST(test_apply_empties_the_batch);
+  return UNITY_END();
+}
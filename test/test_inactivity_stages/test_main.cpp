@@ -0,0 +1,97 @@
+#include <unity.h>
+
+#include "inactivityStages.h"
+
+const uint32_t deadlines[] = {1000, 2000, 3000};
+
+void setUp() {}
+void tearDown() {}
+
+void test_stages_in_order()
+{
+  InactivityStages<3> stages(deadlines);
+  size_t entered;
+  stages.activity(500);
+  TEST_ASSERT_FALSE(stages.update(1499, entered));
+  TEST_ASSERT_TRUE(stages.update(1500, entered));
+  TEST_ASSERT_EQUAL(0, entered);
+  TEST_ASSERT_FALSE(stages.update(1500, entered));
+  TEST_ASSERT_TRUE(stages.update(2500, entered));
+  TEST_ASSERT_EQUAL(1, entered);
+  TEST_ASSERT_TRUE(stages.update(3500, entered));
+  TEST_ASSERT_EQUAL(2, entered);
+  TEST_ASSERT_FALSE(stages.update(100000, entered));
+  uint32_t remaining;
+  TEST_ASSERT_FALSE(stages.untilNext(100000, remaining));
+}
+
+void test_late_update_catches_up_one_at_a_time()
+{
+  InactivityStages<3> stages(deadlines);
+  size_t entered;
+  stages.activity(0);
+  size_t count = 0;
+  while (stages.update(10000, entered)) TEST_ASSERT_EQUAL(count++, entered);
+  TEST_ASSERT_EQUAL(3, count);
+}
+
+void test_activity_starts_over()
+{
+  InactivityStages<3> stages(deadlines);
+  size_t entered;
+  stages.activity(0);
+  stages.update(1500, entered);
+  stages.activity(1600);
+  TEST_ASSERT_EQUAL(0, stages.stage());
+  uint32_t remaining;
+  TEST_ASSERT_TRUE(stages.untilNext(1700, remaining));
+  TEST_ASSERT_EQUAL_UINT32(900, remaining);
+}
+
+void test_until_next_never_negative()
+{
+  InactivityStages<3> stages(deadlines);
+  stages.activity(0);
+  uint32_t remaining;
+  TEST_ASSERT_TRUE(stages.untilNext(5000, remaining));
+  TEST_ASSERT_EQUAL_UINT32(0, remaining);
+}
+
+void test_changed_deadline_and_restore()
+{
+  InactivityStages<3> stages(deadlines);
+  size_t entered;
+  stages.activity(0);
+  stages.setDeadline(0, 500);
+  TEST_ASSERT_TRUE(stages.update(500, entered));
+
+  stages.restore(10000, 2);
+  TEST_ASSERT_EQUAL(2, stages.stage());
+  TEST_ASSERT_EQUAL_UINT32(10000, stages.lastActivityAt());
+  TEST_ASSERT_FALSE(stages.update(12999, entered));
+  TEST_ASSERT_TRUE(stages.update(13000, entered));
+  TEST_ASSERT_EQUAL(2, entered);
+  stages.restore(0, 7);
+  TEST_ASSERT_EQUAL(3, stages.stage());
+}
+
+void test_across_rollover()
+{
+  InactivityStages<3> stages(deadlines);
+  size_t entered;
+  stages.activity(0xFFFFFF00);
+  TEST_ASSERT_FALSE(stages.update(0x100, entered));
+  TEST_ASSERT_TRUE(stages.update(0x300, entered));
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_stages_in_order);
+  RUN_TEST(test_late_update_catches_up_one_at_a_time);
+  RUN_TEST(test_activity_starts_over);
+  RUN_TEST(test_until_next_never_negative);
+  RUN_TEST(test_changed_deadline_and_restore);
+  RUN_TEST(test_across_rollover);
+  return UNITY_END();
+}
@@ -0,0 +1,177 @@
+#include <unity.h>
+#include <vector>
+
+#include "irDecoder.h"
+
+// Builds the RMT capture of a frame from (mark, duration) pulses.
+struct Capture
+{
+  std::vector<IrSymbol> symbols;
+  bool half = false;
+
+  void pulse(bool mark, uint16_t duration)
+  {
+    if (!half) symbols.push_back({duration, (uint8_t)(mark ? 0 : 1), 0, 1});
+    else
+    {
+      symbols.back().duration1 = duration;
+      symbols.back().level1 = mark ? 0 : 1;
+    }
+    half = !half;
+  }
+};
+
+Capture necFrame(uint32_t bits)
+{
+  Capture capture;
+  capture.pulse(true, 9000);
+  capture.pulse(false, 4500);
+  for (int bit = 0; bit < 32; bit++)
+  {
+    capture.pulse(true, 560);
+    capture.pulse(false, (bits >> bit) & 1 ? 1690 : 560);
+  }
+  capture.pulse(true, 560);
+  return capture;
+}
+
+Capture necFrame(uint8_t address, uint8_t command)
+{
+  return necFrame(address | (uint32_t)(uint8_t)~address << 8 | (uint32_t)command << 16 |
+                  (uint32_t)(uint8_t)~command << 24);
+}
+
+// 14 Manchester bits, a 1 is a space then a mark; the capture starts at the
+// first mark and the final space disappears in the idle line.
+Capture rc5Frame(uint8_t address, uint8_t command, bool toggle)
+{
+  uint16_t bits = 1 << 13 | (command & 0x40 ? 0 : 1) << 12 | (toggle ? 1 : 0) << 11 | (address & 0x1F) << 6 |
+                  (command & 0x3F);
+  std::vector<bool> halves;
+  for (int bit = 13; bit >= 0; bit--)
+  {
+    bool one = (bits >> bit) & 1;
+    halves.push_back(one);
+    halves.push_back(!one);
+  }
+  // halves holds "is a space"; flip to marks and drop the leading space
+  Capture capture;
+  size_t i = 1;
+  while (i < halves.size())
+  {
+    bool mark = !halves[i];
+    size_t run = 1;
+    while (i + run < halves.size() && !halves[i + run] == mark) run++;
+    if (!(i + run == halves.size() && !mark)) capture.pulse(mark, 889 * run);
+    i += run;
+  }
+  return capture;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_nec_frame()
+{
+  Capture capture = necFrame(0x04, 0x08);
+  IrCode code;
+  TEST_ASSERT_TRUE(ir::decodeNec(capture.symbols.data(), capture.symbols.size(), code));
+  TEST_ASSERT_EQUAL(IrCode::nec, code.protocol);
+  TEST_ASSERT_EQUAL_HEX16(0x04, code.address);
+  TEST_ASSERT_EQUAL_HEX8(0x08, code.command);
+  TEST_ASSERT_FALSE(code.repeat);
+}
+
+void test_nec_extended_address()
+{
+  Capture capture = necFrame(0x3412 | (uint32_t)0x5A << 16 | (uint32_t)0xA5 << 24);
+  IrCode code;
+  TEST_ASSERT_TRUE(ir::decodeNec(capture.symbols.data(), capture.symbols.size(), code));
+  TEST_ASSERT_EQUAL_HEX16(0x3412, code.address);
+  TEST_ASSERT_EQUAL_HEX8(0x5A, code.command);
+}
+
+void test_nec_repeat()
+{
+  Capture capture;
+  capture.pulse(true, 9000);
+  capture.pulse(false, 2250);
+  capture.pulse(true, 560);
+  IrCode code;
+  TEST_ASSERT_TRUE(ir::decodeNec(capture.symbols.data(), capture.symbols.size(), code));
+  TEST_ASSERT_TRUE(code.repeat);
+}
+
+void test_nec_tolerates_receiver_distortion()
+{
+  Capture capture = necFrame(0x04, 0x08);
+  for (IrSymbol &symbol : capture.symbols)
+  {
+    // marks stretched, spaces shrunk
+    if (symbol.duration0) symbol.duration0 += 90;
+    if (symbol.duration1) symbol.duration1 -= 90;
+  }
+  IrCode code;
+  TEST_ASSERT_TRUE(ir::decodeNec(capture.symbols.data(), capture.symbols.size(), code));
+  TEST_ASSERT_EQUAL_HEX8(0x08, code.command);
+}
+
+void test_nec_rejects_bad_command_inverse()
+{
+  Capture capture = necFrame(0x04 | 0xFB << 8 | (uint32_t)0x08 << 16 | (uint32_t)0x08 << 24);
+  IrCode code;
+  TEST_ASSERT_FALSE(ir::decodeNec(capture.symbols.data(), capture.symbols.size(), code));
+}
+
+void test_rc5_frame_and_toggle()
+{
+  int8_t lastToggle = -1;
+  IrCode code;
+  Capture first = rc5Frame(0x05, 0x02, false);
+  TEST_ASSERT_TRUE(ir::decodeRc5(first.symbols.data(), first.symbols.size(), code, lastToggle));
+  TEST_ASSERT_EQUAL(IrCode::rc5, code.protocol);
+  TEST_ASSERT_EQUAL_HEX16(0x05, code.address);
+  TEST_ASSERT_EQUAL_HEX8(0x02, code.command);
+  TEST_ASSERT_FALSE(code.repeat);
+
+  TEST_ASSERT_TRUE(ir::decodeRc5(first.symbols.data(), first.symbols.size(), code, lastToggle));
+  TEST_ASSERT_TRUE(code.repeat); // key held, same toggle
+
+  Capture next = rc5Frame(0x05, 0x02, true);
+  TEST_ASSERT_TRUE(ir::decodeRc5(next.symbols.data(), next.symbols.size(), code, lastToggle));
+  TEST_ASSERT_FALSE(code.repeat);
+}
+
+void test_rc5_extended_command()
+{
+  int8_t lastToggle = -1;
+  IrCode code;
+  Capture capture = rc5Frame(0x1F, 0x55, false);
+  TEST_ASSERT_TRUE(ir::decodeRc5(capture.symbols.data(), capture.symbols.size(), code, lastToggle));
+  TEST_ASSERT_EQUAL_HEX16(0x1F, code.address);
+  TEST_ASSERT_EQUAL_HEX8(0x55, code.command);
+}
+
+void test_protocols_do_not_mistake_each_other()
+{
+  int8_t lastToggle = -1;
+  IrCode code;
+  Capture nec = necFrame(0x04, 0x08);
+  TEST_ASSERT_FALSE(ir::decodeRc5(nec.symbols.data(), nec.symbols.size(), code, lastToggle));
+  Capture rc5 = rc5Frame(0x05, 0x02, false);
+  TEST_ASSERT_FALSE(ir::decodeNec(rc5.symbols.data(), rc5.symbols.size(), code));
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_nec_frame);
+  RUN_TEST(test_nec_extended_address);
+  RUN_TEST(test_nec_repeat);
+  RUN_TEST(test_nec_tolerates_receiver_distortion);
+  RUN_TEST(test_nec_rejects_bad_command_inverse);
+  RUN_TEST(test_rc5_frame_and_toggle);
+  RUN_TEST(test_rc5_extended_command);
+  RUN_TEST(test_protocols_do_not_mistake_each_other);
+  return UNITY_END();
+}
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unity.h>
+
+#include "runtimeConfig.h"
+
+struct StringSink
+{
+  std::string text;
+  void write(const uint8_t *data, size_t length) { text.append((const char *)data, length); }
+};
+
+// Logs every event of a document, e.g. "{ k:a 1 }".
+struct EventLog
+{
+  std::string events;
+
+  void log(const std::string &event)
+  {
+    if (!events.empty()) events += " ";
+    events += event;
+  }
+  bool beginObject() { return log("{"), true; }
+  bool endObject() { return log("}"), true; }
+  bool beginArray() { return log("["), true; }
+  bool endArray() { return log("]"), true; }
+  bool key(const char *name) { return log(std::string("k:") + name), true; }
+  bool string(const char *text) { return log(std::string("s:") + text), true; }
+  bool number(int32_t value) { return log(std::to_string(value)), true; }
+  bool boolean(bool value) { return log(value ? "true" : "false"), true; }
+  bool null() { return log("null"), true; }
+};
+
+const RuntimeConfig defaults = {{{1000, 30000}, {1000, 60000}, {2000, 60000}, {3000, 120000}},
+                                60000, 600000, 1200000, 20, 1000, 400, 40, 500, 300, 30};
+
+// Parses text into staged, fed in chunks of chunk characters.
+bool parse(const std::string &text, RuntimeConfig &staged, size_t chunk = 1000)
+{
+  ConfigReader handler(staged);
+  handler.reset(defaults);
+  JsonReader<ConfigReader> reader(handler);
+  for (size_t i = 0; i < text.size(); i += chunk)
+  {
+    if (!reader.feed(text.data() + i, std::min(chunk, text.size() - i))) return false;
+  }
+  return reader.finish() && handler.consistent();
+}
+
+std::string events(const std::string &text, json::Error &error)
+{
+  EventLog log;
+  JsonReader<EventLog> reader(log);
+  reader.feed(text.data(), text.size());
+  reader.finish();
+  error = reader.error();
+  return log.events;
+}
+
+// Every field set once per round, pretty-printed; only the last round's
+// values, those of target, survive. Earlier rounds stay in range.
+std::string largeDocument(const RuntimeConfig &target, int rounds)
+{
+  std::string text = "{";
+  for (int round = 0; round < rounds; round++)
+  {
+    RuntimeConfig values = target;
+    int offset = rounds - 1 - round;
+    for (PatternTiming &pattern : values.patterns)
+    {
+      pattern.on += offset;
+      pattern.off += offset;
+    }
+    for (size_t i = 0; i < config::fieldCount; i++)
+    {
+      int32_t &value = values.*config::fields[i].member;
+      value = value - offset >= config::fields[i].min ? value - offset : value + offset;
+    }
+    StringSink sink;
+    JsonWriter<StringSink> writer(sink);
+    writeConfig(writer, values);
+    std::string body = sink.text.substr(1, sink.text.size() - 2);
+    for (size_t at = 0; (at = body.find(',', at)) != std::string::npos; at += 8)
+    {
+      body.insert(at + 1, "\n      ");
+    }
+    text += (round ? ",\n  " : "\n  ") + body;
+  }
+  return text + "\n}\n";
+}
+
+const RuntimeConfig target = {{{800, 20000}, {1500, 45000}, {2500, 90000}, {5000, 240000}},
+                              90000, 900000, 1800000, 35, 1100, 600, 25, 800, 250, 40};
+
+// Uploads text in chunks of chunk characters onto base.
+bool upload(ConfigUpload &document, const RuntimeConfig &base, const std::string &text, size_t chunk)
+{
+  document.begin(base);
+  for (size_t i = 0; i < text.size(); i += chunk)
+  {
+    document.feed(text.data() + i, std::min(chunk, text.size() - i));
+    TEST_ASSERT_FALSE(document.valid());
+  }
+  return document.finish();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_reader_events()
+{
+  json::Error error;
+  std::string logged = events("{\"a\": [1, -20, true, false, null, \"x\\\"y\"]}", error);
+  TEST_ASSERT_EQUAL_STRING("{ k:a [ 1 -20 true false null s:x\"y ] }", logged.c_str());
+  TEST_ASSERT_EQUAL(json::ok, error);
+  logged = events(" 7 ", error);
+  TEST_ASSERT_EQUAL_STRING("7", logged.c_str());
+  TEST_ASSERT_EQUAL(json::ok, error);
+}
+
+void test_reader_errors()
+{
+  json::Error error;
+  events("{\"a\": 1,}", error);
+  TEST_ASSERT_EQUAL(json::syntax, error);
+  events("[1, 2", error);
+  TEST_ASSERT_EQUAL(json::incomplete, error);
+  events("1.5", error);
+  TEST_ASSERT_EQUAL(json::rejected, error);
+  events("2147483648", error);
+  TEST_ASSERT_EQUAL(json::rejected, error);
+  std::string logged = events("-2147483648", error);
+  TEST_ASSERT_EQUAL_STRING("-2147483648", logged.c_str());
+  events("[[[[[[[[[]]]]]]]]]", error);
+  TEST_ASSERT_EQUAL(json::tooDeep, error);
+  events("\"" + std::string(40, 'x') + "\"", error);
+  TEST_ASSERT_EQUAL(json::tooLong, error);
+  events("{} {}", error);
+  TEST_ASSERT_EQUAL(json::syntax, error);
+  events("[1 2]", error);
+  TEST_ASSERT_EQUAL(json::syntax, error);
+}
+
+void test_writer_round_trip()
+{
+  StringSink sink;
+  JsonWriter<StringSink> writer(sink);
+  writeConfig(writer, defaults);
+  RuntimeConfig parsed;
+  TEST_ASSERT_TRUE(parse(sink.text, parsed));
+  TEST_ASSERT_EQUAL_MEMORY(&defaults, &parsed, sizeof(RuntimeConfig));
+  TEST_ASSERT_EQUAL('{', sink.text[0]);
+  TEST_ASSERT_TRUE(sink.text.find("\"patterns\":[{\"on\":1000,\"off\":30000},") != std::string::npos);
+}
+
+void test_writer_escapes_and_negatives()
+{
+  StringSink sink;
+  JsonWriter<StringSink> writer(sink);
+  writer.beginArray();
+  writer.string("a\"b\\c\n");
+  writer.number(-2147483647 - 1);
+  writer.boolean(false);
+  writer.endArray();
+  TEST_ASSERT_EQUAL_STRING("[\"a\\\"b\\\\c\\n\",-2147483648,false]", sink.text.c_str());
+}
+
+// Any chunking gives the same result.
+void test_chunked_partial_document()
+{
+  const std::string text = "{\"patterns\": [{\"on\": 500}, {}, {\"off\": 90000}], \"vpd\": {\"target\": 1200}}";
+  for (size_t chunk = 1; chunk <= text.size(); chunk++)
+  {
+    RuntimeConfig parsed;
+    TEST_ASSERT_TRUE(parse(text, parsed, chunk));
+    TEST_ASSERT_EQUAL(500, parsed.patterns[0].on);
+    TEST_ASSERT_EQUAL(30000, parsed.patterns[0].off);
+    TEST_ASSERT_EQUAL(90000, parsed.patterns[2].off);
+    TEST_ASSERT_EQUAL(3000, parsed.patterns[3].on);
+    TEST_ASSERT_EQUAL(1200, parsed.vpdTargetPa);
+    TEST_ASSERT_EQUAL(defaults.sleepDelay, parsed.sleepDelay);
+  }
+}
+
+void test_rejected_documents()
+{
+  RuntimeConfig parsed;
+  TEST_ASSERT_FALSE(parse("{\"vpd\": {\"target\": 100}}", parsed));                  // below the range
+  TEST_ASSERT_FALSE(parse("{\"vpd\": {\"colour\": 1}}", parsed));                     // unknown field
+  TEST_ASSERT_FALSE(parse("{\"delays\": {\"timeout\": \"long\"}}", parsed));           // wrong type
+  TEST_ASSERT_FALSE(parse("{\"patterns\": [{}, {}, {}, {}, {}]}", parsed));             // too many
+  TEST_ASSERT_FALSE(parse("{\"delays\": {\"timeout\": 60000, \"fanMinimum\": 60000}}", parsed)); // inconsistent
+  TEST_ASSERT_FALSE(parse("{\"vpd\": {\"target\": {}}}", parsed));
+  TEST_ASSERT_FALSE(parse("[]", parsed));
+}
+
+void test_large_document_in_small_chunks()
+{
+  const std::string text = largeDocument(target, 30);
+  TEST_ASSERT_TRUE(text.size() > 8000);
+  const size_t chunks[] = {1, 7, 64, 536, 1460};
+  for (size_t chunk : chunks)
+  {
+    ConfigUpload document;
+    RuntimeConfig base = defaults;
+    TEST_ASSERT_TRUE(upload(document, base, text, chunk));
+    TEST_ASSERT_EQUAL_MEMORY(&target, &document.result(), sizeof(RuntimeConfig));
+    TEST_ASSERT_EQUAL_MEMORY(&defaults, &base, sizeof(RuntimeConfig));
+  }
+}
+
+// An error in the last few bytes of a large document rejects all of it.
+void test_large_document_rejected_whole()
+{
+  const std::string text = largeDocument(target, 30);
+  RuntimeConfig inconsistent = target;
+  inconsistent.sleepDelay = inconsistent.timeoutDelay;
+  std::string outOfRange = text;
+  outOfRange.replace(outOfRange.rfind("\"fanMin\":40"), 12, "\"fanMin\":400");
+  const std::string damaged[] = {
+      outOfRange,
+      text.substr(0, text.size() - 3), // cut off before the last brace
+      text.substr(0, text.size() - 3) + ",\"vpd\":{\"target\":1200,}}",
+      largeDocument(inconsistent, 30),
+  };
+  for (const std::string &document : damaged)
+  {
+    ConfigUpload rejected;
+    RuntimeConfig base = defaults;
+    TEST_ASSERT_FALSE(upload(rejected, base, document, 64));
+    TEST_ASSERT_FALSE(rejected.valid());
+    TEST_ASSERT_EQUAL_MEMORY(&defaults, &base, sizeof(RuntimeConfig));
+  }
+  // found while streaming, right where it is
+  ConfigUpload rejected;
+  upload(rejected, defaults, outOfRange, 64);
+  TEST_ASSERT_EQUAL(json::rejected, rejected.error());
+  TEST_ASSERT_TRUE(rejected.position() > outOfRange.size() - 20);
+}
+
+// Reports how fast documents stream through the parser in 64 byte chunks.
+void test_parse_throughput()
+{
+  const std::string text = largeDocument(target, 30);
+  ConfigUpload document;
+  size_t bytes = 0;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds elapsed;
+  do
+  {
+    TEST_ASSERT_TRUE(upload(document, defaults, text, 64));
+    bytes += text.size();
+    elapsed = std::chrono::steady_clock::now() - started;
+  } while (elapsed < std::chrono::milliseconds(100));
+  char message[96];
+  snprintf(message, sizeof(message), "Parsed %u bytes at %.1f MB/s", (unsigned)bytes, bytes * 1000.0 / elapsed.count());
+  TEST_MESSAGE(message);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_reader_events);
+  RUN_TEST(test_reader_errors);
+  RUN_TEST(test_writer_round_trip);
+  RUN_TEST(test_writer_escapes_and_negatives);
+  RUN_TEST(test_chunked_partial_document);
+  RUN_TEST(test_rejected_documents);
+  RUN_TEST(test_large_document_in_small_chunks);
+  RUN_TEST(test_large_document_rejected_whole);
+  RUN_TEST(test_parse_throughput);
+  return UNITY_END();
+}
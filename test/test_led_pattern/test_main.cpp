@@ -0,0 +1,80 @@
+#include <unity.h>
+
+#include "ledPattern.h"
+
+const LedStep blink[] = {{255, 0, 100}, {0, 0, 100}};
+const LedStep breathe[] = {{128, 500, 0}, {16, 500, 0}, {64, 200, 0}};
+
+void setUp() {}
+void tearDown() {}
+
+void test_nothing_to_show()
+{
+  LedSequencer sequencer;
+  LedStep step;
+  TEST_ASSERT_FALSE(sequencer.next(step));
+  TEST_ASSERT_TRUE(sequencer.playingIdle());
+}
+
+void test_idle_loops()
+{
+  LedSequencer sequencer;
+  sequencer.setIdle({breathe, 3, 0});
+  LedStep step;
+  for (int i = 0; i < 7; i++)
+  {
+    TEST_ASSERT_TRUE(sequencer.next(step));
+    TEST_ASSERT_EQUAL(breathe[i % 3].level, step.level);
+  }
+}
+
+void test_queued_pattern_repeats_then_idle_restarts()
+{
+  LedSequencer sequencer;
+  sequencer.setIdle({breathe, 3, 0});
+  LedStep step;
+  sequencer.next(step); // idle part way through
+  TEST_ASSERT_TRUE(sequencer.enqueue({blink, 2, 3}));
+  for (int i = 0; i < 6; i++)
+  {
+    TEST_ASSERT_TRUE(sequencer.next(step));
+    TEST_ASSERT_EQUAL(blink[i % 2].level, step.level);
+    if (i < 5) TEST_ASSERT_FALSE(sequencer.playingIdle());
+  }
+  TEST_ASSERT_TRUE(sequencer.playingIdle()); // once its last step is handed out
+  sequencer.next(step);
+  TEST_ASSERT_EQUAL(breathe[0].level, step.level); // from its first step
+}
+
+void test_queue_plays_in_order_and_drops_overflow()
+{
+  LedSequencer sequencer;
+  const LedStep levels[] = {{1, 0, 0}, {2, 0, 0}, {3, 0, 0}, {4, 0, 0}, {5, 0, 0}};
+  for (size_t i = 0; i < LedSequencer::queueSize; i++) TEST_ASSERT_TRUE(sequencer.enqueue({&levels[i], 1, 1}));
+  TEST_ASSERT_FALSE(sequencer.enqueue({&levels[4], 1, 1}));
+  LedStep step;
+  for (size_t i = 0; i < LedSequencer::queueSize; i++)
+  {
+    TEST_ASSERT_TRUE(sequencer.next(step));
+    TEST_ASSERT_EQUAL(levels[i].level, step.level);
+  }
+  TEST_ASSERT_FALSE(sequencer.next(step));
+}
+
+void test_empty_patterns_are_refused()
+{
+  LedSequencer sequencer;
+  TEST_ASSERT_FALSE(sequencer.enqueue({blink, 0, 1}));
+  TEST_ASSERT_FALSE(sequencer.enqueue({blink, 2, 0}));
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_nothing_to_show);
+  RUN_TEST(test_idle_loops);
+  RUN_TEST(test_queued_pattern_repeats_then_idle_restarts);
+  RUN_TEST(test_queue_plays_in_order_and_drops_overflow);
+  RUN_TEST(test_empty_patterns_are_refused);
+  return UNITY_END();
+}
@@ -0,0 +1,232 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "modbusRtu.h"
+
+// Modbus RTU over a pseudo-terminal standing in for the RS-485 line: the
+// test is the bus master on the master side, and a unit on the slave side
+// reads it the way the UART driver does, with data events and a receive
+// timeout after frameGapMs of silence. Times are stretched far beyond the
+// 2 ms gap at 19200 baud so that a busy host cannot fake a gap.
+
+const int frameGapMs = 50;
+const int pauseMs = 2;           // between the pieces of a split frame
+const int betweenFramesMs = 200;
+
+// Ten registers holding 100 + address.
+struct FakeRegisters
+{
+  modbus::Exception read(uint16_t address, uint16_t &value)
+  {
+    if (address >= 10) return modbus::illegalAddress;
+    value = 100 + address;
+    return modbus::none;
+  }
+
+  modbus::Exception write(uint16_t, uint16_t) { return modbus::illegalAddress; }
+};
+
+// The unit side, run on its own thread until stopped.
+class Unit
+{
+public:
+  explicit Unit(int line) : slave(1, registers), line(line), thread(&Unit::run, this) {}
+
+  // Waits for the frame in progress, if any, to end.
+  void stop()
+  {
+    running = false;
+    thread.join();
+  }
+
+  FakeRegisters registers;
+  ModbusFramer framer;
+  ModbusSlave<FakeRegisters> slave;
+  uint32_t frames = 0; // receive timeouts with bytes to handle
+
+private:
+  void run()
+  {
+    bool receiving = false;
+    while (running || receiving)
+    {
+      pollfd readable = {line, POLLIN, 0};
+      if (poll(&readable, 1, frameGapMs) > 0)
+      {
+        uint8_t chunk[64];
+        ssize_t length = ::read(line, chunk, sizeof(chunk));
+        if (length <= 0) continue;
+        framer.received(chunk, length);
+        receiving = true;
+        continue;
+      }
+      if (!receiving) continue;
+      receiving = false;
+
+      size_t frameLength = framer.ended();
+      if (frameLength == 0) continue;
+      frames++;
+      uint8_t response[modbus::maxFrame];
+      size_t responseLength = slave.handle(framer.frame(), frameLength, response);
+      if (responseLength > 0 && ::write(line, response, responseLength) != (ssize_t)responseLength) return;
+    }
+  }
+
+  int line;
+  std::atomic<bool> running{true};
+  std::thread thread;
+};
+
+int master = -1;
+int line = -1;
+
+void setUp()
+{
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  TEST_ASSERT_TRUE(master >= 0);
+  TEST_ASSERT_EQUAL(0, grantpt(master));
+  TEST_ASSERT_EQUAL(0, unlockpt(master));
+  line = open(ptsname(master), O_RDWR | O_NOCTTY);
+  TEST_ASSERT_TRUE(line >= 0);
+  // bytes pass untouched, no echo or line editing
+  termios raw;
+  tcgetattr(line, &raw);
+  cfmakeraw(&raw);
+  tcsetattr(line, TCSANOW, &raw);
+}
+
+void tearDown()
+{
+  close(line);
+  close(master);
+}
+
+void pause(int ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+// Appends the CRC.
+std::vector<uint8_t> sealed(std::vector<uint8_t> frame)
+{
+  uint16_t crc = modbus::crc16(frame.data(), frame.size());
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+  return frame;
+}
+
+// Sends bytes from..to of frame in one write.
+void send(const std::vector<uint8_t> &frame, size_t from, size_t to)
+{
+  TEST_ASSERT_EQUAL(to - from, ::write(master, frame.data() + from, to - from));
+}
+
+// Everything the unit sends within timeoutMs, stopping early once expected
+// bytes are in.
+std::vector<uint8_t> receive(size_t expected, int timeoutMs)
+{
+  std::vector<uint8_t> bytes;
+  std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  while (bytes.size() < expected)
+  {
+    int left = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count();
+    pollfd readable = {master, POLLIN, 0};
+    if (left <= 0 || poll(&readable, 1, left) <= 0) break;
+    uint8_t chunk[64];
+    ssize_t length = ::read(master, chunk, sizeof(chunk));
+    if (length <= 0) break;
+    bytes.insert(bytes.end(), chunk, chunk + length);
+  }
+  return bytes;
+}
+
+const std::vector<uint8_t> readTwo = sealed({1, modbus::readHolding, 0, 2, 0, 2});
+const std::vector<uint8_t> readTwoResponse = sealed({1, modbus::readHolding, 4, 0, 102, 0, 103});
+
+// Pieces closer together than the gap are one frame.
+void test_split_frame_is_one_request()
+{
+  Unit unit(line);
+  send(readTwo, 0, 1);
+  pause(pauseMs);
+  send(readTwo, 1, 5);
+  pause(pauseMs);
+  send(readTwo, 5, readTwo.size());
+  std::vector<uint8_t> response = receive(readTwoResponse.size(), 1000);
+  unit.stop();
+  TEST_ASSERT_EQUAL(readTwoResponse.size(), response.size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(readTwoResponse.data(), response.data(), response.size());
+  TEST_ASSERT_EQUAL(1, unit.frames);
+}
+
+void test_frames_apart_are_answered_in_turn()
+{
+  Unit unit(line);
+  const std::vector<uint8_t> readOne = sealed({1, modbus::readInput, 0, 9, 0, 1});
+  const std::vector<uint8_t> readOneResponse = sealed({1, modbus::readInput, 2, 0, 109});
+  send(readTwo, 0, readTwo.size());
+  pause(betweenFramesMs);
+  send(readOne, 0, 3);
+  pause(pauseMs);
+  send(readOne, 3, readOne.size());
+  std::vector<uint8_t> responses = receive(readTwoResponse.size() + readOneResponse.size(), 1000);
+  unit.stop();
+  std::vector<uint8_t> expected = readTwoResponse;
+  expected.insert(expected.end(), readOneResponse.begin(), readOneResponse.end());
+  TEST_ASSERT_EQUAL(expected.size(), responses.size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected.data(), responses.data(), responses.size());
+  TEST_ASSERT_EQUAL(2, unit.slave.requestCount());
+}
+
+// A gap in the middle ends the frame there: neither half passes the CRC,
+// nothing is answered, and the next whole frame is.
+void test_gap_inside_a_frame_splits_it()
+{
+  Unit unit(line);
+  send(readTwo, 0, 4);
+  pause(betweenFramesMs);
+  send(readTwo, 4, readTwo.size());
+  TEST_ASSERT_EQUAL(0, receive(1, betweenFramesMs).size());
+  send(readTwo, 0, readTwo.size());
+  std::vector<uint8_t> response = receive(readTwoResponse.size(), 1000);
+  unit.stop();
+  TEST_ASSERT_EQUAL(3, unit.frames);
+  TEST_ASSERT_EQUAL(2, unit.slave.crcErrorCount());
+  TEST_ASSERT_EQUAL(1, unit.slave.requestCount());
+  TEST_ASSERT_EQUAL(readTwoResponse.size(), response.size());
+}
+
+// Longer than any RTU frame, in pieces: dropped whole, not handled in part.
+void test_oversize_frame_is_dropped()
+{
+  Unit unit(line);
+  std::vector<uint8_t> noise(modbus::maxFrame + 44, 0x55);
+  noise[0] = 1;
+  for (size_t from = 0; from < noise.size(); from += 100)
+  {
+    send(noise, from, from + 100 < noise.size() ? from + 100 : noise.size());
+    pause(pauseMs);
+  }
+  TEST_ASSERT_EQUAL(0, receive(1, betweenFramesMs).size());
+  send(readTwo, 0, readTwo.size());
+  std::vector<uint8_t> response = receive(readTwoResponse.size(), 1000);
+  unit.stop();
+  TEST_ASSERT_EQUAL(1, unit.framer.overflowCount());
+  TEST_ASSERT_EQUAL(0, unit.slave.crcErrorCount());
+  TEST_ASSERT_EQUAL(readTwoResponse.size(), response.size());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_split_frame_is_one_request);
+  RUN_TEST(test_frames_apart_are_answered_in_turn);
+  RUN_TEST(test_gap_inside_a_frame_splits_it);
+  RUN_TEST(test_oversize_frame_is_dropped);
+  return UNITY_END();
+}
@@ -0,0 +1,154 @@
+#include <string.h>
+#include <unity.h>
+
+#include "modbusRtu.h"
+
+// Ten registers holding 100 + address; address 9 refuses writes.
+struct FakeRegisters
+{
+  uint16_t values[10];
+
+  modbus::Exception read(uint16_t address, uint16_t &value)
+  {
+    if (address >= 10) return modbus::illegalAddress;
+    value = values[address];
+    return modbus::none;
+  }
+
+  modbus::Exception write(uint16_t address, uint16_t value)
+  {
+    if (address >= 10) return modbus::illegalAddress;
+    if (address == 9) return modbus::illegalValue;
+    values[address] = value;
+    return modbus::none;
+  }
+};
+
+FakeRegisters registers;
+uint8_t response[modbus::maxFrame];
+
+// Appends the CRC to a frame of length bytes and returns the new length.
+size_t seal(uint8_t *frame, size_t length)
+{
+  uint16_t crc = modbus::crc16(frame, length);
+  frame[length] = crc & 0xFF;
+  frame[length + 1] = crc >> 8;
+  return length + 2;
+}
+
+void setUp()
+{
+  for (uint16_t i = 0; i < 10; i++) registers.values[i] = 100 + i;
+  memset(response, 0, sizeof(response));
+}
+void tearDown() {}
+
+void test_crc_reference_frame()
+{
+  const uint8_t frame[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0A};
+  TEST_ASSERT_EQUAL_HEX16(0xCDC5, modbus::crc16(frame, sizeof(frame)));
+}
+
+void test_read_holding()
+{
+  ModbusSlave<FakeRegisters> slave(1, registers);
+  uint8_t request[8] = {1, modbus::readHolding, 0, 2, 0, 3};
+  size_t length = slave.handle(request, seal(request, 6), response);
+  TEST_ASSERT_EQUAL(11, length);
+  const uint8_t expected[] = {1, 3, 6, 0, 102, 0, 103, 0, 104};
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, response, sizeof(expected));
+  TEST_ASSERT_EQUAL_HEX16(modbus::crc16(response, 9), response[9] | response[10] << 8);
+}
+
+void test_write_single_echoes()
+{
+  ModbusSlave<FakeRegisters> slave(1, registers);
+  uint8_t request[8] = {1, modbus::writeSingle, 0, 4, 0x12, 0x34};
+  size_t length = slave.handle(request, seal(request, 6), response);
+  TEST_ASSERT_EQUAL(8, length);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(request, response, 8);
+  TEST_ASSERT_EQUAL_HEX16(0x1234, registers.values[4]);
+}
+
+void test_write_multiple()
+{
+  ModbusSlave<FakeRegisters> slave(1, registers);
+  uint8_t request[13] = {1, modbus::writeMultiple, 0, 1, 0, 2, 4, 0, 7, 0, 8};
+  size_t length = slave.handle(request, seal(request, 11), response);
+  TEST_ASSERT_EQUAL(8, length);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(request, response, 6);
+  TEST_ASSERT_EQUAL(7, registers.values[1]);
+  TEST_ASSERT_EQUAL(8, registers.values[2]);
+}
+
+void test_write_multiple_stops_at_failing_register()
+{
+  ModbusSlave<FakeRegisters> slave(1, registers);
+  uint8_t request[13] = {1, modbus::writeMultiple, 0, 8, 0, 2, 4, 0, 7, 0, 8};
+  size_t length = slave.handle(request, seal(request, 11), response);
+  TEST_ASSERT_EQUAL(5, length);
+  TEST_ASSERT_EQUAL_HEX8(0x90, response[1]);
+  TEST_ASSERT_EQUAL(modbus::illegalValue, response[2]);
+  TEST_ASSERT_EQUAL(7, registers.values[8]);
+  TEST_ASSERT_EQUAL(1, slave.exceptionCount());
+}
+
+void test_exceptions()
+{
+  ModbusSlave<FakeRegisters> slave(1, registers);
+  uint8_t request[8] = {1, modbus::readInput, 0, 8, 0, 3};
+  TEST_ASSERT_EQUAL(5, slave.handle(request, seal(request, 6), response));
+  TEST_ASSERT_EQUAL_HEX8(0x84, response[1]);
+  TEST_ASSERT_EQUAL(modbus::illegalAddress, response[2]);
+
+  uint8_t unknown[8] = {1, 0x2B, 0, 0, 0, 0};
+  TEST_ASSERT_EQUAL(5, slave.handle(unknown, seal(unknown, 6), response));
+  TEST_ASSERT_EQUAL(modbus::illegalFunction, response[2]);
+
+  uint8_t tooMany[8] = {1, modbus::readHolding, 0, 0, 0, 126};
+  TEST_ASSERT_EQUAL(5, slave.handle(tooMany, seal(tooMany, 6), response));
+  TEST_ASSERT_EQUAL(modbus::illegalValue, response[2]);
+}
+
+void test_silent_frames()
+{
+  ModbusSlave<FakeRegisters> slave(1, registers);
+  uint8_t other[8] = {2, modbus::readHolding, 0, 0, 0, 1};
+  TEST_ASSERT_EQUAL(0, slave.handle(other, seal(other, 6), response));
+
+  uint8_t corrupt[8] = {1, modbus::readHolding, 0, 0, 0, 1};
+  seal(corrupt, 6);
+  corrupt[7] ^= 1;
+  TEST_ASSERT_EQUAL(0, slave.handle(corrupt, 8, response));
+  TEST_ASSERT_EQUAL(1, slave.crcErrorCount());
+
+  TEST_ASSERT_EQUAL(0, slave.handle(corrupt, 3, response));
+  TEST_ASSERT_EQUAL(0, slave.requestCount());
+}
+
+// Broadcast writes are applied but never answered; broadcast reads are ignored.
+void test_broadcast()
+{
+  ModbusSlave<FakeRegisters> slave(1, registers);
+  uint8_t write[8] = {modbus::broadcast, modbus::writeSingle, 0, 3, 0, 42};
+  TEST_ASSERT_EQUAL(0, slave.handle(write, seal(write, 6), response));
+  TEST_ASSERT_EQUAL(42, registers.values[3]);
+
+  uint8_t read[8] = {modbus::broadcast, modbus::readHolding, 0, 0, 0, 1};
+  TEST_ASSERT_EQUAL(0, slave.handle(read, seal(read, 6), response));
+  TEST_ASSERT_EQUAL(0, slave.exceptionCount());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_reference_frame);
+  RUN_TEST(test_read_holding);
+  RUN_TEST(test_write_single_echoes);
+  RUN_TEST(test_write_multiple);
+  RUN_TEST(test_write_multiple_stops_at_failing_register);
+  RUN_TEST(test_exceptions);
+  RUN_TEST(test_silent_frames);
+  RUN_TEST(test_broadcast);
+  return UNITY_END();
+}
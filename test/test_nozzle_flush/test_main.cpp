@@ -0,0 +1,229 @@
+#include <unity.h>
+
+#include "simulator.h"
+
+// The periodic nozzle flush and drying after a session, played through the
+// controller on the simulated clock.
+
+const uint32_t minute = 60 * 1000;
+const uint32_t hour = 60 * minute;
+const uint32_t flushDue = settings::purge::flushInterval;
+
+struct Opening
+{
+  uint32_t at;
+  uint32_t length;
+};
+
+// Valve openings between from and until, from the mist trace events.
+std::vector<Opening> openings(const SimHal &hal, uint32_t from, uint32_t until)
+{
+  std::vector<Opening> result;
+  uint32_t openedAt = 0;
+  bool open = false;
+  for (const TraceEvent &event : hal.events)
+  {
+    if (event.code != traceCode::mist) continue;
+    if (event.value && !open) openedAt = event.at;
+    else if (!event.value && open && openedAt >= from && openedAt < until) result.push_back({openedAt, event.at - openedAt});
+    open = event.value;
+  }
+  return result;
+}
+
+// Flush pulses are the only openings of exactly their length.
+std::vector<Opening> flushPulses(const SimHal &hal, uint32_t from, uint32_t until)
+{
+  std::vector<Opening> pulses;
+  for (const Opening &opening : openings(hal, from, until))
+  {
+    if (opening.length == settings::purge::flushPulseOn) pulses.push_back(opening);
+  }
+  return pulses;
+}
+
+// The fan speeds written between from and until, in order.
+std::vector<int> fanWrites(const SimHal &hal, uint32_t from, uint32_t until)
+{
+  std::vector<int> result;
+  for (const TraceEvent &event : hal.events)
+  {
+    if (event.code == traceCode::fan && event.at >= from && event.at < until) result.push_back(event.value);
+  }
+  return result;
+}
+
+// Like runUntil(), with a button press every ten minutes so the inactivity
+// stages never stop a pattern or put the unit to sleep.
+void runAwake(Simulation &simulation, uint32_t until)
+{
+  while ((int32_t)(until - simulation.hal.clock) > 0)
+  {
+    uint32_t next = simulation.hal.clock + 10 * minute;
+    simulation.runUntil((int32_t)(until - next) < 0 ? until : next);
+    simulation.controller.resetTimeoutTimer();
+  }
+}
+
+void click(Simulation &simulation, int button, int clicks)
+{
+  simulation.controller.clicked(button, clicks);
+  simulation.controller.tick();
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Keeps mist going past the flush interval, stops it and checks that the
+// flush came right after the stop and only then.
+void assertDeferredUntilStopped(Simulation &simulation, uint32_t stopAt)
+{
+  runAwake(simulation, stopAt);
+  TEST_ASSERT_EQUAL(0, flushPulses(simulation.hal, 0, stopAt).size());
+  click(simulation, 3, 1); // stops the pattern or VPD control
+  runAwake(simulation, stopAt + hour);
+
+  std::vector<Opening> pulses = flushPulses(simulation.hal, stopAt, stopAt + hour);
+  TEST_ASSERT_EQUAL(settings::purge::flushPulses, pulses.size());
+  TEST_ASSERT_UINT32_WITHIN(settings::purge::flushRetry, stopAt + settings::purge::flushRetry / 2, pulses[0].at);
+  for (size_t i = 1; i < pulses.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(settings::purge::flushPulseOn + settings::purge::flushPulseOff, pulses[i].at - pulses[i - 1].at);
+  }
+}
+
+void test_flush_waits_for_a_pattern()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  click(simulation, 1, 2);
+  assertDeferredUntilStopped(simulation, flushDue + 10 * minute);
+}
+
+void test_flush_waits_for_vpd_control()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  click(simulation, 2, 3);
+  // dry enough to mist every cycle
+  for (uint32_t at = 0; at < flushDue + 10 * minute; at += 10 * minute)
+  {
+    runAwake(simulation, at);
+    simulation.controller.climateMeasured(1800, 450);
+  }
+  runAwake(simulation, flushDue + 10 * minute);
+  simulation.controller.climateMeasured(1800, 450);
+  TEST_ASSERT_NOT_EQUAL(0, openings(simulation.hal, flushDue - 10 * minute, flushDue + 10 * minute).size());
+  assertDeferredUntilStopped(simulation, flushDue + 10 * minute + 20000);
+}
+
+// Two intervals pass while misting; their retries must not add up to two
+// flushes once the pattern stops.
+void test_missed_intervals_flush_once()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  click(simulation, 1, 2);
+  assertDeferredUntilStopped(simulation, 2 * flushDue + 10 * minute);
+}
+
+// A pattern started between two flush pulses opens the valve right away;
+// the flush keeps its pulses and the pattern its rhythm.
+void test_pattern_started_during_a_flush()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  uint32_t startedAt = flushDue + settings::purge::flushPulseOn + 100; // between the first two pulses
+  runAwake(simulation, startedAt);
+  std::vector<Opening> before = flushPulses(simulation.hal, 0, startedAt);
+  TEST_ASSERT_EQUAL(1, before.size());
+  TEST_ASSERT_EQUAL_UINT32(flushDue, before[0].at);
+  TEST_ASSERT_FALSE(simulation.controller.mistState());
+  click(simulation, 1, 2);
+  TEST_ASSERT_TRUE(simulation.controller.mistState());
+  runAwake(simulation, startedAt + 2 * minute);
+
+  const PatternTiming &pattern = simulation.controller.config().patterns[0];
+  std::vector<Opening> after = openings(simulation.hal, startedAt, startedAt + 2 * minute);
+  // the first on phase covers the second and third pulse, the last two
+  // still follow
+  const uint32_t pulsePeriod = settings::purge::flushPulseOn + settings::purge::flushPulseOff;
+  TEST_ASSERT_EQUAL(6, after.size());
+  TEST_ASSERT_EQUAL_UINT32(startedAt, after[0].at);
+  TEST_ASSERT_EQUAL_UINT32(pattern.on, after[0].length);
+  TEST_ASSERT_EQUAL_UINT32(flushDue + 3 * pulsePeriod, after[1].at);
+  TEST_ASSERT_EQUAL_UINT32(flushDue + 4 * pulsePeriod, after[2].at);
+  for (size_t i = 3; i < after.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(startedAt + (i - 2) * (pattern.on + pattern.off), after[i].at);
+    TEST_ASSERT_EQUAL_UINT32(pattern.on, after[i].length);
+  }
+  TEST_ASSERT_EQUAL(1, simulation.controller.patternMode());
+}
+
+void test_stop_all_after_misting_dries()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  simulation.runUntil(minute);
+  click(simulation, 1, 1);
+  simulation.runUntil(2 * minute);
+  click(simulation, 3, 2);
+  simulation.runUntil(2 * minute + settings::purge::dryingDuration - 1);
+  TEST_ASSERT_EQUAL(settings::purge::dryingFanPercent, simulation.controller.current().fanPercent);
+  simulation.runUntil(2 * minute + settings::purge::dryingDuration);
+  TEST_ASSERT_EQUAL(0, simulation.controller.fanAppliedPercent());
+
+  // nothing misted since, the next stop-all turns the fan off right away
+  click(simulation, 2, 1);
+  simulation.runUntil(10 * minute);
+  click(simulation, 3, 2);
+  TEST_ASSERT_EQUAL(0, simulation.controller.fanAppliedPercent());
+}
+
+// A flush uses the nozzles too, so a stop-all during one dries afterwards
+// and ends the pulses.
+void test_stop_all_during_a_flush_dries()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  runAwake(simulation, flushDue + settings::purge::flushPulseOn + 100);
+  click(simulation, 3, 2);
+  TEST_ASSERT_FALSE(simulation.controller.mistState());
+  TEST_ASSERT_EQUAL(settings::purge::dryingFanPercent, simulation.controller.current().fanPercent);
+  runAwake(simulation, flushDue + 10 * minute);
+  TEST_ASSERT_EQUAL(1, flushPulses(simulation.hal, flushDue, flushDue + 10 * minute).size());
+  // lowered for the valve, then drying and off
+  std::vector<int> fan = fanWrites(simulation.hal, flushDue, flushDue + 10 * minute);
+  TEST_ASSERT_EQUAL(3, fan.size());
+  TEST_ASSERT_TRUE(fan[0] < 100);
+  TEST_ASSERT_EQUAL(settings::purge::dryingFanPercent, fan[1]);
+  TEST_ASSERT_EQUAL(0, fan.back());
+}
+
+// Misting again while drying ends the drying, the fan keeps its speed.
+void test_misting_during_drying_cancels_it()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  click(simulation, 1, 1);
+  simulation.runUntil(minute);
+  click(simulation, 3, 2);
+  simulation.runUntil(2 * minute);
+  click(simulation, 1, 1);
+  simulation.runUntil(2 * minute + settings::purge::dryingDuration);
+  TEST_ASSERT_EQUAL(settings::purge::dryingFanPercent, simulation.controller.fanAppliedPercent());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_flush_waits_for_a_pattern);
+  RUN_TEST(test_flush_waits_for_vpd_control);
+  RUN_TEST(test_missed_intervals_flush_once);
+  RUN_TEST(test_pattern_started_during_a_flush);
+  RUN_TEST(test_stop_all_after_misting_dries);
+  RUN_TEST(test_stop_all_during_a_flush_dries);
+  RUN_TEST(test_misting_during_drying_cancels_it);
+  return UNITY_END();
+}
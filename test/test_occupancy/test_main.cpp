@@ -0,0 +1,59 @@
+#include <unity.h>
+
+#include "occupancy.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_vacant_after_delay_without_motion()
+{
+  OccupancyTracker tracker(60000);
+  TEST_ASSERT_EQUAL(OccupancyTracker::none, tracker.update(30000, 0, false));
+  TEST_ASSERT_EQUAL(OccupancyTracker::none, tracker.update(59999, 0, false));
+  TEST_ASSERT_EQUAL(OccupancyTracker::vacated, tracker.update(60000, 0, false));
+  TEST_ASSERT_TRUE(tracker.isVacant());
+  TEST_ASSERT_EQUAL(OccupancyTracker::none, tracker.update(90000, 0, false));
+}
+
+void test_output_high_keeps_it_occupied()
+{
+  OccupancyTracker tracker(60000);
+  TEST_ASSERT_EQUAL(OccupancyTracker::none, tracker.update(120000, 0, true));
+  TEST_ASSERT_FALSE(tracker.isVacant());
+}
+
+void test_new_motion_occupies_again()
+{
+  OccupancyTracker tracker(60000);
+  tracker.update(60000, 0, false);
+  TEST_ASSERT_EQUAL(OccupancyTracker::occupied, tracker.update(70000, 65000, false)); // an edge came and went
+  TEST_ASSERT_FALSE(tracker.isVacant());
+  TEST_ASSERT_EQUAL(OccupancyTracker::vacated, tracker.update(125000, 65000, false));
+  TEST_ASSERT_EQUAL(OccupancyTracker::occupied, tracker.update(126000, 65000, true));
+}
+
+void test_across_rollover()
+{
+  OccupancyTracker tracker(60000);
+  TEST_ASSERT_EQUAL(OccupancyTracker::none, tracker.update(0x1000, 0xFFFFF000, false));
+  TEST_ASSERT_EQUAL(OccupancyTracker::vacated, tracker.update(0x10000, 0xFFFFF000, false));
+}
+
+void test_pattern_phase()
+{
+  TEST_ASSERT_EQUAL_UINT32(0, patternPhase(1000, 1000, 31000));
+  TEST_ASSERT_EQUAL_UINT32(500, patternPhase(1000, 32500, 31000));
+  TEST_ASSERT_EQUAL_UINT32(0x200, patternPhase(0xFFFFFF00, 0x100, 1000));
+  TEST_ASSERT_EQUAL_UINT32(0, patternPhase(0, 5000, 0));
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_vacant_after_delay_without_motion);
+  RUN_TEST(test_output_high_keeps_it_occupied);
+  RUN_TEST(test_new_motion_occupies_again);
+  RUN_TEST(test_across_rollover);
+  RUN_TEST(test_pattern_phase);
+  return UNITY_END();
+}
@@ -0,0 +1,108 @@
+#include <string>
+#include <unity.h>
+
+#include "outputShadow.h"
+
+// Records the peripheral writes in order, e.g. "fan 100, mist 1".
+struct RecordingDriver
+{
+  std::string writes;
+
+  void writeMist(bool state) { log(std::string("mist ") + (state ? "1" : "0")); }
+  void writeFanPercent(int percent) { log("fan " + std::to_string(percent)); }
+
+  void log(const std::string &write)
+  {
+    if (!writes.empty()) writes += ", ";
+    writes += write;
+  }
+};
+
+RecordingDriver driver;
+
+void setUp() { driver.writes.clear(); }
+void tearDown() {}
+
+void test_first_commit_writes_everything()
+{
+  OutputShadow<RecordingDriver> outputs(driver);
+  outputs.commit();
+  TEST_ASSERT_EQUAL_STRING("mist 0, fan 0", driver.writes.c_str());
+  TEST_ASSERT_FALSE(outputs.pending());
+}
+
+void test_only_changes_are_written()
+{
+  OutputShadow<RecordingDriver> outputs(driver);
+  outputs.commit();
+  driver.writes.clear();
+  outputs.setFanPercent(50);
+  outputs.setFanPercent(80); // only the last request of a pass counts
+  outputs.setMist(true);
+  outputs.setMist(false);
+  outputs.commit();
+  TEST_ASSERT_EQUAL_STRING("fan 80", driver.writes.c_str());
+  driver.writes.clear();
+  outputs.commit();
+  TEST_ASSERT_EQUAL_STRING("", driver.writes.c_str());
+}
+
+// The valve closes before the fan changes and opens after it.
+void test_valve_order_around_fan()
+{
+  OutputShadow<RecordingDriver> outputs(driver);
+  outputs.commit();
+  driver.writes.clear();
+  outputs.setMist(true);
+  outputs.setFanPercent(100);
+  outputs.commit();
+  TEST_ASSERT_EQUAL_STRING("fan 100, mist 1", driver.writes.c_str());
+  driver.writes.clear();
+  outputs.setMist(false);
+  outputs.setFanPercent(0);
+  outputs.commit();
+  TEST_ASSERT_EQUAL_STRING("mist 0, fan 0", driver.writes.c_str());
+}
+
+void test_held_back_outputs_stay_pending()
+{
+  OutputShadow<RecordingDriver> outputs(driver);
+  outputs.commit();
+  driver.writes.clear();
+  outputs.setMist(true);
+  outputs.setFanPercent(100);
+  outputs.commit(false, false);
+  TEST_ASSERT_EQUAL_STRING("", driver.writes.c_str());
+  TEST_ASSERT_TRUE(outputs.pending());
+  outputs.commit(false, true);
+  TEST_ASSERT_EQUAL_STRING("fan 100", driver.writes.c_str());
+  TEST_ASSERT_TRUE(outputs.mistPending());
+  TEST_ASSERT_FALSE(outputs.fanPending());
+  outputs.commit();
+  TEST_ASSERT_EQUAL_STRING("fan 100, mist 1", driver.writes.c_str());
+  TEST_ASSERT_FALSE(outputs.pending());
+}
+
+void test_closing_and_slowing_are_never_held_back()
+{
+  OutputShadow<RecordingDriver> outputs(driver);
+  outputs.setMist(true);
+  outputs.setFanPercent(100);
+  outputs.commit();
+  driver.writes.clear();
+  outputs.setMist(false);
+  outputs.setFanPercent(50);
+  outputs.commit(false, false);
+  TEST_ASSERT_EQUAL_STRING("mist 0, fan 50", driver.writes.c_str());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_commit_writes_everything);
+  RUN_TEST(test_only_changes_are_written);
+  RUN_TEST(test_valve_order_around_fan);
+  RUN_TEST(test_held_back_outputs_stay_pending);
+  RUN_TEST(test_closing_and_slowing_are_never_held_back);
+  return UNITY_END();
+}
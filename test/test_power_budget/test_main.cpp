@@ -0,0 +1,95 @@
+#include <unity.h>
+
+#include "powerBudget.h"
+
+enum : size_t
+{
+  fan,
+  valve,
+  loads
+};
+
+const PowerLoad loadTable[] = {{1200, 1800, 40}, {400, 600, 15}};
+const PowerBudgetConfig config = {1500, 3000};
+
+void setUp() {}
+void tearDown() {}
+
+void test_steady_draw_follows_levels()
+{
+  PowerBudget<loads> budget(config, loadTable);
+  TEST_ASSERT_EQUAL_UINT32(0, budget.steadyMa());
+  budget.set(fan, 50, 0);
+  budget.set(valve, 100, 0);
+  TEST_ASSERT_EQUAL_UINT32(1000, budget.steadyMa());
+}
+
+void test_inrush_window()
+{
+  PowerBudget<loads> budget(config, loadTable);
+  budget.set(fan, 100, 1000);
+  TEST_ASSERT_EQUAL_UINT32(3000, budget.peakMa(1039));
+  TEST_ASSERT_EQUAL_UINT32(1200, budget.peakMa(1040));
+  budget.set(fan, 50, 2000); // slowing down draws no inrush
+  TEST_ASSERT_EQUAL_UINT32(600, budget.peakMa(2000));
+}
+
+void test_starts_are_staggered()
+{
+  PowerBudget<loads> budget(config, loadTable);
+  TEST_ASSERT_TRUE(budget.canStart(fan, 100, 0));
+  budget.set(fan, 100, 0);
+  TEST_ASSERT_FALSE(budget.canStart(valve, 100, 10)); // 3000 + 1000 over the peak budget
+  TEST_ASSERT_TRUE(budget.canStart(valve, 100, 40));
+}
+
+// The starting load's own steady draw counts too.
+void test_small_start_fits_beside_inrush()
+{
+  PowerBudget<loads> budget(config, loadTable);
+  budget.set(valve, 100, 0);
+  TEST_ASSERT_TRUE(budget.canStart(fan, 10, 5));   // 1000 + 120 + 1800 fits in 3000
+  TEST_ASSERT_FALSE(budget.canStart(fan, 50, 5));  // 1000 + 600 + 1800 does not
+}
+
+void test_load_alone_always_starts()
+{
+  const PowerBudgetConfig tight = {1000, 1000};
+  PowerBudget<loads> budget(tight, loadTable);
+  TEST_ASSERT_TRUE(budget.canStart(fan, 100, 0));
+}
+
+// Each load is capped so its steady draw fits next to the others at full.
+void test_max_percent()
+{
+  PowerBudget<loads> budget(config, loadTable);
+  TEST_ASSERT_EQUAL_UINT8(91, budget.maxPercent(fan));
+  TEST_ASSERT_EQUAL_UINT8(75, budget.maxPercent(valve));
+  const PowerBudgetConfig starved = {300, 3000};
+  PowerBudget<loads> small(starved, loadTable);
+  TEST_ASSERT_EQUAL_UINT8(0, small.maxPercent(valve));
+}
+
+// A released load no longer counts, whatever its last level.
+void test_released_load_frees_its_share()
+{
+  PowerBudget<loads> budget(config, loadTable);
+  budget.set(valve, 100, 0);
+  budget.reserve(valve, false);
+  TEST_ASSERT_EQUAL_UINT8(100, budget.maxPercent(fan));
+  budget.reserve(valve, true);
+  TEST_ASSERT_EQUAL_UINT8(91, budget.maxPercent(fan));
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_steady_draw_follows_levels);
+  RUN_TEST(test_inrush_window);
+  RUN_TEST(test_starts_are_staggered);
+  RUN_TEST(test_small_start_fits_beside_inrush);
+  RUN_TEST(test_load_alone_always_starts);
+  RUN_TEST(test_max_percent);
+  RUN_TEST(test_released_load_frees_its_share);
+  return UNITY_END();
+}
@@ -0,0 +1,186 @@
+#include <unity.h>
+
+#include "simulator.h"
+
+// The supply current of the simulated unit, from its own model of the loads
+// in SimHal, while the controller's power budget staggers the starts and
+// caps the fan.
+
+const PowerLoad &fanLoad = settings::power::fan;
+const PowerLoad &valveLoad = settings::power::valve;
+
+struct Start
+{
+  uint32_t at;
+  uint32_t inrushMs;
+};
+
+// Valve openings and fan speed-ups, in order, from the trace events.
+std::vector<Start> starts(const SimHal &hal)
+{
+  std::vector<Start> result;
+  bool mist = false;
+  int fanPercent = 0;
+  for (const TraceEvent &event : hal.events)
+  {
+    if (event.code == traceCode::mist)
+    {
+      if (event.value && !mist) result.push_back({event.at, valveLoad.inrushMs});
+      mist = event.value;
+    }
+    else if (event.code == traceCode::fan)
+    {
+      if (event.value > fanPercent) result.push_back({event.at, fanLoad.inrushMs});
+      fanPercent = event.value;
+    }
+  }
+  return result;
+}
+
+// Never two starts in the same pass; two inrush windows may only overlap
+// within the peak budget, which assertCapped() checks.
+void assertStaggered(const SimHal &hal)
+{
+  std::vector<Start> all = starts(hal);
+  for (size_t i = 1; i < all.size(); i++)
+  {
+    TEST_ASSERT_TRUE(all[i].at != all[i - 1].at);
+  }
+}
+
+// The steady draw in budget, and the peak within budget or, for a start on
+// its own, one inrush on top of the steady draw.
+void assertCapped(Simulation &simulation)
+{
+  const SimMetrics &metrics = simulation.metrics();
+  uint32_t lonePeak = settings::power::steadyBudgetMa + fanLoad.inrushMa;
+  TEST_ASSERT_TRUE(metrics.peakSteadyMa <= settings::power::steadyBudgetMa);
+  TEST_ASSERT_TRUE(metrics.peakMa <= (lonePeak > settings::power::peakBudgetMa ? lonePeak : settings::power::peakBudgetMa));
+}
+
+int lastFanWrite(const SimHal &hal)
+{
+  int percent = -1;
+  for (const TraceEvent &event : hal.events)
+  {
+    if (event.code == traceCode::fan) percent = event.value;
+  }
+  return percent;
+}
+
+void click(Simulation &simulation, int button, int clicks)
+{
+  simulation.controller.clicked(button, clicks);
+  simulation.controller.tick();
+}
+
+void setUp() {}
+void tearDown() {}
+
+// The fan is switched on in the same pass as a pattern's on phase opens the
+// valve; the fan waits for the valve's inrush.
+void test_fan_on_at_a_pattern_edge()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  click(simulation, 2, 2); // fan off
+  simulation.runUntil(1000);
+  click(simulation, 1, 2);
+  const PatternTiming &pattern = simulation.controller.config().patterns[0];
+  uint32_t edge = 1000 + pattern.on + pattern.off;
+  simulation.runUntil(edge - 1);
+  simulation.hal.clock = edge;
+  simulation.controller.clicked(2, 1); // fan on
+  simulation.controller.tick();
+  simulation.runUntil(edge + pattern.on / 2);
+
+  TEST_ASSERT_TRUE(simulation.controller.mistState());
+  TEST_ASSERT_EQUAL(simulation.controller.fanAppliedPercent(), lastFanWrite(simulation.hal));
+  std::vector<Start> all = starts(simulation.hal);
+  TEST_ASSERT_EQUAL_UINT32(edge, all[all.size() - 2].at);
+  TEST_ASSERT_EQUAL_UINT32(edge + valveLoad.inrushMs, all.back().at);
+  assertStaggered(simulation.hal);
+  assertCapped(simulation);
+}
+
+// A fan speed-up just before the edge holds the opening back instead.
+void test_pattern_edge_during_fan_spin_up()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  click(simulation, 2, 2);
+  simulation.runUntil(1000);
+  click(simulation, 1, 2);
+  const PatternTiming &pattern = simulation.controller.config().patterns[0];
+  uint32_t edge = 1000 + pattern.on + pattern.off;
+  simulation.runUntil(edge - 10);
+  click(simulation, 2, 1);
+  simulation.runUntil(edge + 1000);
+
+  std::vector<Start> all = starts(simulation.hal);
+  TEST_ASSERT_EQUAL_UINT32(edge - 10, all[all.size() - 2].at);
+  TEST_ASSERT_EQUAL_UINT32(edge - 10 + fanLoad.inrushMs, all.back().at);
+  assertStaggered(simulation.hal);
+  assertCapped(simulation);
+}
+
+// The valve's share only limits the fan while mist is on or due.
+void test_fan_runs_full_between_sessions()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  TEST_ASSERT_EQUAL(100, simulation.controller.fanAppliedPercent());
+  simulation.runUntil(1000);
+  click(simulation, 1, 2);
+  TEST_ASSERT_TRUE(simulation.controller.fanAppliedPercent() < 100);
+  simulation.runUntil(20000); // off phase, the next opening is due
+  TEST_ASSERT_FALSE(simulation.controller.mistState());
+  TEST_ASSERT_TRUE(simulation.controller.fanAppliedPercent() < 100);
+  click(simulation, 3, 1);
+  TEST_ASSERT_EQUAL(100, simulation.controller.fanAppliedPercent());
+  assertStaggered(simulation.hal);
+  assertCapped(simulation);
+}
+
+// Hours of patterns, bursts, fan changes and the flushes in between.
+void test_long_session_stays_in_budget()
+{
+  Simulation simulation;
+  simulation.powerOn();
+  for (uint32_t at = 0; at < 8 * 60 * 60 * 1000; at += 7 * 60 * 1000 + 333)
+  {
+    simulation.runUntil(at);
+    switch ((at / 1000) % 5)
+    {
+    case 0:
+      click(simulation, 1, 1 + (at / 1000) % 4);
+      break;
+    case 1:
+      click(simulation, 2, 1);
+      break;
+    case 2:
+      simulation.controller.encoderTurned(5);
+      simulation.controller.tick();
+      break;
+    case 3:
+      click(simulation, 3, 1);
+      break;
+    default:
+      click(simulation, 2, 2);
+      break;
+    }
+  }
+  TEST_ASSERT_TRUE(simulation.metrics().valveCycles > 100);
+  assertStaggered(simulation.hal);
+  assertCapped(simulation);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fan_on_at_a_pattern_edge);
+  RUN_TEST(test_pattern_edge_during_fan_spin_up);
+  RUN_TEST(test_fan_runs_full_between_sessions);
+  RUN_TEST(test_long_session_stays_in_budget);
+  return UNITY_END();
+}
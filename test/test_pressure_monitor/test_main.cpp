@@ -0,0 +1,132 @@
+#include <unity.h>
+
+#include "pressureMonitor.h"
+
+// One raw sample per bin of 1 us, so bins and settle times are easy to count.
+PressureMonitorConfig singleSampleBins()
+{
+  PressureMonitorConfig config;
+  config.samplePeriodUs = 1;
+  config.samplesPerBin = 1;
+  return config;
+}
+
+void feed(PressureMonitor &monitor, uint16_t level, size_t bins)
+{
+  for (size_t i = 0; i < bins; i++) monitor.addSample(level);
+}
+
+// A capture that stays at rest - drop for settleBins, then flows at settled.
+bool capture(PressureMonitor &monitor, uint16_t rest, uint16_t drop, uint16_t settled, size_t settleBins)
+{
+  monitor.valveOpened();
+  bool done = false;
+  for (size_t i = 0; i < PressureMonitor::captureBins; i++)
+  {
+    done = monitor.addSample(i < settleBins ? rest - drop : settled);
+  }
+  return done;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_capture_features()
+{
+  PressureMonitor monitor(singleSampleBins());
+  feed(monitor, 2000, 50);
+  TEST_ASSERT_TRUE(capture(monitor, 2000, 600, 1800, 10));
+  const PressureFeatures &features = monitor.lastFeatures();
+  TEST_ASSERT_FLOAT_WITHIN(0.5, 2000, features.restPressure);
+  TEST_ASSERT_FLOAT_WITHIN(0.5, 600, features.dropMagnitude);
+  TEST_ASSERT_FLOAT_WITHIN(0.5, 10, features.settleTime);
+  TEST_ASSERT_TRUE(monitor.isLearning());
+}
+
+void test_capture_cut_short_is_ignored()
+{
+  PressureMonitor monitor(singleSampleBins());
+  feed(monitor, 2000, 50);
+  monitor.valveOpened();
+  feed(monitor, 1500, 20);
+  monitor.valveClosed();
+  TEST_ASSERT_FALSE(monitor.isCapturing());
+  feed(monitor, 2000, PressureMonitor::captureBins);
+  TEST_ASSERT_FLOAT_WITHIN(0.5, 0, monitor.lastFeatures().restPressure);
+}
+
+// The valve stays open after the window is full; the flowing pressure seen
+// then must not count as resting pressure for the next capture.
+void test_rest_pressure_only_while_closed()
+{
+  PressureMonitor monitor(singleSampleBins());
+  feed(monitor, 2000, 50);
+  capture(monitor, 2000, 600, 1800, 10);
+  feed(monitor, 1800, 500);
+  monitor.valveClosed();
+  capture(monitor, 2000, 600, 1800, 10);
+  TEST_ASSERT_FLOAT_WITHIN(0.5, 2000, monitor.lastFeatures().restPressure);
+}
+
+void test_baseline_settle_time_keeps_fractions()
+{
+  PressureMonitor monitor(singleSampleBins());
+  feed(monitor, 2000, 50);
+  capture(monitor, 2000, 600, 1800, 1);
+  monitor.valveClosed();
+  capture(monitor, 2000, 600, 1800, 2);
+  monitor.valveClosed();
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 1.5, monitor.baseline().settleTime);
+}
+
+void test_clog_after_consecutive_deviations()
+{
+  PressureMonitorConfig config = singleSampleBins();
+  PressureMonitor monitor(config);
+  feed(monitor, 2000, 50);
+  for (uint8_t i = 0; i < config.learnCaptures; i++)
+  {
+    capture(monitor, 2000, 600, 1800, 10);
+    monitor.valveClosed();
+  }
+  TEST_ASSERT_FALSE(monitor.isLearning());
+
+  // a clogged nozzle: much less drop, slow to settle
+  for (uint8_t i = 0; i < config.faultAfter; i++)
+  {
+    TEST_ASSERT_FALSE(monitor.clogged());
+    capture(monitor, 2000, 150, 1900, 60);
+    monitor.valveClosed();
+  }
+  TEST_ASSERT_TRUE(monitor.clogged());
+
+  capture(monitor, 2000, 600, 1800, 10);
+  TEST_ASSERT_FALSE(monitor.clogged());
+}
+
+void test_relearn_forgets_baseline()
+{
+  PressureMonitorConfig config = singleSampleBins();
+  PressureMonitor monitor(config);
+  feed(monitor, 2000, 50);
+  for (uint8_t i = 0; i < config.learnCaptures; i++)
+  {
+    capture(monitor, 2000, 600, 1800, 10);
+    monitor.valveClosed();
+  }
+  monitor.relearn();
+  TEST_ASSERT_TRUE(monitor.isLearning());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, monitor.baseline().dropMagnitude);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_capture_features);
+  RUN_TEST(test_capture_cut_short_is_ignored);
+  RUN_TEST(test_rest_pressure_only_while_closed);
+  RUN_TEST(test_baseline_settle_time_keeps_fractions);
+  RUN_TEST(test_clog_after_consecutive_deviations);
+  RUN_TEST(test_relearn_forgets_baseline);
+  return UNITY_END();
+}
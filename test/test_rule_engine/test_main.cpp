@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <unity.h>
+
+#include "ruleEngine.h"
+
+// Inputs by id; writes are logged, e.g. "6=0, 0=50".
+struct FakeMachine
+{
+  int32_t inputs[256];
+  std::string writes;
+
+  int32_t read(uint8_t input) { return inputs[input]; }
+  void write(uint8_t output, int32_t value)
+  {
+    if (!writes.empty()) writes += ", ";
+    writes += std::to_string(output) + "=" + std::to_string(value);
+  }
+};
+
+enum : uint8_t
+{
+  fanPercent = 0,
+  mist = 2,
+  patternSelect = 6,
+  temperature = 9,
+  humidity = 17,
+  button2Clicks3 = 128 + 8 + 3
+};
+
+// python3 tools/compileRules.py of
+//   when humidity > 800 then patternSelect = 0
+//   when button2.clicks3 then fanPercent = 50, mist = 0
+//   when temperature - 5 >= -3 and not (mist == 1) then fanPercent = 300
+const uint8_t compiled[] = {0xa7, 0x03, 0x0c, 0x03, 0x11, 0x02, 0x20, 0x03, 0x08, 0x0f, 0x01, 0x00, 0x10, 0x06, 0x11,
+                            0x0c, 0x03, 0x8b, 0x0f, 0x01, 0x32, 0x10, 0x00, 0x01, 0x00, 0x10, 0x02, 0x11, 0x16, 0x03,
+                            0x09, 0x01, 0x05, 0x05, 0x01, 0xfd, 0x09, 0x03, 0x02, 0x01, 0x01, 0x0a, 0x0e, 0x0c, 0x0f,
+                            0x02, 0x2c, 0x01, 0x10, 0x00, 0x11};
+
+FakeMachine machine;
+
+void setUp()
+{
+  for (int32_t &input : machine.inputs) input = 0;
+  machine.inputs[mist] = 1;
+  machine.writes.clear();
+}
+void tearDown() {}
+
+void test_compiled_program_loads()
+{
+  RuleEngine<FakeMachine> engine;
+  TEST_ASSERT_TRUE(engine.load(compiled, sizeof(compiled)));
+  TEST_ASSERT_EQUAL(3, engine.ruleCount());
+  TEST_ASSERT_EQUAL(sizeof(compiled), engine.programLength());
+  TEST_ASSERT_EQUAL(0, engine.evaluate(machine));
+  TEST_ASSERT_EQUAL_STRING("", machine.writes.c_str());
+}
+
+// Actions run on the rising edge of their condition only.
+void test_rules_fire_on_rising_edge()
+{
+  RuleEngine<FakeMachine> engine;
+  engine.load(compiled, sizeof(compiled));
+  machine.inputs[humidity] = 801;
+  TEST_ASSERT_EQUAL(1, engine.evaluate(machine));
+  TEST_ASSERT_EQUAL_STRING("6=0", machine.writes.c_str());
+  TEST_ASSERT_EQUAL(0, engine.evaluate(machine));
+  machine.inputs[humidity] = 800;
+  engine.evaluate(machine);
+  machine.inputs[humidity] = 900;
+  TEST_ASSERT_EQUAL(1, engine.evaluate(machine));
+  TEST_ASSERT_EQUAL_STRING("6=0, 6=0", machine.writes.c_str());
+}
+
+void test_actions_run_in_order()
+{
+  RuleEngine<FakeMachine> engine;
+  engine.load(compiled, sizeof(compiled));
+  machine.inputs[button2Clicks3] = 1;
+  engine.evaluate(machine);
+  TEST_ASSERT_EQUAL_STRING("0=50, 2=0", machine.writes.c_str());
+}
+
+// Negative literals, push16, and, not and parentheses.
+void test_arithmetic_and_logic()
+{
+  RuleEngine<FakeMachine> engine;
+  engine.load(compiled, sizeof(compiled));
+  machine.inputs[temperature] = 1; // 1 - 5 = -4
+  engine.evaluate(machine);
+  TEST_ASSERT_EQUAL_STRING("", machine.writes.c_str());
+  machine.inputs[temperature] = 2;
+  engine.evaluate(machine);
+  TEST_ASSERT_EQUAL_STRING("", machine.writes.c_str()); // mist is on
+  machine.inputs[mist] = 0;
+  engine.evaluate(machine);
+  TEST_ASSERT_EQUAL_STRING("0=300", machine.writes.c_str());
+}
+
+void test_invalid_programs_are_refused()
+{
+  RuleEngine<FakeMachine> engine;
+  engine.load(compiled, sizeof(compiled));
+
+  uint8_t program[sizeof(compiled)];
+  for (size_t i = 0; i < sizeof(compiled); i++) program[i] = compiled[i];
+  program[0] = 0xA6; // wrong magic
+  TEST_ASSERT_FALSE(engine.load(program, sizeof(program)));
+  TEST_ASSERT_FALSE(engine.load(compiled, sizeof(compiled) - 1)); // truncated
+
+  const uint8_t underflow[] = {rules::magic, 1, 4, rules::push8, 1, rules::add, rules::end};
+  TEST_ASSERT_FALSE(engine.load(underflow, sizeof(underflow)));
+  const uint8_t noThen[] = {rules::magic, 1, 3, rules::push8, 1, rules::end};
+  TEST_ASSERT_FALSE(engine.load(noThen, sizeof(noThen)));
+  const uint8_t writeInCondition[] = {rules::magic, 1, 6, rules::push8, 1, rules::write, 0, rules::then, rules::end};
+  TEST_ASSERT_FALSE(engine.load(writeInCondition, sizeof(writeInCondition)));
+  const uint8_t unknownOp[] = {rules::magic, 1, 4, rules::push8, 1, rules::then, 99};
+  TEST_ASSERT_FALSE(engine.load(unknownOp, sizeof(unknownOp)));
+  const uint8_t trailing[] = {rules::magic, 0, 0};
+  TEST_ASSERT_FALSE(engine.load(trailing, sizeof(trailing)));
+
+  TEST_ASSERT_EQUAL(3, engine.ruleCount()); // the loaded program is kept
+}
+
+// Nine pushes need a ninth stack slot.
+void test_stack_limit()
+{
+  uint8_t program[64] = {rules::magic, 1, 0};
+  size_t length = 3;
+  for (size_t i = 0; i <= rules::maxStack; i++)
+  {
+    program[length++] = rules::push8;
+    program[length++] = 1;
+  }
+  for (size_t i = 0; i < rules::maxStack; i++) program[length++] = rules::add;
+  program[length++] = rules::then;
+  program[length++] = rules::end;
+  program[2] = length - 3;
+  RuleEngine<FakeMachine> engine;
+  TEST_ASSERT_FALSE(engine.load(program, length));
+}
+
+// The largest program load() accepts: 16 rules in 256 bytes, each
+// condition a chain of loads anded together, each rule writing once.
+size_t fullProgram(uint8_t (&program)[rules::maxProgram])
+{
+  size_t length = 0;
+  program[length++] = rules::magic;
+  program[length++] = rules::maxRules;
+  size_t codeLeft = rules::maxProgram - 2 - rules::maxRules; // without the length bytes
+  for (size_t rule = 0; rule < rules::maxRules; rule++)
+  {
+    size_t ruleLength = codeLeft / (rules::maxRules - rule);
+    codeLeft -= ruleLength;
+    program[length++] = ruleLength;
+    size_t end = length + ruleLength;
+    program[length++] = rules::load;
+    program[length++] = 0;
+    // then, a value, a write and end take 6 bytes, 7 with a 16 bit value
+    while (end - length >= 6 + 3)
+    {
+      program[length++] = rules::load;
+      program[length++] = 1;
+      program[length++] = rules::both;
+    }
+    if (end - length == 8)
+    {
+      program[length++] = rules::negate;
+      program[length++] = rules::negate;
+    }
+    bool wide = end - length == 7;
+    program[length++] = rules::then;
+    if (wide)
+    {
+      program[length++] = rules::push16;
+      program[length++] = 0x34;
+      program[length++] = 0x12;
+    }
+    else
+    {
+      program[length++] = rules::load;
+      program[length++] = 1;
+    }
+    program[length++] = rules::write;
+    program[length++] = rule;
+    program[length++] = rules::end;
+  }
+  return length;
+}
+
+// Without FakeMachine's string log, so the timings are the engine's.
+struct ArrayMachine
+{
+  int32_t inputs[2];
+  int32_t outputs[rules::maxRules];
+
+  int32_t read(uint8_t input) { return inputs[input]; }
+  void write(uint8_t output, int32_t value) { outputs[output] = value; }
+};
+
+ArrayMachine arrayMachine;
+
+// Nanoseconds per evaluate() of the full program, measured over 50 ms.
+// With toggle, input 0 alternates so every rule fires every other pass.
+double nanosecondsPerEvaluation(RuleEngine<ArrayMachine> &engine, bool toggle)
+{
+  size_t evaluations = 0;
+  size_t fired = 0;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds elapsed;
+  do
+  {
+    for (int i = 0; i < 100; i++, evaluations++)
+    {
+      if (toggle) arrayMachine.inputs[0] = !arrayMachine.inputs[0];
+      fired += engine.evaluate(arrayMachine);
+    }
+    elapsed = std::chrono::steady_clock::now() - started;
+  } while (elapsed < std::chrono::milliseconds(50));
+  TEST_ASSERT_EQUAL(toggle ? evaluations / 2 * rules::maxRules : 0, fired);
+  return (double)elapsed.count() / evaluations;
+}
+
+// Reports the cost of one loop()'s rule pass at the program size limit; the
+// worst case is every rule firing.
+void test_evaluation_time_of_a_full_program()
+{
+  uint8_t program[rules::maxProgram];
+  size_t length = fullProgram(program);
+  TEST_ASSERT_EQUAL(rules::maxProgram, length);
+  RuleEngine<ArrayMachine> engine;
+  TEST_ASSERT_TRUE(engine.load(program, length));
+  TEST_ASSERT_EQUAL(rules::maxRules, engine.ruleCount());
+
+  arrayMachine.inputs[0] = 0;
+  arrayMachine.inputs[1] = 1;
+  double idle = nanosecondsPerEvaluation(engine, false);
+  // alternating passes, half of them with all 16 rules firing
+  double alternating = nanosecondsPerEvaluation(engine, true);
+  double worst = 2 * alternating - idle;
+  char message[128];
+  snprintf(message, sizeof(message), "evaluate() of %u rules in %u bytes: %.0f ns when none fire, %.0f ns when all do",
+           (unsigned)rules::maxRules, (unsigned)length, idle, worst);
+  TEST_MESSAGE(message);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_compiled_program_loads);
+  RUN_TEST(test_rules_fire_on_rising_edge);
+  RUN_TEST(test_actions_run_in_order);
+  RUN_TEST(test_arithmetic_and_logic);
+  RUN_TEST(test_invalid_programs_are_refused);
+  RUN_TEST(test_stack_limit);
+  RUN_TEST(test_evaluation_time_of_a_full_program);
+  return UNITY_END();
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unity.h>
+
+#include "simulator.h"
+
+// Plays each scenario in scenarios/ through the control logic and compares
+// the valve and fan switching with the golden trace of the same name in
+// golden/. After an intended change, regenerate a golden with
+// tools/simulate.cpp and tools/compareTrace.py --update.
+
+// The simulator is exact; a golden captured on a unit needs some slack.
+#ifndef SCENARIO_TOLERANCE_MS
+#define SCENARIO_TOLERANCE_MS 0
+#endif
+
+struct Actuation
+{
+  uint32_t at;
+  std::string event;
+  int value;
+};
+
+// The scenarios and goldens are next to this file.
+std::string path(const char *directory, const char *name)
+{
+  std::string file = __FILE__;
+  return file.substr(0, file.find_last_of("/\\") + 1) + directory + "/" + name + ".txt";
+}
+
+// The mist and fan events, relative to the first, like compareTrace.py.
+std::vector<Actuation> simulate(const char *name)
+{
+  std::vector<scenario::Step> steps;
+  std::string error;
+  bool read = scenario::read(path("scenarios", name).c_str(), steps, error);
+  TEST_ASSERT_TRUE_MESSAGE(read, error.c_str());
+
+  Simulation simulation;
+  scenario::play(simulation, steps);
+  std::vector<Actuation> trace;
+  uint32_t start = 0;
+  for (const TraceEvent &event : simulation.hal.events)
+  {
+    if (event.code != traceCode::mist && event.code != traceCode::fan) continue;
+    if (trace.empty()) start = event.at;
+    trace.push_back({event.at - start, event.code == traceCode::mist ? "mist" : "fan", event.value});
+  }
+  return trace;
+}
+
+std::vector<Actuation> readGolden(const char *name)
+{
+  std::string file = path("golden", name);
+  FILE *golden = fopen(file.c_str(), "r");
+  TEST_ASSERT_NOT_NULL_MESSAGE(golden, file.c_str());
+  std::vector<Actuation> trace;
+  char line[128];
+  while (fgets(line, sizeof(line), golden))
+  {
+    line[strcspn(line, "#")] = '\0';
+    unsigned long at;
+    char event[16];
+    int value;
+    if (sscanf(line, "%lu %15s %d", &at, event, &value) == 3) trace.push_back({(uint32_t)at, event, value});
+  }
+  fclose(golden);
+  return trace;
+}
+
+void checkScenario(const char *name)
+{
+  std::vector<Actuation> captured = simulate(name);
+  std::vector<Actuation> golden = readGolden(name);
+  char message[160];
+  for (size_t i = 0; i < captured.size() && i < golden.size(); i++)
+  {
+    const Actuation &got = captured[i];
+    const Actuation &expected = golden[i];
+    snprintf(message, sizeof(message), "%s event %d: expected %s %d at %lu ms, got %s %d at %lu ms", name, (int)i,
+             expected.event.c_str(), expected.value, (unsigned long)expected.at, got.event.c_str(), got.value,
+             (unsigned long)got.at);
+    TEST_ASSERT_TRUE_MESSAGE(got.event == expected.event && got.value == expected.value, message);
+    TEST_ASSERT_UINT32_WITHIN_MESSAGE(SCENARIO_TOLERANCE_MS, expected.at, got.at, message);
+  }
+  snprintf(message, sizeof(message), "%s: %d events captured, %d expected", name, (int)captured.size(),
+           (int)golden.size());
+  TEST_ASSERT_EQUAL_MESSAGE(golden.size(), captured.size(), message);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_button_one() { checkScenario("buttonOne"); }
+void test_button_two() { checkScenario("buttonTwo"); }
+void test_button_three() { checkScenario("buttonThree"); }
+void test_pattern_2() { checkScenario("pattern2"); }
+void test_pattern_3() { checkScenario("pattern3"); }
+void test_pattern_4() { checkScenario("pattern4"); }
+void test_pattern_5() { checkScenario("pattern5"); }
+void test_timeout() { checkScenario("timeout"); }
+void test_cancel_during_pulse() { checkScenario("cancelDuringPulse"); }
+void test_supply_droop() { checkScenario("supplyDroop"); }
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_button_one);
+  RUN_TEST(test_button_two);
+  RUN_TEST(test_button_three);
+  RUN_TEST(test_pattern_2);
+  RUN_TEST(test_pattern_3);
+  RUN_TEST(test_pattern_4);
+  RUN_TEST(test_pattern_5);
+  RUN_TEST(test_timeout);
+  RUN_TEST(test_cancel_during_pulse);
+  RUN_TEST(test_supply_droop);
+  return UNITY_END();
+}
@@ -0,0 +1,145 @@
+#include <unity.h>
+
+#include "simulator.h"
+
+// Load shedding against SimSupply: the rail droops with the load current
+// through the source resistance, and the controller sees it through a
+// SupplyMonitor the way the firmware does.
+
+const uint32_t weakSupplyMilliohms = 500; // fan spin-up and valve pull-in sag the rail
+const uint32_t stiffSupplyMilliohms = 100;
+
+struct Change
+{
+  uint32_t at;
+  int value;
+};
+
+std::vector<Change> changes(const SimHal &hal, uint16_t code, uint32_t from, uint32_t until)
+{
+  std::vector<Change> result;
+  for (const TraceEvent &event : hal.events)
+  {
+    if (event.code == code && event.at >= from && event.at < until) result.push_back({event.at, event.value});
+  }
+  return result;
+}
+
+void click(Simulation &simulation, int button, int clicks)
+{
+  simulation.controller.clicked(button, clicks);
+  simulation.controller.tick();
+}
+
+void setUp() {}
+void tearDown() {}
+
+// The fan's spin-up at power on sags the rail; the fan is shed and gets its
+// speed back only once the rail has stayed up for the recovery hold.
+void test_fan_start_sags_and_recovers()
+{
+  Simulation simulation;
+  simulation.connectSupply(12000, weakSupplyMilliohms);
+  simulation.powerOn();
+  simulation.runUntil(60000);
+
+  std::vector<Change> supply = changes(simulation.hal, traceCode::supply, 0, 60000);
+  TEST_ASSERT_EQUAL(2, supply.size());
+  TEST_ASSERT_EQUAL(SupplyMonitor::sagging, supply[0].value);
+  TEST_ASSERT_EQUAL(SupplyMonitor::normal, supply[1].value);
+  TEST_ASSERT_TRUE(supply[1].at - supply[0].at <= settings::power::fan.inrushMs + SimSupply::readingMs);
+
+  std::vector<Change> fan = changes(simulation.hal, traceCode::fan, 0, 60000);
+  TEST_ASSERT_EQUAL(3, fan.size());
+  TEST_ASSERT_EQUAL(100, fan[0].value);
+  TEST_ASSERT_EQUAL(settings::supply::saggingFanPercent, fan[1].value);
+  TEST_ASSERT_EQUAL_UINT32(supply[0].at, fan[1].at);
+  TEST_ASSERT_EQUAL(100, fan[2].value);
+  TEST_ASSERT_EQUAL_UINT32(supply[1].at + settings::supply::recoveryHold, fan[2].at);
+
+  TEST_ASSERT_TRUE(simulation.supply.lowestMv < settings::supply::sagBelowMv);
+  TEST_ASSERT_TRUE(simulation.supply.lowestMv >= settings::supply::criticalBelowMv);
+}
+
+// With the valve open and the fan shed the rail sits between the sag and
+// release thresholds; it stays sagging, one event per opening, and no
+// opening goes out while it is.
+void test_valve_opening_holds_the_sag_until_it_closes()
+{
+  Simulation simulation;
+  simulation.connectSupply(12000, weakSupplyMilliohms);
+  simulation.powerOn();
+  simulation.runUntil(20000);
+  click(simulation, 1, 2);
+  simulation.runUntil(200000);
+
+  std::vector<Change> mist = changes(simulation.hal, traceCode::mist, 20000, 200000);
+  std::vector<Change> supply = changes(simulation.hal, traceCode::supply, 20000, 200000);
+  TEST_ASSERT_TRUE(mist.size() >= 10);
+  TEST_ASSERT_EQUAL(mist.size(), supply.size());
+  for (size_t i = 0; i + 1 < mist.size(); i += 2)
+  {
+    TEST_ASSERT_EQUAL(1, mist[i].value);
+    TEST_ASSERT_EQUAL(SupplyMonitor::sagging, supply[i].value);
+    TEST_ASSERT_TRUE(supply[i].at - mist[i].at <= settings::power::valve.inrushMs);
+    // back up only once the valve has closed
+    TEST_ASSERT_EQUAL(SupplyMonitor::normal, supply[i + 1].value);
+    TEST_ASSERT_TRUE(supply[i + 1].at >= mist[i + 1].at);
+    TEST_ASSERT_TRUE(supply[i + 1].at - mist[i + 1].at <= SimSupply::readingMs);
+  }
+
+  // shed for the whole opening and the recovery hold after it
+  for (const Change &change : changes(simulation.hal, traceCode::fan, 20000, 200000))
+  {
+    for (size_t i = 1; i < supply.size(); i += 2)
+    {
+      if (change.at > supply[i - 1].at && change.at < supply[i].at + settings::supply::recoveryHold)
+      {
+        TEST_ASSERT_TRUE(change.value <= settings::supply::saggingFanPercent);
+      }
+    }
+  }
+}
+
+void test_stiff_supply_never_sheds()
+{
+  Simulation simulation;
+  simulation.connectSupply(12000, stiffSupplyMilliohms);
+  simulation.powerOn();
+  click(simulation, 1, 2);
+  simulation.runUntil(200000);
+  click(simulation, 2, 3);
+  simulation.controller.climateMeasured(1800, 450);
+  simulation.runUntil(400000);
+
+  TEST_ASSERT_EQUAL(0, changes(simulation.hal, traceCode::supply, 0, 400000).size());
+  TEST_ASSERT_TRUE(simulation.supply.lowestMv >= settings::supply::sagBelowMv);
+}
+
+// A rail that sinks on its own, e.g. a failing adapter, goes critical: the
+// fan stops, and runs at the sagging limit for the recovery hold after.
+void test_critical_rail_stops_the_fan()
+{
+  Simulation simulation;
+  simulation.connectSupply(12000, stiffSupplyMilliohms);
+  simulation.powerOn();
+  simulation.runUntil(1000);
+  simulation.connectSupply(10000, stiffSupplyMilliohms);
+  simulation.runUntil(2000);
+  TEST_ASSERT_EQUAL(0, simulation.controller.fanAppliedPercent());
+  simulation.connectSupply(12000, stiffSupplyMilliohms);
+  simulation.runUntil(3000);
+  TEST_ASSERT_EQUAL(settings::supply::saggingFanPercent, simulation.controller.fanAppliedPercent());
+  simulation.runUntil(3000 + settings::supply::recoveryHold);
+  TEST_ASSERT_EQUAL(100, simulation.controller.fanAppliedPercent());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fan_start_sags_and_recovers);
+  RUN_TEST(test_valve_opening_holds_the_sag_until_it_closes);
+  RUN_TEST(test_stiff_supply_never_sheds);
+  RUN_TEST(test_critical_rail_stops_the_fan);
+  return UNITY_END();
+}
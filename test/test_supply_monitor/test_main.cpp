@@ -0,0 +1,77 @@
+#include <unity.h>
+
+#include "supplyMonitor.h"
+
+// One sample per block at 1 mV per count, so samples read as millivolts.
+const SupplyMonitorConfig config = {1, 1000, 11000, 11400, 10000, 10500};
+
+void setUp() {}
+void tearDown() {}
+
+void test_normal_rail_logs_nothing()
+{
+  SupplyMonitor monitor(config);
+  TEST_ASSERT_FALSE(monitor.addSample(12000, 0));
+  TEST_ASSERT_EQUAL(SupplyMonitor::normal, monitor.currentState());
+  TEST_ASSERT_EQUAL_UINT32(12000, monitor.lastMillivolts());
+  TEST_ASSERT_EQUAL(0, monitor.eventCount());
+}
+
+void test_sag_with_release_hysteresis()
+{
+  SupplyMonitor monitor(config);
+  TEST_ASSERT_TRUE(monitor.addSample(10900, 100));
+  TEST_ASSERT_EQUAL(SupplyMonitor::sagging, monitor.currentState());
+  TEST_ASSERT_FALSE(monitor.addSample(11200, 200));
+  TEST_ASSERT_TRUE(monitor.addSample(11500, 300));
+  TEST_ASSERT_EQUAL(SupplyMonitor::normal, monitor.currentState());
+  TEST_ASSERT_EQUAL(2, monitor.eventCount());
+  TEST_ASSERT_EQUAL_UINT32(100, monitor.event(0).at);
+  TEST_ASSERT_EQUAL(SupplyMonitor::sagging, monitor.event(0).state);
+  TEST_ASSERT_EQUAL_UINT16(11500, monitor.event(1).millivolts);
+}
+
+void test_critical_recovers_through_sagging()
+{
+  SupplyMonitor monitor(config);
+  monitor.addSample(9000, 0);
+  TEST_ASSERT_EQUAL(SupplyMonitor::critical, monitor.currentState());
+  monitor.addSample(10200, 0);
+  TEST_ASSERT_EQUAL(SupplyMonitor::critical, monitor.currentState());
+  monitor.addSample(10600, 0);
+  TEST_ASSERT_EQUAL(SupplyMonitor::sagging, monitor.currentState());
+}
+
+void test_samples_average_into_blocks()
+{
+  SupplyMonitorConfig averaged = config;
+  averaged.samplesPerBlock = 4;
+  SupplyMonitor monitor(averaged);
+  monitor.addSample(12000, 0);
+  monitor.addSample(12000, 0);
+  monitor.addSample(12000, 0);
+  TEST_ASSERT_EQUAL_UINT32(0, monitor.lastMillivolts());
+  monitor.addSample(8000, 0); // one dip is not a sag
+  TEST_ASSERT_EQUAL_UINT32(11000, monitor.lastMillivolts());
+  TEST_ASSERT_EQUAL(SupplyMonitor::normal, monitor.currentState());
+}
+
+void test_log_keeps_the_newest()
+{
+  SupplyMonitor monitor(config);
+  for (uint32_t i = 0; i < SupplyMonitor::logSize + 4; i++) monitor.addSample(i % 2 ? 12000 : 10900, i);
+  TEST_ASSERT_EQUAL(SupplyMonitor::logSize, monitor.eventCount());
+  TEST_ASSERT_EQUAL_UINT32(4, monitor.event(0).at);
+  TEST_ASSERT_EQUAL_UINT32(SupplyMonitor::logSize + 3, monitor.event(SupplyMonitor::logSize - 1).at);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_normal_rail_logs_nothing);
+  RUN_TEST(test_sag_with_release_hysteresis);
+  RUN_TEST(test_critical_recovers_through_sagging);
+  RUN_TEST(test_samples_average_into_blocks);
+  RUN_TEST(test_log_keeps_the_newest);
+  return UNITY_END();
+}
@@ -0,0 +1,114 @@
+#include <unity.h>
+
+#include "thermalPolicy.h"
+
+const ThermalCurvePoint curve[] = {{40.0, 100}, {50.0, 85}, {60.0, 70}};
+const ThermalPolicyConfig config = {2.0, 4.0, 2.0, curve, 3};
+
+void setUp() {}
+void tearDown() {}
+
+void test_no_reading_restricts_nothing()
+{
+  ThermalPolicy policy(config);
+  TEST_ASSERT_FALSE(policy.hasReading());
+  TEST_ASSERT_TRUE(policy.mistAllowed());
+  TEST_ASSERT_EQUAL(100, policy.fanLimitPercent());
+}
+
+void test_frost_lockout_with_hysteresis()
+{
+  ThermalPolicy policy(config);
+  TEST_ASSERT_FALSE(policy.update(10, 0));
+  TEST_ASSERT_TRUE(policy.update(1.5, 1000));
+  TEST_ASSERT_FALSE(policy.mistAllowed());
+  TEST_ASSERT_FALSE(policy.update(3.0, 2000)); // between the thresholds, still blocked
+  TEST_ASSERT_FALSE(policy.mistAllowed());
+  TEST_ASSERT_TRUE(policy.update(4.5, 3000));
+  TEST_ASSERT_TRUE(policy.mistAllowed());
+}
+
+void test_first_reading_inside_band_blocks()
+{
+  ThermalPolicy policy(config);
+  policy.update(3.0, 0);
+  TEST_ASSERT_FALSE(policy.mistAllowed());
+}
+
+void test_fan_derating_curve()
+{
+  ThermalPolicy policy(config);
+  policy.update(30, 0);
+  TEST_ASSERT_EQUAL(100, policy.fanLimitPercent());
+  policy.update(45, 0);
+  TEST_ASSERT_INT_WITHIN(1, 92, policy.fanLimitPercent());
+  policy.update(70, 0);
+  TEST_ASSERT_EQUAL(70, policy.fanLimitPercent());
+  TEST_ASSERT_EQUAL(70, policy.filterFanPercent(100));
+  TEST_ASSERT_EQUAL(50, policy.filterFanPercent(50));
+}
+
+void test_derating_relaxes_after_cooling()
+{
+  ThermalPolicy policy(config);
+  policy.update(50, 0);
+  TEST_ASSERT_EQUAL(85, policy.fanLimitPercent());
+  policy.update(49, 0); // within the hysteresis, the derate holds
+  TEST_ASSERT_EQUAL(85, policy.fanLimitPercent());
+  policy.update(45, 0);
+  TEST_ASSERT_GREATER_THAN(85, policy.fanLimitPercent());
+}
+
+void test_stale_reading_is_forgotten()
+{
+  ThermalPolicy policy(config);
+  policy.update(1.0, 1000);
+  TEST_ASSERT_FALSE(policy.mistAllowed());
+  TEST_ASSERT_FALSE(policy.expire(31000, 30000));
+  TEST_ASSERT_FALSE(policy.mistAllowed());
+  TEST_ASSERT_TRUE(policy.expire(31001, 30000));
+  TEST_ASSERT_FALSE(policy.hasReading());
+  TEST_ASSERT_TRUE(policy.mistAllowed());
+
+  // a sensor that comes back starts from its new reading
+  policy.update(3.0, 40000);
+  TEST_ASSERT_FALSE(policy.mistAllowed());
+}
+
+void test_expire_across_rollover()
+{
+  ThermalPolicy policy(config);
+  policy.update(20, 0xFFFFF000);
+  policy.expire(0x1000, 30000);
+  TEST_ASSERT_TRUE(policy.hasReading());
+  policy.expire(0x10000, 30000);
+  TEST_ASSERT_FALSE(policy.hasReading());
+}
+
+void test_temperature_register()
+{
+  ThermalPolicy policy(config);
+  TEST_ASSERT_EQUAL_HEX16(0xFFFF, policy.temperatureRegister());
+  policy.update(21.5, 0);
+  TEST_ASSERT_EQUAL_HEX16(215, policy.temperatureRegister());
+  policy.update(-3.2, 0);
+  TEST_ASSERT_EQUAL(-32, (int16_t)policy.temperatureRegister());
+  policy.update(-0.1, 0); // must not read as no reading
+  TEST_ASSERT_EQUAL(-2, (int16_t)policy.temperatureRegister());
+  policy.expire(100000, 30000);
+  TEST_ASSERT_EQUAL_HEX16(0xFFFF, policy.temperatureRegister());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_no_reading_restricts_nothing);
+  RUN_TEST(test_frost_lockout_with_hysteresis);
+  RUN_TEST(test_first_reading_inside_band_blocks);
+  RUN_TEST(test_fan_derating_curve);
+  RUN_TEST(test_derating_relaxes_after_cooling);
+  RUN_TEST(test_stale_reading_is_forgotten);
+  RUN_TEST(test_expire_across_rollover);
+  RUN_TEST(test_temperature_register);
+  return UNITY_END();
+}
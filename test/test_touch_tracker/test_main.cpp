@@ -0,0 +1,57 @@
+#include <unity.h>
+
+#include "touchTracker.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_first_reading_is_the_baseline()
+{
+  TouchTracker tracker;
+  TEST_ASSERT_FALSE(tracker.update(20000));
+  TEST_ASSERT_EQUAL_UINT32(20000, tracker.baselineReading());
+  TEST_ASSERT_EQUAL_UINT32(1000, tracker.thresholdDelta());
+}
+
+void test_press_and_release_with_hysteresis()
+{
+  TouchTracker tracker;
+  tracker.update(20000);
+  TEST_ASSERT_FALSE(tracker.update(20900));
+  TEST_ASSERT_TRUE(tracker.update(21200));
+  TEST_ASSERT_TRUE(tracker.update(20700)); // above the release level, 60% of the threshold
+  TEST_ASSERT_FALSE(tracker.update(20500));
+}
+
+void test_baseline_follows_drift_only_while_released()
+{
+  TouchTracker tracker;
+  tracker.update(20000);
+  for (int i = 0; i < 500; i++) tracker.update(20400);
+  TEST_ASSERT_UINT32_WITHIN(5, 20400, tracker.baselineReading());
+
+  tracker.update(22000);
+  TEST_ASSERT_TRUE(tracker.isPressed());
+  for (int i = 0; i < 500; i++) tracker.update(22000);
+  TEST_ASSERT_UINT32_WITHIN(5, 20400, tracker.baselineReading()); // the finger is not learned
+}
+
+void test_track_ignores_touched_readings()
+{
+  TouchTracker tracker;
+  tracker.track(20000);
+  for (int i = 0; i < 100; i++) tracker.track(30000, true);
+  TEST_ASSERT_EQUAL_UINT32(20000, tracker.baselineReading());
+  tracker.track(21000);
+  TEST_ASSERT_EQUAL_UINT32(20020, tracker.baselineReading());
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_reading_is_the_baseline);
+  RUN_TEST(test_press_and_release_with_hysteresis);
+  RUN_TEST(test_baseline_follows_drift_only_while_released);
+  RUN_TEST(test_track_ignores_touched_readings);
+  return UNITY_END();
+}
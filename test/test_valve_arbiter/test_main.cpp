@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <chrono>
+#include <unity.h>
+
+#include "valveArbiter.h"
+
+enum : size_t
+{
+  burst,
+  pattern,
+  manual,
+  sources
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_single_request()
+{
+  ValveArbiter<sources> arbiter;
+  uint32_t edge;
+  TEST_ASSERT_FALSE(arbiter.nextEdge(0, edge));
+  arbiter.request(burst, 100, 1100);
+  TEST_ASSERT_FALSE(arbiter.valveOn(99));
+  TEST_ASSERT_TRUE(arbiter.nextEdge(0, edge));
+  TEST_ASSERT_EQUAL_UINT32(100, edge);
+  TEST_ASSERT_TRUE(arbiter.valveOn(100));
+  TEST_ASSERT_TRUE(arbiter.nextEdge(100, edge));
+  TEST_ASSERT_EQUAL_UINT32(1100, edge);
+  TEST_ASSERT_FALSE(arbiter.valveOn(1100));
+  TEST_ASSERT_FALSE(arbiter.nextEdge(1100, edge));
+  TEST_ASSERT_FALSE(arbiter.isActive(burst)); // dropped once expired
+}
+
+// A short burst inside a long pattern pulse must not cut the pulse short.
+void test_burst_inside_pulse()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.request(pattern, 0, 3000);
+  arbiter.request(burst, 500, 1500);
+  uint32_t edge;
+  TEST_ASSERT_TRUE(arbiter.nextEdge(600, edge));
+  TEST_ASSERT_EQUAL_UINT32(3000, edge);
+  TEST_ASSERT_TRUE(arbiter.valveOn(2000));
+}
+
+// Overlapping and touching intervals merge into one run.
+void test_chained_intervals()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.request(burst, 0, 1000);
+  arbiter.request(pattern, 800, 2000);
+  arbiter.request(manual, 2000, 2500);
+  uint32_t edge;
+  TEST_ASSERT_TRUE(arbiter.nextEdge(0, edge));
+  TEST_ASSERT_EQUAL_UINT32(2500, edge);
+}
+
+void test_gap_between_intervals()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.request(burst, 0, 1000);
+  arbiter.request(pattern, 2000, 3000);
+  uint32_t edge;
+  TEST_ASSERT_TRUE(arbiter.nextEdge(0, edge));
+  TEST_ASSERT_EQUAL_UINT32(1000, edge);
+  TEST_ASSERT_TRUE(arbiter.nextEdge(1000, edge));
+  TEST_ASSERT_EQUAL_UINT32(2000, edge);
+}
+
+void test_hold_has_no_end()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.hold(manual, 0);
+  arbiter.request(pattern, 100, 200);
+  uint32_t edge;
+  TEST_ASSERT_FALSE(arbiter.nextEdge(150, edge));
+  TEST_ASSERT_TRUE(arbiter.valveOn(1000000));
+  arbiter.release(manual);
+  TEST_ASSERT_FALSE(arbiter.valveOn(1000000));
+}
+
+void test_new_request_replaces_old()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.request(pattern, 0, 3000);
+  arbiter.request(pattern, 0, 1000);
+  TEST_ASSERT_FALSE(arbiter.valveOn(2000));
+}
+
+void test_release_stops_pulse_in_progress()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.request(pattern, 0, 3000);
+  arbiter.release(pattern);
+  TEST_ASSERT_FALSE(arbiter.valveOn(1000));
+  arbiter.request(burst, 0, 3000);
+  arbiter.clear();
+  TEST_ASSERT_FALSE(arbiter.valveOn(1000));
+}
+
+void test_across_rollover()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.request(burst, 0xFFFFFF00, 0x100);
+  TEST_ASSERT_TRUE(arbiter.valveOn(0xFFFFFFFF));
+  TEST_ASSERT_TRUE(arbiter.valveOn(0x50));
+  uint32_t edge;
+  TEST_ASSERT_TRUE(arbiter.nextEdge(0xFFFFFFF0, edge));
+  TEST_ASSERT_EQUAL_UINT32(0x100, edge);
+  TEST_ASSERT_FALSE(arbiter.valveOn(0x100));
+}
+
+void test_relative_request()
+{
+  ValveArbiter<sources> arbiter;
+  arbiter.request(pattern, 900, 2000);
+  int32_t start, end;
+  bool open;
+  arbiter.relativeRequest(pattern, 1000, start, end, open);
+  TEST_ASSERT_EQUAL_INT32(-100, start);
+  TEST_ASSERT_EQUAL_INT32(1000, end);
+  TEST_ASSERT_FALSE(open);
+}
+
+// The worst case of nextEdge(): overlapping requests chained in reverse
+// source order, so each pass over the sources extends the run by one.
+template <size_t count>
+double nanosecondsPerEdge()
+{
+  ValveArbiter<count> arbiter;
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t start = (count - 1 - i) * 10;
+    arbiter.request(i, start, start + 15);
+  }
+  volatile uint32_t now = 0;
+  uint32_t edge = 0;
+  size_t calls = 0;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds elapsed;
+  do
+  {
+    for (int i = 0; i < 100; i++, calls++)
+    {
+      arbiter.nextEdge(now, edge);
+    }
+    elapsed = std::chrono::steady_clock::now() - started;
+  } while (elapsed < std::chrono::milliseconds(20));
+  TEST_ASSERT_EQUAL_UINT32((count - 1) * 10 + 15, edge);
+  return (double)elapsed.count() / calls;
+}
+
+// nextEdge() is quadratic in the number of sources, see valveArbiter.h.
+void test_cost_with_many_sources()
+{
+  double few = nanosecondsPerEdge<6>();
+  double some = nanosecondsPerEdge<64>();
+  double many = nanosecondsPerEdge<256>();
+  char message[128];
+  snprintf(message, sizeof(message), "nextEdge() worst case: %.0f ns with 6 sources, %.0f with 64, %.0f with 256", few,
+           some, many);
+  TEST_MESSAGE(message);
+  // four times the sources should cost about sixteen times as much
+  TEST_ASSERT_TRUE(many / some < 64);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_single_request);
+  RUN_TEST(test_burst_inside_pulse);
+  RUN_TEST(test_chained_intervals);
+  RUN_TEST(test_gap_between_intervals);
+  RUN_TEST(test_hold_has_no_end);
+  RUN_TEST(test_new_request_replaces_old);
+  RUN_TEST(test_release_stops_pulse_in_progress);
+  RUN_TEST(test_across_rollover);
+  RUN_TEST(test_relative_request);
+  RUN_TEST(test_cost_with_many_sources);
+  return UNITY_END();
+}
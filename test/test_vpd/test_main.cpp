@@ -0,0 +1,106 @@
+#include <math.h>
+#include <unity.h>
+
+#include "vpd.h"
+
+double tetensPa(double celsius) { return 610.78 * exp(17.27 * celsius / (celsius + 237.3)); }
+
+void setUp() {}
+void tearDown() {}
+
+// The table plus interpolation against the formula it was made from, at
+// every hundredth of a degree of its range.
+void test_saturation_pressure_accuracy()
+{
+  double worst = 0;
+  for (int centi = vpd::tableMinCelsius * 100; centi <= vpd::tableMaxCelsius * 100; centi++)
+  {
+    double exact = tetensPa(centi / 100.0);
+    double error = fabs(vpd::saturationVaporPressurePa(centi) - exact) / exact;
+    if (error > worst) worst = error;
+  }
+  TEST_ASSERT_TRUE(worst < 0.003);
+}
+
+void test_saturation_pressure_clamps_outside_table()
+{
+  TEST_ASSERT_EQUAL(vpd::saturationTablePa[0], vpd::saturationVaporPressurePa(-2000));
+  TEST_ASSERT_EQUAL(12336, vpd::saturationVaporPressurePa(6000));
+}
+
+void test_deficit()
+{
+  TEST_ASSERT_INT_WITHIN(2, 2338 / 2, vpd::vaporPressureDeficitPa(2000, 5000));
+  TEST_ASSERT_EQUAL(0, vpd::vaporPressureDeficitPa(2000, 10000));
+  TEST_ASSERT_EQUAL(0, vpd::vaporPressureDeficitPa(2000, 12000)); // over 100% reads as saturated
+  TEST_ASSERT_EQUAL(2338, vpd::vaporPressureDeficitPa(2000, 0));
+}
+
+void test_humid_room_ventilates()
+{
+  VpdController controller;
+  VpdOutput output = controller.update(700);
+  TEST_ASSERT_EQUAL(0, output.mistDutyPermille);
+  TEST_ASSERT_EQUAL(100, output.fanPercent);
+}
+
+void test_dry_room_mists_up_to_the_cap()
+{
+  VpdControllerConfig config;
+  VpdController controller(config);
+  VpdOutput output = controller.update(3000);
+  TEST_ASSERT_EQUAL(config.maxDutyPermille, output.mistDutyPermille);
+  TEST_ASSERT_EQUAL(100, output.fanPercent);
+  for (int i = 0; i < 100; i++) controller.update(3000);
+  TEST_ASSERT_EQUAL(config.maxDutyPermille, controller.integralPermille()); // no windup past the cap
+}
+
+void test_on_target_runs_nothing()
+{
+  VpdController controller;
+  VpdOutput output = controller.update(1000);
+  TEST_ASSERT_EQUAL(0, output.mistDutyPermille);
+  TEST_ASSERT_EQUAL(0, output.fanPercent);
+}
+
+// Closed loop against a crude room: misting lowers the deficit, the dry
+// air coming in raises it back towards 2 kPa. The controller must settle
+// close to its target without chattering between the extremes.
+void test_closed_loop_settles_near_target()
+{
+  VpdControllerConfig config;
+  VpdController controller(config);
+  int32_t vpdPa = 2000;
+  VpdOutput output;
+  for (int cycle = 0; cycle < 200; cycle++)
+  {
+    output = controller.update(vpdPa);
+    vpdPa += (2000 - vpdPa) / 10 - output.mistDutyPermille * 3;
+  }
+  TEST_ASSERT_INT_WITHIN(150, config.targetPa, vpdPa);
+  TEST_ASSERT_GREATER_THAN(0, output.mistDutyPermille);
+  TEST_ASSERT_LESS_THAN(config.maxDutyPermille, output.mistDutyPermille);
+}
+
+void test_integral_survives_restore()
+{
+  VpdController controller;
+  for (int i = 0; i < 5; i++) controller.update(1500);
+  VpdController restored;
+  restored.restoreIntegral(controller.integralPermille());
+  TEST_ASSERT_EQUAL(controller.update(1500).mistDutyPermille, restored.update(1500).mistDutyPermille);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_saturation_pressure_accuracy);
+  RUN_TEST(test_saturation_pressure_clamps_outside_table);
+  RUN_TEST(test_deficit);
+  RUN_TEST(test_humid_room_ventilates);
+  RUN_TEST(test_dry_room_mists_up_to_the_cap);
+  RUN_TEST(test_on_target_runs_nothing);
+  RUN_TEST(test_closed_loop_settles_near_target);
+  RUN_TEST(test_integral_survives_restore);
+  return UNITY_END();
+}
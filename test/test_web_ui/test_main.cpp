@@ -0,0 +1,272 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unity.h>
+
+#include "controller.h"
+#include "webHost.h"
+
+// The web UI served by WebHost on a local socket, requested the way a
+// browser does. The server runs on its own thread; the unit behind it is
+// only looked at once that has stopped, or through the server.
+
+const uint32_t eventIntervalMs = 50;
+
+struct FakeUnit
+{
+  uint16_t registers[remoteRegister::count] = {};
+  RuntimeConfig current = defaultRuntimeConfig();
+
+  modbus::Exception read(uint16_t address, uint16_t &value)
+  {
+    if (address >= remoteRegister::count) return modbus::illegalAddress;
+    value = registers[address];
+    return modbus::none;
+  }
+
+  modbus::Exception write(uint16_t address, uint16_t value)
+  {
+    if (address >= remoteRegister::count) return modbus::illegalAddress;
+    registers[address] = value;
+    return modbus::none;
+  }
+
+  RuntimeConfig config() { return current; }
+  void applyRuntimeConfig(const RuntimeConfig &config) { current = config; }
+};
+
+class Server
+{
+public:
+  Server() : host(unit, eventIntervalMs)
+  {
+    TEST_ASSERT_TRUE(host.begin());
+    thread = std::thread([this]() {
+      while (running) host.serve(5);
+    });
+  }
+
+  ~Server() { stop(); }
+
+  void stop()
+  {
+    running = false;
+    if (thread.joinable()) thread.join();
+  }
+
+  uint16_t port() const { return host.port(); }
+
+  FakeUnit unit;
+
+private:
+  WebHost<FakeUnit> host;
+  std::atomic<bool> running{true};
+  std::thread thread;
+};
+
+int connectTo(const Server &server)
+{
+  int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+  TEST_ASSERT_TRUE(socket >= 0);
+  timeval timeout = {2, 0}; // a hung server fails the test instead of the run
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(server.port());
+  TEST_ASSERT_EQUAL(0, connect(socket, (sockaddr *)&address, sizeof(address)));
+  return socket;
+}
+
+void sendAll(int socket, const std::string &data)
+{
+  TEST_ASSERT_EQUAL(data.size(), ::send(socket, data.data(), data.size(), 0));
+}
+
+// Reads until the server closes the connection.
+std::string readAll(int socket)
+{
+  std::string response;
+  char data[1024];
+  ssize_t length;
+  while ((length = recv(socket, data, sizeof(data), 0)) > 0) response.append(data, length);
+  close(socket);
+  return response;
+}
+
+std::string get(const Server &server, const std::string &path, const std::string &headers = "")
+{
+  int socket = connectTo(server);
+  sendAll(socket, "GET " + path + " HTTP/1.1\r\nHost: unit\r\n" + headers + "\r\n");
+  return readAll(socket);
+}
+
+// The body goes out in pieces of at most chunk bytes, as a slow client's would.
+std::string post(const Server &server, const std::string &path, const std::string &body, size_t chunk = 1024)
+{
+  int socket = connectTo(server);
+  sendAll(socket, "POST " + path + " HTTP/1.1\r\nHost: unit\r\nContent-Length: " + std::to_string(body.size()) +
+                      "\r\n\r\n");
+  for (size_t at = 0; at < body.size(); at += chunk)
+  {
+    sendAll(socket, body.substr(at, chunk));
+    usleep(1000);
+  }
+  return readAll(socket);
+}
+
+int status(const std::string &response) { return atoi(response.c_str() + 9); }
+
+// A header's value, "" without it.
+std::string header(const std::string &response, const char *name)
+{
+  std::string key = std::string("\r\n") + name + ": ";
+  size_t at = response.find(key);
+  if (at == std::string::npos || at > response.find("\r\n\r\n")) return "";
+  at += key.size();
+  return response.substr(at, response.find("\r\n", at) - at);
+}
+
+std::string body(const std::string &response) { return response.substr(response.find("\r\n\r\n") + 4); }
+
+void setUp() {}
+void tearDown() {}
+
+void test_assets_are_gzipped_and_cached()
+{
+  Server server;
+  const WebAsset &index = *webUi::findAsset("/index.html");
+  std::string response = get(server, "/");
+  TEST_ASSERT_EQUAL(200, status(response));
+  TEST_ASSERT_EQUAL_STRING("text/html", header(response, "Content-Type").c_str());
+  TEST_ASSERT_EQUAL_STRING("gzip", header(response, "Content-Encoding").c_str());
+  TEST_ASSERT_EQUAL_STRING(webUi::cacheControl, header(response, "Cache-Control").c_str());
+  TEST_ASSERT_EQUAL_STRING(index.etag, header(response, "ETag").c_str());
+  std::string data = body(response);
+  TEST_ASSERT_EQUAL(index.length, data.size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(index.data, data.data(), index.length);
+  TEST_ASSERT_EQUAL_HEX8(0x1F, (uint8_t)data[0]); // gzip magic
+  TEST_ASSERT_EQUAL_HEX8(0x8B, (uint8_t)data[1]);
+
+  TEST_ASSERT_TRUE(data == body(get(server, "/index.html")));
+}
+
+// A browser revalidating its copy gets a bodiless 304 for a current ETag
+// and the asset again for a stale one.
+void test_revalidation()
+{
+  Server server;
+  const WebAsset &index = *webUi::findAsset("/");
+  std::string current = get(server, "/", std::string("If-None-Match: ") + index.etag + "\r\n");
+  TEST_ASSERT_EQUAL(304, status(current));
+  TEST_ASSERT_EQUAL(0, body(current).size());
+
+  std::string stale = get(server, "/", "If-None-Match: \"0000000000000000\"\r\n");
+  TEST_ASSERT_EQUAL(200, status(stale));
+  TEST_ASSERT_EQUAL(index.length, body(stale).size());
+
+  TEST_ASSERT_EQUAL(404, status(get(server, "/missing.js")));
+}
+
+void test_write()
+{
+  Server server;
+  TEST_ASSERT_EQUAL(202, status(post(server, "/write", "register=0&value=55")));
+  TEST_ASSERT_EQUAL(202, status(post(server, "/write", "value=1&register=2")));
+  // out of range, negative or missing: refused, not wrapped
+  TEST_ASSERT_EQUAL(400, status(post(server, "/write", "register=0&value=65591")));
+  TEST_ASSERT_EQUAL(400, status(post(server, "/write", "register=-1&value=5")));
+  TEST_ASSERT_EQUAL(400, status(post(server, "/write", "register=0&value=5x")));
+  TEST_ASSERT_EQUAL(400, status(post(server, "/write", "register=0")));
+  server.stop();
+  TEST_ASSERT_EQUAL(55, server.unit.registers[0]);
+  TEST_ASSERT_EQUAL(1, server.unit.registers[2]);
+}
+
+// A document is parsed as its pieces arrive and applied whole, or not at all.
+void test_config()
+{
+  Server server;
+  std::string before = body(get(server, "/config"));
+  TEST_ASSERT_TRUE(before.find("\"timeout\":7200000") != std::string::npos);
+
+  std::string refused = post(server, "/config", "{\"delays\": {\"timeout\": 9000000, \"sleep\": 1}}", 7);
+  TEST_ASSERT_EQUAL(400, status(refused));
+  TEST_ASSERT_TRUE(body(refused).find("Invalid configuration") == 0);
+  TEST_ASSERT_EQUAL_STRING(before.c_str(), body(get(server, "/config")).c_str());
+
+  TEST_ASSERT_EQUAL(202, status(post(server, "/config", "{\"delays\": {\"timeout\": 9000000}}", 7)));
+  std::string after = body(get(server, "/config"));
+  TEST_ASSERT_EQUAL_STRING("application/json", header(get(server, "/config"), "Content-Type").c_str());
+  TEST_ASSERT_TRUE(after.find("\"timeout\":9000000") != std::string::npos);
+
+  TEST_ASSERT_EQUAL(409, status(post(server, "/config", ""))); // no body
+  server.stop();
+  TEST_ASSERT_EQUAL(9000000, server.unit.current.timeoutDelay);
+}
+
+// The next "registers" event's data, "" if none comes in time.
+std::string nextEvent(int socket, std::string &stream)
+{
+  for (;;)
+  {
+    size_t end = stream.find("\n\n");
+    if (end != std::string::npos)
+    {
+      std::string event = stream.substr(0, end);
+      stream.erase(0, end + 2);
+      TEST_ASSERT_TRUE(event.find("event: registers\ndata: ") == 0);
+      return event.substr(event.find("data: ") + 6);
+    }
+    char data[256];
+    ssize_t length = recv(socket, data, sizeof(data), 0);
+    if (length <= 0) return "";
+    stream.append(data, length);
+  }
+}
+
+// One long-lived response: every interval brings all registers, and a write
+// shows up in the next event.
+void test_event_stream()
+{
+  Server server;
+  int socket = connectTo(server);
+  sendAll(socket, "GET /events HTTP/1.1\r\nHost: unit\r\nAccept: text/event-stream\r\n\r\n");
+  std::string stream;
+  while (stream.find("\r\n\r\n") == std::string::npos)
+  {
+    char data[256];
+    ssize_t length = recv(socket, data, sizeof(data), 0);
+    TEST_ASSERT_TRUE(length > 0);
+    stream.append(data, length);
+  }
+  TEST_ASSERT_EQUAL(200, status(stream));
+  TEST_ASSERT_EQUAL_STRING("text/event-stream", header(stream, "Content-Type").c_str());
+  TEST_ASSERT_EQUAL_STRING("no-cache", header(stream, "Cache-Control").c_str());
+  stream = body(stream);
+
+  std::string first = nextEvent(socket, stream);
+  TEST_ASSERT_EQUAL_STRING("[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0]", first.c_str());
+
+  TEST_ASSERT_EQUAL(202, status(post(server, "/write", "register=0&value=42")));
+  std::string event;
+  for (int i = 0; i < 3 && event.find("[42,") != 0; i++) event = nextEvent(socket, stream);
+  TEST_ASSERT_EQUAL_STRING("[42,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0]", event.c_str());
+  close(socket);
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_assets_are_gzipped_and_cached);
+  RUN_TEST(test_revalidation);
+  RUN_TEST(test_write);
+  RUN_TEST(test_config);
+  RUN_TEST(test_event_stream);
+  return UNITY_END();
+}
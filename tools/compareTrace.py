@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Compares an actuation trace captured from the serial console against a
+# reference, to catch changes in when the valve and fan switch.
+#
+#   trace on                     (console: print every event as it happens)
+#   ... run the scenario, save the console output to capture.txt ...
+#   python3 tools/compareTrace.py capture.txt reference.txt --tolerance 50
+#   python3 tools/compareTrace.py capture.txt reference.txt --update
+#
+# Times are taken relative to the first compared event, so a capture does
+# not need to start at a particular uptime. References list one event per
+# line, "<ms> <event> <value>", and may contain # comments.
+
+import argparse
+import re
+import sys
+
+from decodeCrash import TRACE_CODES
+
+DEFAULT_EVENTS = "mist,fan"
+
+LINE = re.compile(r"^trace (\d+) (\d+) (-?\d+)\s*$")
+
+
+def readCapture(path, events):
+    captured = []
+    with open(path) as f:
+        for line in f:
+            match = LINE.match(line.strip())
+            if not match:
+                continue  # other console output
+            at, code, value = (int(group) for group in match.groups())
+            name = TRACE_CODES[code] if code < len(TRACE_CODES) else "code%d" % code
+            if name in events:
+                captured.append((at, name, value))
+    return rebase(captured)
+
+
+def readReference(path):
+    reference = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].split()
+            if not line:
+                continue
+            if len(line) != 3:
+                raise ValueError("%s:%d: expected <ms> <event> <value>" % (path, number))
+            reference.append((int(line[0]), line[1], int(line[2])))
+    return reference
+
+
+# Makes the first event time 0.
+def rebase(trace):
+    if not trace:
+        return trace
+    start = trace[0][0]
+    return [((at - start) & 0xFFFFFFFF, name, value) for at, name, value in trace]
+
+
+def writeReference(path, trace):
+    with open(path, "w") as f:
+        for at, name, value in trace:
+            f.write("%8d %s %d\n" % (at, name, value))
+
+
+# Returns a description of the first difference, or None.
+def compare(captured, reference, tolerance, drift):
+    for index, (got, expected) in enumerate(zip(captured, reference)):
+        if got[1:] != expected[1:]:
+            return "event %d: expected %s %d at %d ms, got %s %d at %d ms" % (
+                index, expected[1], expected[2], expected[0], got[1], got[2], got[0])
+        allowed = tolerance + drift * expected[0]
+        if abs(got[0] - expected[0]) > allowed:
+            return "event %d: %s %d at %d ms, expected %d ms (+-%d)" % (
+                index, got[1], got[2], got[0], expected[0], allowed)
+    if len(captured) != len(reference):
+        return "%d events captured, %d expected" % (len(captured), len(reference))
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare a captured actuation trace with a reference.")
+    parser.add_argument("capture", help="console output with trace lines")
+    parser.add_argument("reference", help="reference trace")
+    parser.add_argument("--events", default=DEFAULT_EVENTS,
+                        help="comma separated events to compare, default %s" % DEFAULT_EVENTS)
+    parser.add_argument("--tolerance", type=int, default=20, help="allowed timing error in ms")
+    parser.add_argument("--drift", type=float, default=0.0,
+                        help="additional allowed error per ms of trace, for clock differences")
+    parser.add_argument("--update", action="store_true", help="write the capture as the new reference")
+    arguments = parser.parse_args()
+
+    events = arguments.events.split(",")
+    unknown = [name for name in events if name not in TRACE_CODES]
+    if unknown:
+        sys.exit("error: unknown event %s" % ", ".join(unknown))
+
+    captured = readCapture(arguments.capture, events)
+    if not captured:
+        sys.exit("error: no trace events in %s" % arguments.capture)
+    if arguments.update:
+        writeReference(arguments.reference, captured)
+        print("Wrote %d events to %s" % (len(captured), arguments.reference))
+        return
+
+    try:
+        reference = rebase([event for event in readReference(arguments.reference) if event[1] in events])
+    except (OSError, ValueError) as error:
+        sys.exit("error: %s" % error)
+    difference = compare(captured, reference, arguments.tolerance, arguments.drift)
+    if difference:
+        sys.exit("FAIL %s" % difference)
+    print("OK %d events within %d ms" % (len(captured), arguments.tolerance))
+
+
+if __name__ == "__main__":
+    main()
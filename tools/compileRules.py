@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# Compiles automation rules into the bytecode run by include/ruleEngine.h.
+#
+#   when humidity > 800 then patternSelect = 0
+#   when button2.clicks3 then fanPercent = 50, mist = 0
+#
+# Conditions combine inputs and integers with + - < <= > >= == != and, or,
+# not and parentheses. Inputs are the remote registers (as in the register
+# map in src/main.cpp) and button events, buttonN.clicksM, true for one
+# evaluation after button N was clicked M times. vpd, temperature and
+# humidity read as -1 until measured. Actions write registers.
+# Lines starting with # are comments.
+#
+# Prints the program as hex, ready to send to the serial console:
+#   python3 tools/compileRules.py rules.txt        ->  rules a701...
+
+import re
+import sys
+
+MAGIC = 0xA7
+MAX_PROGRAM = 256
+MAX_RULES = 16
+
+# Keep in the order of remoteRegister in include/remoteRegisters.h.
+REGISTERS = [
+    "fanPercent", "fanAppliedPercent", "mist", "patternMode", "patternOnSeconds", "patternOffSeconds",
+    "patternSelect", "mistFraction", "vpd", "temperature", "supplyMillivolts", "faults", "waterTotalHigh",
+    "waterTotalLow", "waterDayHigh", "waterDayLow", "stopAll", "humidity",
+]
+BUTTON_EVENTS = 128  # buttonN.clicksM is BUTTON_EVENTS + (N - 1) * 8 + M, see ruleButtonEvents in src/main.cpp
+
+OPS = {
+    "push8": 1, "push16": 2, "load": 3, "+": 4, "-": 5, "<": 6, "<=": 7, ">": 8, ">=": 9, "==": 10,
+    "!=": 11, "and": 12, "or": 13, "not": 14, "then": 15, "write": 16, "end": 17,
+}
+
+TOKEN = re.compile(r"\s*(?:(\d+)|([A-Za-z_][A-Za-z0-9_.]*)|(<=|>=|==|!=|[<>+\-(),=]))")
+
+
+class CompileError(Exception):
+    pass
+
+
+def tokenize(text):
+    tokens = []
+    position = 0
+    text = text.rstrip()
+    while position < len(text):
+        match = TOKEN.match(text, position)
+        if not match:
+            raise CompileError("unexpected %r" % text[position:])
+        tokens.append(match.group(1) or match.group(2) or match.group(3))
+        position = match.end()
+    return tokens
+
+
+def inputId(name):
+    if name in REGISTERS:
+        return REGISTERS.index(name)
+    match = re.fullmatch(r"button([1-3])\.clicks([1-7])", name)
+    if match:
+        return BUTTON_EVENTS + (int(match.group(1)) - 1) * 8 + int(match.group(2))
+    raise CompileError("unknown input %r" % name)
+
+
+class Parser:
+    def __init__(self, tokens):
+        self.tokens = tokens
+        self.position = 0
+        self.code = []
+
+    def peek(self):
+        return self.tokens[self.position] if self.position < len(self.tokens) else None
+
+    def take(self, expected=None):
+        token = self.peek()
+        if token is None or (expected is not None and token != expected):
+            raise CompileError("expected %r, got %r" % (expected or "more", token))
+        self.position += 1
+        return token
+
+    def number(self, value):
+        if -128 <= value <= 127:
+            self.code += [OPS["push8"], value & 0xFF]
+        elif -32768 <= value <= 32767:
+            self.code += [OPS["push16"], value & 0xFF, (value >> 8) & 0xFF]
+        else:
+            raise CompileError("%d does not fit 16 bits" % value)
+
+    def expression(self):
+        self.conjunction()
+        while self.peek() == "or":
+            self.take()
+            self.conjunction()
+            self.code.append(OPS["or"])
+
+    def conjunction(self):
+        self.negation()
+        while self.peek() == "and":
+            self.take()
+            self.negation()
+            self.code.append(OPS["and"])
+
+    def negation(self):
+        if self.peek() == "not":
+            self.take()
+            self.negation()
+            self.code.append(OPS["not"])
+        else:
+            self.comparison()
+
+    def comparison(self):
+        self.sum()
+        if self.peek() in ("<", "<=", ">", ">=", "==", "!="):
+            op = self.take()
+            self.sum()
+            self.code.append(OPS[op])
+
+    def sum(self):
+        self.primary()
+        while self.peek() in ("+", "-"):
+            op = self.take()
+            self.primary()
+            self.code.append(OPS[op])
+
+    def primary(self):
+        token = self.take()
+        if token == "(":
+            self.expression()
+            self.take(")")
+        elif token == "-":
+            operand = self.take()
+            if not operand.isdigit():
+                raise CompileError("expected a number after '-', got %r" % operand)
+            self.number(-int(operand))
+        elif token.isdigit():
+            self.number(int(token))
+        elif token == "true":
+            self.number(1)
+        elif token == "false":
+            self.number(0)
+        else:
+            self.code += [OPS["load"], inputId(token)]
+
+    def rule(self):
+        self.take("when")
+        self.expression()
+        self.take("then")
+        self.code.append(OPS["then"])
+        while True:
+            name = self.take()
+            if name not in REGISTERS:
+                raise CompileError("unknown register %r" % name)
+            self.take("=")
+            self.expression()
+            self.code += [OPS["write"], REGISTERS.index(name)]
+            if self.peek() != ",":
+                break
+            self.take(",")
+        if self.peek() is not None:
+            raise CompileError("unexpected %r" % self.peek())
+        self.code.append(OPS["end"])
+        return self.code
+
+
+def compileRules(text):
+    rules = []
+    for number, line in enumerate(text.splitlines(), 1):
+        line = line.split("#", 1)[0].strip()
+        if not line:
+            continue
+        try:
+            code = Parser(tokenize(line)).rule()
+        except CompileError as error:
+            raise CompileError("line %d: %s" % (number, error))
+        if len(code) > 255:
+            raise CompileError("line %d: rule too long" % number)
+        rules.append(code)
+    if len(rules) > MAX_RULES:
+        raise CompileError("%d rules, at most %d fit" % (len(rules), MAX_RULES))
+    program = [MAGIC, len(rules)]
+    for code in rules:
+        program += [len(code)] + code
+    if len(program) > MAX_PROGRAM:
+        raise CompileError("program is %d bytes, at most %d fit" % (len(program), MAX_PROGRAM))
+    return bytes(program)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: compileRules.py rules.txt")
+    with open(sys.argv[1]) as f:
+        text = f.read()
+    try:
+        program = compileRules(text)
+    except CompileError as error:
+        sys.exit("error: %s" % error)
+    print("rules " + program.hex())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+# Decodes the crash record printed by the "crash" console command (or a raw
+# 464 byte dump of it) and resolves the backtrace against the firmware ELF.
+#
+#   python3 tools/decodeCrash.py crash.txt --elf .pio/build/lolin_s2_mini/firmware.elf
+#
+# The layout mirrors CrashRecord in include/crashRecord.h.
+
+import argparse
+import binascii
+import shutil
+import struct
+import subprocess
+import sys
+import zlib
+
+MAGIC = 0x48535243
+VERSION = 2
+RECORD_SIZE = 464
+TRACE_LENGTH = 32
+BACKTRACE_LENGTH = 16
+
+RESET_REASONS = [
+    "unknown", "power on", "external pin", "software", "panic", "interrupt watchdog", "task watchdog",
+    "other watchdog", "deep sleep", "brownout", "SDIO",
+]
+
+# Keep in the order of traceCode in include/controller.h.
+TRACE_CODES = ["boot", "mist", "fan", "pattern", "stopAll", "supply", "fault", "remoteWrite", "rule", "config", "state"]
+
+PATTERN_MODES = ["idle", "repeating", "VPD control", "nozzle flush"]
+SUPPLY_STATES = ["normal", "sagging", "critical"]
+
+
+def readRecord(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) != RECORD_SIZE:
+        text = data.decode("ascii", "replace").split()
+        if text and text[0] == "crash":
+            text = text[1:]
+        data = binascii.unhexlify("".join(text))
+    if len(data) != RECORD_SIZE:
+        raise ValueError("expected %d bytes, got %d" % (RECORD_SIZE, len(data)))
+    return data
+
+
+def decode(data):
+    fields = struct.unpack_from("<IHBBIII16I16s16s16I", data, 0)
+    magic, version, reason, depth, pc, cause, address = fields[:7]
+    backtrace = fields[7:7 + BACKTRACE_LENGTH]
+    task, elfSha = fields[7 + BACKTRACE_LENGTH:9 + BACKTRACE_LENGTH]
+    registers = fields[9 + BACKTRACE_LENGTH:]
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a version %d crash record" % VERSION)
+    (crc,) = struct.unpack_from("<I", data, RECORD_SIZE - 4)
+    if zlib.crc32(data[:RECORD_SIZE - 4]) != crc:
+        raise ValueError("checksum mismatch, the record is damaged")
+
+    state = struct.unpack_from("<IhhBBBBiHH", data, 180)
+    (eventCount,) = struct.unpack_from("<I", data, 200)
+    events = [struct.unpack_from("<IHh", data, 204 + 8 * i) for i in range(min(eventCount, TRACE_LENGTH))]
+    return {
+        "reason": reason,
+        "pc": pc,
+        "cause": cause,
+        "address": address,
+        "backtrace": list(backtrace[:depth]),
+        "registers": registers,
+        "task": task.split(b"\0", 1)[0].decode("ascii", "replace"),
+        "elfSha": elfSha.split(b"\0", 1)[0].decode("ascii", "replace"),
+        "state": state,
+        "events": events,
+    }
+
+
+def symbolize(addresses, elf, addr2line):
+    if not elf or not addresses:
+        return {}
+    tool = shutil.which(addr2line)
+    if tool is None:
+        print("(%s not found, addresses are not resolved)" % addr2line, file=sys.stderr)
+        return {}
+    output = subprocess.run([tool, "-pfiaC", "-e", elf] + ["0x%08x" % a for a in addresses],
+                            capture_output=True, text=True, check=True).stdout
+    names = {}
+    for line in output.splitlines():
+        if line.startswith("0x"):
+            address, _, location = line.partition(": ")
+            names[int(address, 16)] = location
+    return names
+
+
+def describe(code, value):
+    name = TRACE_CODES[code] if code < len(TRACE_CODES) else "code %d" % code
+    if code == 0:
+        return "%s (%s)" % (name, RESET_REASONS[value] if 0 <= value < len(RESET_REASONS) else value)
+    if code == 5:
+        return "%s %s" % (name, SUPPLY_STATES[value] if 0 <= value < len(SUPPLY_STATES) else value)
+    return "%s %d" % (name, value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a crash record and resolve its backtrace.")
+    parser.add_argument("record", help="console output of the crash command, or the raw record")
+    parser.add_argument("--elf", help="firmware.elf of the build that crashed")
+    parser.add_argument("--addr2line", default="xtensa-esp32s2-elf-addr2line")
+    arguments = parser.parse_args()
+
+    try:
+        record = decode(readRecord(arguments.record))
+    except ValueError as error:
+        sys.exit("error: %s" % error)
+
+    reason = record["reason"]
+    print("Reset reason: %s" % (RESET_REASONS[reason] if reason < len(RESET_REASONS) else reason))
+    if record["backtrace"] or record["pc"]:
+        print("Task %s, exception cause %d at 0x%08x, ELF %s" % (record["task"], record["cause"],
+                                                                  record["address"], record["elfSha"]))
+        names = symbolize([record["pc"]] + record["backtrace"], arguments.elf, arguments.addr2line)
+        print("PC 0x%08x %s" % (record["pc"], names.get(record["pc"], "")))
+        for i, address in enumerate(record["backtrace"]):
+            print("  #%-2d 0x%08x %s" % (i, address, names.get(address, "")))
+        for row in range(0, 16, 4):
+            print("  " + "  ".join("A%-2d 0x%08x" % (row + i, record["registers"][row + i]) for i in range(4)))
+    else:
+        print("No core dump summary (not a panic, or core dumps are disabled)")
+
+    uptime, fan, fanApplied, mist, mode, faults, supplyState, vpd, supplyMv, _ = record["state"]
+    print("State at the last snapshot, uptime %.1f s:" % (uptime / 1000))
+    print("  fan %d%% (applied %d%%), mist %s, %s" % (fan, fanApplied, "on" if mist else "off",
+                                                    PATTERN_MODES[mode] if mode < len(PATTERN_MODES) else mode))
+    print("  faults 0x%x, supply %s %d mV, VPD %s" % (faults, SUPPLY_STATES[supplyState] if supplyState < 3 else supplyState,
+                                                    supplyMv, "%d Pa" % vpd if vpd >= 0 else "unknown"))
+    print("Last %d events:" % len(record["events"]))
+    for at, code, value in record["events"]:
+        print("  %10.3f s  %s" % (at / 1000, describe(code, value)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,79 @@
+# PlatformIO pre-build script: gzips everything in web/ and writes it to
+# include/webAssets.h as const arrays, which end up in flash and are served
+# from there as they are. The header is only rewritten when its content
+# changes, so unchanged assets do not trigger a rebuild. Host builds outside
+# PlatformIO run it on its own.
+
+import gzip
+import hashlib
+import mimetypes
+import os
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO
+    projectDir = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:  # run on its own: python3 tools/embedWebAssets.py
+    projectDir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+webDir = os.path.join(projectDir, "web")
+headerPath = os.path.join(projectDir, "include", "webAssets.h")
+
+
+def identifier(name):
+    return "".join(c if c.isalnum() else "_" for c in name)
+
+
+def embed():
+    assets = []
+    for root, _, files in os.walk(webDir):
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            url = "/" + os.path.relpath(path, webDir).replace(os.sep, "/")
+            with open(path, "rb") as f:
+                raw = f.read()
+            data = gzip.compress(raw, compresslevel=9, mtime=0)
+            contentType = mimetypes.guess_type(name)[0] or "application/octet-stream"
+            etag = '"' + hashlib.sha1(raw).hexdigest()[:16] + '"'
+            assets.append((url, contentType, data, etag))
+
+    lines = [
+        "#pragma once",
+        "",
+        "// Generated by tools/embedWebAssets.py from web/, do not edit.",
+        "",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "",
+        "struct WebAsset",
+        "{",
+        "  const char *path;",
+        "  const char *contentType;",
+        "  const uint8_t *data; // gzip",
+        "  size_t length;",
+        "  const char *etag;",
+        "};",
+        "",
+    ]
+    for url, _, data, _ in assets:
+        lines.append("const uint8_t webAsset_%s[] = {" % identifier(url))
+        for i in range(0, len(data), 16):
+            lines.append("  " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+        lines.append("};")
+        lines.append("")
+    lines.append("const WebAsset webAssets[] = {")
+    for url, contentType, data, etag in assets:
+        lines.append('  {"%s", "%s", webAsset_%s, %d, "%s"},' % (url, contentType, identifier(url), len(data),
+                                                                 etag.replace('"', '\\"')))
+    lines.append("};")
+    lines.append("constexpr size_t webAssetCount = sizeof(webAssets) / sizeof(webAssets[0]);")
+    content = "\n".join(lines) + "\n"
+
+    if os.path.exists(headerPath):
+        with open(headerPath) as f:
+            if f.read() == content:
+                return
+    with open(headerPath, "w") as f:
+        f.write(content)
+    print("Embedded %d web assets (%d bytes gzipped)" % (len(assets), sum(len(a[2]) for a in assets)))
+
+
+embed()
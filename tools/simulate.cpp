@@ -0,0 +1,35 @@
+// Plays a scenario through the control logic on the host and prints the
+// trace events the way "trace on" does on the console, for
+// tools/compareTrace.py. See include/simulator.h for the scenario format.
+//
+//   g++ -std=gnu++11 -O2 -Iinclude tools/simulate.cpp -o simulate
+//   ./simulate test/test_scenarios/scenarios/pattern2.txt > capture.txt
+//   python3 tools/compareTrace.py capture.txt test/test_scenarios/golden/pattern2.txt --tolerance 0
+//   python3 tools/compareTrace.py capture.txt test/test_scenarios/golden/pattern2.txt --update
+
+#include <stdio.h>
+
+#include "simulator.h"
+
+int main(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s <scenario>\n", argv[0]);
+    return 2;
+  }
+  std::vector<scenario::Step> steps;
+  std::string error;
+  if (!scenario::read(argv[1], steps, error))
+  {
+    fprintf(stderr, "error: %s\n", error.c_str());
+    return 1;
+  }
+  Simulation simulation;
+  scenario::play(simulation, steps);
+  for (const TraceEvent &event : simulation.hal.events)
+  {
+    printf("trace %lu %u %d\n", (unsigned long)event.at, event.code, event.value);
+  }
+  return 0;
+}
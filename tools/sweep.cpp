@@ -0,0 +1,461 @@
+// Sweeps runtime configurations over simulated days of use and reports
+// water, valve cycles and energy for each, to tune patterns and timeouts.
+//
+//   g++ -std=gnu++11 -O2 -pthread -Iinclude tools/sweep.cpp -o sweep
+//   ./sweep --pattern 1s:30s 3s:15s --timeout 1h 2h --days 30 --seeds 8
+//   ./sweep --base config.json --sleep 2h 3h 4h --scaling
+//
+// --base takes a document exported from GET /config; every option given
+// replaces that field with each of its values in turn, and all combinations
+// are run. A configuration the firmware would reject is skipped.
+//
+// Each run is a Controller of its own (include/simulator.h) driven by a
+// random but reproducible use: sessions arrive at random, each turns the fan
+// on and starts one of the patterns, and some end early with stop-all;
+// the rest run into the inactivity stages. Runs share nothing but their
+// result slot and are spread over a work-stealing thread pool.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "jsonStream.h"
+#include "runtimeConfig.h"
+#include "simulator.h"
+
+constexpr uint64_t hour = 60 * 60 * 1000;
+constexpr uint64_t day = 24 * hour;
+// the 32 bit clock orders times up to 24 days apart; a longer quiet spell
+// between sessions changes nothing but the time asleep
+constexpr double longestGap = 20 * day;
+
+// Runs jobs 0 to count - 1 on a number of threads. Each worker starts with
+// a contiguous share in a deque of its own and takes from its back; once it
+// is empty the worker steals from the front of the others', so a share of
+// slow configurations does not leave the other cores idle.
+class WorkStealingPool
+{
+public:
+  explicit WorkStealingPool(size_t workers) : queues(workers) {}
+
+  void run(size_t count, const std::function<void(size_t)> &job)
+  {
+    size_t workers = queues.size();
+    for (size_t worker = 0; worker < workers; worker++)
+    {
+      for (size_t i = count * worker / workers; i < count * (worker + 1) / workers; i++)
+      {
+        queues[worker].jobs.push_back(i);
+      }
+    }
+    steals = 0;
+    std::vector<std::thread> threads;
+    for (size_t worker = 0; worker < workers; worker++)
+    {
+      threads.emplace_back([this, worker, &job]() {
+        size_t index;
+        while (take(worker, index)) job(index);
+      });
+    }
+    for (std::thread &thread : threads) thread.join();
+  }
+
+  size_t stolen() const { return steals; }
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+  };
+
+  // No jobs are added while running, so once every queue is empty the
+  // worker is done.
+  bool take(size_t worker, size_t &job)
+  {
+    Queue &own = queues[worker];
+    {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.jobs.empty())
+      {
+        job = own.jobs.back();
+        own.jobs.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+      Queue &victim = queues[(worker + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty())
+      {
+        job = victim.jobs.front();
+        victim.jobs.pop_front();
+        steals++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<Queue> queues;
+  std::atomic<size_t> steals{0};
+};
+
+struct Usage
+{
+  double sessionsPerDay = 3;
+  double sessionMs = 45 * 60 * 1000; // mean time until stop-all
+  double stopProbability = 0.5;     // share of sessions ended by stop-all
+};
+
+// One unit over span ms from power on. The seed alone decides the use, so
+// every configuration sees the same sessions.
+SimMetrics simulate(const RuntimeConfig &config, const Usage &usage, uint32_t seed, uint64_t span)
+{
+  std::mt19937 random(seed);
+  std::exponential_distribution<double> untilSession(usage.sessionsPerDay / day);
+  std::exponential_distribution<double> untilStop(1 / usage.sessionMs);
+  std::uniform_real_distribution<double> chance(0, 1);
+  std::uniform_int_distribution<int> clicks(2, 1 + configPatternCount);
+
+  Simulation simulation;
+  simulation.hal.recording = false;
+  simulation.controller.applyRuntimeConfig(config);
+  simulation.powerOn();
+
+  uint64_t session = (uint64_t)std::min(untilSession(random), longestGap);
+  while (session < span)
+  {
+    uint64_t next = session + (uint64_t)std::min(untilSession(random), longestGap);
+    simulation.runUntil((uint32_t)session);
+    simulation.controller.clicked(2, 1);
+    simulation.controller.clicked(1, clicks(random));
+    simulation.controller.tick();
+    if (chance(random) < usage.stopProbability)
+    {
+      uint64_t stop = session + (uint64_t)untilStop(random);
+      if (stop < next && stop < span)
+      {
+        simulation.runUntil((uint32_t)stop);
+        simulation.controller.clicked(3, 2);
+        simulation.controller.tick();
+      }
+    }
+    session = next;
+  }
+  simulation.runUntil((uint32_t)span);
+  return simulation.metrics();
+}
+
+// "90m", "2h", "1000" (ms); false if text is none of these.
+bool parseDuration(const char *text, int32_t &ms)
+{
+  static const struct
+  {
+    const char *suffix;
+    uint64_t unit;
+  } units[] = {{"", 1}, {"ms", 1}, {"s", 1000}, {"m", 60 * 1000}, {"h", hour}, {"d", day}};
+  char *end;
+  unsigned long value = strtoul(text, &end, 10);
+  if (end == text || *text == '-') return false;
+  for (const auto &unit : units)
+  {
+    if (strcmp(end, unit.suffix) == 0 && value * unit.unit <= INT32_MAX)
+    {
+      ms = (int32_t)(value * unit.unit);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string formatDuration(int32_t ms)
+{
+  static const struct
+  {
+    const char *suffix;
+    int32_t unit;
+  } units[] = {{"d", (int32_t)day}, {"h", (int32_t)hour}, {"m", 60 * 1000}, {"s", 1000}};
+  for (const auto &unit : units)
+  {
+    if (ms % unit.unit == 0) return std::to_string(ms / unit.unit) + unit.suffix;
+  }
+  return std::to_string(ms) + "ms";
+}
+
+// One option that is swept, with the values given for it.
+struct Axis
+{
+  const char *option;
+  const char *name;                // in the labels
+  int32_t RuntimeConfig::*member;  // nullptr: the timing of every pattern
+  bool duration;
+  std::vector<PatternTiming> values; // on/off, or the value in on
+};
+
+struct Configuration
+{
+  std::string label;
+  RuntimeConfig config;
+};
+
+struct StringSink
+{
+  std::string text;
+  void write(const uint8_t *data, size_t length) { text.append((const char *)data, length); }
+};
+
+// Parses a configuration document over base: 0 if the firmware accepts it,
+// 1 if it rejects a value, 2 if the delays are out of order.
+int parseConfig(const std::string &text, const RuntimeConfig &base, RuntimeConfig &parsed)
+{
+  ConfigReader handler(parsed);
+  handler.reset(base);
+  JsonReader<ConfigReader> reader(handler);
+  if (!reader.feed(text.data(), text.size()) || !reader.finish()) return 1;
+  return handler.consistent() ? 0 : 2;
+}
+
+// Whether the firmware would take config, checked by handing it the
+// document the configuration page would send.
+int check(const RuntimeConfig &config)
+{
+  StringSink sink;
+  JsonWriter<StringSink> writer(sink);
+  writeConfig(writer, config);
+  RuntimeConfig parsed;
+  return parseConfig(sink.text, defaultRuntimeConfig(), parsed);
+}
+
+// Every combination of the values given, in the order of the options.
+std::vector<Configuration> configurations(const RuntimeConfig &base, const std::vector<Axis> &axes)
+{
+  std::vector<Configuration> result;
+  std::vector<size_t> index(axes.size(), 0);
+  while (true)
+  {
+    Configuration configuration = {"", base};
+    for (size_t i = 0; i < axes.size(); i++)
+    {
+      const Axis &axis = axes[i];
+      const PatternTiming &value = axis.values[index[i]];
+      if (!configuration.label.empty()) configuration.label += " ";
+      if (axis.member == nullptr)
+      {
+        for (PatternTiming &pattern : configuration.config.patterns) pattern = value;
+        configuration.label += formatDuration(value.on) + ":" + formatDuration(value.off);
+      }
+      else
+      {
+        configuration.config.*axis.member = value.on;
+        configuration.label += std::string(axis.name) + "=" +
+                               (axis.duration ? formatDuration(value.on) : std::to_string(value.on));
+      }
+    }
+    if (configuration.label.empty()) configuration.label = "base";
+
+    int rejected = check(configuration.config);
+    if (rejected == 0) result.push_back(configuration);
+    else if (rejected == 1) printf("skipped %s, a value is out of range\n", configuration.label.c_str());
+    else printf("skipped %s, fanMinimum < timeout < sleep does not hold\n", configuration.label.c_str());
+
+    size_t i = axes.size();
+    while (i > 0 && ++index[i - 1] == axes[i - 1].values.size()) index[--i] = 0;
+    if (i == 0) return result;
+  }
+}
+
+bool readFile(const char *path, std::string &text)
+{
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) return false;
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) text.append(buffer, length);
+  fclose(file);
+  return true;
+}
+
+int usage(const char *program)
+{
+  fprintf(stderr,
+          "usage: %s [--base config.json] [--pattern on:off ...] [--fan-minimum ms ...] [--timeout ms ...]\n"
+          "       [--sleep ms ...] [--fan-minimum-percent %% ...] [--days 30] [--seeds 4] [--sessions-per-day 3]\n"
+          "       [--session 45m] [--stop-probability 0.5] [--nozzle-ml-per-minute 60] [--supply-volts 12]\n"
+          "       [--workers n] [--scaling]\n"
+          "durations take ms, s, m, h or d, e.g. 90m\n",
+          program);
+  return 2;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<Axis> options = {
+      {"--pattern", "pattern", nullptr, true, {}},
+      {"--fan-minimum", "fanMinimum", &RuntimeConfig::fanMinimumDelay, true, {}},
+      {"--timeout", "timeout", &RuntimeConfig::timeoutDelay, true, {}},
+      {"--sleep", "sleep", &RuntimeConfig::sleepDelay, true, {}},
+      {"--fan-minimum-percent", "fanMinimumPercent", &RuntimeConfig::fanMinimumPercent, false, {}},
+  };
+  const char *basePath = nullptr;
+  int days = 30;
+  int seeds = 4;
+  Usage use;
+  double nozzleMlPerMinute = 60;
+  double supplyVolts = 12;
+  size_t workers = std::max(1u, std::thread::hardware_concurrency());
+  bool scaling = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *option = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    Axis *axis = nullptr;
+    for (Axis &candidate : options)
+    {
+      if (strcmp(option, candidate.option) == 0) axis = &candidate;
+    }
+    if (axis != nullptr)
+    {
+      // every value up to the next option
+      for (; i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0; i++)
+      {
+        const char *text = argv[i + 1];
+        PatternTiming timing = {0, 0};
+        bool valid;
+        if (axis->member == nullptr)
+        {
+          std::string on(text, strcspn(text, ":"));
+          valid = text[on.size()] == ':' && parseDuration(on.c_str(), timing.on) &&
+                  parseDuration(text + on.size() + 1, timing.off);
+        }
+        else if (axis->duration) valid = parseDuration(text, timing.on);
+        else valid = sscanf(text, "%d", &timing.on) == 1;
+        if (!valid)
+        {
+          fprintf(stderr, "error: %s takes %s, not %s\n", option,
+                  axis->member == nullptr ? "on:off" : axis->duration ? "durations like 90m or 2h" : "numbers", text);
+          return 2;
+        }
+        axis->values.push_back(timing);
+      }
+      if (axis->values.empty()) return usage(argv[0]);
+      continue;
+    }
+    if (strcmp(option, "--scaling") == 0)
+    {
+      scaling = true;
+      continue;
+    }
+    if (value == nullptr) return usage(argv[0]);
+    int32_t ms;
+    bool valid = true;
+    if (strcmp(option, "--base") == 0) basePath = value;
+    else if (strcmp(option, "--days") == 0) valid = sscanf(value, "%d", &days) == 1 && days > 0;
+    else if (strcmp(option, "--seeds") == 0) valid = sscanf(value, "%d", &seeds) == 1 && seeds > 0;
+    else if (strcmp(option, "--sessions-per-day") == 0)
+      valid = sscanf(value, "%lf", &use.sessionsPerDay) == 1 && use.sessionsPerDay > 0;
+    else if (strcmp(option, "--session") == 0)
+    {
+      valid = parseDuration(value, ms) && ms > 0;
+      use.sessionMs = ms;
+    }
+    else if (strcmp(option, "--stop-probability") == 0) valid = sscanf(value, "%lf", &use.stopProbability) == 1;
+    else if (strcmp(option, "--nozzle-ml-per-minute") == 0) valid = sscanf(value, "%lf", &nozzleMlPerMinute) == 1;
+    else if (strcmp(option, "--supply-volts") == 0) valid = sscanf(value, "%lf", &supplyVolts) == 1;
+    else if (strcmp(option, "--workers") == 0) valid = sscanf(value, "%zu", &workers) == 1 && workers > 0;
+    else return usage(argv[0]);
+    if (!valid)
+    {
+      fprintf(stderr, "error: %s %s is not valid\n", option, value);
+      return 2;
+    }
+    i++;
+  }
+
+  RuntimeConfig base = defaultRuntimeConfig();
+  if (basePath != nullptr)
+  {
+    std::string text;
+    if (!readFile(basePath, text))
+    {
+      fprintf(stderr, "error: cannot read %s\n", basePath);
+      return 1;
+    }
+    RuntimeConfig loaded;
+    if (parseConfig(text, base, loaded) != 0)
+    {
+      fprintf(stderr, "error: %s is not a configuration the firmware accepts\n", basePath);
+      return 1;
+    }
+    base = loaded;
+  }
+
+  std::vector<Axis> axes;
+  for (const Axis &axis : options)
+  {
+    if (!axis.values.empty()) axes.push_back(axis);
+  }
+  std::vector<Configuration> configs = configurations(base, axes);
+  if (configs.empty())
+  {
+    fprintf(stderr, "error: no configuration left to run\n");
+    return 1;
+  }
+
+  uint64_t span = days * day;
+  size_t runs = configs.size() * seeds;
+  double simulatedHours = (double)runs * span / hour;
+  std::vector<SimMetrics> results(runs);
+  auto job = [&](size_t index) { results[index] = simulate(configs[index / seeds].config, use, index % seeds, span); };
+
+  std::vector<size_t> workerCounts;
+  if (scaling)
+  {
+    for (size_t count = 1; count < workers; count *= 2) workerCounts.push_back(count);
+  }
+  workerCounts.push_back(workers);
+  std::vector<double> seconds;
+  std::vector<size_t> steals;
+  for (size_t count : workerCounts)
+  {
+    WorkStealingPool pool(count);
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    pool.run(runs, job);
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    steals.push_back(pool.stolen());
+  }
+
+  double unitDays = (double)days * seeds;
+  printf("%-40s %10s %10s %11s %10s\n", "configuration", "water l/d", "cycles/d", "energy Wh/d", "awake h/d");
+  for (size_t i = 0; i < configs.size(); i++)
+  {
+    SimMetrics metrics;
+    for (int seed = 0; seed < seeds; seed++) metrics.add(results[i * seeds + seed]);
+    double water = metrics.mistMs / 60000.0 * nozzleMlPerMinute / 1000;
+    double milliampMs = (double)metrics.fanPercentMs / 100 * settings::power::fan.steadyMa +
+                        (double)metrics.mistMs * settings::power::valve.steadyMa;
+    double energy = milliampMs / 1000 * supplyVolts / hour;
+    printf("%-40s %10.2f %10.0f %11.1f %10.1f\n", configs[i].label.c_str(), water / unitDays,
+           metrics.valveCycles / unitDays, energy / unitDays, metrics.awakeMs / (double)hour / unitDays);
+  }
+
+  printf("\n%zu runs, %.0f simulated hours, %u cores\n", runs, simulatedHours, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < workerCounts.size(); i++)
+  {
+    printf("%3zu workers: %8.2f s, %12.0f simulated h/s, speedup %.2f, %zu runs stolen\n", workerCounts[i],
+           seconds[i], simulatedHours / seconds[i], seconds[0] / seconds[i], steals[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Serves the web UI on the host, for working on web/ without flashing a
+// unit: the embedded assets, /write, /config and the event stream, answered
+// by a simulated controller (include/simulator.h) that runs in real time.
+//
+//   python3 tools/embedWebAssets.py
+//   g++ -std=gnu++11 -O2 -Iinclude tools/webServe.cpp -o webServe
+//   ./webServe 8080
+//
+// then open http://127.0.0.1:8080/. Registers the simulation has nothing
+// behind, water and supply for example, read 0.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "simulator.h"
+#include "webHost.h"
+
+// The registers of RemoteRegisters in src/main.cpp that the controller
+// answers on its own.
+struct SimulatedUnit
+{
+  Simulation simulation;
+
+  modbus::Exception read(uint16_t address, uint16_t &value)
+  {
+    Controller<SimHal> &controller = simulation.controller;
+    const CurrentValue &current = controller.current();
+    switch (address)
+    {
+    case remoteRegister::fanPercent: value = current.fanPercent; break;
+    case remoteRegister::fanAppliedPercent: value = controller.fanAppliedPercent(); break;
+    case remoteRegister::mist: value = controller.mistState(); break;
+    case remoteRegister::patternMode: value = controller.patternMode(); break;
+    case remoteRegister::patternOnSeconds: value = controller.patternRunning() ? current.patternOnDuration / 1000 : 0; break;
+    case remoteRegister::patternOffSeconds: value = controller.patternRunning() ? current.patternOffDuration / 1000 : 0; break;
+    case remoteRegister::mistFraction: value = current.mistFractionPercent; break;
+    case remoteRegister::vpd: value = current.vpdPa < 0 ? 0xFFFF : current.vpdPa; break;
+    case remoteRegister::temperature: value = controller.thermal().temperatureRegister(); break;
+    case remoteRegister::humidity: value = current.humidityPermille < 0 ? 0xFFFF : current.humidityPermille; break;
+    default:
+      if (address >= remoteRegister::count) return modbus::illegalAddress;
+      value = 0;
+    }
+    return modbus::none;
+  }
+
+  modbus::Exception write(uint16_t address, uint16_t value)
+  {
+    Controller<SimHal> &controller = simulation.controller;
+    switch (address)
+    {
+    case remoteRegister::fanPercent:
+      if (value > 100) return modbus::illegalValue;
+      controller.requestFanPercent(value);
+      break;
+    case remoteRegister::mist:
+      if (value > 1) return modbus::illegalValue;
+      if (value) controller.mistHold(mistSource::remote);
+      else controller.mistRelease(mistSource::remote);
+      break;
+    case remoteRegister::patternSelect:
+      if (!controller.selectPattern(value)) return modbus::illegalValue;
+      break;
+    case remoteRegister::stopAll:
+      if (value != 1) return modbus::illegalValue;
+      controller.cancelAllTimerTasksAndTurnOffMistAndFan();
+      break;
+    default:
+      return modbus::illegalAddress;
+    }
+    controller.resetTimeoutTimer();
+    return modbus::none;
+  }
+
+  RuntimeConfig config() { return simulation.controller.config(); }
+  void applyRuntimeConfig(const RuntimeConfig &config) { simulation.controller.applyRuntimeConfig(config); }
+};
+
+int main(int argc, char **argv)
+{
+  if (argc > 2)
+  {
+    fprintf(stderr, "usage: %s [port]\n", argv[0]);
+    return 2;
+  }
+  SimulatedUnit unit;
+  unit.simulation.powerOn();
+  WebHost<SimulatedUnit> host(unit);
+  if (!host.begin(argc == 2 ? atoi(argv[1]) : 8080))
+  {
+    perror("listen");
+    return 1;
+  }
+  printf("http://127.0.0.1:%u/\n", host.port());
+  fflush(stdout);
+
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  for (;;)
+  {
+    host.serve(20);
+    uint32_t elapsed =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    unit.simulation.runUntil(elapsed);
+  }
+}